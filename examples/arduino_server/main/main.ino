@@ -6,7 +6,7 @@
 static UDSServer_t srv;
 static UDSISOTpC_t tp;
 
-extern "C" uint32_t isotp_user_get_us(void) { return UDSMillis() * 1000; }
+extern "C" uint32_t isotp_user_get_us(void) { return UDSMicros(); }
 
 extern "C" int isotp_user_send_can(uint32_t arb_id, const uint8_t *data, const uint8_t size, void *ud) {
   (void)ud;
@@ -35,10 +35,7 @@ static void CANRecv(UDSISOTpC_t *tp) {
           UDS_LOGI(__FILE__, "phys frame received\n");
           isotp_on_can_message(&tp->phys_link, buf, len);
         } else if (CAN.packetId() == tp->func_sa) {
-          if (ISOTP_RECEIVE_STATUS_IDLE != tp->phys_link.receive_status) {
-            UDS_LOGI(__FILE__, "func frame received but cannot process because link is not idle");
-            return;
-          }
+          // received also while a physical request is in progress
           isotp_on_can_message(&tp->func_link, buf, len);
     }
   }
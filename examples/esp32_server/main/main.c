@@ -45,7 +45,7 @@ int isotp_user_send_can(const uint32_t arbitration_id, const uint8_t *data, cons
 
 void isotp_user_debug(const char *fmt, ...) { (void)fmt; }
 
-uint32_t isotp_user_get_us(void) { return UDSMillis() * 1000; }
+uint32_t isotp_user_get_us(void) { return UDSMicros(); }
 
 static const UDSISOTpCConfig_t tp_cfg = {
     .source_addr = 0x7E0,
@@ -63,11 +63,7 @@ static void uds_task(void *arg) {
             if (rx_msg.identifier == tp.phys_sa) {
                 isotp_on_can_message(&tp.phys_link, rx_msg.data, rx_msg.data_length_code);
             } else if (rx_msg.identifier == tp.func_sa) {
-                if (ISOTP_RECEIVE_STATUS_IDLE != tp.phys_link.receive_status) {
-                    ESP_LOGI(TAG,
-                             "func frame received but cannot process because link is not idle");
-                    continue;
-                }
+                // received also while a physical request is in progress
                 isotp_on_can_message(&tp.func_link, rx_msg.data, rx_msg.data_length_code);
             } else {
                 ESP_LOGI(TAG, "received unknown can id 0x%03lx", rx_msg.identifier);
@@ -93,7 +93,7 @@ int main(int ac, char **av) {
     UDSClient_t client;
     UDSTpIsoTpSock_t tp;
 
-    if (UDSTpIsoTpSockInitClient(&tp, "vcan0", 0x7E8, 0x7E0, 0x7DF)) {
+    if (UDSTpIsoTpSockInitClient(&tp, "vcan0", 0x7E8, 0x7E0, 0x7DF, NULL)) {
         UDS_LOGE(__FILE__, "UDSTpIsoTpSockInitClient failed");
         exit(-1);
     }
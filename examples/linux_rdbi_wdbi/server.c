@@ -78,7 +78,7 @@ int main(int ac, char **av) {
     sa.sa_handler = sigint_handler;
     sigaction(SIGINT, &sa, NULL);
 
-    if (UDSTpIsoTpSockInitServer(&tp, "vcan0", 0x7E0, 0x7E8, 0x7DF)) {
+    if (UDSTpIsoTpSockInitServer(&tp, "vcan0", 0x7E0, 0x7E8, 0x7DF, NULL)) {
         fprintf(stderr, "UDSTpIsoTpSockInitServer failed\n");
         exit(-1);
     }
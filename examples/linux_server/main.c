@@ -36,7 +36,7 @@ int main(int ac, char **av) {
     sigaction(SIGINT, &sa, NULL);
 
     // 1. Initialize a transport
-    if (UDSTpIsoTpSockInitServer(&tp, "vcan0", 0x7E0, 0x7E8, 0x7DF)) {
+    if (UDSTpIsoTpSockInitServer(&tp, "vcan0", 0x7E0, 0x7E8, 0x7DF, NULL)) {
         fprintf(stderr, "UDSTpIsoTpSockInitServer failed\n");
         exit(-1);
     }
@@ -121,7 +121,7 @@ int main(int ac, char **av) {
     sigaction(SIGINT, &sa, NULL);
 
 #if defined(UDS_TP_ISOTP_SOCK)
-    if (UDSTpIsoTpSockInitServer(&tp, "vcan0", 0x7E0, 0x7E8, 0x7DF)) {
+    if (UDSTpIsoTpSockInitServer(&tp, "vcan0", 0x7E0, 0x7E8, 0x7DF, NULL)) {
         fprintf(stderr, "UDSTpIsoTpSockInitServer failed\n");
         exit(-1);
     }
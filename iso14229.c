@@ -5,6 +5,10 @@
  * @see https://github.com/driftregion/iso14229
  */
 
+#if defined(UDS_TP_ISOTP_C_SOCKETCAN) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#endif
+
 #include "iso14229.h"
 
 #ifdef UDS_LINES
@@ -209,7 +213,7 @@ static UDSErr_t PollLowLevel(UDSClient_t *client) {
         } else if (0 == ret) {
             UDS_LOGI(__FILE__, "send in progress...");
             ; // Waiting for send completion
-        } else if (client->send_size == ret) {
+        } else if ((ssize_t)client->send_size == ret) {
             changeState(client, STATE_AWAIT_SEND_COMPLETE);
         } else {
             err = UDS_ERR_BUFSIZ;
@@ -217,11 +221,8 @@ static UDSErr_t PollLowLevel(UDSClient_t *client) {
         break;
     }
     case STATE_AWAIT_SEND_COMPLETE: {
-        if (client->_options_copy & UDS_FUNCTIONAL) {
-            // "The Functional addressing is applied only to single frame transmission"
-            // Specification of Diagnostic Communication (Diagnostic on CAN - Network Layer)
-            changeState(client, STATE_IDLE);
-        }
+        // functional requests too: the transport may still be reading send_buf (DoIP borrows it
+        // for messages of any length) and the next request would overwrite it
         if (tp_status & UDS_TP_SEND_IN_PROGRESS) {
             ; // await send complete
         } else {
@@ -250,8 +251,7 @@ static UDSErr_t PollLowLevel(UDSClient_t *client) {
             }
         } else {
             UDS_LOGI(__FILE__, "received %zd bytes. Processing...", len);
-            UDS_ASSERT(len <= (ssize_t)UINT16_MAX);
-            client->recv_size = (uint16_t)len;
+            client->recv_size = (size_t)len;
 
             err = ValidateServerResponse(client);
             if (UDS_OK == err) {
@@ -303,7 +303,7 @@ static UDSErr_t PreRequestCheck(UDSClient_t *client) {
     return UDS_OK;
 }
 
-UDSErr_t UDSSendBytes(UDSClient_t *client, const uint8_t *data, uint16_t size) {
+UDSErr_t UDSSendBytes(UDSClient_t *client, const uint8_t *data, size_t size) {
     UDSErr_t err = PreRequestCheck(client);
     if (err) {
         return err;
@@ -535,7 +535,7 @@ UDSErr_t UDSSendRequestUpload(UDSClient_t *client, uint8_t dataFormatIdentifier,
  * @addtogroup transferData_0x36
  */
 UDSErr_t UDSSendTransferData(UDSClient_t *client, uint8_t blockSequenceCounter,
-                             const uint16_t blockLength, const uint8_t *data, uint16_t size) {
+                             const size_t blockLength, const uint8_t *data, size_t size) {
     UDSErr_t err = PreRequestCheck(client);
     if (err) {
         return err;
@@ -550,16 +550,19 @@ UDSErr_t UDSSendTransferData(UDSClient_t *client, uint8_t blockSequenceCounter,
     if (size > (blockLength - 2)) {
         return UDS_ERR_INVALID_ARG;
     }
+    if (UDS_0X36_REQ_BASE_LEN + size > sizeof(client->send_buf)) {
+        return UDS_ERR_BUFSIZ;
+    }
     client->send_buf[0] = kSID_TRANSFER_DATA;
     client->send_buf[1] = blockSequenceCounter;
     memmove(&client->send_buf[UDS_0X36_REQ_BASE_LEN], data, size);
-    UDS_LOGI(__FILE__, "size: %d, blocklength: %d", size, blockLength);
+    UDS_LOGI(__FILE__, "size: %zu, blocklength: %zu", size, blockLength);
     client->send_size = UDS_0X36_REQ_BASE_LEN + size;
     return SendRequest(client);
 }
 
 UDSErr_t UDSSendTransferDataStream(UDSClient_t *client, uint8_t blockSequenceCounter,
-                                   const uint16_t blockLength, FILE *fd) {
+                                   const size_t blockLength, FILE *fd) {
     UDSErr_t err = PreRequestCheck(client);
     if (err) {
         return err;
@@ -571,10 +574,11 @@ UDSErr_t UDSSendTransferDataStream(UDSClient_t *client, uint8_t blockSequenceCou
     client->send_buf[0] = kSID_TRANSFER_DATA;
     client->send_buf[1] = blockSequenceCounter;
 
-    size_t _size = fread(&client->send_buf[2], 1, blockLength - 2, fd);
-    UDS_ASSERT(_size < UINT16_MAX);
-    uint16_t size = (uint16_t)_size;
-    UDS_LOGI(__FILE__, "size: %d, blocklength: %d", size, blockLength);
+    if (blockLength > sizeof(client->send_buf)) {
+        return UDS_ERR_BUFSIZ;
+    }
+    size_t size = fread(&client->send_buf[2], 1, blockLength - 2, fd);
+    UDS_LOGI(__FILE__, "size: %zu, blocklength: %zu", size, blockLength);
     client->send_size = UDS_0X36_REQ_BASE_LEN + size;
     return SendRequest(client);
 }
@@ -650,7 +654,7 @@ UDSErr_t UDSSendRequestFileTransfer(UDSClient_t *client, uint8_t mode, const cha
         }
     }
 
-    client->send_size = (uint16_t)bufSize;
+    client->send_size = bufSize;
     return SendRequest(client);
 }
 
@@ -757,7 +761,7 @@ UDSErr_t UDSUnpackSecurityAccessResponse(const UDSClient_t *client,
         return UDS_ERR_RESP_TOO_SHORT;
     }
     resp->securityAccessType = client->recv_buf[1];
-    resp->securitySeedLength = client->recv_size - UDS_0X27_RESP_BASE_LEN;
+    resp->securitySeedLength = (uint16_t)(client->recv_size - UDS_0X27_RESP_BASE_LEN);
     resp->securitySeed = resp->securitySeedLength == 0 ? NULL : &client->recv_buf[2];
     return UDS_OK;
 }
@@ -784,7 +788,7 @@ UDSErr_t UDSUnpackRoutineControlResponse(const UDSClient_t *client,
     resp->routineControlType = client->recv_buf[1];
     resp->routineIdentifier =
         (uint16_t)((uint16_t)(client->recv_buf[2] << 8) | (uint16_t)client->recv_buf[3]);
-    resp->routineStatusRecordLength = client->recv_size - UDS_0X31_RESP_MIN_LEN;
+    resp->routineStatusRecordLength = (uint16_t)(client->recv_size - UDS_0X31_RESP_MIN_LEN);
     resp->routineStatusRecord =
         resp->routineStatusRecordLength == 0 ? NULL : &client->recv_buf[UDS_0X31_RESP_MIN_LEN];
     return UDS_OK;
@@ -819,7 +823,7 @@ UDSErr_t UDSUnpackRequestDownloadResponse(const UDSClient_t *client,
     for (uint8_t byteIdx = 0; byteIdx < maxNumberOfBlockLengthSize; byteIdx++) {
         uint8_t byte = client->recv_buf[UDS_0X34_RESP_BASE_LEN + byteIdx];
         uint8_t shiftBytes = maxNumberOfBlockLengthSize - 1 - byteIdx;
-        resp->maxNumberOfBlockLength |= byte << (8 * shiftBytes);
+        resp->maxNumberOfBlockLength |= (size_t)byte << (8 * shiftBytes);
     }
     return UDS_OK;
 }
@@ -1015,7 +1019,7 @@ static UDSErr_t Handle_0x14_ClearDiagnosticInformation(UDSServer_t *srv, UDSReq_
     return UDS_PositiveResponse;
 }
 
-static uint8_t safe_copy(UDSServer_t *srv, const void *src, uint16_t count) {
+static uint8_t safe_copy(UDSServer_t *srv, const void *src, size_t count) {
     if (srv == NULL) {
         return UDS_NRC_GeneralReject;
     }
@@ -1357,7 +1361,7 @@ static UDSErr_t decodeAddressAndLengthWithOffset(UDSReq_t *r, uint8_t *const buf
     *memoryAddress = 0;
     *memorySize = 0;
 
-    UDS_ASSERT(buf >= r->recv_buf && buf <= r->recv_buf + sizeof(r->recv_buf));
+    UDS_ASSERT(buf >= r->recv_buf && buf <= r->recv_buf + r->recv_len);
 
     if (r->recv_len < 3) {
         return NegativeResponse(r, UDS_NRC_IncorrectMessageLengthOrInvalidFormat);
@@ -1783,6 +1787,19 @@ static void ResetTransfer(UDSServer_t *srv) {
     srv->xferIsActive = false;
 }
 
+/**
+ * @brief write maxNumberOfBlockLength in 2 bytes, or 4 if it doesn't fit
+ * @return number of bytes written
+ */
+static uint8_t EncodeMaxNumberOfBlockLength(uint8_t *dst, uint32_t maxNumberOfBlockLength) {
+    const uint8_t len = maxNumberOfBlockLength > UINT16_MAX ? 4 : 2;
+    for (uint8_t idx = 0; idx < len; idx++) {
+        uint8_t shiftBytes = (uint8_t)(len - 1 - idx);
+        dst[idx] = (uint8_t)(maxNumberOfBlockLength >> (shiftBytes * 8));
+    }
+    return len;
+}
+
 static UDSErr_t Handle_0x34_RequestDownload(UDSServer_t *srv, UDSReq_t *r) {
     UDSErr_t err = UDS_PositiveResponse;
     void *memoryAddress = 0;
@@ -1824,9 +1841,6 @@ static UDSErr_t Handle_0x34_RequestDownload(UDSServer_t *srv, UDSReq_t *r) {
     srv->xferTotalBytes = memorySize;
     srv->xferBlockLength = args.maxNumberOfBlockLength;
 
-    // ISO-14229-1:2013 Table 401:
-    uint8_t lengthFormatIdentifier = (uint8_t)(sizeof(args.maxNumberOfBlockLength) << 4);
-
     /* ISO-14229-1:2013 Table 396: maxNumberOfBlockLength
     This parameter is used by the requestDownload positive response message to
     inform the client how many data bytes (maxNumberOfBlockLength) to include in
@@ -1838,14 +1852,12 @@ static UDSErr_t Handle_0x34_RequestDownload(UDSServer_t *srv, UDSReq_t *r) {
         args.maxNumberOfBlockLength = UDS_TP_MTU;
     }
 
+    uint8_t len = EncodeMaxNumberOfBlockLength(&r->send_buf[UDS_0X34_RESP_BASE_LEN],
+                                               args.maxNumberOfBlockLength);
     r->send_buf[0] = UDS_RESPONSE_SID_OF(kSID_REQUEST_DOWNLOAD);
-    r->send_buf[1] = lengthFormatIdentifier;
-    for (uint8_t idx = 0; idx < (uint8_t)sizeof(args.maxNumberOfBlockLength); idx++) {
-        uint8_t shiftBytes = (uint8_t)(sizeof(args.maxNumberOfBlockLength) - 1 - idx);
-        uint8_t byte = (args.maxNumberOfBlockLength >> (shiftBytes * 8)) & 0xFF;
-        r->send_buf[UDS_0X34_RESP_BASE_LEN + idx] = byte;
-    }
-    r->send_len = UDS_0X34_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength);
+    // ISO-14229-1:2013 Table 401: lengthFormatIdentifier
+    r->send_buf[1] = (uint8_t)(len << 4);
+    r->send_len = UDS_0X34_RESP_BASE_LEN + len;
     return UDS_PositiveResponse;
 }
 
@@ -1890,22 +1902,17 @@ static UDSErr_t Handle_0x35_RequestUpload(UDSServer_t *srv, UDSReq_t *r) {
     srv->xferTotalBytes = memorySize;
     srv->xferBlockLength = args.maxNumberOfBlockLength;
 
-    uint8_t lengthFormatIdentifier = (uint8_t)(sizeof(args.maxNumberOfBlockLength) << 4);
-
+    uint8_t len = EncodeMaxNumberOfBlockLength(&r->send_buf[UDS_0X35_RESP_BASE_LEN],
+                                               args.maxNumberOfBlockLength);
     r->send_buf[0] = UDS_RESPONSE_SID_OF(kSID_REQUEST_UPLOAD);
-    r->send_buf[1] = lengthFormatIdentifier;
-    for (uint8_t idx = 0; idx < (uint8_t)sizeof(args.maxNumberOfBlockLength); idx++) {
-        uint8_t shiftBytes = (sizeof(args.maxNumberOfBlockLength) - 1 - idx) & 0xFF;
-        uint8_t byte = (args.maxNumberOfBlockLength >> (shiftBytes * 8)) & 0xFF;
-        r->send_buf[UDS_0X35_RESP_BASE_LEN + idx] = byte;
-    }
-    r->send_len = UDS_0X35_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength);
+    r->send_buf[1] = (uint8_t)(len << 4);
+    r->send_len = UDS_0X35_RESP_BASE_LEN + len;
     return UDS_PositiveResponse;
 }
 
 static UDSErr_t Handle_0x36_TransferData(UDSServer_t *srv, UDSReq_t *r) {
     UDSErr_t err = UDS_PositiveResponse;
-    uint16_t request_data_len = (uint16_t)(r->recv_len - UDS_0X36_REQ_BASE_LEN);
+    size_t request_data_len = r->recv_len - UDS_0X36_REQ_BASE_LEN;
     uint8_t blockSequenceCounter = 0;
 
     if (!srv->xferIsActive) {
@@ -1936,8 +1943,8 @@ static UDSErr_t Handle_0x36_TransferData(UDSServer_t *srv, UDSReq_t *r) {
     {
         UDSTransferDataArgs_t args = {
             .data = &r->recv_buf[UDS_0X36_REQ_BASE_LEN],
-            .len = (uint16_t)(r->recv_len - UDS_0X36_REQ_BASE_LEN),
-            .maxRespLen = (uint16_t)(srv->xferBlockLength - UDS_0X36_RESP_BASE_LEN),
+            .len = r->recv_len - UDS_0X36_REQ_BASE_LEN,
+            .maxRespLen = srv->xferBlockLength - UDS_0X36_RESP_BASE_LEN,
             .copyResponse = safe_copy,
         };
 
@@ -1974,7 +1981,7 @@ static UDSErr_t Handle_0x37_RequestTransferExit(UDSServer_t *srv, UDSReq_t *r) {
 
     UDSRequestTransferExitArgs_t args = {
         .data = &r->recv_buf[UDS_0X37_REQ_BASE_LEN],
-        .len = (uint16_t)(r->recv_len - UDS_0X37_REQ_BASE_LEN),
+        .len = r->recv_len - UDS_0X37_REQ_BASE_LEN,
         .copyResponse = safe_copy,
     };
 
@@ -2085,18 +2092,14 @@ static UDSErr_t Handle_0x38_RequestFileTransfer(UDSServer_t *srv, UDSReq_t *r) {
         args.maxNumberOfBlockLength = UDS_TP_MTU;
     }
 
+    uint8_t len = EncodeMaxNumberOfBlockLength(&r->send_buf[UDS_0X38_RESP_BASE_LEN],
+                                               args.maxNumberOfBlockLength);
     r->send_buf[0] = UDS_RESPONSE_SID_OF(kSID_REQUEST_FILE_TRANSFER);
     r->send_buf[1] = args.modeOfOperation;
-    r->send_buf[2] = (uint8_t)sizeof(args.maxNumberOfBlockLength);
-    for (uint8_t idx = 0; idx < (uint8_t)sizeof(args.maxNumberOfBlockLength); idx++) {
-        uint8_t shiftBytes = (uint8_t)(sizeof(args.maxNumberOfBlockLength) - 1 - idx);
-        uint8_t byte = (uint8_t)(args.maxNumberOfBlockLength >> (shiftBytes * 8));
-        r->send_buf[UDS_0X38_RESP_BASE_LEN + idx] = byte;
-    }
-    r->send_buf[UDS_0X38_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength)] =
-        args.dataFormatIdentifier;
+    r->send_buf[2] = len;
+    r->send_buf[UDS_0X38_RESP_BASE_LEN + len] = args.dataFormatIdentifier;
 
-    r->send_len = UDS_0X38_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength) + 1;
+    r->send_len = UDS_0X38_RESP_BASE_LEN + len + 1;
     return UDS_PositiveResponse;
 }
 
@@ -2406,6 +2409,7 @@ UDSErr_t UDSServerInit(UDSServer_t *srv) {
         return UDS_ERR_INVALID_ARG;
     }
     memset(srv, 0, sizeof(UDSServer_t));
+    srv->r.recv_buf = srv->r.recv_storage;
     srv->p2_ms = UDS_SERVER_DEFAULT_P2_MS;
     srv->p2_star_ms = UDS_SERVER_DEFAULT_P2_STAR_MS;
     srv->s3_ms = UDS_SERVER_DEFAULT_S3_MS;
@@ -2418,6 +2422,30 @@ UDSErr_t UDSServerInit(UDSServer_t *srv) {
     return UDS_OK;
 }
 
+/**
+ * @brief Receive a request, borrowing the transport's buffer when the transport supports it
+ */
+static ssize_t ReceiveRequest(UDSServer_t *srv, UDSReq_t *r) {
+    r->recv_buf = r->recv_storage;
+    if (srv->tp->peek && srv->tp->release) {
+        ssize_t len = UDSTpPeek(srv->tp, &r->recv_buf, &r->info);
+        r->recv_lent = len > 0;
+        return len;
+    }
+    return UDSTpRecv(srv->tp, r->recv_storage, sizeof(r->recv_storage), &r->info);
+}
+
+/**
+ * @brief Give a borrowed request buffer back to the transport once the handler is done with it
+ */
+static void ReleaseRequest(UDSServer_t *srv, UDSReq_t *r) {
+    if (r->recv_lent) {
+        UDSTpRelease(srv->tp);
+        r->recv_lent = false;
+    }
+    r->recv_buf = r->recv_storage;
+}
+
 void UDSServerPoll(UDSServer_t *srv) {
     // UDS-1-2013 Figure 38: Session Timeout (S3)
     if (UDS_LEV_DS_DS != srv->sessionType &&
@@ -2431,7 +2459,10 @@ void UDSServerPoll(UDSServer_t *srv) {
         EmitEvent(srv, UDS_EVT_DoScheduledReset, &srv->ecuResetScheduled);
     }
 
-    UDSTpPoll(srv->tp);
+    // the transport may still be sending from r->send_buf, see UDSTp_t.send
+    if (UDSTpPoll(srv->tp) & UDS_TP_SEND_IN_PROGRESS) {
+        return;
+    }
 
     UDSReq_t *r = &srv->r;
 
@@ -2448,6 +2479,7 @@ void UDSServerPoll(UDSServer_t *srv) {
                 // No longer RCRRP'ing
                 srv->RCRRP = false;
                 srv->notReadyToReceive = false;
+                ReleaseRequest(srv, r);
 
                 // Not a consecutive 0x78 response, use p2 instead of p2_star * 0.3
                 srv->p2_timer = UDSMillis() + srv->p2_ms;
@@ -2482,9 +2514,9 @@ void UDSServerPoll(UDSServer_t *srv) {
         if (srv->notReadyToReceive) {
             return; // cannot respond to request right now
         }
-        ssize_t len = UDSTpRecv(srv->tp, r->recv_buf, sizeof(r->recv_buf), &r->info);
+        ssize_t len = ReceiveRequest(srv, r);
         if (len < 0) {
-            UDS_LOGE(__FILE__, "UDSTpRecv failed with %zd\n", r->recv_len);
+            UDS_LOGE(__FILE__, "UDSTpRecv failed with %zd\n", len);
             return;
         }
 
@@ -2494,7 +2526,10 @@ void UDSServerPoll(UDSServer_t *srv) {
             UDSErr_t response = evaluateServiceResponse(srv, r);
             srv->requestInProgress = true;
             if (UDS_NRC_RequestCorrectlyReceived_ResponsePending == response) {
+                // the handler is called again with the same request
                 srv->RCRRP = true;
+            } else {
+                ReleaseRequest(srv, r);
             }
         }
     }
@@ -2523,6 +2558,48 @@ UDSTpStatus_t UDSTpPoll(struct UDSTp *hdl) {
     return hdl->poll(hdl);
 }
 
+ssize_t UDSTpPeek(struct UDSTp *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(hdl->peek);
+    return hdl->peek(hdl, buf, info);
+}
+
+void UDSTpRelease(struct UDSTp *hdl) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(hdl->release);
+    hdl->release(hdl);
+}
+
+int UDSTpGetFds(struct UDSTp *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    if (NULL == hdl->get_fds) {
+        return 0;
+    }
+    return hdl->get_fds(hdl, fds, max_fds);
+}
+
+bool UDSTpNextDeadline(struct UDSTp *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(deadline_ms);
+    if (NULL == hdl->next_deadline) {
+        return false;
+    }
+    return hdl->next_deadline(hdl, deadline_ms);
+}
+
+ssize_t UDSTpSendPartial(struct UDSTp *hdl, const uint8_t *buf, size_t len, size_t available,
+                         UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    if (hdl->send_partial) {
+        return hdl->send_partial(hdl, (uint8_t *)buf, len, available, info);
+    }
+    if (NULL == buf || available < len) {
+        return 0;
+    }
+    return UDSTpSend(hdl, buf, (ssize_t)len, info);
+}
+
+
 #ifdef UDS_LINES
 #line 1 "src/util.c"
 #endif
@@ -2550,6 +2627,43 @@ uint32_t UDSMillis(void) {
 }
 #endif
 
+#if UDS_CUSTOM_MICROS
+#elif UDS_CUSTOM_MILLIS
+uint32_t UDSMicros(void) { return UDSMillis() * 1000; }
+#else
+uint32_t UDSMicros(void) {
+#if UDS_SYS == UDS_SYS_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    long long microseconds = (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+    return (uint32_t)microseconds;
+#elif UDS_SYS == UDS_SYS_WINDOWS
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    long long microseconds = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    return (uint32_t)microseconds;
+#elif UDS_SYS == UDS_SYS_ARDUINO
+    return micros();
+#elif UDS_SYS == UDS_SYS_ESP32
+    return (uint32_t)esp_timer_get_time();
+#else
+#error "UDSMicros() undefined!"
+#endif
+}
+#endif
+
+#if UDS_SYS == UDS_SYS_UNIX
+uint64_t UDSRealtimeToMonotonicNs(const struct timespec *ts) {
+    // kernel packet timestamps use the wall clock, shift them by its current offset
+    struct timespec rt, mono;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t offset_ns =
+        ((int64_t)rt.tv_sec - mono.tv_sec) * 1000000000LL + (rt.tv_nsec - mono.tv_nsec);
+    return (uint64_t)((int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec - offset_ns);
+}
+#endif
+
 /**
  * @brief Check if a security level is reserved per ISO14229-1:2020 Table 42
  *
@@ -2899,8 +3013,9 @@ static ssize_t tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
         break;
     case UDS_A_TA_TYPE_FUNCTIONAL:
         link = &tp->func_link;
-        if (len > 7) {
-            UDS_LOGI(__FILE__, "Cannot send more than 7 bytes via functional addressing\n");
+        if (len > isotp_single_frame_max_size(link)) {
+            UDS_LOGI(__FILE__, "Cannot send more than %u bytes via functional addressing\n",
+                     isotp_single_frame_max_size(link));
             ret = -3;
             goto done;
         }
@@ -2925,29 +3040,67 @@ done:
     return ret;
 }
 
+// ISO-TP frames are sent as far as the data reaches, e.g. while a gateway still receives it
+static ssize_t tp_send_partial(UDSTp_t *hdl, uint8_t *buf, size_t len, size_t available,
+                               UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
+    IsoTpLink *link = &tp->phys_link;
+    int ret = ISOTP_RET_OK;
+    if (NULL == buf) {
+        isotp_send_abort(link);
+        return 0;
+    }
+    if (info && UDS_A_TA_TYPE_FUNCTIONAL == info->A_TA_Type) {
+        // functional messages are single frames
+        return available < len ? 0 : tp_send(hdl, buf, len, info);
+    }
+    if (len > link->send_buf_size) {
+        return -1;
+    }
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && link->send_data == buf) {
+        ret = isotp_send_extend(link, (uint32_t)available);
+    } else {
+        ret = isotp_send_partial(link, link->send_arbitration_id, buf, (uint32_t)len,
+                                 (uint32_t)available);
+        if (ISOTP_RET_NO_DATA == ret) {
+            return 0;
+        }
+    }
+    return ISOTP_RET_OK == ret ? (ssize_t)len : ret;
+}
+
+static void RecvInfo(const UDSISOTpC_t *tp, const IsoTpLink *link, UDSSDU_t *info) {
+    if (NULL == info) {
+        return;
+    }
+    if (link == &tp->phys_link) {
+        info->A_TA = tp->phys_sa;
+        info->A_SA = tp->phys_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+    } else {
+        info->A_TA = tp->func_sa;
+        info->A_SA = tp->func_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
+    }
+    info->A_AE = link->addr_ext_len ? link->receive_addr_ext : 0;
+}
+
 static ssize_t tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     UDS_ASSERT(buf);
-    uint16_t out_size = 0;
+    uint32_t out_size = 0;
     UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
 
     int ret = isotp_receive(&tp->phys_link, buf, bufsize, &out_size);
     if (ret == ISOTP_RET_OK) {
-        UDS_LOGI(__FILE__, "phys link received %d bytes", out_size);
-        if (NULL != info) {
-            info->A_TA = tp->phys_sa;
-            info->A_SA = tp->phys_ta;
-            info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
-        }
+        UDS_LOGI(__FILE__, "phys link received %u bytes", (unsigned)out_size);
+        RecvInfo(tp, &tp->phys_link, info);
     } else if (ret == ISOTP_RET_NO_DATA) {
         ret = isotp_receive(&tp->func_link, buf, bufsize, &out_size);
         if (ret == ISOTP_RET_OK) {
-            UDS_LOGI(__FILE__, "func link received %d bytes", out_size);
-            if (NULL != info) {
-                info->A_TA = tp->func_sa;
-                info->A_SA = tp->func_ta;
-                info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
-            }
+            UDS_LOGI(__FILE__, "func link received %u bytes", (unsigned)out_size);
+            RecvInfo(tp, &tp->func_link, info);
         } else if (ret == ISOTP_RET_NO_DATA) {
             return 0;
         } else {
@@ -2959,6 +3112,36 @@ static ssize_t tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *inf
     return out_size;
 }
 
+static int SetLinkFCParams(IsoTpLink *link, const UDSISOTpFCParams_t *params) {
+    return isotp_set_fc_params(link, params->bs, params->st_min_us, params->n_bs_us,
+                               params->n_cr_us, params->wft_max);
+}
+
+static ssize_t tp_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    const uint8_t *data = NULL;
+    uint32_t out_size = 0;
+    UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
+
+    if (ISOTP_RET_OK == isotp_receive_peek(&tp->phys_link, &data, &out_size)) {
+        RecvInfo(tp, &tp->phys_link, info);
+    } else if (ISOTP_RET_OK == isotp_receive_peek(&tp->func_link, &data, &out_size)) {
+        RecvInfo(tp, &tp->func_link, info);
+    } else {
+        return 0;
+    }
+    *buf = (uint8_t *)data;
+    return out_size;
+}
+
+static void tp_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
+    isotp_receive_release(&tp->phys_link);
+    isotp_receive_release(&tp->func_link);
+}
+
 UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg) {
     if (cfg == NULL || tp == NULL) {
         return UDS_ERR_INVALID_ARG;
@@ -2966,15 +3149,46 @@ UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg) {
     tp->hdl.poll = tp_poll;
     tp->hdl.send = tp_send;
     tp->hdl.recv = tp_recv;
+    tp->hdl.peek = tp_peek;
+    tp->hdl.release = tp_release;
+    tp->hdl.send_partial = tp_send_partial;
     tp->phys_sa = cfg->source_addr;
     tp->phys_ta = cfg->target_addr;
     tp->func_sa = cfg->source_addr_func;
     tp->func_ta = cfg->target_addr_func;
 
-    isotp_init_link(&tp->phys_link, tp->phys_ta, tp->send_buf, sizeof(tp->send_buf), tp->recv_buf,
-                    sizeof(tp->recv_buf));
-    isotp_init_link(&tp->func_link, tp->func_ta, tp->recv_buf, sizeof(tp->send_buf), tp->recv_buf,
+    // the links send from the caller's buffer, see UDSTp_t.send
+    isotp_init_link(&tp->phys_link, tp->phys_ta, NULL, UDS_ISOTP_MTU, tp->recv_buf,
                     sizeof(tp->recv_buf));
+    isotp_init_link(&tp->func_link, tp->func_ta, NULL, ISOTP_CAN_FD_MAX_DL, tp->func_recv_buf,
+                    sizeof(tp->func_recv_buf));
+    if (cfg->tx_dl) {
+        if (ISOTP_RET_OK != isotp_set_tx_dl(&tp->phys_link, cfg->tx_dl) ||
+            ISOTP_RET_OK != isotp_set_tx_dl(&tp->func_link, cfg->tx_dl)) {
+            return UDS_ERR_INVALID_ARG;
+        }
+    }
+    if (cfg->max_cf_per_poll) {
+        isotp_set_max_cf_per_poll(&tp->phys_link, cfg->max_cf_per_poll);
+    }
+    isotp_set_address_extension(&tp->phys_link, cfg->addr_ext, cfg->target_ae, cfg->source_ae);
+    isotp_set_address_extension(&tp->func_link, cfg->addr_ext, cfg->target_ae_func,
+                                cfg->source_ae_func);
+    isotp_set_receive_pool(&tp->phys_link, cfg->rx_pool);
+    if (cfg->fc_params) {
+        return UDSISOTpCSetFCParams(tp, cfg->fc_params);
+    }
+    return UDS_OK;
+}
+
+UDSErr_t UDSISOTpCSetFCParams(UDSISOTpC_t *tp, const UDSISOTpFCParams_t *params) {
+    if (tp == NULL || params == NULL) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    if (ISOTP_RET_OK != SetLinkFCParams(&tp->phys_link, params) ||
+        ISOTP_RET_OK != SetLinkFCParams(&tp->func_link, params)) {
+        return UDS_ERR_BUSY;
+    }
     return UDS_OK;
 }
 
@@ -2986,6 +3200,10 @@ UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg) {
 #endif
 #if defined(UDS_TP_ISOTP_C_SOCKETCAN)
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#endif
+
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include <net/if.h>
@@ -2997,7 +3215,48 @@ UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg) {
 #include <errno.h>
 #include <stdarg.h>
 
-static int SetupSocketCAN(const char *ifname) {
+static_assert(sizeof(UDSTpISOTpCMmsg_t) == sizeof(struct mmsghdr) &&
+                  offsetof(UDSTpISOTpCMmsg_t, msg_len) == offsetof(struct mmsghdr, msg_len),
+              "UDSTpISOTpCMmsg_t must match struct mmsghdr");
+
+// CAN IDs above 0x7FF are sent and filtered as 29-bit identifiers
+static canid_t ToSocketCANId(uint32_t id) { return id > CAN_SFF_MASK ? (id | CAN_EFF_FLAG) : id; }
+
+static uint32_t FromSocketCANId(canid_t can_id) {
+    return (can_id & CAN_EFF_FLAG) ? (can_id & CAN_EFF_MASK) : (can_id & CAN_SFF_MASK);
+}
+
+// normal fixed addressing: priority and N_SA are masked out of the bus table key and the filter
+#define NORMAL_FIXED_KEY_MASK (0x03FFFF00u)
+#define NORMAL_FIXED_ADDR_EXT (-2)
+
+// Fibonacci hashing of the CAN ID and address byte into the bus table
+static uint32_t BusSlot(uint32_t can_id, int16_t addr_ext) {
+    return ((can_id * 257u + (uint32_t)(addr_ext + 1)) * 2654435761u) &
+           (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1);
+}
+
+static UDSErr_t SocketCANApplyFilters(const UDSTpISOTpCBus_t *bus) {
+    if (!bus->kernel_filter) {
+        return UDS_OK;
+    }
+    if (setsockopt(bus->fd, SOL_CAN_RAW, CAN_RAW_FILTER, bus->filters,
+                   bus->num_filters * sizeof(struct can_filter)) < 0) {
+        perror("setsockopt CAN_RAW_FILTER");
+        return UDS_FAIL;
+    }
+    return UDS_OK;
+}
+
+// timestamp received frames, see SocketCANRxTime
+static void SocketCANEnableTimestamps(int fd) {
+    const int enable = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt SO_TIMESTAMPNS");
+    }
+}
+
+static int SetupSocketCAN(const char *ifname, bool can_fd) {
     struct sockaddr_can addr = {0};
     struct ifreq ifr = {0};
     int sockfd = -1;
@@ -3007,6 +3266,26 @@ static int SetupSocketCAN(const char *ifname) {
         goto done;
     }
 
+    SocketCANEnableTimestamps(sockfd);
+
+    // receive nothing until transports are attached to the bus
+    if (setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0) {
+        perror("setsockopt CAN_RAW_FILTER");
+        close(sockfd);
+        sockfd = -1;
+        goto done;
+    }
+
+    if (can_fd) {
+        const int enable = 1;
+        if (setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0) {
+            perror("setsockopt CAN_RAW_FD_FRAMES");
+            close(sockfd);
+            sockfd = -1;
+            goto done;
+        }
+    }
+
     memset(&ifr, 0, sizeof(ifr));
     if (snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname) >= (int)sizeof(ifr.ifr_name)) {
         UDS_LOGE(__FILE__, "Interface name too long");
@@ -3026,7 +3305,7 @@ done:
     return sockfd;
 }
 
-uint32_t isotp_user_get_us(void) { return UDSMillis() * 1000; }
+uint32_t isotp_user_get_us(void) { return UDSMicros(); }
 
 __attribute__((format(printf, 1, 2))) void isotp_user_debug(const char *message, ...) {
     va_list args;
@@ -3035,86 +3314,385 @@ __attribute__((format(printf, 1, 2))) void isotp_user_debug(const char *message,
     va_end(args);
 }
 
+// Sends the queued frames. Frames the interface can't take right now stay queued.
+static void SocketCANFlush(UDSTpISOTpCBus_t *bus) {
+    int sent = 0;
+
+    while (sent < bus->tx_count) {
+        int n = sendmmsg(bus->fd, (struct mmsghdr *)&bus->tx_msgs[sent], bus->tx_count - sent, MSG_DONTWAIT);
+        if (n < 0) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && ENOBUFS != errno) {
+                perror("sendmmsg");
+                sent = bus->tx_count; // drop the batch, isotp-c will time out
+            }
+            break;
+        }
+        sent += n;
+    }
+
+    for (int i = 0; i < sent; i++) {
+        if (bus->tx_owners[i]) {
+            bus->tx_owners[i]->tx_queued--;
+        }
+    }
+    if (sent > 0 && sent < bus->tx_count) {
+        for (int i = sent; i < bus->tx_count; i++) {
+            bus->tx_frames[i - sent] = bus->tx_frames[i];
+            bus->tx_iovs[i - sent].iov_len = bus->tx_iovs[i].iov_len;
+            bus->tx_owners[i - sent] = bus->tx_owners[i];
+        }
+    }
+    bus->tx_count -= sent;
+}
+
 #ifndef ISO_TP_USER_SEND_CAN_ARG
 #error "ISO_TP_USER_SEND_CAN_ARG must be defined"
 #endif
 int isotp_user_send_can(const uint32_t arbitration_id, const uint8_t *data, const uint8_t size,
                         void *user_data) {
-    (void)fflush(stdout);
     UDS_ASSERT(user_data);
-    int sockfd = *(int *)user_data;
-    struct can_frame frame = {0};
-    frame.can_id = arbitration_id;
-    frame.can_dlc = size;
-    memmove(frame.data, data, size);
-    if (write(sockfd, &frame, sizeof(struct can_frame)) != sizeof(struct can_frame)) {
-        perror("Write err");
-        return ISOTP_RET_ERROR;
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)user_data;
+    UDSTpISOTpCBus_t *bus = tp->bus;
+
+    if (bus->tx_count >= UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX) {
+        SocketCANFlush(bus);
+        if (bus->tx_count >= UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX) {
+            // the interface queue is full, isotp_poll retries the frame on the next call
+            return ISOTP_RET_NOSPACE;
+        }
+    }
+
+    struct canfd_frame *frame = &bus->tx_frames[bus->tx_count];
+    memset(frame, 0, sizeof(*frame));
+    frame->can_id = ToSocketCANId(arbitration_id);
+    frame->len = size;
+    memmove(frame->data, data, size);
+
+    // with CAN_RAW_FD_FRAMES enabled the socket takes both frame sizes, the MTU selects the type
+    bus->tx_iovs[bus->tx_count].iov_len = CAN_MTU;
+    if (tp->can_fd) {
+        frame->flags = CANFD_BRS;
+        bus->tx_iovs[bus->tx_count].iov_len = CANFD_MTU;
     }
+    bus->tx_owners[bus->tx_count] = tp;
+    bus->tx_count++;
+    tp->tx_queued++;
     return ISOTP_RET_OK;
 }
 
-static void SocketCANRecv(UDSTpISOTpC_t *tp) {
-    UDS_ASSERT(tp);
-    struct can_frame frame = {0};
-    int nbytes = 0;
+// kernel receive time of a frame read by recvmmsg, 0 if the socket doesn't timestamp
+static uint64_t SocketCANRxTime(struct msghdr *msg) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (SOL_SOCKET == c->cmsg_level && SCM_TIMESTAMPNS == c->cmsg_type) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return UDSRealtimeToMonotonicNs(&ts);
+        }
+    }
+    return 0;
+}
 
-    for (;;) {
-        nbytes = read(tp->fd, &frame, sizeof(struct can_frame));
-        if (nbytes < 0) {
-            if (EAGAIN == errno || EWOULDBLOCK == errno) {
-                break;
+// fills info for the complete message in link
+static void SocketCANRecvInfo(const UDSTpISOTpC_t *tp, const IsoTpLink *link, UDSSDU_t *info) {
+    if (link == &tp->func_link) {
+        info->A_TA = tp->func_sa;
+        info->A_SA = tp->normal_fixed ? tp->func_rx_sa : tp->func_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
+        info->rx_time_ns = tp->func_rx_time_ns;
+    } else if (tp->normal_fixed) {
+        const UDSTpISOTpCPeer_t *peer = (const UDSTpISOTpCPeer_t *)link;
+        info->A_TA = tp->phys_sa;
+        info->A_SA = peer->addr;
+        info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+        info->rx_time_ns = peer->rx_time_ns;
+    } else {
+        info->A_TA = tp->phys_sa;
+        info->A_SA = tp->phys_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+        info->rx_time_ns = tp->phys_rx_time_ns;
+    }
+    info->A_AE = link->addr_ext_len ? link->receive_addr_ext : 0;
+}
+
+// with normal fixed addressing the sender of the message read last is the target of replies
+static void SocketCANRead(UDSTpISOTpC_t *tp, const UDSSDU_t *rx_info, UDSSDU_t *info) {
+    if (tp->normal_fixed) {
+        tp->reply_ta = rx_info->A_SA;
+    }
+    if (info) {
+        *info = *rx_info;
+    }
+}
+
+// moves the complete message in link to the receive queue, the link receives the next message
+// while this one waits to be read
+static void SocketCANQueue(UDSTpISOTpC_t *tp, IsoTpLink *link) {
+    if (UDS_ISOTP_C_RX_QUEUE_LEN == tp->rx_count ||
+        ISOTP_RECEIVE_STATUS_FULL != link->receive_status) {
+        return;
+    }
+    UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[(tp->rx_head + tp->rx_count) % UDS_ISOTP_C_RX_QUEUE_LEN];
+    SocketCANRecvInfo(tp, link, &m->info);
+    if (ISOTP_RET_OK == isotp_receive_take(link, &m->data, &m->len)) {
+        m->pool = link->receive_pool;
+    } else if (link->receive_size <= sizeof(m->sf)) {
+        (void)isotp_receive(link, m->sf, sizeof(m->sf), &m->len);
+        m->data = m->sf;
+        m->pool = NULL;
+    } else {
+        return; // a multi-frame message without a pool block waits in its link
+    }
+    tp->rx_count++;
+}
+
+// messages that found the queue full wait in their links until there is room
+static void SocketCANQueueHeld(UDSTpISOTpC_t *tp) {
+    SocketCANQueue(tp, &tp->phys_link);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        SocketCANQueue(tp, &tp->peers[i].link);
+    }
+    SocketCANQueue(tp, &tp->func_link);
+}
+
+static void SocketCANRxPop(UDSTpISOTpC_t *tp) {
+    const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+    if (m->pool) {
+        isotp_pool_put(m->pool, m->data);
+    }
+    tp->rx_head = (tp->rx_head + 1) % UDS_ISOTP_C_RX_QUEUE_LEN;
+    tp->rx_count--;
+    tp->rx_lent = false;
+    SocketCANQueueHeld(tp);
+}
+
+// ISO 15765-2 2016 Table 4 note b: functional addressing is only used with single frames
+static bool SocketCANIsSingleFrame(const IsoTpLink *link, const struct canfd_frame *frame) {
+    return frame->len > link->addr_ext_len &&
+           ISOTP_PCI_TYPE_SINGLE == frame->data[link->addr_ext_len] >> 4;
+}
+
+// hands the frame to the links listening to can_id and addr_ext
+static void SocketCANDispatchTo(UDSTpISOTpCBus_t *bus, uint32_t can_id, int16_t addr_ext,
+                                const struct canfd_frame *frame, uint64_t rx_time_ns) {
+    // several links may listen to the same ID, e.g. a functional address shared by servers
+    for (uint32_t slot = BusSlot(can_id, addr_ext); bus->table[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1)) {
+        const UDSTpISOTpCBusEntry_t *entry = &bus->table[slot];
+        if (entry->can_id != can_id || entry->addr_ext != addr_ext) {
+            continue;
+        }
+        // the functional link receives independently of the physical one, e.g. TesterPresent
+        // while a long request is still arriving
+        if (entry->link == &entry->tp->func_link && !SocketCANIsSingleFrame(entry->link, frame)) {
+            continue;
+        }
+        const bool was_full = ISOTP_RECEIVE_STATUS_FULL == entry->link->receive_status;
+        isotp_on_can_message(entry->link, frame->data, frame->len);
+        if (!was_full && ISOTP_RECEIVE_STATUS_FULL == entry->link->receive_status) {
+            if (entry->link == &entry->tp->phys_link) {
+                entry->tp->phys_rx_time_ns = rx_time_ns;
             } else {
-                perror("read");
+                entry->tp->func_rx_time_ns = rx_time_ns;
             }
-        } else if (nbytes == 0) {
-            break;
-        } else {
-            if (frame.can_id == tp->phys_sa) {
-                isotp_on_can_message(&tp->phys_link, frame.data, frame.can_dlc);
-            } else if (frame.can_id == tp->func_sa) {
-                if (ISOTP_RECEIVE_STATUS_IDLE != tp->phys_link.receive_status) {
-                    UDS_LOGI(__FILE__,
-                             "func frame received but cannot process because link is not idle");
-                    return;
-                }
-                // TODO: reject if it's longer than a single frame
-                isotp_on_can_message(&tp->func_link, frame.data, frame.can_dlc);
+            SocketCANQueue(entry->tp, entry->link);
+        }
+    }
+}
+
+// the peer talking to addr, a free peer is taken over if alloc is set
+static UDSTpISOTpCPeer_t *SocketCANPeer(UDSTpISOTpC_t *tp, uint8_t addr, bool alloc) {
+    if (tp->peer_index[addr]) {
+        return &tp->peers[tp->peer_index[addr] - 1];
+    }
+    if (!alloc) {
+        return NULL;
+    }
+    for (uint16_t n = 0; n < tp->num_peers; n++) {
+        const uint16_t i = (tp->next_free_peer + n) % tp->num_peers;
+        UDSTpISOTpCPeer_t *peer = &tp->peers[i];
+        if (ISOTP_SEND_STATUS_INPROGRESS == peer->link.send_status ||
+            ISOTP_RECEIVE_STATUS_IDLE != peer->link.receive_status) {
+            continue;
+        }
+        if (tp->peer_index[peer->addr] == i + 1) {
+            tp->peer_index[peer->addr] = 0;
+        }
+        peer->addr = addr;
+        peer->link.send_arbitration_id = UDS_ISOTP_NORMAL_FIXED_PHYS_ID(addr, tp->phys_sa);
+        tp->peer_index[addr] = i + 1;
+        tp->next_free_peer = (i + 1) % tp->num_peers;
+        return peer;
+    }
+    return NULL;
+}
+
+// normal fixed addressing: the link is chosen by the N_SA in the CAN ID
+static void SocketCANDispatchFixed(UDSTpISOTpCBus_t *bus, uint32_t can_id,
+                                   const struct canfd_frame *frame, uint64_t rx_time_ns) {
+    const uint32_t key = can_id & NORMAL_FIXED_KEY_MASK;
+    const uint8_t sa = can_id & 0xFFu;
+    for (uint32_t slot = BusSlot(key, NORMAL_FIXED_ADDR_EXT); bus->table[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1)) {
+        const UDSTpISOTpCBusEntry_t *entry = &bus->table[slot];
+        if (entry->can_id != key || entry->addr_ext != NORMAL_FIXED_ADDR_EXT) {
+            continue;
+        }
+        UDSTpISOTpC_t *tp = entry->tp;
+        if (sa == tp->phys_sa) {
+            continue; // our own frames on a loopback bus
+        }
+        if (entry->link == &tp->func_link) {
+            if (!SocketCANIsSingleFrame(&tp->func_link, frame)) {
+                continue;
+            }
+            const bool was_full = ISOTP_RECEIVE_STATUS_FULL == tp->func_link.receive_status;
+            isotp_on_can_message(&tp->func_link, frame->data, frame->len);
+            if (!was_full && ISOTP_RECEIVE_STATUS_FULL == tp->func_link.receive_status) {
+                tp->func_rx_sa = sa;
+                tp->func_rx_time_ns = rx_time_ns;
+                SocketCANQueue(tp, &tp->func_link);
+            }
+            continue;
+        }
+        // single and first frames start a message and may take over a free peer, consecutive
+        // and flow control frames belong to a transfer in progress
+        const uint8_t pci_type = frame->len ? frame->data[0] >> 4 : 0xFF;
+        UDSTpISOTpCPeer_t *peer =
+            SocketCANPeer(tp, sa, ISOTP_PCI_TYPE_SINGLE == pci_type ||
+                                      ISOTP_PCI_TYPE_FIRST_FRAME == pci_type);
+        if (NULL == peer) {
+            UDS_LOGI(__FILE__, "'%s': no free peer for 0x%02X, frame dropped", tp->tag, sa);
+            continue;
+        }
+        const bool was_full = ISOTP_RECEIVE_STATUS_FULL == peer->link.receive_status;
+        isotp_on_can_message(&peer->link, frame->data, frame->len);
+        if (!was_full && ISOTP_RECEIVE_STATUS_FULL == peer->link.receive_status) {
+            peer->rx_time_ns = rx_time_ns;
+            SocketCANQueue(tp, &peer->link);
+        }
+    }
+}
+
+static void SocketCANDispatch(UDSTpISOTpCBus_t *bus, const struct canfd_frame *frame,
+                              uint64_t rx_time_ns) {
+    const uint32_t can_id = FromSocketCANId(frame->can_id);
+    SocketCANDispatchTo(bus, can_id, -1, frame, rx_time_ns);
+    if (bus->num_addr_ext_links && frame->len > 0) {
+        SocketCANDispatchTo(bus, can_id, frame->data[0], frame, rx_time_ns);
+    }
+    if (bus->num_normal_fixed_links && (frame->can_id & CAN_EFF_FLAG)) {
+        SocketCANDispatchFixed(bus, can_id, frame, rx_time_ns);
+    }
+}
+
+static void SocketCANRecv(UDSTpISOTpCBus_t *bus) {
+    UDS_ASSERT(bus);
+    int nframes = 0;
+
+    for (;;) {
+        for (int i = 0; i < bus->rx_batch_size; i++) {
+            // recvmmsg shrinks it to the control data received
+            bus->rx_msgs[i].msg_hdr.msg_controllen = sizeof(bus->rx_control[i]);
+        }
+        nframes = recvmmsg(bus->fd, (struct mmsghdr *)bus->rx_msgs, bus->rx_batch_size, MSG_DONTWAIT, NULL);
+        if (nframes < 0) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                perror("recvmmsg");
             }
+            break;
         }
+        for (int i = 0; i < nframes; i++) {
+            SocketCANDispatch(bus, &bus->rx_frames[i],
+                              SocketCANRxTime(&bus->rx_msgs[i].msg_hdr));
+        }
+        if (nframes < bus->rx_batch_size) {
+            // the socket queue is drained
+            break;
+        }
+    }
+}
+
+static void SocketCANPollLinks(UDSTpISOTpC_t *tp) {
+    if (tp->normal_fixed) {
+        for (uint16_t i = 0; i < tp->num_peers; i++) {
+            isotp_poll(&tp->peers[i].link);
+        }
+    } else {
+        isotp_poll(&tp->phys_link);
     }
 }
 
+static bool SocketCANOwnsBus(const UDSTpISOTpC_t *tp) { return tp->bus == &tp->own_bus; }
+
 static UDSTpStatus_t isotp_c_socketcan_tp_poll(UDSTp_t *hdl) {
     UDS_ASSERT(hdl);
     UDSTpStatus_t status = 0;
     UDSTpISOTpC_t *impl = (UDSTpISOTpC_t *)hdl;
-    SocketCANRecv(impl);
-    isotp_poll(&impl->phys_link);
-    if (impl->phys_link.send_status == ISOTP_SEND_STATUS_INPROGRESS) {
+    if (SocketCANOwnsBus(impl)) {
+        UDSTpISOTpCBusPoll(impl->bus);
+    } else {
+        // frames on a shared bus are received by UDSTpISOTpCBusPoll
+        SocketCANPollLinks(impl);
+        SocketCANFlush(impl->bus);
+    }
+    if (impl->send_link->send_status == ISOTP_SEND_STATUS_INPROGRESS || impl->tx_queued) {
         status |= UDS_TP_SEND_IN_PROGRESS;
     }
-    if (impl->phys_link.send_status == ISOTP_SEND_STATUS_ERROR) {
+    if (impl->send_link->send_status == ISOTP_SEND_STATUS_ERROR) {
         status |= UDS_TP_ERR;
     }
     return status;
 }
 
+// normal fixed addressing: the target is info->A_TA if info->A_SA is our address, else the
+// configured target or the sender of the last received message
+static uint32_t SocketCANFixedTarget(const UDSTpISOTpC_t *tp, const UDSSDU_t *info) {
+    if (info && info->A_SA == tp->phys_sa) {
+        return info->A_TA;
+    }
+    return UDS_TP_NOOP_ADDR == tp->phys_ta ? tp->reply_ta : tp->phys_ta;
+}
+
+// the link a physical message to ta is sent on, NULL if all peers are busy
+static IsoTpLink *SocketCANSendLink(UDSTpISOTpC_t *tp, uint32_t ta) {
+    if (!tp->normal_fixed) {
+        return &tp->phys_link;
+    }
+    UDSTpISOTpCPeer_t *peer = SocketCANPeer(tp, (uint8_t)ta, true);
+    if (NULL == peer) {
+        return NULL;
+    }
+    tp->send_link = &peer->link;
+    return &peer->link;
+}
+
 static ssize_t isotp_c_socketcan_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ssize_t ret = -1;
     UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
     IsoTpLink *link = NULL;
     const UDSTpAddr_t ta_type = info ? info->A_TA_Type : UDS_A_TA_TYPE_PHYSICAL;
-    const uint32_t ta = ta_type == UDS_A_TA_TYPE_PHYSICAL ? tp->phys_ta : tp->func_ta;
+    uint32_t ta = ta_type == UDS_A_TA_TYPE_PHYSICAL ? tp->phys_ta : tp->func_ta;
     switch (ta_type) {
     case UDS_A_TA_TYPE_PHYSICAL:
-        link = &tp->phys_link;
-        break;
-    case UDS_A_TA_TYPE_FUNCTIONAL:
+        if (tp->normal_fixed) {
+            ta = SocketCANFixedTarget(tp, info);
+            if (ta > 0xFF) {
+                UDS_LOGI(__FILE__, "'%s': no target address", tp->tag);
+                goto done;
+            }
+        }
+        link = SocketCANSendLink(tp, ta);
+        if (NULL == link) {
+            ret = ISOTP_RET_INPROGRESS;
+            goto done;
+        }
+        break;
+    case UDS_A_TA_TYPE_FUNCTIONAL:
         link = &tp->func_link;
-        if (len > 7) {
-            UDS_LOGI(__FILE__, "Cannot send more than 7 bytes via functional addressing");
+        if (len > isotp_single_frame_max_size(link)) {
+            UDS_LOGI(__FILE__, "Cannot send more than %u bytes via functional addressing",
+                     isotp_single_frame_max_size(link));
             ret = -3;
             goto done;
         }
@@ -3125,6 +3703,7 @@ static ssize_t isotp_c_socketcan_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len,
     }
 
     int send_status = isotp_send(link, buf, len);
+    SocketCANFlush(tp->bus);
     switch (send_status) {
     case ISOTP_RET_OK:
         ret = len;
@@ -3142,30 +3721,91 @@ done:
     return ret;
 }
 
+// ISO-TP frames are sent as far as the data reaches, e.g. while a gateway still receives it
+static ssize_t isotp_c_socketcan_tp_send_partial(UDSTp_t *hdl, uint8_t *buf, size_t len,
+                                                 size_t available, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    int ret = ISOTP_RET_OK;
+    if (NULL == buf) {
+        isotp_send_abort(tp->send_link);
+        return 0;
+    }
+    if (info && UDS_A_TA_TYPE_FUNCTIONAL == info->A_TA_Type) {
+        // functional messages are single frames
+        return available < len ? 0 : isotp_c_socketcan_tp_send(hdl, buf, len, info);
+    }
+    const uint32_t ta = tp->normal_fixed ? SocketCANFixedTarget(tp, info) : tp->phys_ta;
+    if (ta > 0xFF && tp->normal_fixed) {
+        return -1;
+    }
+    IsoTpLink *link = SocketCANSendLink(tp, ta);
+    if (NULL == link) {
+        return 0;
+    }
+    if (len > link->send_buf_size) {
+        return -1;
+    }
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && link->send_data == buf) {
+        ret = isotp_send_extend(link, (uint32_t)available);
+    } else {
+        ret = isotp_send_partial(link, link->send_arbitration_id, buf, (uint32_t)len,
+                                 (uint32_t)available);
+        SocketCANFlush(tp->bus);
+        if (ISOTP_RET_NO_DATA == ret) {
+            return 0;
+        }
+    }
+    return ISOTP_RET_OK == ret ? (ssize_t)len : ret;
+}
+
+// normal fixed addressing: the peer link with a complete message, the peers take turns
+static IsoTpLink *SocketCANFullPeer(UDSTpISOTpC_t *tp) {
+    for (uint16_t n = 0; n < tp->num_peers; n++) {
+        const uint16_t i = (tp->next_peer + n) % tp->num_peers;
+        if (ISOTP_RECEIVE_STATUS_LENT == tp->peers[i].link.receive_status) {
+            return &tp->peers[i].link;
+        }
+    }
+    for (uint16_t n = 0; n < tp->num_peers; n++) {
+        const uint16_t i = (tp->next_peer + n) % tp->num_peers;
+        if (ISOTP_RECEIVE_STATUS_FULL == tp->peers[i].link.receive_status) {
+            tp->next_peer = (i + 1) % tp->num_peers;
+            return &tp->peers[i].link;
+        }
+    }
+    return &tp->phys_link;
+}
+
 static ssize_t isotp_c_socketcan_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize,
                                          UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     UDS_ASSERT(buf);
-    uint16_t out_size = 0;
+    uint32_t out_size = 0;
     UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    UDSSDU_t rx_info = {0};
 
-    int ret = isotp_receive(&tp->phys_link, buf, bufsize, &out_size);
+    if (tp->rx_count) {
+        const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+        out_size = m->len < bufsize ? m->len : (uint32_t)bufsize;
+        memcpy(buf, m->data, out_size);
+        SocketCANRead(tp, &m->info, info);
+        SocketCANRxPop(tp);
+        return out_size;
+    }
+
+    IsoTpLink *phys_link = tp->normal_fixed ? SocketCANFullPeer(tp) : &tp->phys_link;
+    SocketCANRecvInfo(tp, phys_link, &rx_info);
+    int ret = isotp_receive(phys_link, buf, bufsize, &out_size);
     if (ret == ISOTP_RET_OK) {
-        UDS_LOGI(__FILE__, "phys link received %d bytes", out_size);
-        if (NULL != info) {
-            info->A_TA = tp->phys_sa;
-            info->A_SA = tp->phys_ta;
-            info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
-        }
+        UDS_LOGI(__FILE__, "phys link received %u bytes", (unsigned)out_size);
+        SocketCANRead(tp, &rx_info, info);
     } else if (ret == ISOTP_RET_NO_DATA) {
+        SocketCANRecvInfo(tp, &tp->func_link, &rx_info);
         ret = isotp_receive(&tp->func_link, buf, bufsize, &out_size);
         if (ret == ISOTP_RET_OK) {
-            UDS_LOGI(__FILE__, "func link received %d bytes", out_size);
-            if (NULL != info) {
-                info->A_TA = tp->func_sa;
-                info->A_SA = tp->func_ta;
-                info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
-            }
+            UDS_LOGI(__FILE__, "func link received %u bytes", (unsigned)out_size);
+            SocketCANRead(tp, &rx_info, info);
         } else if (ret == ISOTP_RET_NO_DATA) {
             return 0;
         } else {
@@ -3177,35 +3817,492 @@ static ssize_t isotp_c_socketcan_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufs
     return out_size;
 }
 
-UDSErr_t UDSTpISOTpCInit(UDSTpISOTpC_t *tp, const char *ifname, uint32_t source_addr,
-                         uint32_t target_addr, uint32_t source_addr_func,
-                         uint32_t target_addr_func) {
-    UDS_ASSERT(tp);
-    UDS_ASSERT(ifname);
+static ssize_t isotp_c_socketcan_tp_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    const uint8_t *data = NULL;
+    uint32_t out_size = 0;
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    UDSSDU_t rx_info = {0};
+
+    if (tp->rx_count) {
+        const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+        SocketCANRead(tp, &m->info, info);
+        tp->rx_lent = true;
+        *buf = m->data;
+        return m->len;
+    }
+
+    IsoTpLink *phys_link = tp->normal_fixed ? SocketCANFullPeer(tp) : &tp->phys_link;
+    if (ISOTP_RET_OK == isotp_receive_peek(phys_link, &data, &out_size)) {
+        SocketCANRecvInfo(tp, phys_link, &rx_info);
+    } else if (ISOTP_RET_OK == isotp_receive_peek(&tp->func_link, &data, &out_size)) {
+        SocketCANRecvInfo(tp, &tp->func_link, &rx_info);
+    } else {
+        return 0;
+    }
+    SocketCANRead(tp, &rx_info, info);
+    *buf = (uint8_t *)data;
+    return out_size;
+}
+
+static void isotp_c_socketcan_tp_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    if (tp->rx_lent) {
+        SocketCANRxPop(tp);
+        return;
+    }
+    isotp_receive_release(&tp->phys_link);
+    isotp_receive_release(&tp->func_link);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        isotp_receive_release(&tp->peers[i].link);
+    }
+}
+
+static int isotp_c_socketcan_tp_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    if (max_fds < 1) {
+        return 0;
+    }
+    fds[0].fd = tp->bus->fd;
+    fds[0].events = UDS_TP_FD_READ;
+    if (tp->bus->tx_count) {
+        // sendmmsg hit EAGAIN, the rest of the batch goes out once the socket is writable
+        fds[0].events |= UDS_TP_FD_WRITE;
+    }
+    return 1;
+}
+
+// moves *deadline_us to the next deadline of link if that comes first
+static void SocketCANLinkDeadline(IsoTpLink *link, bool *found, uint32_t *deadline_us) {
+    uint32_t link_us = 0;
+    if (!isotp_next_deadline(link, &link_us)) {
+        return;
+    }
+    if (!*found || IsoTpTimeAfter(*deadline_us, link_us)) {
+        *deadline_us = link_us;
+    }
+    *found = true;
+}
+
+static bool isotp_c_socketcan_tp_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    uint32_t deadline_us = 0;
+    bool found = false;
+    SocketCANLinkDeadline(&tp->phys_link, &found, &deadline_us);
+    SocketCANLinkDeadline(&tp->func_link, &found, &deadline_us);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        SocketCANLinkDeadline(&tp->peers[i].link, &found, &deadline_us);
+    }
+    if (!found) {
+        return false;
+    }
+
+    // isotp-c counts in microseconds, round up so that the deadline has passed when poll runs
+    int32_t remaining_us = (int32_t)(deadline_us - isotp_user_get_us());
+    if (remaining_us < 0) {
+        remaining_us = 0;
+    }
+    *deadline_ms = UDSMillis() + ((uint32_t)remaining_us + 999) / 1000;
+    return true;
+}
+
+static UDSErr_t BusAddRxFilter(UDSTpISOTpCBus_t *bus, canid_t id, canid_t mask) {
+    for (int i = 0; i < bus->num_filters; i++) {
+        if (bus->filters[i].can_id == id && bus->filters[i].can_mask == mask) {
+            bus->filter_refs[i]++;
+            return UDS_OK;
+        }
+    }
+    if (bus->num_filters >= UDS_ISOTP_C_SOCKETCAN_FILTER_MAX) {
+        UDS_LOGE(__FILE__, "cannot filter more than %d CAN IDs", UDS_ISOTP_C_SOCKETCAN_FILTER_MAX);
+        return UDS_ERR_BUFSIZ;
+    }
+    bus->filters[bus->num_filters].can_id = id;
+    bus->filters[bus->num_filters].can_mask = mask;
+    bus->filter_refs[bus->num_filters] = 1;
+    bus->num_filters++;
+    return SocketCANApplyFilters(bus);
+}
+
+static canid_t BusFilterMask(canid_t id) {
+    return CAN_EFF_FLAG | CAN_RTR_FLAG | ((id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+}
+
+// links with normal fixed addressing are entered with the target address part of can_id and
+// receive from every N_SA
+static UDSErr_t BusAddLink(UDSTpISOTpCBus_t *bus, UDSTpISOTpC_t *tp, IsoTpLink *link,
+                           uint32_t can_id) {
+    int16_t addr_ext = link->addr_ext_len ? link->receive_addr_ext : -1;
+    UDSErr_t err = UDS_OK;
+    if (tp->normal_fixed) {
+        addr_ext = NORMAL_FIXED_ADDR_EXT;
+        can_id &= NORMAL_FIXED_KEY_MASK;
+        err = BusAddRxFilter(bus, CAN_EFF_FLAG | can_id,
+                             CAN_EFF_FLAG | CAN_RTR_FLAG | NORMAL_FIXED_KEY_MASK);
+    } else {
+        err = UDSTpISOTpCBusAddRxId(bus, can_id);
+    }
+    if (UDS_OK != err) {
+        return err;
+    }
+    uint32_t slot = BusSlot(can_id, addr_ext);
+    while (bus->table[slot].tp) {
+        slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1);
+    }
+    bus->table[slot].can_id = can_id;
+    bus->table[slot].addr_ext = addr_ext;
+    bus->table[slot].tp = tp;
+    bus->table[slot].link = link;
+    if (addr_ext >= 0) {
+        bus->num_addr_ext_links++;
+    } else if (NORMAL_FIXED_ADDR_EXT == addr_ext) {
+        bus->num_normal_fixed_links++;
+    }
+    return UDS_OK;
+}
+
+static void BusRemoveRxFilter(UDSTpISOTpCBus_t *bus, canid_t id, canid_t mask) {
+    for (int i = 0; i < bus->num_filters; i++) {
+        if (bus->filters[i].can_id == id && bus->filters[i].can_mask == mask) {
+            if (0 == --bus->filter_refs[i]) {
+                bus->num_filters--;
+                bus->filters[i] = bus->filters[bus->num_filters];
+                bus->filter_refs[i] = bus->filter_refs[bus->num_filters];
+                SocketCANApplyFilters(bus);
+            }
+            return;
+        }
+    }
+}
+
+static void BusRemove(UDSTpISOTpCBus_t *bus, UDSTpISOTpC_t *tp) {
+    // linear probing can't simply clear slots, so the remaining entries are inserted again
+    UDSTpISOTpCBusEntry_t remaining[UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE];
+    int num_remaining = 0;
+    for (int i = 0; i < UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE; i++) {
+        if (bus->table[i].tp == tp) {
+            const uint32_t can_id = bus->table[i].can_id;
+            if (NORMAL_FIXED_ADDR_EXT == bus->table[i].addr_ext) {
+                BusRemoveRxFilter(bus, CAN_EFF_FLAG | can_id,
+                                  CAN_EFF_FLAG | CAN_RTR_FLAG | NORMAL_FIXED_KEY_MASK);
+                bus->num_normal_fixed_links--;
+            } else {
+                BusRemoveRxFilter(bus, ToSocketCANId(can_id), BusFilterMask(ToSocketCANId(can_id)));
+            }
+            if (bus->table[i].addr_ext >= 0) {
+                bus->num_addr_ext_links--;
+            }
+        } else if (bus->table[i].tp) {
+            remaining[num_remaining++] = bus->table[i];
+        }
+    }
+    memset(bus->table, 0, sizeof(bus->table));
+    for (int i = 0; i < num_remaining; i++) {
+        uint32_t slot = BusSlot(remaining[i].can_id, remaining[i].addr_ext);
+        while (bus->table[slot].tp) {
+            slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1);
+        }
+        bus->table[slot] = remaining[i];
+    }
+
+    for (int i = 0; i < bus->num_tps; i++) {
+        if (bus->tps[i] == tp) {
+            bus->tps[i] = bus->tps[--bus->num_tps];
+            break;
+        }
+    }
+
+    // frames still queued are sent, but nobody waits for them
+    for (int i = 0; i < bus->tx_count; i++) {
+        if (bus->tx_owners[i] == tp) {
+            bus->tx_owners[i] = NULL;
+        }
+    }
+    tp->tx_queued = 0;
+}
+
+static void BusInit(UDSTpISOTpCBus_t *bus, const UDSTpISOTpCBusConfig_t *cfg) {
+    memset(bus, 0, sizeof(*bus));
+    bus->can_fd = cfg->can_fd;
+
+    bus->rx_batch_size = UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX;
+    if (cfg->rx_batch_size && cfg->rx_batch_size < UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX) {
+        bus->rx_batch_size = cfg->rx_batch_size;
+    }
+    for (int i = 0; i < UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX; i++) {
+        bus->rx_iovs[i].iov_base = &bus->rx_frames[i];
+        bus->rx_iovs[i].iov_len = sizeof(bus->rx_frames[i]);
+        bus->rx_msgs[i].msg_hdr.msg_iov = &bus->rx_iovs[i];
+        bus->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        bus->rx_msgs[i].msg_hdr.msg_control = bus->rx_control[i];
+    }
+    for (int i = 0; i < UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX; i++) {
+        bus->tx_iovs[i].iov_base = &bus->tx_frames[i];
+        bus->tx_msgs[i].msg_hdr.msg_iov = &bus->tx_iovs[i];
+        bus->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+UDSErr_t UDSTpISOTpCBusInit(UDSTpISOTpCBus_t *bus, const char *ifname,
+                            const UDSTpISOTpCBusConfig_t *cfg) {
+    if (NULL == bus || NULL == ifname || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    BusInit(bus, cfg);
+    bus->kernel_filter = true;
+    bus->fd = SetupSocketCAN(ifname, bus->can_fd);
+    if (bus->fd < 0) {
+        return UDS_FAIL;
+    }
+    return UDS_OK;
+}
+
+UDSErr_t UDSTpISOTpCBusInitWithFd(UDSTpISOTpCBus_t *bus, int fd,
+                                  const UDSTpISOTpCBusConfig_t *cfg) {
+    if (NULL == bus || fd < 0 || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    BusInit(bus, cfg);
+    bus->fd = fd;
+    SocketCANEnableTimestamps(fd);
+    return UDS_OK;
+}
+
+void UDSTpISOTpCBusDeinit(UDSTpISOTpCBus_t *bus) {
+    UDS_ASSERT(bus);
+    close(bus->fd);
+    bus->fd = -1;
+}
+
+void UDSTpISOTpCBusPoll(UDSTpISOTpCBus_t *bus) {
+    UDS_ASSERT(bus);
+    SocketCANRecv(bus);
+    for (int i = 0; i < bus->num_tps; i++) {
+        SocketCANPollLinks(bus->tps[i]);
+    }
+    SocketCANFlush(bus);
+}
+
+UDSErr_t UDSTpISOTpCBusAddRxId(UDSTpISOTpCBus_t *bus, uint32_t can_id) {
+    if (NULL == bus) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    const canid_t id = ToSocketCANId(can_id);
+    return BusAddRxFilter(bus, id, BusFilterMask(id));
+}
+
+UDSErr_t UDSTpISOTpCAddRxId(UDSTpISOTpC_t *tp, uint32_t can_id) {
+    if (NULL == tp) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    return UDSTpISOTpCBusAddRxId(tp->bus, can_id);
+}
+
+static int SocketCANSetLinkFCParams(IsoTpLink *link, const UDSISOTpFCParams_t *params) {
+    return isotp_set_fc_params(link, params->bs, params->st_min_us, params->n_bs_us,
+                               params->n_cr_us, params->wft_max);
+}
+
+UDSErr_t UDSTpISOTpCSetFCParams(UDSTpISOTpC_t *tp, const UDSISOTpFCParams_t *params) {
+    if (NULL == tp || NULL == params) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    bool busy = ISOTP_RET_OK != SocketCANSetLinkFCParams(&tp->phys_link, params) ||
+                ISOTP_RET_OK != SocketCANSetLinkFCParams(&tp->func_link, params);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        busy |= ISOTP_RET_OK != SocketCANSetLinkFCParams(&tp->peers[i].link, params);
+    }
+    if (busy) {
+        UDS_LOGW(__FILE__, "'%s': cannot change flow control parameters during a transfer",
+                 tp->tag);
+        return UDS_ERR_BUSY;
+    }
+    return UDS_OK;
+}
+
+// physical links, and the peers with normal fixed addressing, are set up alike
+static int SocketCANInitPhysLink(UDSTpISOTpC_t *tp, IsoTpLink *link, uint32_t send_id,
+                                 uint8_t *recv_buf, uint32_t recv_buf_size,
+                                 const UDSTpISOTpCConfig_t *cfg) {
+    // the links send from the caller's buffer, see UDSTp_t.send
+    isotp_init_link(link, send_id, NULL, UDS_ISOTP_MTU, recv_buf, recv_buf_size);
+    if (cfg->tx_dl && ISOTP_RET_OK != isotp_set_tx_dl(link, cfg->tx_dl)) {
+        return ISOTP_RET_ERROR;
+    }
+    if (cfg->max_cf_per_poll) {
+        isotp_set_max_cf_per_poll(link, cfg->max_cf_per_poll);
+    }
+    isotp_set_address_extension(link, cfg->addr_ext, cfg->target_ae, cfg->source_ae);
+    isotp_set_receive_pool(link, cfg->rx_pool);
+    link->user_send_can_arg = tp;
+    return ISOTP_RET_OK;
+}
+
+UDSErr_t UDSTpISOTpCInitOnBus(UDSTpISOTpC_t *tp, UDSTpISOTpCBus_t *bus,
+                              const UDSTpISOTpCConfig_t *cfg) {
+    if (NULL == tp || NULL == bus || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    if (bus->num_tps >= UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS) {
+        UDS_LOGE(__FILE__, "'%s': bus is full", tp->tag);
+        return UDS_ERR_BUFSIZ;
+    }
     tp->hdl.poll = isotp_c_socketcan_tp_poll;
     tp->hdl.send = isotp_c_socketcan_tp_send;
     tp->hdl.recv = isotp_c_socketcan_tp_recv;
-    tp->phys_sa = source_addr;
-    tp->phys_ta = target_addr;
-    tp->func_sa = source_addr_func;
-    tp->func_ta = target_addr;
-    tp->fd = SetupSocketCAN(ifname);
-
-    isotp_init_link(&tp->phys_link, target_addr, tp->send_buf, sizeof(tp->send_buf), tp->recv_buf,
-                    sizeof(tp->recv_buf));
-    isotp_init_link(&tp->func_link, target_addr_func, tp->recv_buf, sizeof(tp->send_buf),
-                    tp->recv_buf, sizeof(tp->recv_buf));
+    tp->hdl.peek = isotp_c_socketcan_tp_peek;
+    tp->hdl.release = isotp_c_socketcan_tp_release;
+    tp->hdl.send_partial = isotp_c_socketcan_tp_send_partial;
+    tp->hdl.get_fds = isotp_c_socketcan_tp_get_fds;
+    tp->hdl.next_deadline = isotp_c_socketcan_tp_next_deadline;
+    tp->phys_sa = cfg->source_addr;
+    tp->phys_ta = cfg->target_addr;
+    tp->func_sa = cfg->source_addr_func;
+    tp->func_ta = cfg->target_addr_func;
+    tp->bus = bus;
+
+    tp->normal_fixed = cfg->normal_fixed;
+    tp->peers = NULL;
+    tp->num_peers = 0;
+    if (cfg->normal_fixed) {
+        if (NULL == cfg->peers || 0 == cfg->num_peers || cfg->addr_ext || cfg->source_addr > 0xFF) {
+            UDS_LOGE(__FILE__, "'%s': normal fixed addressing needs peers and 8 bit addresses",
+                     tp->tag);
+            return UDS_ERR_INVALID_ARG;
+        }
+        tp->peers = cfg->peers;
+        tp->num_peers = cfg->num_peers;
+    }
+    memset(tp->peer_index, 0, sizeof(tp->peer_index));
+    tp->next_peer = 0;
+    tp->next_free_peer = 0;
+    tp->reply_ta = UDS_TP_NOOP_ADDR;
+    tp->send_link = &tp->phys_link;
+    tp->rx_head = 0;
+    tp->rx_count = 0;
+    tp->rx_lent = false;
+
+    // IDs of normal fixed addressing are built from the addresses
+    const uint32_t phys_rx_id =
+        tp->normal_fixed ? UDS_ISOTP_NORMAL_FIXED_PHYS_ID(tp->phys_sa, 0) : tp->phys_sa;
+    const uint32_t func_rx_id =
+        tp->normal_fixed ? UDS_ISOTP_NORMAL_FIXED_FUNC_ID(tp->func_sa, 0) : tp->func_sa;
+    const uint32_t func_tx_id =
+        tp->normal_fixed ? UDS_ISOTP_NORMAL_FIXED_FUNC_ID(tp->func_ta, tp->phys_sa) : tp->func_ta;
+
+    if (ISOTP_RET_OK != SocketCANInitPhysLink(tp, &tp->phys_link, cfg->target_addr, tp->recv_buf,
+                                              sizeof(tp->recv_buf), cfg)) {
+        UDS_LOGE(__FILE__, "invalid tx_dl %d", cfg->tx_dl);
+        return UDS_ERR_INVALID_ARG;
+    }
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        UDSTpISOTpCPeer_t *peer = &tp->peers[i];
+        (void)SocketCANInitPhysLink(tp, &peer->link, UDS_ISOTP_NORMAL_FIXED_PHYS_ID(0, tp->phys_sa),
+                                    peer->recv_buf, sizeof(peer->recv_buf), cfg);
+        peer->addr = 0;
+        peer->rx_time_ns = 0;
+    }
+    isotp_init_link(&tp->func_link, func_tx_id, NULL, ISOTP_CAN_FD_MAX_DL, tp->func_recv_buf,
+                    sizeof(tp->func_recv_buf));
+    if (cfg->tx_dl) {
+        (void)isotp_set_tx_dl(&tp->func_link, cfg->tx_dl);
+    }
+    tp->can_fd = tp->phys_link.send_dl > ISOTP_CAN_DL;
+    if (tp->can_fd && !bus->can_fd) {
+        UDS_LOGE(__FILE__, "'%s': tx_dl %d needs a CAN-FD bus", tp->tag, cfg->tx_dl);
+        return UDS_ERR_INVALID_ARG;
+    }
+    isotp_set_address_extension(&tp->func_link, cfg->addr_ext, cfg->target_ae_func,
+                                cfg->source_ae_func);
+    if (cfg->fc_params) {
+        UDSErr_t err = UDSTpISOTpCSetFCParams(tp, cfg->fc_params);
+        if (UDS_OK != err) {
+            return err;
+        }
+    }
+    tp->func_link.user_send_can_arg = tp;
 
-    tp->phys_link.user_send_can_arg = &(tp->fd);
-    tp->func_link.user_send_can_arg = &(tp->fd);
+    UDSErr_t err = BusAddLink(bus, tp, &tp->phys_link, phys_rx_id);
+    if (UDS_OK == err && tp->func_sa != UDS_TP_NOOP_ADDR) {
+        err = BusAddLink(bus, tp, &tp->func_link, func_rx_id);
+    }
+    if (UDS_OK != err) {
+        BusRemove(bus, tp);
+        return err;
+    }
+    bus->tps[bus->num_tps++] = tp;
 
     return UDS_OK;
 }
 
+// opens a bus on ifname, or on fd if ifname is NULL
+static UDSErr_t InitOnOwnBus(UDSTpISOTpC_t *tp, const char *ifname, int fd,
+                             const UDSTpISOTpCConfig_t *cfg) {
+    UDSTpISOTpCBus_t *bus = &tp->own_bus;
+    const UDSTpISOTpCBusConfig_t bus_cfg = {
+        .can_fd = cfg->tx_dl > ISOTP_CAN_DL,
+        .rx_batch_size = cfg->rx_batch_size,
+    };
+    UDSErr_t err = ifname ? UDSTpISOTpCBusInit(bus, ifname, &bus_cfg)
+                          : UDSTpISOTpCBusInitWithFd(bus, fd, &bus_cfg);
+    if (UDS_OK == err) {
+        err = UDSTpISOTpCInitOnBus(tp, bus, cfg);
+    }
+    if (UDS_OK != err) {
+        UDSTpISOTpCBusDeinit(bus);
+        tp->bus = NULL;
+    }
+    return err;
+}
+
+UDSErr_t UDSTpISOTpCInitWithConfig(UDSTpISOTpC_t *tp, const char *ifname,
+                                   const UDSTpISOTpCConfig_t *cfg) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(ifname);
+    UDS_ASSERT(cfg);
+    return InitOnOwnBus(tp, ifname, -1, cfg);
+}
+
+UDSErr_t UDSTpISOTpCInitWithFd(UDSTpISOTpC_t *tp, int fd, const UDSTpISOTpCConfig_t *cfg) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(cfg);
+    return InitOnOwnBus(tp, NULL, fd, cfg);
+}
+
+UDSErr_t UDSTpISOTpCInit(UDSTpISOTpC_t *tp, const char *ifname, uint32_t source_addr,
+                         uint32_t target_addr, uint32_t source_addr_func,
+                         uint32_t target_addr_func) {
+    UDSTpISOTpCConfig_t cfg = {
+        .source_addr = source_addr,
+        .target_addr = target_addr,
+        .source_addr_func = source_addr_func,
+        .target_addr_func = target_addr_func,
+    };
+    return UDSTpISOTpCInitWithConfig(tp, ifname, &cfg);
+}
+
 void UDSTpISOTpCDeinit(UDSTpISOTpC_t *tp) {
     UDS_ASSERT(tp);
-    close(tp->fd);
-    tp->fd = -1;
+    if (NULL == tp->bus) {
+        return;
+    }
+    BusRemove(tp->bus, tp);
+    // queued messages give their pool blocks back
+    for (; tp->rx_count; tp->rx_count--) {
+        const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+        if (m->pool) {
+            isotp_pool_put(m->pool, m->data);
+        }
+        tp->rx_head = (tp->rx_head + 1) % UDS_ISOTP_C_RX_QUEUE_LEN;
+    }
+    if (SocketCANOwnsBus(tp)) {
+        UDSTpISOTpCBusDeinit(tp->bus);
+    }
+    tp->bus = NULL;
 }
 
 #endif
@@ -3228,71 +4325,99 @@ void UDSTpISOTpCDeinit(UDSTpISOTpC_t *tp) {
 #include <sys/types.h>
 #include <unistd.h>
 
+// take the asynchronous error pending on fd, e.g. ECOMM when no flow control frame arrived
+static int TakeSocketError(int fd) {
+    int pending_err = 0;
+    socklen_t len = sizeof(pending_err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &pending_err, &len) || !pending_err) {
+        UDS_LOGE(__FILE__, "POLLERR was set, but no error returned via SO_ERROR?");
+        return 0;
+    }
+    switch (pending_err) {
+    case ECOMM:
+        UDS_LOGE(__FILE__, "ECOMM: Communication error on send");
+        break;
+    default:
+        UDS_LOGE(__FILE__, "Asynchronous socket error: %s (%d)", strerror(pending_err),
+                 pending_err);
+        break;
+    }
+    return pending_err;
+}
+
+// The kernel aborts a transmission with ECOMM (no flow control), EMSGSIZE (FC.OVFLW) or EBADMSG
+// (bad flow control). ETIMEDOUT and EILSEQ end a reception on the same socket.
+static bool IsSendError(int err) { return ECOMM == err || EMSGSIZE == err || EBADMSG == err; }
+
 static UDSTpStatus_t isotp_sock_tp_poll(UDSTp_t *hdl) {
     UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
     UDSTpStatus_t status = 0;
-    int ret = 0;
-    int fds[2] = {impl->phys_fd, impl->func_fd};
     struct pollfd pfds[2] = {0};
     pfds[0].fd = impl->phys_fd;
-    pfds[0].events = POLLERR | POLLOUT;
-    pfds[0].revents = 0;
-
+    pfds[0].events = POLLIN;
     pfds[1].fd = impl->func_fd;
-    pfds[1].events = POLLERR | POLLOUT;
-    pfds[1].revents = 0;
+    pfds[1].events = POLLIN;
 
-    ret = poll(pfds, 2, 1);
+    // The kernel ISO-TP driver suppresses POLLOUT while tx.state != ISOTP_IDLE, so POLLOUT
+    // coming back marks the end of the transmission.
+    // See: https://lore.kernel.org/all/20230331125511.372783-1-michal.sojka@cvut.cz/
+    if (impl->send_in_progress) {
+        pfds[0].events |= POLLOUT;
+    }
+
+    // POLLERR is always reported
+    int ret = poll(pfds, 2, impl->poll_timeout_ms);
     if (ret < 0) {
-        UDS_LOGE(__FILE__, "poll failed: %d", ret);
-        status |= UDS_TP_ERR;
-    } else if (ret == 0) {
-        ; // timeout, no events
-    } else {
-        // poll() returned with events
-        for (int i = 0; i < 2; i++) {
-            struct pollfd pfd = pfds[i];
-
-            // Check for errors
-            if (pfd.revents & POLLERR) {
-                int pending_err = 0;
-                socklen_t len = sizeof(pending_err);
-                if (!getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &pending_err, &len) && pending_err) {
-                    switch (pending_err) {
-                    case ECOMM:
-                        UDS_LOGE(__FILE__, "ECOMM: Communication error on send");
-                        status |= UDS_TP_ERR;
-                        break;
-                    default:
-                        UDS_LOGE(__FILE__, "Asynchronous socket error: %s (%d)",
-                                 strerror(pending_err), pending_err);
-                        status |= UDS_TP_ERR;
-                        break;
-                    }
-                } else {
-                    UDS_LOGE(__FILE__, "POLLERR was set, but no error returned via SO_ERROR?");
-                }
+        if (EINTR != errno) {
+            UDS_LOGE(__FILE__, "poll failed: %d", ret);
+            status |= UDS_TP_ERR;
+        }
+    } else if (ret > 0) {
+        if (pfds[0].revents & POLLERR) {
+            int err = TakeSocketError(impl->phys_fd);
+            if (err) {
+                status |= UDS_TP_ERR;
             }
-
-            // Check if send is in progress on physical socket
-            // Only check the physical socket (not functional) since that's what sends multi-frame
-            if (fds[i] == impl->phys_fd && pfd.revents != 0) {
-                // When POLLOUT is NOT set but other events are present, the socket cannot accept
-                // writes because a multi-frame transmission is in progress.
-                // See: https://lore.kernel.org/all/20230331125511.372783-1-michal.sojka@cvut.cz/
-                // The kernel ISO-TP driver suppresses POLLOUT when tx.state != ISOTP_IDLE
-                if (!(pfd.revents & POLLOUT)) {
-                    status |= UDS_TP_SEND_IN_PROGRESS;
-                }
+            // a failed reception doesn't end the message being sent
+            if (IsSendError(err)) {
+                impl->send_in_progress = false;
             }
         }
+        if ((pfds[1].revents & POLLERR) && TakeSocketError(impl->func_fd)) {
+            status |= UDS_TP_ERR;
+        }
+        if (pfds[0].revents & POLLOUT) {
+            impl->send_in_progress = false;
+        }
+    }
+
+    if (impl->send_in_progress) {
+        status |= UDS_TP_SEND_IN_PROGRESS;
     }
     return status;
 }
 
-static ssize_t tp_recv_once(int fd, uint8_t *buf, size_t size) {
-    ssize_t ret = read(fd, buf, size);
-    if (ret < 0) {
+// read one message and the time the kernel received its last frame
+static ssize_t tp_recv_once(int fd, uint8_t *buf, size_t size, uint64_t *rx_time_ns) {
+    struct iovec iov = {.iov_base = buf, .iov_len = size};
+    uint64_t control[(CMSG_SPACE(sizeof(struct timespec)) + 7) / 8]; // aligned for cmsghdr
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t ret = recvmsg(fd, &msg, 0);
+    if (ret > 0) {
+        *rx_time_ns = 0;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (SOL_SOCKET == c->cmsg_level && SCM_TIMESTAMPNS == c->cmsg_type) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                *rx_time_ns = UDSRealtimeToMonotonicNs(&ts);
+            }
+        }
+    } else if (ret < 0) {
         if (EAGAIN == errno || EWOULDBLOCK == errno) {
             ret = 0;
         } else {
@@ -3312,13 +4437,13 @@ static ssize_t isotp_sock_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UD
     UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
     UDSSDU_t *msg = &impl->recv_info;
 
-    ret = tp_recv_once(impl->phys_fd, buf, bufsize);
+    ret = tp_recv_once(impl->phys_fd, buf, bufsize, &msg->rx_time_ns);
     if (ret > 0) {
         msg->A_TA = impl->phys_sa;
         msg->A_SA = impl->phys_ta;
         msg->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
     } else {
-        ret = tp_recv_once(impl->func_fd, buf, bufsize);
+        ret = tp_recv_once(impl->func_fd, buf, bufsize, &msg->rx_time_ns);
         if (ret > 0) {
             msg->A_TA = impl->func_sa;
             msg->A_SA = impl->func_ta;
@@ -3333,34 +4458,95 @@ static ssize_t isotp_sock_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UD
 
         UDS_LOGD(__FILE__, "'%s' received %ld bytes from 0x%03x (%s), ", impl->tag, ret, msg->A_TA,
                  msg->A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "phys" : "func");
-        UDS_LOG_SDU(__FILE__, impl->recv_buf, ret, msg);
+        UDS_LOG_SDU(__FILE__, buf, ret, msg);
     }
 
     return ret;
 }
 
-static ssize_t isotp_sock_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
+static ssize_t isotp_sock_tp_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
-    ssize_t ret = -1;
+    UDS_ASSERT(buf);
     UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
-    int fd;
-    const UDSTpAddr_t ta_type = info ? info->A_TA_Type : UDS_A_TA_TYPE_PHYSICAL;
 
-    if (UDS_A_TA_TYPE_PHYSICAL == ta_type) {
-        fd = impl->phys_fd;
-    } else if (UDS_A_TA_TYPE_FUNCTIONAL == ta_type) {
-        if (len > 7) {
-            UDS_LOGI(__FILE__, "UDSTpIsoTpSock: functional request too large");
-            return -1;
+    // the kernel reassembles the message, read it once into recv_buf and lend it from there
+    if (0 == impl->recv_len) {
+        ssize_t ret = isotp_sock_tp_recv(hdl, impl->recv_buf, sizeof(impl->recv_buf), NULL);
+        if (ret <= 0) {
+            return ret;
         }
-        fd = impl->func_fd;
-    } else {
+        impl->recv_len = (size_t)ret;
+    }
+    if (info) {
+        *info = impl->recv_info;
+    }
+    *buf = impl->recv_buf;
+    return (ssize_t)impl->recv_len;
+}
+
+static void isotp_sock_tp_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
+    impl->recv_len = 0;
+}
+
+static int isotp_sock_tp_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
+    // while peek() lends recv_buf nothing more is read, so don't wake up for readable sockets
+    int read_events = impl->recv_len ? 0 : UDS_TP_FD_READ;
+    int n = 0;
+    if (n < max_fds) {
+        fds[n].fd = impl->phys_fd;
+        fds[n].events = read_events | (impl->send_in_progress ? UDS_TP_FD_WRITE : 0);
+        n++;
+    }
+    if (n < max_fds) {
+        fds[n].fd = impl->func_fd;
+        fds[n].events = read_events;
+        n++;
+    }
+    return n;
+}
+
+static bool isotp_sock_tp_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    // the kernel runs the ISO-TP timers, completion shows up as socket events
+    (void)hdl;
+    (void)deadline_ms;
+    return false;
+}
+
+// largest functional message, it has to fit into a single frame
+static size_t SingleFrameMax(const UDSTpIsoTpSockOpts_t *opts) {
+    // CAN FD single frames longer than 8 bytes use a two byte PCI
+    return opts->tx_dl > 8 ? opts->tx_dl - 2U : 7U;
+}
+
+static ssize_t isotp_sock_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    ssize_t ret = -1;
+    UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
+    int fd;
+    const UDSTpAddr_t ta_type = info ? info->A_TA_Type : UDS_A_TA_TYPE_PHYSICAL;
+
+    if (UDS_A_TA_TYPE_PHYSICAL == ta_type) {
+        fd = impl->phys_fd;
+    } else if (UDS_A_TA_TYPE_FUNCTIONAL == ta_type) {
+        if (len > SingleFrameMax(&impl->opts)) {
+            UDS_LOGI(__FILE__, "UDSTpIsoTpSock: functional request too large");
+            return -1;
+        }
+        fd = impl->func_fd;
+    } else {
         ret = -4;
         goto done;
     }
     ret = write(fd, buf, len);
     if (ret < 0) {
         perror("write");
+    } else if (fd == impl->phys_fd) {
+        // complete once the kernel reports POLLOUT again, see isotp_sock_tp_poll
+        impl->send_in_progress = true;
     }
 done:;
     int ta = ta_type == UDS_A_TA_TYPE_PHYSICAL ? impl->phys_ta : impl->func_ta;
@@ -3371,7 +4557,28 @@ done:;
     return ret;
 }
 
-static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool functional) {
+static const UDSISOTpFCParams_t DefaultFCParams = {
+    .bs = 0x10,
+    .st_min_us = 3000,
+    .n_bs_us = 1000000,
+    .n_cr_us = 1000000,
+    .wft_max = 0,
+};
+
+// encode STmin for a flow control frame, rounding up
+static uint8_t StMinByte(uint32_t st_min_us) {
+    if (st_min_us == 0) {
+        return 0;
+    }
+    if (st_min_us < 1000) {
+        return (uint8_t)(0xF0 + (st_min_us + 99) / 100);
+    }
+    uint32_t ms = (st_min_us + 999) / 1000;
+    return ms > 0x7F ? 0x7F : (uint8_t)ms;
+}
+
+static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool functional,
+                         const UDSISOTpFCParams_t *fc_params, const UDSTpIsoTpSockOpts_t *ll) {
     int fd = 0;
     if ((fd = socket(AF_CAN, SOCK_DGRAM | SOCK_NONBLOCK, CAN_ISOTP)) < 0) {
         perror("Socket");
@@ -3379,13 +4586,19 @@ static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool
     }
 
     struct can_isotp_fc_options fcopts = {
-        .bs = 0x10,
-        .stmin = 3,
-        .wftmax = 0,
+        .bs = fc_params->bs,
+        .stmin = StMinByte(fc_params->st_min_us),
+        .wftmax = fc_params->wft_max,
     };
     if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fcopts, sizeof(fcopts)) < 0) {
         perror("setsockopt");
-        return -1;
+        goto fail;
+    }
+
+    // timestamp received messages, see tp_recv_once
+    const int enable = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt (SO_TIMESTAMPNS):");
     }
 
     struct can_isotp_options opts;
@@ -3396,18 +4609,44 @@ static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool
         // configure the socket as listen-only to avoid sending FC frames
         opts.flags |= CAN_ISOTP_LISTEN_MODE;
     }
+    opts.frame_txtime = ll->frame_txtime_ns;
+    if (ll->tx_padding) {
+        opts.flags |= CAN_ISOTP_TX_PADDING;
+        opts.txpad_content = ll->tx_pad_content;
+    }
+    if (ll->force_tx_stmin) {
+        opts.flags |= CAN_ISOTP_FORCE_TXSTMIN;
+        uint32_t tx_stmin_ns = ll->tx_stmin_us * 1000U;
+        if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_TX_STMIN, &tx_stmin_ns, sizeof(tx_stmin_ns)) <
+            0) {
+            perror("setsockopt (tx_stmin):");
+            goto fail;
+        }
+    }
 
     if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts)) < 0) {
         perror("setsockopt (isotp_options):");
-        return -1;
+        goto fail;
+    }
+
+    if (ll->tx_dl > 8 || ll->tx_flags) {
+        struct can_isotp_ll_options llopts = {
+            .mtu = CANFD_MTU,
+            .tx_dl = ll->tx_dl ? ll->tx_dl : 8,
+            .tx_flags = ll->tx_flags,
+        };
+        if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_LL_OPTS, &llopts, sizeof(llopts)) < 0) {
+            UDS_LOGE(__FILE__, "setsockopt (ll_options): %s, tx_dl %u", strerror(errno),
+                     llopts.tx_dl);
+            goto fail;
+        }
     }
 
     struct ifreq ifr;
     memset(&ifr, 0, sizeof(ifr));
     if (snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", if_name) >= (int)sizeof(ifr.ifr_name)) {
         UDS_LOGE(__FILE__, "Interface name too long");
-        close(fd);
-        return -1;
+        goto fail;
     }
     ioctl(fd, SIOCGIFINDEX, &ifr);
 
@@ -3420,24 +4659,49 @@ static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool
 
     if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         UDS_LOGI(__FILE__, "Bind: %s %s\n", strerror(errno), if_name);
-        return -1;
+        goto fail;
     }
     return fd;
+fail:
+    close(fd);
+    return -1;
 }
 
-UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t source_addr_func) {
-    UDS_ASSERT(tp);
+// the flow control parameters are copied, opts->fc_params need not outlive init
+static void LinuxSockSetOpts(UDSTpIsoTpSock_t *tp, const UDSTpIsoTpSockOpts_t *opts) {
+    if (opts) {
+        tp->opts = *opts;
+    }
+    tp->fc_params = tp->opts.fc_params ? *tp->opts.fc_params : DefaultFCParams;
+    tp->opts.fc_params = NULL;
+}
+
+static void LinuxSockInitHdl(UDSTpIsoTpSock_t *tp, const UDSTpIsoTpSockOpts_t *opts) {
     memset(tp, 0, sizeof(*tp));
+    LinuxSockSetOpts(tp, opts);
     tp->hdl.send = isotp_sock_tp_send;
     tp->hdl.recv = isotp_sock_tp_recv;
     tp->hdl.poll = isotp_sock_tp_poll;
+    tp->hdl.peek = isotp_sock_tp_peek;
+    tp->hdl.release = isotp_sock_tp_release;
+    tp->hdl.get_fds = isotp_sock_tp_get_fds;
+    tp->hdl.next_deadline = isotp_sock_tp_next_deadline;
+}
+
+UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
+                                  uint32_t target_addr, uint32_t source_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts) {
+    UDS_ASSERT(tp);
+    LinuxSockInitHdl(tp, opts);
     tp->phys_sa = source_addr;
     tp->phys_ta = target_addr;
     tp->func_sa = source_addr_func;
 
-    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false);
-    tp->func_fd = LinuxSockBind(ifname, source_addr_func, 0, true);
+    snprintf(tp->ifname, sizeof(tp->ifname), "%s", ifname);
+
+    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false, &tp->fc_params,
+                               &tp->opts);
+    tp->func_fd = LinuxSockBind(ifname, source_addr_func, 0, true, &tp->fc_params, &tp->opts);
     if (tp->phys_fd < 0 || tp->func_fd < 0) {
         UDS_LOGI(__FILE__, "foo\n");
         (void)fflush(stdout);
@@ -3452,18 +4716,19 @@ UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint
 }
 
 UDSErr_t UDSTpIsoTpSockInitClient(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t target_addr_func) {
+                                  uint32_t target_addr, uint32_t target_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts) {
     UDS_ASSERT(tp);
-    memset(tp, 0, sizeof(*tp));
-    tp->hdl.send = isotp_sock_tp_send;
-    tp->hdl.recv = isotp_sock_tp_recv;
-    tp->hdl.poll = isotp_sock_tp_poll;
+    LinuxSockInitHdl(tp, opts);
     tp->func_ta = target_addr_func;
     tp->phys_ta = target_addr;
     tp->phys_sa = source_addr;
 
-    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false);
-    tp->func_fd = LinuxSockBind(ifname, 0, target_addr_func, true);
+    snprintf(tp->ifname, sizeof(tp->ifname), "%s", ifname);
+
+    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false, &tp->fc_params,
+                               &tp->opts);
+    tp->func_fd = LinuxSockBind(ifname, 0, target_addr_func, true, &tp->fc_params, &tp->opts);
     if (tp->phys_fd < 0 || tp->func_fd < 0) {
         return UDS_FAIL;
     }
@@ -3477,6 +4742,41 @@ UDSErr_t UDSTpIsoTpSockInitClient(UDSTpIsoTpSock_t *tp, const char *ifname, uint
     return UDS_OK;
 }
 
+UDSErr_t UDSTpIsoTpSockInitWithFds(UDSTpIsoTpSock_t *tp, int phys_fd, int func_fd,
+                                   const UDSTpIsoTpSockOpts_t *opts) {
+    UDS_ASSERT(tp);
+    LinuxSockInitHdl(tp, opts);
+    if (phys_fd < 0 || func_fd < 0) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    tp->phys_fd = phys_fd;
+    tp->func_fd = func_fd;
+    UDS_LOGI(__FILE__, "initialized phys link (fd %d) func link (fd %d)", phys_fd, func_fd);
+    return UDS_OK;
+}
+
+UDSErr_t UDSTpIsoTpSockSetFCParams(UDSTpIsoTpSock_t *tp, const UDSISOTpFCParams_t *params) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(params);
+    if (tp->send_in_progress) {
+        return UDS_ERR_BUSY;
+    }
+    if (!tp->ifname[0]) {
+        // sockets from UDSTpIsoTpSockInitWithFds, there is no interface to bind to
+        return UDS_ERR_MISUSE;
+    }
+    // closed first, two sockets bound to the same IDs would both send flow control frames
+    if (close(tp->phys_fd) < 0) {
+        perror("failed to close socket");
+    }
+    tp->phys_fd = LinuxSockBind(tp->ifname, tp->phys_sa, tp->phys_ta, false, params, &tp->opts);
+    if (tp->phys_fd < 0) {
+        return UDS_FAIL;
+    }
+    tp->fc_params = *params;
+    return UDS_OK;
+}
+
 void UDSTpIsoTpSockDeinit(UDSTpIsoTpSock_t *tp) {
     if (tp) {
         if (close(tp->phys_fd) < 0) {
@@ -3502,71 +4802,483 @@ void UDSTpIsoTpSockDeinit(UDSTpIsoTpSock_t *tp) {
 #include <string.h>
 #include <stdlib.h>
 
-#define MAX_NUM_TP 16
-#define NUM_MSGS 8
-static ISOTPMock_t *TPs[MAX_NUM_TP];
+static ISOTPMock_t *TPs[UDS_ISOTP_MOCK_MAX_TPS];
 static unsigned TPCount = 0;
 static FILE *LogFile = NULL;
+
+// receivers by address, several transports may share one, e.g. a functional address
+static struct Route {
+    uint32_t addr;
+    ISOTPMock_t *tp; // NULL if the slot is empty
+} Routes[UDS_ISOTP_MOCK_TABLE_SIZE];
+
+enum MockBusFrame {
+    MOCK_BUS_FIRST = 0, // single frame or first frame
+    MOCK_BUS_FC,        // flow control frame from the receiver
+    MOCK_BUS_CF,        // consecutive frame
+    MOCK_BUS_DONE,
+};
+
+// ring buffer of messages in send order
 static struct Msg {
-    uint8_t buf[UDS_ISOTP_MTU];
+    const uint8_t *buf; // borrowed from the sender until the message is delivered
     size_t len;
     UDSSDU_t info;
-    uint32_t scheduled_tx_time;
+    uint32_t scheduled_tx_time; // without a bus: arrival - 1, on a bus: arrival rounded up
+    uint64_t rx_time_ns;
     ISOTPMock_t *sender;
-} msgs[NUM_MSGS];
+
+    // transfer on the sender's bus
+    uint8_t frame;       // enum MockBusFrame, next frame on the bus
+    size_t sent;         // payload bytes sent
+    uint8_t sn;          // sequence number of the next consecutive frame
+    uint8_t block_left;  // consecutive frames until the next flow control, 0: no limit
+    uint32_t fc_id;      // CAN ID of the receiver's flow control frames
+    uint64_t ready_ns;   // the next frame may start from here on
+} msgs[UDS_ISOTP_MOCK_QUEUE_LEN];
+static unsigned MsgHead = 0;
 static unsigned MsgCount = 0;
+static uint32_t NetworkPass = 0;
+static uint32_t BusScan = 0;
 
-static void NetworkPoll(void) {
-    for (unsigned i = 0; i < MsgCount; i++) {
-        if (UDSTimeAfter(UDSMillis(), msgs[i].scheduled_tx_time)) {
-            bool found = false;
-            for (unsigned j = 0; j < TPCount; j++) {
-                ISOTPMock_t *tp = TPs[j];
-                if (tp->sa_phys == msgs[i].info.A_TA || tp->sa_func == msgs[i].info.A_TA) {
-                    found = true;
-                    if (tp->recv_len > 0) {
-                        UDS_LOGW(__FILE__,
-                                 "TPMock: %s recv buffer is already full. Message dropped",
-                                 tp->name);
-                        continue;
-                    }
+static uint32_t MockRouteSlot(uint32_t addr) {
+    return (addr * 2654435761u) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1);
+}
 
-                    UDS_LOGD(__FILE__,
-                             "%s receives %ld bytes from TA=0x%03X (A_TA_Type=%s):", tp->name,
-                             msgs[i].len, msgs[i].info.A_TA,
-                             msgs[i].info.A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "PHYSICAL"
-                                                                              : "FUNCTIONAL");
-                    UDS_LOG_SDU(__FILE__, msgs[i].buf, msgs[i].len, &(msgs[i].info));
+static void MockRouteAdd(uint32_t addr, ISOTPMock_t *tp) {
+    uint32_t slot = MockRouteSlot(addr);
+    while (Routes[slot].tp) {
+        if (Routes[slot].addr == addr && Routes[slot].tp == tp) {
+            return;
+        }
+        slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1);
+    }
+    Routes[slot].addr = addr;
+    Routes[slot].tp = tp;
+}
 
-                    memmove(tp->recv_buf, msgs[i].buf, msgs[i].len);
-                    tp->recv_len = msgs[i].len;
-                    tp->recv_info = msgs[i].info;
-                }
+static void MockRouteRemove(const ISOTPMock_t *tp) {
+    // linear probing can't simply clear slots, so the remaining entries are inserted again
+    struct Route remaining[UDS_ISOTP_MOCK_TABLE_SIZE];
+    unsigned num_remaining = 0;
+    for (unsigned i = 0; i < UDS_ISOTP_MOCK_TABLE_SIZE; i++) {
+        if (Routes[i].tp && Routes[i].tp != tp) {
+            remaining[num_remaining++] = Routes[i];
+        }
+    }
+    memset(Routes, 0, sizeof(Routes));
+    for (unsigned i = 0; i < num_remaining; i++) {
+        MockRouteAdd(remaining[i].addr, remaining[i].tp);
+    }
+}
+
+// frame lengths above 8 bytes CAN FD can carry, DLC 9 to 15
+static const uint8_t MockBusFDLens[] = {12, 16, 20, 24, 32, 48, 64};
+
+static uint8_t MockBusFDLen(unsigned len) {
+    if (len <= 8) {
+        return (uint8_t)len;
+    }
+    for (unsigned i = 0; i < sizeof(MockBusFDLens); i++) {
+        if (MockBusFDLens[i] >= len) {
+            return MockBusFDLens[i];
+        }
+    }
+    return 64;
+}
+
+static uint8_t MockBusDLC(unsigned len) {
+    for (uint8_t i = 0; i < sizeof(MockBusFDLens); i++) {
+        if (MockBusFDLens[i] == len) {
+            return 9 + i;
+        }
+    }
+    return (uint8_t)len;
+}
+
+static uint8_t MockBusStMinByte(uint32_t st_min_us) {
+    if (st_min_us > 0 && st_min_us <= 900) {
+        return (uint8_t)(0xF0 + (st_min_us + 99) / 100);
+    }
+    const uint32_t ms = (st_min_us + 999) / 1000;
+    return ms > 0x7F ? 0x7F : (uint8_t)ms;
+}
+
+// bits of a frame in the arbitration and data phases, with stuff bits
+struct MockBusBits {
+    uint32_t nominal;
+    uint32_t data;
+    bool data_phase;
+    uint8_t last;
+    uint8_t run;
+    bool crc_on;
+    uint16_t crc; // CRC-15 of classic frames
+};
+
+static void MockBusCount(struct MockBusBits *b, uint32_t n) {
+    if (b->data_phase) {
+        b->data += n;
+    } else {
+        b->nominal += n;
+    }
+}
+
+// a bit in the dynamically stuffed part of the frame
+static void MockBusBit(struct MockBusBits *b, uint8_t bit) {
+    if (b->crc_on) {
+        const bool crc_nxt = bit ^ ((b->crc >> 14) & 1U);
+        b->crc = (uint16_t)((b->crc << 1) & 0x7FFF);
+        if (crc_nxt) {
+            b->crc ^= 0x4599;
+        }
+    }
+    MockBusCount(b, 1);
+    if (b->run > 0 && bit == b->last) {
+        b->run++;
+    } else {
+        b->last = bit;
+        b->run = 1;
+    }
+    if (5 == b->run) {
+        // the stuff bit has the opposite level and starts the next run
+        MockBusCount(b, 1);
+        b->last = !bit;
+        b->run = 1;
+    }
+}
+
+static void MockBusBits(struct MockBusBits *b, uint32_t value, unsigned n) {
+    while (n-- > 0) {
+        MockBusBit(b, (value >> n) & 1U);
+    }
+}
+
+// time a frame takes the bus, ISO 11898-1 frame formats including the interframe space
+static uint64_t MockBusFrameNs(const ISOTPMockBus_t *bus, uint32_t id, const uint8_t *data,
+                               unsigned len) {
+    const bool fd = bus->cfg.tx_dl > 8;
+    const bool brs = fd && bus->cfg.data_bitrate > 0;
+    const bool ext = id > 0x7FF;
+    struct MockBusBits b = {0};
+    b.crc_on = !fd;
+
+    MockBusBit(&b, 0); // SOF
+    if (ext) {
+        MockBusBits(&b, id >> 18, 11);
+        MockBusBits(&b, 3, 2); // SRR, IDE
+        MockBusBits(&b, id & 0x3FFFF, 18);
+    } else {
+        MockBusBits(&b, id, 11);
+    }
+    if (fd) {
+        MockBusBit(&b, 0); // RRS
+        if (!ext) {
+            MockBusBit(&b, 0); // IDE
+        }
+        MockBusBits(&b, 2, 2); // FDF, res
+        MockBusBit(&b, brs);
+        b.data_phase = brs;
+        MockBusBit(&b, 0); // ESI
+    } else {
+        MockBusBits(&b, 0, 3); // RTR, IDE or r1, r0
+    }
+    MockBusBits(&b, MockBusDLC(len), 4);
+    for (unsigned i = 0; i < len; i++) {
+        MockBusBits(&b, data[i], 8);
+    }
+    if (fd) {
+        // stuff count and CRC, a fixed stuff bit before them and after every fourth bit
+        const uint32_t crc_len = len > 16 ? 21 : 17;
+        const uint32_t fixed_stuff_bits = 1 + (4 + crc_len) / 4;
+        MockBusCount(&b, 4 + crc_len + fixed_stuff_bits + 1); // + CRC delimiter
+    } else {
+        b.crc_on = false;
+        MockBusBits(&b, b.crc, 15);
+        MockBusCount(&b, 1); // CRC delimiter
+    }
+    b.data_phase = false;
+    MockBusCount(&b, 1 + 1 + 7 + 3); // ACK, ACK delimiter, EOF, intermission
+
+    uint64_t ns = (uint64_t)b.nominal * 1000000000ULL / bus->cfg.bitrate;
+    if (b.data) {
+        ns += (uint64_t)b.data * 1000000000ULL / bus->cfg.data_bitrate;
+    }
+    return ns;
+}
+
+static unsigned MockBusTxDl(const ISOTPMockBus_t *bus) {
+    return bus->cfg.tx_dl > 8 ? bus->cfg.tx_dl : 8;
+}
+
+static bool MockBusIsSingleFrame(const ISOTPMockBus_t *bus, size_t len) {
+    return len <= 7 || (MockBusTxDl(bus) > 8 && len <= MockBusTxDl(bus) - 2);
+}
+
+// payload bytes the next frame of m carries
+static size_t MockBusChunk(const ISOTPMockBus_t *bus, const struct Msg *m) {
+    const size_t tx_dl = MockBusTxDl(bus);
+    switch (m->frame) {
+    case MOCK_BUS_FIRST:
+        if (MockBusIsSingleFrame(bus, m->len)) {
+            return m->len;
+        }
+        return m->len > 4095 ? tx_dl - 6 : tx_dl - 2;
+    case MOCK_BUS_CF:
+        return m->len - m->sent < tx_dl - 1 ? m->len - m->sent : tx_dl - 1;
+    default:
+        return 0;
+    }
+}
+
+// the next frame of m on the bus, returns its length
+static unsigned MockBusNextFrame(const ISOTPMockBus_t *bus, const struct Msg *m, uint32_t *id,
+                                 uint8_t *data) {
+    const size_t chunk = MockBusChunk(bus, m);
+    unsigned n = 0;
+    *id = m->info.A_TA;
+    switch (m->frame) {
+    case MOCK_BUS_FIRST:
+        if (MockBusIsSingleFrame(bus, m->len) && m->len <= 7) {
+            data[n++] = (uint8_t)m->len;
+        } else if (MockBusIsSingleFrame(bus, m->len)) {
+            data[n++] = 0x00;
+            data[n++] = (uint8_t)m->len;
+        } else if (m->len <= 4095) {
+            data[n++] = (uint8_t)(0x10 | ((m->len >> 8) & 0x0F));
+            data[n++] = (uint8_t)m->len;
+        } else {
+            data[n++] = 0x10;
+            data[n++] = 0x00;
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                data[n++] = (uint8_t)(m->len >> shift);
             }
+        }
+        memmove(&data[n], m->buf, chunk);
+        n += chunk;
+        break;
+    case MOCK_BUS_FC:
+        *id = m->fc_id;
+        data[n++] = 0x30;
+        data[n++] = bus->cfg.fc.bs;
+        data[n++] = MockBusStMinByte(bus->cfg.fc.st_min_us);
+        break;
+    case MOCK_BUS_CF:
+        data[n++] = (uint8_t)(0x20 | m->sn);
+        memmove(&data[n], m->buf + m->sent, chunk);
+        n += chunk;
+        break;
+    default:
+        break;
+    }
+
+    unsigned len = bus->cfg.tx_padding ? MockBusTxDl(bus) : n;
+    if (bus->cfg.tx_dl > 8) {
+        len = MockBusFDLen(len);
+    }
+    memset(&data[n], 0xCC, len - n);
+    return len;
+}
+
+// send the next frame of m, it ends at end_ns
+static void MockBusSent(const ISOTPMockBus_t *bus, struct Msg *m, uint64_t end_ns) {
+    m->ready_ns = end_ns;
+    switch (m->frame) {
+    case MOCK_BUS_FIRST:
+        if (MockBusIsSingleFrame(bus, m->len) || 0 == m->fc_id) {
+            // nobody answers a first frame without a receiver, the message is lost
+            m->frame = MOCK_BUS_DONE;
+        } else {
+            m->sent = MockBusChunk(bus, m);
+            m->sn = 1;
+            m->frame = MOCK_BUS_FC;
+        }
+        break;
+    case MOCK_BUS_FC:
+        m->block_left = bus->cfg.fc.bs;
+        m->frame = MOCK_BUS_CF;
+        break;
+    case MOCK_BUS_CF:
+        m->sent += MockBusChunk(bus, m);
+        m->sn = (m->sn + 1) & 0x0F;
+        if (m->sent >= m->len) {
+            m->frame = MOCK_BUS_DONE;
+        } else if (m->block_left > 0 && 0 == --m->block_left) {
+            m->frame = MOCK_BUS_FC;
+        } else {
+            m->ready_ns = end_ns + (uint64_t)bus->cfg.fc.st_min_us * 1000U;
+        }
+        break;
+    default:
+        break;
+    }
+    if (MOCK_BUS_DONE == m->frame) {
+        const uint64_t done_ms = (end_ns + 999999U) / 1000000U;
+        m->scheduled_tx_time = bus->origin_ms + (uint32_t)done_ms;
+        m->rx_time_ns = (uint64_t)bus->origin_ms * 1000000U + end_ns;
+    }
+}
 
-            if (!found) {
-                UDS_LOGW(__FILE__, "TPMock: no matching receiver for message");
+// send the frames that start on the bus before now_ns
+static void MockBusRun(ISOTPMockBus_t *bus, uint64_t now_ns) {
+    for (;;) {
+        // the oldest unfinished message of every sender on the bus competes
+        struct Msg *contenders[UDS_ISOTP_MOCK_QUEUE_LEN];
+        unsigned num_contenders = 0;
+        uint64_t start_ns = UINT64_MAX;
+        BusScan++;
+        for (unsigned i = 0; i < MsgCount; i++) {
+            struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+            if (m->sender->bus != bus || MOCK_BUS_DONE == m->frame ||
+                m->sender->bus_scan == BusScan) {
+                continue;
+            }
+            m->sender->bus_scan = BusScan;
+            contenders[num_contenders++] = m;
+            const uint64_t t = m->ready_ns > bus->free_ns ? m->ready_ns : bus->free_ns;
+            if (t < start_ns) {
+                start_ns = t;
             }
+        }
+        if (0 == num_contenders || start_ns >= now_ns) {
+            // a frame sent from now on may still win arbitration
+            return;
+        }
 
-            for (unsigned j = i + 1; j < MsgCount; j++) {
-                msgs[j - 1] = msgs[j];
+        // the lowest ID among the frames ready at start_ns wins arbitration
+        struct Msg *winner = NULL;
+        uint32_t winner_id = 0;
+        unsigned winner_len = 0;
+        uint8_t winner_data[64];
+        for (unsigned i = 0; i < num_contenders; i++) {
+            if (contenders[i]->ready_ns > start_ns) {
+                continue;
+            }
+            uint32_t id = 0;
+            uint8_t data[64];
+            const unsigned len = MockBusNextFrame(bus, contenders[i], &id, data);
+            if (NULL == winner || id < winner_id) {
+                winner = contenders[i];
+                winner_id = id;
+                winner_len = len;
+                memmove(winner_data, data, len);
             }
-            MsgCount--;
-            i--;
+        }
+        const uint64_t end_ns = start_ns + MockBusFrameNs(bus, winner_id, winner_data, winner_len);
+        bus->free_ns = end_ns;
+        bus->busy_ns += end_ns - start_ns;
+        bus->num_frames++;
+        MockBusSent(bus, winner, end_ns);
+    }
+}
+
+static uint64_t MockBusNow(const ISOTPMockBus_t *bus) {
+    return (uint64_t)(uint32_t)(UDSMillis() - bus->origin_ms) * 1000000U;
+}
+
+// delivery is due: the message arrived on a bus, or the scheduled millisecond passed
+static bool MockDue(const struct Msg *m, uint32_t now) {
+    if (m->sender->bus) {
+        return MOCK_BUS_DONE == m->frame && !UDSTimeAfter(m->scheduled_tx_time, now);
+    }
+    return UDSTimeAfter(now, m->scheduled_tx_time);
+}
+
+// a receiver that holds back an older message takes no newer ones in this pass
+static bool MockRxFull(const ISOTPMock_t *tp) {
+    return tp->rx_count == UDS_ISOTP_MOCK_RX_FIFO_LEN || tp->blocked_pass == NetworkPass;
+}
+
+// copy m into the rx_fifo of every receiver. A message to a single receiver waits while its
+// rx_fifo is full, receivers sharing the address each get it unless their rx_fifo is full.
+static bool MockDeliver(struct Msg *m) {
+    const uint32_t addr = m->info.A_TA;
+    unsigned num_receivers = 0;
+    ISOTPMock_t *receiver = NULL;
+    for (uint32_t slot = MockRouteSlot(addr); Routes[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) {
+        if (Routes[slot].addr == addr) {
+            receiver = Routes[slot].tp;
+            num_receivers++;
+        }
+    }
+    if (0 == num_receivers) {
+        UDS_LOGW(__FILE__, "TPMock: no matching receiver for message");
+        return true;
+    }
+    if (1 == num_receivers && MockRxFull(receiver)) {
+        receiver->blocked_pass = NetworkPass;
+        return false;
+    }
+
+    for (uint32_t slot = MockRouteSlot(addr); Routes[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) {
+        ISOTPMock_t *tp = Routes[slot].tp;
+        if (Routes[slot].addr != addr) {
+            continue;
+        }
+        // one receiver that isn't read doesn't hold up the others
+        if (MockRxFull(tp)) {
+            UDS_LOGW(__FILE__, "%s: rx_fifo full, dropping message to TA=0x%03X", tp->name, addr);
+            tp->rx_dropped++;
+            continue;
+        }
+
+        UDS_LOGD(__FILE__, "%s receives %ld bytes from TA=0x%03X (A_TA_Type=%s):", tp->name,
+                 m->len, m->info.A_TA,
+                 m->info.A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "PHYSICAL" : "FUNCTIONAL");
+        UDS_LOG_SDU(__FILE__, m->buf, m->len, &(m->info));
+
+        ISOTPMockRxMsg_t *rx =
+            &tp->rx_fifo[(tp->rx_head + tp->rx_count) % UDS_ISOTP_MOCK_RX_FIFO_LEN];
+        memmove(rx->buf, m->buf, m->len);
+        rx->len = m->len;
+        rx->info = m->info;
+        // the simulated arrival, not the time it was polled
+        rx->info.rx_time_ns = m->rx_time_ns;
+        tp->rx_count++;
+    }
+    return true;
+}
+
+// deliver the messages that are due, linear in the number of queued messages and receivers
+static void NetworkPoll(void) {
+    if (0 == MsgCount) {
+        return;
+    }
+    const uint32_t now = UDSMillis();
+    const unsigned count = MsgCount;
+    unsigned kept = 0;
+    NetworkPass++;
+    for (unsigned i = 0; i < count; i++) {
+        ISOTPMockBus_t *bus = msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN].sender->bus;
+        if (bus && bus->pass != NetworkPass) {
+            bus->pass = NetworkPass;
+            MockBusRun(bus, MockBusNow(bus));
+        }
+    }
+    for (unsigned i = 0; i < count; i++) {
+        struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+        if (MockDue(m, now) && MockDeliver(m)) {
+            m->sender->tx_pending--;
+        } else {
+            msgs[(MsgHead + kept) % UDS_ISOTP_MOCK_QUEUE_LEN] = *m;
+            kept++;
         }
     }
+    MsgCount = kept;
 }
 
 static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ISOTPMock_t *tp = (ISOTPMock_t *)hdl;
-    if (MsgCount >= NUM_MSGS) {
+    if (MsgCount >= UDS_ISOTP_MOCK_QUEUE_LEN) {
         UDS_LOGW(__FILE__, "mock_tp_send: too many messages in the queue");
         return -1;
     }
-    struct Msg *m = &msgs[MsgCount++];
+    struct Msg *m = &msgs[(MsgHead + MsgCount) % UDS_ISOTP_MOCK_QUEUE_LEN];
     UDSTpAddr_t ta_type =
         info == NULL ? (UDSTpAddr_t)UDS_A_TA_TYPE_PHYSICAL : (UDSTpAddr_t)info->A_TA_Type;
+    memset(&m->info, 0, sizeof(m->info));
     m->len = len;
     m->info.A_AE = info == NULL ? 0 : info->A_AE;
     if (UDS_A_TA_TYPE_PHYSICAL == ta_type) {
@@ -3574,10 +5286,8 @@ static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_
         m->info.A_SA = tp->sa_phys;
     } else if (UDS_A_TA_TYPE_FUNCTIONAL == ta_type) {
 
-        // This condition is only true for standard CAN.
-        // Technically CAN-FD may also be used in ISO-TP.
-        // TODO: add profiles to isotp_mock
-        if (len > 7) {
+        // functional requests are single frames, CAN FD ones only on a bus configured for it
+        if (tp->bus ? !MockBusIsSingleFrame(tp->bus, len) : len > 7) {
             UDS_LOGW(__FILE__, "mock_tp_send: functional message too long: %ld", len);
             return -1;
         }
@@ -3589,7 +5299,27 @@ static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_
     }
     m->info.A_TA_Type = ta_type;
     m->scheduled_tx_time = UDSMillis() + tp->send_tx_delay_ms;
-    memmove(m->buf, buf, len);
+    // NetworkPoll delivers in the millisecond after the scheduled time, MockBusSent stamps bus ones
+    m->rx_time_ns = (uint64_t)(m->scheduled_tx_time + 1) * 1000000U;
+    m->buf = buf;
+    m->sender = tp;
+    m->frame = MOCK_BUS_FIRST;
+    m->sent = 0;
+    m->fc_id = 0;
+    if (tp->bus) {
+        m->ready_ns = MockBusNow(tp->bus);
+        // the receiver answers first frames with flow control
+        for (uint32_t slot = MockRouteSlot(m->info.A_TA); Routes[slot].tp;
+             slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) {
+            if (UDS_A_TA_TYPE_PHYSICAL == ta_type && Routes[slot].addr == m->info.A_TA &&
+                Routes[slot].tp->sa_phys == m->info.A_TA) {
+                m->fc_id = Routes[slot].tp->ta_phys;
+                break;
+            }
+        }
+    }
+    MsgCount++;
+    tp->tx_pending++;
 
     UDS_LOGD(__FILE__, "%s sends %ld bytes to TA=0x%03X (A_TA_Type=%s):", tp->name, len,
              m->info.A_TA, m->info.A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "PHYSICAL" : "FUNCTIONAL");
@@ -3598,52 +5328,131 @@ static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_
     return len;
 }
 
+static void MockRxPop(ISOTPMock_t *tp) {
+    if (tp->rx_count > 0) {
+        tp->rx_head = (tp->rx_head + 1) % UDS_ISOTP_MOCK_RX_FIFO_LEN;
+        tp->rx_count--;
+        // a message may have been waiting for the room
+        NetworkPoll();
+    }
+}
+
 static ssize_t mock_tp_recv(struct UDSTp *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ISOTPMock_t *tp = (ISOTPMock_t *)hdl;
-    if (tp->recv_len == 0) {
+    if (tp->rx_count == 0) {
         return 0;
     }
-    if (bufsize < tp->recv_len) {
-        UDS_LOGW(__FILE__, "mock_tp_recv: buffer too small: %ld < %ld", bufsize, tp->recv_len);
+    const ISOTPMockRxMsg_t *rx = &tp->rx_fifo[tp->rx_head];
+    if (bufsize < rx->len) {
+        UDS_LOGW(__FILE__, "mock_tp_recv: buffer too small: %ld < %ld", bufsize, rx->len);
         return -1;
     }
-    ssize_t len = (ssize_t)tp->recv_len;
-    memmove(buf, tp->recv_buf, tp->recv_len);
+    ssize_t len = (ssize_t)rx->len;
+    memmove(buf, rx->buf, rx->len);
     if (info) {
-        *info = tp->recv_info;
+        *info = rx->info;
     }
-    tp->recv_len = 0;
+    MockRxPop(tp);
     return len;
 }
 
+static ssize_t mock_tp_peek(struct UDSTp *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    ISOTPMock_t *tp = (ISOTPMock_t *)hdl;
+    if (tp->rx_count == 0) {
+        return 0;
+    }
+    ISOTPMockRxMsg_t *rx = &tp->rx_fifo[tp->rx_head];
+    *buf = rx->buf;
+    if (info) {
+        *info = rx->info;
+    }
+    return (ssize_t)rx->len;
+}
+
+static void mock_tp_release(struct UDSTp *hdl) {
+    UDS_ASSERT(hdl);
+    MockRxPop((ISOTPMock_t *)hdl);
+}
+
 static UDSTpStatus_t mock_tp_poll(struct UDSTp *hdl) {
-    (void)hdl; // unused parameter
     NetworkPoll();
-    // todo: make this status reflect TX time
+    // the sender's buffer is in use until the message is delivered
+    if (((ISOTPMock_t *)hdl)->tx_pending) {
+        return UDS_TP_SEND_IN_PROGRESS;
+    }
     return UDS_TP_IDLE;
 }
 
+static bool mock_tp_next_deadline(struct UDSTp *hdl, uint32_t *deadline_ms) {
+    (void)hdl;
+    // the mock has no file descriptors, every tp on the network is woken by its next delivery
+    NetworkPoll();
+    const uint32_t now = UDSMillis();
+    bool pending = false;
+    for (unsigned i = 0; i < MsgCount; i++) {
+        const struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+        uint32_t t = 0;
+        if (m->sender->bus && MOCK_BUS_DONE != m->frame) {
+            // the bus is simulated millisecond by millisecond
+            t = now + 1;
+        } else if (MockDue(m, now)) {
+            // due, but waiting until the receiver reads its rx_fifo
+            continue;
+        } else {
+            // NetworkPoll delivers once UDSMillis() reaches the arrival on a bus, otherwise once
+            // it is after the scheduled time
+            t = m->sender->bus ? m->scheduled_tx_time : m->scheduled_tx_time + 1;
+        }
+        if (!pending || UDSTimeAfter(*deadline_ms, t)) {
+            *deadline_ms = t;
+        }
+        pending = true;
+    }
+    return pending;
+}
+
 static_assert(offsetof(ISOTPMock_t, hdl) == 0, "ISOTPMock_t must not have any members before hdl");
 
 static void ISOTPMockAttach(ISOTPMock_t *tp, ISOTPMockArgs_t *args) {
     UDS_ASSERT(tp);
     UDS_ASSERT(args);
-    UDS_ASSERT(TPCount < MAX_NUM_TP);
+    UDS_ASSERT(TPCount < UDS_ISOTP_MOCK_MAX_TPS);
     TPs[TPCount++] = tp;
     tp->hdl.send = mock_tp_send;
     tp->hdl.recv = mock_tp_recv;
     tp->hdl.poll = mock_tp_poll;
+    tp->hdl.peek = mock_tp_peek;
+    tp->hdl.release = mock_tp_release;
+    tp->hdl.next_deadline = mock_tp_next_deadline;
     tp->sa_func = args->sa_func;
     tp->sa_phys = args->sa_phys;
     tp->ta_func = args->ta_func;
     tp->ta_phys = args->ta_phys;
-    tp->recv_len = 0;
+    tp->rx_head = 0;
+    tp->rx_count = 0;
+    tp->tx_pending = 0;
+    tp->bus_scan = 0;
+    tp->bus = args->bus;
+    MockRouteAdd(tp->sa_phys, tp);
+    MockRouteAdd(tp->sa_func, tp);
     UDS_LOGV(__FILE__, "attached %s. TPCount: %d", tp->name, TPCount);
 }
 
 static void ISOTPMockDetach(ISOTPMock_t *tp) {
     UDS_ASSERT(tp);
+    // drop undelivered messages, their buffers go away with the sender
+    unsigned kept = 0;
+    for (unsigned i = 0; i < MsgCount; i++) {
+        const struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+        if (m->sender != tp) {
+            msgs[(MsgHead + kept) % UDS_ISOTP_MOCK_QUEUE_LEN] = *m;
+            kept++;
+        }
+    }
+    MsgCount = kept;
+    MockRouteRemove(tp);
     for (unsigned i = 0; i < TPCount; i++) {
         if (TPs[i] == tp) {
             for (unsigned j = i + 1; j < TPCount; j++) {
@@ -3658,7 +5467,7 @@ static void ISOTPMockDetach(ISOTPMock_t *tp) {
 }
 
 UDSTp_t *ISOTPMockNew(const char *name, ISOTPMockArgs_t *args) {
-    if (TPCount >= MAX_NUM_TP) {
+    if (TPCount >= UDS_ISOTP_MOCK_MAX_TPS) {
         UDS_LOGI(__FILE__, "TPCount: %d, too many TPs\n", TPCount);
         return NULL;
     }
@@ -3686,32 +5495,1774 @@ void ISOTPMockLogToFile(const char *filename) {
         (void)fprintf(stderr, "Filename is NULL\n");
         return;
     }
-    // create file
-    LogFile = fopen(filename, "w");
-    if (!LogFile) {
-        (void)fprintf(stderr, "Failed to open log file %s\n", filename);
-        return;
+    // create file
+    LogFile = fopen(filename, "w");
+    if (!LogFile) {
+        (void)fprintf(stderr, "Failed to open log file %s\n", filename);
+        return;
+    }
+}
+
+void ISOTPMockLogToStdout(void) {
+    if (LogFile) {
+        return;
+    }
+    LogFile = stdout;
+}
+
+void ISOTPMockReset(void) {
+    memset(TPs, 0, sizeof(TPs));
+    TPCount = 0;
+    memset(Routes, 0, sizeof(Routes));
+    memset(msgs, 0, sizeof(msgs));
+    MsgHead = 0;
+    MsgCount = 0;
+}
+
+void ISOTPMockBusInit(ISOTPMockBus_t *bus, const ISOTPMockBusConfig_t *cfg) {
+    UDS_ASSERT(bus);
+    UDS_ASSERT(cfg);
+    UDS_ASSERT(cfg->bitrate > 0);
+    memset(bus, 0, sizeof(*bus));
+    bus->cfg = *cfg;
+    bus->origin_ms = UDSMillis();
+}
+
+void ISOTPMockFree(UDSTp_t *tp) {
+    ISOTPMock_t *tpm = (ISOTPMock_t *)tp;
+    ISOTPMockDetach(tpm);
+    free(tp);
+}
+
+#endif
+
+
+#ifdef UDS_LINES
+#line 1 "src/tp/doip.c"
+#endif
+#if defined(UDS_TP_DOIP)
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// ISO 13400-2:2012 Table 17 payload types
+enum {
+    DOIP_GENERIC_NACK = 0x0000,
+    DOIP_VEHICLE_ID_REQ = 0x0001,
+    DOIP_VEHICLE_ID_REQ_EID = 0x0002,
+    DOIP_VEHICLE_ID_REQ_VIN = 0x0003,
+    DOIP_VEHICLE_ANNOUNCEMENT = 0x0004,
+    DOIP_ROUTING_ACTIVATION_REQ = 0x0005,
+    DOIP_ROUTING_ACTIVATION_RES = 0x0006,
+    DOIP_ALIVE_CHECK_REQ = 0x0007,
+    DOIP_ALIVE_CHECK_RES = 0x0008,
+    DOIP_ENTITY_STATUS_REQ = 0x4001,
+    DOIP_ENTITY_STATUS_RES = 0x4002,
+    DOIP_POWER_MODE_REQ = 0x4003,
+    DOIP_POWER_MODE_RES = 0x4004,
+    DOIP_DIAG_MSG = 0x8001,
+    DOIP_DIAG_ACK = 0x8002,
+    DOIP_DIAG_NACK = 0x8003,
+};
+
+// ISO 13400-2:2012 Table 19 generic header NACK codes
+enum {
+    DOIP_NACK_INCORRECT_PATTERN = 0x00,
+    DOIP_NACK_UNKNOWN_PAYLOAD_TYPE = 0x01,
+    DOIP_NACK_MESSAGE_TOO_LARGE = 0x02,
+    DOIP_NACK_INVALID_PAYLOAD_LENGTH = 0x04,
+};
+
+// ISO 13400-2:2012 Table 25 routing activation response codes
+enum {
+    DOIP_RA_SA_DIFFERENT = 0x02,
+    DOIP_RA_SA_IN_USE = 0x03,
+    DOIP_RA_UNSUPPORTED_TYPE = 0x06,
+    DOIP_RA_SUCCESS = 0x10,
+    DOIP_RA_CONFIRMATION_PENDING = 0x11,
+};
+
+// ISO 13400-2:2012 Table 28 diagnostic message NACK codes
+enum {
+    DOIP_DIAG_NACK_INVALID_SA = 0x02,
+    DOIP_DIAG_NACK_UNKNOWN_TA = 0x03,
+    DOIP_DIAG_NACK_TOO_LARGE = 0x04,
+};
+
+#define DOIP_HEADER_LEN (8)
+#define DOIP_DIAG_ADDR_LEN (4) // SA and TA in front of the diagnostic user data
+#define DOIP_VEHICLE_ID_RES_LEN (32)
+
+enum {
+    DOIP_RX_HEADER = 0,
+    DOIP_RX_PAYLOAD,   // control message payload into rx_ctrl
+    DOIP_RX_DIAG_ADDR, // SA and TA of a diagnostic message into rx_ctrl
+    DOIP_RX_DIAG_HOLD, // waiting for DoIPConnAcceptDiag or DoIPConnDiscard
+    DOIP_RX_DIAG_DATA, // user data into rx_dst
+    DOIP_RX_DISCARD,
+};
+
+// results of DoIPConnRead
+enum {
+    DOIP_CONN_CLOSED = -1,
+    DOIP_CONN_NONE = 0,   // no complete message
+    DOIP_CONN_MSG,        // a control message is in rx_ctrl
+    DOIP_CONN_DIAG_START, // SA and TA of a diagnostic message are in rx_ctrl
+    DOIP_CONN_DIAG,       // a diagnostic message was read into rx_dst
+};
+
+static uint16_t DoIPGetBE16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+
+static uint32_t DoIPGetBE32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void DoIPPutBE16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void DoIPPutBE32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void DoIPPutHeader(uint8_t *p, uint16_t type, uint32_t len) {
+    p[0] = UDS_DOIP_PROTOCOL_VERSION;
+    p[1] = (uint8_t)~UDS_DOIP_PROTOCOL_VERSION;
+    DoIPPutBE16(p + 2, type);
+    DoIPPutBE32(p + 4, len);
+}
+
+// ISO 13400-2:2012 Figure 7: version 0xFF is only allowed in vehicle identification requests,
+// which are sent over UDP
+static bool DoIPHeaderValid(const uint8_t *hdr, bool udp) {
+    if ((uint8_t)(hdr[0] ^ hdr[1]) != 0xFF) {
+        return false;
+    }
+    return (hdr[0] >= 0x01 && hdr[0] <= 0x03) || (hdr[0] == 0xFF && udp);
+}
+
+// payload lengths from ISO 13400-2:2012 Table 17 and the message definitions
+static bool DoIPPayloadLenValid(uint16_t type, uint32_t len) {
+    switch (type) {
+    case DOIP_GENERIC_NACK:
+        return len == 1;
+    case DOIP_VEHICLE_ID_REQ:
+    case DOIP_ALIVE_CHECK_REQ:
+    case DOIP_ENTITY_STATUS_REQ:
+    case DOIP_POWER_MODE_REQ:
+        return len == 0;
+    case DOIP_VEHICLE_ID_REQ_EID:
+        return len == 6;
+    case DOIP_VEHICLE_ID_REQ_VIN:
+        return len == 17;
+    case DOIP_VEHICLE_ANNOUNCEMENT:
+        return len == 32 || len == 33;
+    case DOIP_ROUTING_ACTIVATION_REQ:
+        return len == 7 || len == 11;
+    case DOIP_ROUTING_ACTIVATION_RES:
+        return len == 9 || len == 13;
+    case DOIP_ALIVE_CHECK_RES:
+        return len == 2;
+    case DOIP_ENTITY_STATUS_RES:
+        return len == 3 || len == 7;
+    case DOIP_POWER_MODE_RES:
+        return len == 1;
+    case DOIP_DIAG_MSG:
+        return len > DOIP_DIAG_ADDR_LEN;
+    case DOIP_DIAG_ACK:
+    case DOIP_DIAG_NACK:
+        return len >= DOIP_DIAG_ADDR_LEN + 1;
+    default:
+        return true;
+    }
+}
+
+static int DoIPSetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Nagle's algorithm would hold a response until the ACK of the previous segment arrives
+static int DoIPSetupStream(int fd) {
+    int one = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        return -1;
+    }
+    return DoIPSetNonBlocking(fd);
+}
+
+static int DoIPResolve(const char *host, uint16_t port, int socktype, struct sockaddr_storage *addr,
+                       socklen_t *addr_len) {
+    struct addrinfo hints = {0};
+    struct addrinfo *res = NULL;
+    char port_str[8];
+    (void)snprintf(port_str, sizeof(port_str), "%u", port);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = AI_NUMERICSERV;
+    int err = getaddrinfo(host, port_str, &hints, &res);
+    if (err != 0 || NULL == res) {
+        UDS_LOGE(__FILE__, "DoIP: cannot resolve %s: %s", host, gai_strerror(err));
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void DoIPConnInit(UDSTpDoIPConn_t *c, int fd) {
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+}
+
+static void DoIPConnClose(UDSTpDoIPConn_t *c) {
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    DoIPConnInit(c, -1);
+}
+
+static bool DoIPConnTxPending(const UDSTpDoIPConn_t *c) {
+    return c->tx_ctrl_pos < c->tx_ctrl_len || c->tx_diag_data != NULL;
+}
+
+static bool DoIPConnQueue(UDSTpDoIPConn_t *c, uint16_t type, const uint8_t *payload, size_t len) {
+    if (c->tx_ctrl_len + DOIP_HEADER_LEN + len > sizeof(c->tx_ctrl)) {
+        UDS_LOGW(__FILE__, "DoIP: control queue full, dropping payload type 0x%04X", type);
+        return false;
+    }
+    uint8_t *p = &c->tx_ctrl[c->tx_ctrl_len];
+    DoIPPutHeader(p, type, (uint32_t)len);
+    if (len) {
+        memcpy(p + DOIP_HEADER_LEN, payload, len);
+    }
+    c->tx_ctrl_len += DOIP_HEADER_LEN + len;
+    return true;
+}
+
+static void DoIPConnQueueGenericNack(UDSTpDoIPConn_t *c, uint8_t code) {
+    (void)DoIPConnQueue(c, DOIP_GENERIC_NACK, &code, 1);
+}
+
+static void DoIPConnQueueDiagAck(UDSTpDoIPConn_t *c, uint16_t type, uint16_t sa, uint16_t ta,
+                                 uint8_t code) {
+    uint8_t payload[5];
+    DoIPPutBE16(payload, sa);
+    DoIPPutBE16(payload + 2, ta);
+    payload[4] = code;
+    (void)DoIPConnQueue(c, type, payload, sizeof(payload));
+}
+
+static bool DoIPConnSendDiag(UDSTpDoIPConn_t *c, uint16_t sa, uint16_t ta, const uint8_t *data,
+                             size_t len) {
+    if (c->tx_diag_data) {
+        return false;
+    }
+    DoIPPutHeader(c->tx_diag_hdr, DOIP_DIAG_MSG, (uint32_t)(len + DOIP_DIAG_ADDR_LEN));
+    DoIPPutBE16(c->tx_diag_hdr + DOIP_HEADER_LEN, sa);
+    DoIPPutBE16(c->tx_diag_hdr + DOIP_HEADER_LEN + 2, ta);
+    c->tx_diag_data = data;
+    c->tx_diag_len = len;
+    c->tx_diag_pos = 0;
+    return true;
+}
+
+/**
+ * @brief Write as much of the send queue as the socket takes
+ * @details A started diagnostic message is finished before control messages, they cannot be
+ * interleaved on the stream.
+ * @return 0 on success, -1 if the connection failed
+ */
+static int DoIPConnFlush(UDSTpDoIPConn_t *c) {
+    for (;;) {
+        ssize_t n = 0;
+        if (c->tx_diag_data && (c->tx_diag_pos > 0 || c->tx_ctrl_pos == c->tx_ctrl_len)) {
+            struct iovec iov[2];
+            int iovcnt = 0;
+            if (c->tx_diag_pos < sizeof(c->tx_diag_hdr)) {
+                iov[iovcnt].iov_base = c->tx_diag_hdr + c->tx_diag_pos;
+                iov[iovcnt].iov_len = sizeof(c->tx_diag_hdr) - c->tx_diag_pos;
+                iovcnt++;
+                iov[iovcnt].iov_base = (void *)c->tx_diag_data;
+                iov[iovcnt].iov_len = c->tx_diag_len;
+            } else {
+                size_t off = c->tx_diag_pos - sizeof(c->tx_diag_hdr);
+                iov[iovcnt].iov_base = (void *)(c->tx_diag_data + off);
+                iov[iovcnt].iov_len = c->tx_diag_len - off;
+            }
+            iovcnt++;
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            n = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                c->tx_diag_pos += (size_t)n;
+                if (c->tx_diag_pos == sizeof(c->tx_diag_hdr) + c->tx_diag_len) {
+                    c->tx_diag_data = NULL;
+                    c->tx_diag_len = 0;
+                    c->tx_diag_pos = 0;
+                }
+            }
+        } else if (c->tx_ctrl_pos < c->tx_ctrl_len) {
+            n = send(c->fd, c->tx_ctrl + c->tx_ctrl_pos, c->tx_ctrl_len - c->tx_ctrl_pos,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                c->tx_ctrl_pos += (size_t)n;
+                if (c->tx_ctrl_pos == c->tx_ctrl_len) {
+                    c->tx_ctrl_pos = 0;
+                    c->tx_ctrl_len = 0;
+                }
+            }
+        } else {
+            return 0;
+        }
+
+        if (n < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return 0;
+            }
+            if (EINTR != errno) {
+                UDS_LOGI(__FILE__, "DoIP: send failed: %s", strerror(errno));
+                return -1;
+            }
+        }
+    }
+}
+
+static void DoIPConnAcceptDiag(UDSTpDoIPConn_t *c, uint8_t *buf) {
+    c->rx_dst = buf;
+    c->rx_state = DOIP_RX_DIAG_DATA;
+}
+
+static void DoIPConnDiscard(UDSTpDoIPConn_t *c) { c->rx_state = DOIP_RX_DISCARD; }
+
+/**
+ * @brief Read from the connection until a message or a part of it needs the caller's attention
+ */
+static int DoIPConnRead(UDSTpDoIPConn_t *c) {
+    uint8_t scratch[256];
+    for (;;) {
+        uint8_t *dst = NULL;
+        size_t want = 0;
+        switch (c->rx_state) {
+        case DOIP_RX_HEADER:
+            dst = c->rx_hdr + c->rx_pos;
+            want = DOIP_HEADER_LEN - c->rx_pos;
+            break;
+        case DOIP_RX_PAYLOAD:
+            dst = c->rx_ctrl + c->rx_pos;
+            want = c->rx_len - c->rx_pos;
+            break;
+        case DOIP_RX_DISCARD:
+            dst = scratch;
+            want = c->rx_len - c->rx_pos;
+            if (want > sizeof(scratch)) {
+                want = sizeof(scratch);
+            }
+            break;
+        case DOIP_RX_DIAG_ADDR:
+            dst = c->rx_ctrl + c->rx_pos;
+            want = DOIP_DIAG_ADDR_LEN - c->rx_pos;
+            break;
+        case DOIP_RX_DIAG_HOLD:
+            return DOIP_CONN_DIAG_START;
+        case DOIP_RX_DIAG_DATA:
+            dst = c->rx_dst + (c->rx_pos - DOIP_DIAG_ADDR_LEN);
+            want = c->rx_len - c->rx_pos;
+            break;
+        default:
+            UDS_ASSERT(false);
+            return DOIP_CONN_CLOSED;
+        }
+
+        if (want > 0) {
+            ssize_t n = recv(c->fd, dst, want, MSG_DONTWAIT);
+            if (n == 0) {
+                return DOIP_CONN_CLOSED;
+            }
+            if (n < 0) {
+                if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                    return DOIP_CONN_NONE;
+                }
+                if (EINTR == errno) {
+                    continue;
+                }
+                return DOIP_CONN_CLOSED;
+            }
+            c->rx_pos += (uint32_t)n;
+            if ((size_t)n < want) {
+                continue;
+            }
+        }
+
+        switch (c->rx_state) {
+        case DOIP_RX_HEADER:
+            if (c->rx_pos < DOIP_HEADER_LEN) {
+                break;
+            }
+            c->rx_pos = 0;
+            if (!DoIPHeaderValid(c->rx_hdr, false)) {
+                // ISO 13400-2:2012 Figure 7: the socket is closed after the NACK
+                DoIPConnQueueGenericNack(c, DOIP_NACK_INCORRECT_PATTERN);
+                c->close_after_tx = true;
+                return DOIP_CONN_NONE;
+            }
+            c->rx_type = DoIPGetBE16(c->rx_hdr + 2);
+            c->rx_len = DoIPGetBE32(c->rx_hdr + 4);
+            // diagnostic messages are read into the receiver's buffer, see DoIPServerDiagStart
+            if (DOIP_DIAG_MSG != c->rx_type && c->rx_len > sizeof(c->rx_ctrl)) {
+                DoIPConnQueueGenericNack(c, DOIP_NACK_MESSAGE_TOO_LARGE);
+                DoIPConnDiscard(c);
+                break;
+            }
+            if (!DoIPPayloadLenValid(c->rx_type, c->rx_len)) {
+                DoIPConnQueueGenericNack(c, DOIP_NACK_INVALID_PAYLOAD_LENGTH);
+                c->close_after_tx = true;
+                return DOIP_CONN_NONE;
+            }
+            c->rx_state = DOIP_DIAG_MSG == c->rx_type ? DOIP_RX_DIAG_ADDR : DOIP_RX_PAYLOAD;
+            break;
+        case DOIP_RX_PAYLOAD:
+            if (c->rx_pos == c->rx_len) {
+                c->rx_state = DOIP_RX_HEADER;
+                c->rx_pos = 0;
+                return DOIP_CONN_MSG;
+            }
+            break;
+        case DOIP_RX_DIAG_ADDR:
+            if (c->rx_pos == DOIP_DIAG_ADDR_LEN) {
+                c->rx_state = DOIP_RX_DIAG_HOLD;
+                return DOIP_CONN_DIAG_START;
+            }
+            break;
+        case DOIP_RX_DIAG_DATA:
+            if (c->rx_pos == c->rx_len) {
+                c->rx_state = DOIP_RX_HEADER;
+                c->rx_pos = 0;
+                return DOIP_CONN_DIAG;
+            }
+            break;
+        case DOIP_RX_DISCARD:
+            if (c->rx_pos == c->rx_len) {
+                c->rx_state = DOIP_RX_HEADER;
+                c->rx_pos = 0;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static uint32_t DoIPEarliest(bool *has, uint32_t current, uint32_t t) {
+    if (!*has || UDSTimeAfter(current, t)) {
+        *has = true;
+        return t;
+    }
+    return current;
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Server
+ */
+
+static size_t DoIPServerVehicleId(const UDSTpDoIPServer_t *tp, uint8_t *p) {
+    memcpy(p, tp->vin, sizeof(tp->vin));
+    DoIPPutBE16(p + 17, tp->logical_address);
+    memcpy(p + 19, tp->eid, sizeof(tp->eid));
+    memcpy(p + 25, tp->gid, sizeof(tp->gid));
+    p[31] = 0x00; // further action: none
+    return DOIP_VEHICLE_ID_RES_LEN;
+}
+
+static int DoIPServerOpenConnections(const UDSTpDoIPServer_t *tp) {
+    int n = 0;
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        n += tp->conns[i].fd >= 0;
+    }
+    return n;
+}
+
+/**
+ * @brief Build the response to a request that may arrive on UDP or TCP
+ * @return payload type of the response, 0 if the request is not answered
+ */
+static uint16_t DoIPServerStatusResponse(const UDSTpDoIPServer_t *tp, uint16_t type,
+                                         const uint8_t *payload, uint8_t *res, size_t *res_len) {
+    switch (type) {
+    case DOIP_VEHICLE_ID_REQ_EID:
+        if (memcmp(payload, tp->eid, sizeof(tp->eid))) {
+            return 0;
+        }
+        *res_len = DoIPServerVehicleId(tp, res);
+        return DOIP_VEHICLE_ANNOUNCEMENT;
+    case DOIP_VEHICLE_ID_REQ_VIN:
+        if (memcmp(payload, tp->vin, sizeof(tp->vin))) {
+            return 0;
+        }
+        *res_len = DoIPServerVehicleId(tp, res);
+        return DOIP_VEHICLE_ANNOUNCEMENT;
+    case DOIP_VEHICLE_ID_REQ:
+        *res_len = DoIPServerVehicleId(tp, res);
+        return DOIP_VEHICLE_ANNOUNCEMENT;
+    case DOIP_ENTITY_STATUS_REQ:
+        res[0] = tp->is_target ? 0x00 : 0x01; // DoIP gateway or DoIP node
+        res[1] = UDS_DOIP_MAX_CONNECTIONS;
+        res[2] = (uint8_t)DoIPServerOpenConnections(tp);
+        DoIPPutBE32(res + 3, (uint32_t)(UDS_DOIP_MTU + DOIP_DIAG_ADDR_LEN));
+        *res_len = 7;
+        return DOIP_ENTITY_STATUS_RES;
+    case DOIP_POWER_MODE_REQ:
+        res[0] = 0x01; // ready
+        *res_len = 1;
+        return DOIP_POWER_MODE_RES;
+    default:
+        return 0;
+    }
+}
+
+static void DoIPServerSendUDP(UDSTpDoIPServer_t *tp, uint16_t type, const uint8_t *payload,
+                              size_t len, const struct sockaddr *to, socklen_t to_len) {
+    uint8_t msg[DOIP_HEADER_LEN + DOIP_VEHICLE_ID_RES_LEN];
+    UDS_ASSERT(len <= sizeof(msg) - DOIP_HEADER_LEN);
+    DoIPPutHeader(msg, type, (uint32_t)len);
+    memcpy(msg + DOIP_HEADER_LEN, payload, len);
+    if (sendto(tp->udp_fd, msg, DOIP_HEADER_LEN + len, MSG_DONTWAIT, to, to_len) < 0) {
+        UDS_LOGI(__FILE__, "DoIP: UDP send failed: %s", strerror(errno));
+    }
+}
+
+static void DoIPServerPollUDP(UDSTpDoIPServer_t *tp) {
+    uint8_t msg[64];
+    for (;;) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n =
+            recvfrom(tp->udp_fd, msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            return;
+        }
+        uint8_t nack = 0;
+        uint16_t type = 0;
+        uint32_t len = 0;
+        if (n < DOIP_HEADER_LEN || !DoIPHeaderValid(msg, true)) {
+            nack = DOIP_NACK_INCORRECT_PATTERN;
+        } else {
+            type = DoIPGetBE16(msg + 2);
+            len = DoIPGetBE32(msg + 4);
+            if (len > sizeof(msg) - DOIP_HEADER_LEN) {
+                nack = DOIP_NACK_MESSAGE_TOO_LARGE;
+            } else if ((size_t)n != DOIP_HEADER_LEN + len || !DoIPPayloadLenValid(type, len)) {
+                nack = DOIP_NACK_INVALID_PAYLOAD_LENGTH;
+            }
+        }
+
+        uint8_t res[DOIP_VEHICLE_ID_RES_LEN];
+        size_t res_len = 0;
+        if (0 == nack) {
+            uint16_t res_type =
+                DoIPServerStatusResponse(tp, type, msg + DOIP_HEADER_LEN, res, &res_len);
+            if (res_type) {
+                DoIPServerSendUDP(tp, res_type, res, res_len, (struct sockaddr *)&from, from_len);
+                continue;
+            }
+            if (DOIP_VEHICLE_ID_REQ_EID == type || DOIP_VEHICLE_ID_REQ_VIN == type) {
+                continue; // meant for another vehicle
+            }
+            nack = DOIP_NACK_UNKNOWN_PAYLOAD_TYPE;
+        }
+        DoIPServerSendUDP(tp, DOIP_GENERIC_NACK, &nack, 1, (struct sockaddr *)&from, from_len);
+    }
+}
+
+static UDSTpDoIPConn_t *DoIPServerFreeConn(UDSTpDoIPServer_t *tp) {
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd < 0) {
+            return &tp->conns[i];
+        }
+    }
+    return NULL;
+}
+
+static void DoIPServerAdopt(UDSTpDoIPConn_t *c, int fd) {
+    DoIPConnInit(c, fd);
+    c->inactivity_timer = UDSMillis() + UDS_DOIP_INITIAL_INACTIVITY_MS;
+}
+
+static UDSTpDoIPRxSlot_t *DoIPServerFillingSlot(UDSTpDoIPServer_t *tp, const UDSTpDoIPConn_t *c) {
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        UDSTpDoIPRxSlot_t *slot = &tp->rx_slots[i];
+        if (UDS_DOIP_SLOT_FILLING == slot->state && slot->conn == c) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static void DoIPServerCloseConn(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    UDS_LOGI(__FILE__, "DoIP: closing connection of tester 0x%04X", c->tester_addr);
+    // complete messages stay, a partial one is dropped. A taken one is aborted, the taker gives
+    // it back.
+    UDSTpDoIPRxSlot_t *slot = DoIPServerFillingSlot(tp, c);
+    if (slot) {
+        slot->conn = NULL;
+        slot->state = slot->taken ? UDS_DOIP_SLOT_ABORTED : UDS_DOIP_SLOT_FREE;
+    }
+    DoIPConnClose(c);
+}
+
+// ISO 13400-2:2012 Figure 10: a tester connecting while all sockets are in use triggers an alive
+// check of the registered testers
+static void DoIPServerAccept(UDSTpDoIPServer_t *tp) {
+    for (;;) {
+        int fd = accept(tp->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        if (DoIPSetupStream(fd) < 0) {
+            close(fd);
+            continue;
+        }
+        UDSTpDoIPConn_t *c = DoIPServerFreeConn(tp);
+        if (c) {
+            DoIPServerAdopt(c, fd);
+            continue;
+        }
+        if (tp->pending_fd >= 0) {
+            close(fd);
+            continue;
+        }
+        tp->pending_fd = fd;
+        tp->alive_check_timer = UDSMillis() + UDS_DOIP_ALIVE_CHECK_MS;
+        for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+            UDSTpDoIPConn_t *other = &tp->conns[i];
+            if (other->active && DoIPConnQueue(other, DOIP_ALIVE_CHECK_REQ, NULL, 0)) {
+                other->alive_check_pending = true;
+            }
+        }
+    }
+}
+
+static void DoIPServerAliveCheck(UDSTpDoIPServer_t *tp) {
+    if (tp->pending_fd < 0) {
+        return;
+    }
+    bool waiting = false;
+    bool expired = UDSTimeAfter(UDSMillis(), tp->alive_check_timer);
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        UDSTpDoIPConn_t *c = &tp->conns[i];
+        if (c->fd >= 0 && c->alive_check_pending) {
+            if (expired) {
+                DoIPServerCloseConn(tp, c);
+            } else {
+                waiting = true;
+            }
+        }
+    }
+
+    UDSTpDoIPConn_t *c = DoIPServerFreeConn(tp);
+    if (c) {
+        DoIPServerAdopt(c, tp->pending_fd);
+        tp->pending_fd = -1;
+    } else if (!waiting || expired) {
+        // every registered tester is alive
+        close(tp->pending_fd);
+        tp->pending_fd = -1;
+    }
+}
+
+static void DoIPServerRoutingActivation(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint16_t sa = DoIPGetBE16(c->rx_ctrl);
+    uint8_t activation_type = c->rx_ctrl[2];
+    uint8_t code = DOIP_RA_SUCCESS;
+
+    if (activation_type != 0x00 && activation_type != 0x01) {
+        code = DOIP_RA_UNSUPPORTED_TYPE;
+    } else if (c->active && c->tester_addr != sa) {
+        code = DOIP_RA_SA_DIFFERENT;
+    } else {
+        for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+            UDSTpDoIPConn_t *other = &tp->conns[i];
+            if (other != c && other->active && other->tester_addr == sa) {
+                code = DOIP_RA_SA_IN_USE;
+            }
+        }
+    }
+
+    uint8_t res[9] = {0};
+    DoIPPutBE16(res, sa);
+    DoIPPutBE16(res + 2, tp->logical_address);
+    res[4] = code;
+    (void)DoIPConnQueue(c, DOIP_ROUTING_ACTIVATION_RES, res, sizeof(res));
+
+    if (DOIP_RA_SUCCESS == code) {
+        c->active = true;
+        c->tester_addr = sa;
+        c->inactivity_timer = UDSMillis() + UDS_DOIP_GENERAL_INACTIVITY_MS;
+        UDS_LOGI(__FILE__, "DoIP: routing activated for tester 0x%04X", sa);
+    } else {
+        UDS_LOGI(__FILE__, "DoIP: routing activation of 0x%04X denied: 0x%02X", sa, code);
+        c->close_after_tx = true;
+    }
+}
+
+static void DoIPServerHandleCtrl(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint8_t res[16];
+    size_t res_len = 0;
+    uint16_t res_type = 0;
+    switch (c->rx_type) {
+    case DOIP_ROUTING_ACTIVATION_REQ:
+        DoIPServerRoutingActivation(tp, c);
+        break;
+    case DOIP_ALIVE_CHECK_RES:
+        c->alive_check_pending = false;
+        break;
+    case DOIP_GENERIC_NACK:
+        UDS_LOGI(__FILE__, "DoIP: tester sent generic NACK 0x%02X", c->rx_ctrl[0]);
+        break;
+    case DOIP_ENTITY_STATUS_REQ:
+    case DOIP_POWER_MODE_REQ:
+        res_type = DoIPServerStatusResponse(tp, c->rx_type, c->rx_ctrl, res, &res_len);
+        (void)DoIPConnQueue(c, res_type, res, res_len);
+        break;
+    default:
+        DoIPConnQueueGenericNack(c, DOIP_NACK_UNKNOWN_PAYLOAD_TYPE);
+        break;
+    }
+}
+
+static bool DoIPServerIsTarget(const UDSTpDoIPServer_t *tp, uint16_t ta) {
+    return ta == tp->logical_address || ta == tp->func_address ||
+           (tp->is_target && tp->is_target(tp->is_target_arg, ta));
+}
+
+static UDSTpDoIPRxSlot_t *DoIPServerFreeSlot(UDSTpDoIPServer_t *tp) {
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        if (UDS_DOIP_SLOT_FREE == tp->rx_slots[i].state) {
+            return &tp->rx_slots[i];
+        }
+    }
+    return NULL;
+}
+
+// ISO 13400-2:2012 Figure 9: diagnostic message handling
+static void DoIPServerDiagStart(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint16_t sa = DoIPGetBE16(c->rx_ctrl);
+    uint16_t ta = DoIPGetBE16(c->rx_ctrl + 2);
+    uint32_t len = c->rx_len - DOIP_DIAG_ADDR_LEN;
+
+    if (!c->active || sa != c->tester_addr) {
+        DoIPConnQueueDiagAck(c, DOIP_DIAG_NACK, ta, sa, DOIP_DIAG_NACK_INVALID_SA);
+        DoIPConnDiscard(c);
+        c->close_after_tx = true;
+    } else if (!DoIPServerIsTarget(tp, ta)) {
+        DoIPConnQueueDiagAck(c, DOIP_DIAG_NACK, ta, sa, DOIP_DIAG_NACK_UNKNOWN_TA);
+        DoIPConnDiscard(c);
+    } else if (len > UDS_DOIP_MTU) {
+        DoIPConnQueueDiagAck(c, DOIP_DIAG_NACK, ta, sa, DOIP_DIAG_NACK_TOO_LARGE);
+        DoIPConnDiscard(c);
+    } else {
+        UDSTpDoIPRxSlot_t *slot = DoIPServerFreeSlot(tp);
+        if (slot) {
+            memset(slot, 0, offsetof(UDSTpDoIPRxSlot_t, buf));
+            slot->state = UDS_DOIP_SLOT_FILLING;
+            slot->seq = tp->rx_seq++;
+            slot->conn = c;
+            slot->len = len;
+            slot->info.A_Mtype = UDS_A_MTYPE_DIAG;
+            slot->info.A_SA = sa;
+            slot->info.A_TA = ta;
+            slot->info.A_TA_Type =
+                ta == tp->func_address ? UDS_A_TA_TYPE_FUNCTIONAL : UDS_A_TA_TYPE_PHYSICAL;
+            DoIPConnAcceptDiag(c, slot->buf);
+        }
+    }
+    // otherwise the message stays in the socket until a slot is free
+}
+
+static void DoIPServerDiagComplete(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint16_t sa = DoIPGetBE16(c->rx_ctrl);
+    uint16_t ta = DoIPGetBE16(c->rx_ctrl + 2);
+    UDSTpDoIPRxSlot_t *slot = DoIPServerFillingSlot(tp, c);
+    UDS_ASSERT(slot);
+    slot->conn = NULL;
+    slot->received = slot->len;
+    slot->state = slot->drop ? UDS_DOIP_SLOT_FREE : UDS_DOIP_SLOT_READY;
+    DoIPConnQueueDiagAck(c, DOIP_DIAG_ACK, ta, sa, 0x00);
+}
+
+static void DoIPServerPollConn(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    while (!c->close_after_tx) {
+        int ev = DoIPConnRead(c);
+        if (DOIP_CONN_CLOSED == ev) {
+            DoIPServerCloseConn(tp, c);
+            return;
+        }
+        if (DOIP_CONN_NONE == ev) {
+            break;
+        }
+        if (c->active) {
+            c->inactivity_timer = UDSMillis() + UDS_DOIP_GENERAL_INACTIVITY_MS;
+        }
+        if (DOIP_CONN_MSG == ev) {
+            DoIPServerHandleCtrl(tp, c);
+        } else if (DOIP_CONN_DIAG_START == ev) {
+            DoIPServerDiagStart(tp, c);
+            if (DOIP_RX_DIAG_HOLD == c->rx_state) {
+                break;
+            }
+        } else if (DOIP_CONN_DIAG == ev) {
+            DoIPServerDiagComplete(tp, c);
+        }
+    }
+
+    // a taker may forward the part that arrived so far
+    UDSTpDoIPRxSlot_t *slot = DoIPServerFillingSlot(tp, c);
+    if (slot) {
+        slot->received = c->rx_pos - DOIP_DIAG_ADDR_LEN;
+    }
+
+    if (DoIPConnFlush(c) < 0) {
+        DoIPServerCloseConn(tp, c);
+        return;
+    }
+    if (c->close_after_tx && !DoIPConnTxPending(c)) {
+        DoIPServerCloseConn(tp, c);
+        return;
+    }
+    if (UDSTimeAfter(UDSMillis(), c->inactivity_timer)) {
+        UDS_LOGI(__FILE__, "DoIP: connection inactive");
+        DoIPServerCloseConn(tp, c);
+    }
+}
+
+static UDSTpStatus_t doip_server_poll(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    UDSTpStatus_t status = 0;
+
+    DoIPServerAccept(tp);
+    DoIPServerPollUDP(tp);
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd >= 0) {
+            DoIPServerPollConn(tp, &tp->conns[i]);
+        }
+    }
+    DoIPServerAliveCheck(tp);
+
+    if (tp->announce_count && UDSTimeAfter(UDSMillis(), tp->announce_timer)) {
+        uint8_t res[DOIP_VEHICLE_ID_RES_LEN];
+        size_t len = DoIPServerVehicleId(tp, res);
+        DoIPServerSendUDP(tp, DOIP_VEHICLE_ANNOUNCEMENT, res, len,
+                          (struct sockaddr *)&tp->announce_addr, tp->announce_addr_len);
+        tp->announce_count--;
+        tp->announce_timer = UDSMillis() + UDS_DOIP_ANNOUNCE_INTERVAL_MS;
+    }
+
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].tx_diag_data) {
+            status |= UDS_TP_SEND_IN_PROGRESS;
+        }
+    }
+    return status;
+}
+
+static UDSTpDoIPConn_t *DoIPServerFindTester(UDSTpDoIPServer_t *tp, uint16_t tester_addr) {
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        UDSTpDoIPConn_t *c = &tp->conns[i];
+        if (c->fd >= 0 && c->active && c->tester_addr == tester_addr) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static ssize_t doip_server_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    // with info a gateway can answer for the ECUs behind it, otherwise the entity answers the
+    // tester of the last request
+    uint16_t sa = tp->logical_address;
+    uint16_t ta = tp->reply_addr;
+    if (info && info->A_SA) {
+        sa = (uint16_t)info->A_SA;
+        ta = (uint16_t)info->A_TA;
+    }
+    UDSTpDoIPConn_t *c = DoIPServerFindTester(tp, ta);
+    if (NULL == c) {
+        UDS_LOGW(__FILE__, "DoIP: tester 0x%04X is not connected", ta);
+        return -1;
+    }
+    if (!DoIPConnSendDiag(c, sa, ta, buf, len)) {
+        return -2;
+    }
+    if (DoIPConnFlush(c) < 0) {
+        DoIPServerCloseConn(tp, c);
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+// the lent message, otherwise the oldest complete message that isn't taken
+static UDSTpDoIPRxSlot_t *DoIPServerNextSlot(UDSTpDoIPServer_t *tp) {
+    UDSTpDoIPRxSlot_t *next = NULL;
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        UDSTpDoIPRxSlot_t *slot = &tp->rx_slots[i];
+        if (UDS_DOIP_SLOT_READY != slot->state || slot->taken) {
+            continue;
+        }
+        if (slot->lent) {
+            return slot;
+        }
+        if (NULL == next || (int32_t)(slot->seq - next->seq) < 0) {
+            next = slot;
+        }
+    }
+    return next;
+}
+
+static ssize_t doip_server_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    UDSTpDoIPRxSlot_t *slot = DoIPServerNextSlot(tp);
+    if (NULL == slot) {
+        return 0;
+    }
+    slot->lent = true;
+    tp->reply_addr = (uint16_t)slot->info.A_SA;
+    *buf = slot->buf;
+    if (info) {
+        *info = slot->info;
+    }
+    return (ssize_t)slot->len;
+}
+
+static void doip_server_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    UDSTpDoIPRxSlot_t *slot = DoIPServerNextSlot(tp);
+    if (slot && slot->lent) {
+        slot->state = UDS_DOIP_SLOT_FREE;
+        slot->lent = false;
+    }
+}
+
+static ssize_t doip_server_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    uint8_t *data = NULL;
+    ssize_t len = doip_server_peek(hdl, &data, info);
+    if (len <= 0) {
+        return len;
+    }
+    if ((size_t)len > bufsize) {
+        UDS_LOGW(__FILE__, "DoIP: buffer too small: %zu < %zd", bufsize, len);
+        doip_server_release(hdl);
+        return -1;
+    }
+    memcpy(buf, data, (size_t)len);
+    doip_server_release(hdl);
+    return len;
+}
+
+static int doip_server_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    int n = 0;
+    if (n < max_fds) {
+        fds[n++] = (UDSTpFd_t){.fd = tp->listen_fd, .events = UDS_TP_FD_READ};
+    }
+    if (n < max_fds) {
+        fds[n++] = (UDSTpFd_t){.fd = tp->udp_fd, .events = UDS_TP_FD_READ};
+    }
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS && n < max_fds; i++) {
+        const UDSTpDoIPConn_t *c = &tp->conns[i];
+        if (c->fd < 0) {
+            continue;
+        }
+        int events = 0;
+        // a held diagnostic message is read once a slot is free, not when data arrives
+        if (DOIP_RX_DIAG_HOLD != c->rx_state && !c->close_after_tx) {
+            events |= UDS_TP_FD_READ;
+        }
+        if (DoIPConnTxPending(c)) {
+            events |= UDS_TP_FD_WRITE;
+        }
+        fds[n++] = (UDSTpFd_t){.fd = c->fd, .events = events};
+    }
+    return n;
+}
+
+static bool doip_server_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    bool has = false;
+    uint32_t t = 0;
+    // timers expire once UDSMillis() is past them
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd >= 0) {
+            t = DoIPEarliest(&has, t, tp->conns[i].inactivity_timer + 1);
+        }
+    }
+    if (tp->pending_fd >= 0) {
+        t = DoIPEarliest(&has, t, tp->alive_check_timer + 1);
+    }
+    if (tp->announce_count) {
+        t = DoIPEarliest(&has, t, tp->announce_timer + 1);
+    }
+    if (has) {
+        *deadline_ms = t;
+    }
+    return has;
+}
+
+int UDSTpDoIPServerTake(UDSTpDoIPServer_t *tp, uint16_t ta) {
+    UDS_ASSERT(tp);
+    int oldest = -1;
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        const UDSTpDoIPRxSlot_t *slot = &tp->rx_slots[i];
+        if (UDS_DOIP_SLOT_FREE == slot->state || slot->taken || slot->lent || slot->drop ||
+            slot->info.A_TA != ta) {
+            continue;
+        }
+        if (oldest < 0 || (int32_t)(slot->seq - tp->rx_slots[oldest].seq) < 0) {
+            oldest = i;
+        }
+    }
+    if (oldest >= 0) {
+        tp->rx_slots[oldest].taken = true;
+    }
+    return oldest;
+}
+
+void UDSTpDoIPServerGiveBack(UDSTpDoIPServer_t *tp, int slot) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(slot >= 0 && slot < UDS_DOIP_RX_SLOTS);
+    UDSTpDoIPRxSlot_t *s = &tp->rx_slots[slot];
+    s->taken = false;
+    if (UDS_DOIP_SLOT_FILLING == s->state) {
+        s->drop = true;
+    } else {
+        s->state = UDS_DOIP_SLOT_FREE;
+    }
+}
+
+bool UDSTpDoIPServerSending(const UDSTpDoIPServer_t *tp, const uint8_t *buf) {
+    UDS_ASSERT(tp);
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd >= 0 && tp->conns[i].tx_diag_data == buf) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int DoIPServerBind(const char *addr, uint16_t port, int socktype) {
+    struct sockaddr_storage sa;
+    socklen_t sa_len = 0;
+    if (DoIPResolve(addr, port, socktype, &sa, &sa_len) < 0) {
+        return -1;
+    }
+    int fd = socket(sa.ss_family, socktype, 0);
+    if (fd < 0) {
+        UDS_LOGE(__FILE__, "DoIP: socket: %s", strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (SOCK_DGRAM == socktype) {
+        (void)setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    }
+    if (bind(fd, (struct sockaddr *)&sa, sa_len) < 0 || DoIPSetNonBlocking(fd) < 0 ||
+        (SOCK_STREAM == socktype && listen(fd, UDS_DOIP_MAX_CONNECTIONS) < 0)) {
+        UDS_LOGE(__FILE__, "DoIP: cannot bind %s:%u: %s", addr, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+UDSErr_t UDSTpDoIPServerInit(UDSTpDoIPServer_t *tp, const UDSTpDoIPServerConfig_t *cfg) {
+    if (NULL == tp || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    memset(tp, 0, sizeof(*tp));
+    tp->hdl.poll = doip_server_poll;
+    tp->hdl.send = doip_server_send;
+    tp->hdl.recv = doip_server_recv;
+    tp->hdl.peek = doip_server_peek;
+    tp->hdl.release = doip_server_release;
+    tp->hdl.get_fds = doip_server_get_fds;
+    tp->hdl.next_deadline = doip_server_next_deadline;
+    tp->logical_address = cfg->logical_address;
+    tp->func_address = cfg->func_address ? cfg->func_address : UDS_DOIP_FUNC_ADDR_DEFAULT;
+    memcpy(tp->vin, cfg->vin, sizeof(tp->vin));
+    memcpy(tp->eid, cfg->eid, sizeof(tp->eid));
+    memcpy(tp->gid, cfg->gid, sizeof(tp->gid));
+    tp->pending_fd = -1;
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        DoIPConnInit(&tp->conns[i], -1);
+    }
+
+    const char *addr = cfg->bind_addr ? cfg->bind_addr : "0.0.0.0";
+    uint16_t port = cfg->port ? cfg->port : UDS_DOIP_PORT;
+    tp->listen_fd = DoIPServerBind(addr, port, SOCK_STREAM);
+    tp->udp_fd = DoIPServerBind(addr, port, SOCK_DGRAM);
+    if (tp->listen_fd < 0 || tp->udp_fd < 0) {
+        UDSTpDoIPServerDeinit(tp);
+        return UDS_FAIL;
+    }
+
+    if (cfg->announce_addr) {
+        if (DoIPResolve(cfg->announce_addr, port, SOCK_DGRAM, &tp->announce_addr,
+                        &tp->announce_addr_len) < 0) {
+            UDSTpDoIPServerDeinit(tp);
+            return UDS_FAIL;
+        }
+        tp->announce_count = UDS_DOIP_ANNOUNCE_NUM;
+        tp->announce_timer = UDSMillis();
+    }
+    UDS_LOGI(__FILE__, "DoIP: entity 0x%04X listening on %s:%u", tp->logical_address, addr, port);
+    return UDS_OK;
+}
+
+void UDSTpDoIPServerDeinit(UDSTpDoIPServer_t *tp) {
+    if (NULL == tp) {
+        return;
+    }
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        DoIPConnClose(&tp->conns[i]);
+    }
+    if (tp->pending_fd >= 0) {
+        close(tp->pending_fd);
+        tp->pending_fd = -1;
+    }
+    if (tp->listen_fd >= 0) {
+        close(tp->listen_fd);
+        tp->listen_fd = -1;
+    }
+    if (tp->udp_fd >= 0) {
+        close(tp->udp_fd);
+        tp->udp_fd = -1;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Client
+ */
+
+static void DoIPClientFail(UDSTpDoIPClient_t *tp) {
+    tp->state = UDS_DOIP_CLIENT_FAILED;
+    tp->pending_data = NULL;
+    tp->awaiting_ack = false;
+    tp->send_err = true;
+    DoIPConnClose(&tp->conn);
+}
+
+static void DoIPClientStartSend(UDSTpDoIPClient_t *tp) {
+    if (tp->pending_data && UDS_DOIP_CLIENT_ACTIVE == tp->state &&
+        DoIPConnSendDiag(&tp->conn, tp->source_addr, tp->pending_ta, tp->pending_data,
+                         tp->pending_len)) {
+        tp->pending_data = NULL;
+        tp->awaiting_ack = true;
+        tp->timer = UDSMillis() + UDS_DOIP_DIAG_ACK_TIMEOUT_MS;
+    }
+}
+
+static void DoIPClientConnected(UDSTpDoIPClient_t *tp) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct pollfd pfd = {.fd = tp->conn.fd, .events = POLLOUT};
+    if (poll(&pfd, 1, 0) <= 0) {
+        return;
+    }
+    if (getsockopt(tp->conn.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        UDS_LOGE(__FILE__, "DoIP: connect failed: %s", strerror(err));
+        DoIPClientFail(tp);
+        return;
+    }
+    uint8_t req[7] = {0};
+    DoIPPutBE16(req, tp->source_addr);
+    req[2] = tp->activation_type;
+    (void)DoIPConnQueue(&tp->conn, DOIP_ROUTING_ACTIVATION_REQ, req, sizeof(req));
+    tp->state = UDS_DOIP_CLIENT_ACTIVATING;
+    tp->timer = UDSMillis() + UDS_DOIP_CTRL_TIMEOUT_MS;
+}
+
+static void DoIPClientHandleCtrl(UDSTpDoIPClient_t *tp) {
+    UDSTpDoIPConn_t *c = &tp->conn;
+    uint8_t res[2];
+    switch (c->rx_type) {
+    case DOIP_ROUTING_ACTIVATION_RES: {
+        uint8_t code = c->rx_ctrl[4];
+        if (DOIP_RA_SUCCESS == code) {
+            tp->state = UDS_DOIP_CLIENT_ACTIVE;
+            DoIPClientStartSend(tp);
+        } else if (DOIP_RA_CONFIRMATION_PENDING == code) {
+            tp->timer = UDSMillis() + UDS_DOIP_CTRL_TIMEOUT_MS;
+        } else {
+            UDS_LOGE(__FILE__, "DoIP: routing activation denied: 0x%02X", code);
+            DoIPClientFail(tp);
+        }
+        break;
+    }
+    case DOIP_ALIVE_CHECK_REQ:
+        DoIPPutBE16(res, tp->source_addr);
+        (void)DoIPConnQueue(c, DOIP_ALIVE_CHECK_RES, res, sizeof(res));
+        break;
+    case DOIP_DIAG_ACK:
+        tp->awaiting_ack = false;
+        break;
+    case DOIP_DIAG_NACK:
+        tp->nack_code = c->rx_ctrl[4];
+        UDS_LOGW(__FILE__, "DoIP: diagnostic message NACK 0x%02X", tp->nack_code);
+        tp->awaiting_ack = false;
+        tp->send_err = true;
+        break;
+    case DOIP_GENERIC_NACK:
+        UDS_LOGW(__FILE__, "DoIP: generic NACK 0x%02X", c->rx_ctrl[0]);
+        if (tp->awaiting_ack) {
+            tp->awaiting_ack = false;
+            tp->send_err = true;
+        }
+        break;
+    default:
+        DoIPConnQueueGenericNack(c, DOIP_NACK_UNKNOWN_PAYLOAD_TYPE);
+        break;
+    }
+}
+
+static void DoIPClientPollConn(UDSTpDoIPClient_t *tp) {
+    UDSTpDoIPConn_t *c = &tp->conn;
+    while (!c->close_after_tx && tp->state != UDS_DOIP_CLIENT_FAILED) {
+        int ev = DoIPConnRead(c);
+        if (DOIP_CONN_CLOSED == ev) {
+            UDS_LOGI(__FILE__, "DoIP: connection closed by the entity");
+            DoIPClientFail(tp);
+            return;
+        }
+        if (DOIP_CONN_NONE == ev) {
+            break;
+        }
+        if (DOIP_CONN_MSG == ev) {
+            DoIPClientHandleCtrl(tp);
+        } else if (DOIP_CONN_DIAG_START == ev) {
+            uint16_t ta = DoIPGetBE16(c->rx_ctrl + 2);
+            if (ta != tp->source_addr || c->rx_len - DOIP_DIAG_ADDR_LEN > sizeof(tp->recv_buf)) {
+                UDS_LOGW(__FILE__, "DoIP: dropping diagnostic message to 0x%04X", ta);
+                DoIPConnDiscard(c);
+            } else if (0 == tp->recv_len) {
+                DoIPConnAcceptDiag(c, tp->recv_buf);
+            } else {
+                break; // the previous message has not been read yet
+            }
+        } else if (DOIP_CONN_DIAG == ev) {
+            tp->recv_len = c->rx_len - DOIP_DIAG_ADDR_LEN;
+            tp->recv_info.A_Mtype = UDS_A_MTYPE_DIAG;
+            tp->recv_info.A_SA = DoIPGetBE16(c->rx_ctrl);
+            tp->recv_info.A_TA = DoIPGetBE16(c->rx_ctrl + 2);
+            tp->recv_info.A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+            tp->recv_info.A_AE = 0;
+        }
+    }
+    if (tp->state != UDS_DOIP_CLIENT_FAILED &&
+        (DoIPConnFlush(c) < 0 || (c->close_after_tx && !DoIPConnTxPending(c)))) {
+        DoIPClientFail(tp);
+    }
+}
+
+static UDSTpStatus_t doip_client_poll(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    UDSTpStatus_t status = 0;
+
+    if (UDS_DOIP_CLIENT_CONNECTING == tp->state) {
+        DoIPClientConnected(tp);
+    }
+    if (UDS_DOIP_CLIENT_ACTIVATING == tp->state || UDS_DOIP_CLIENT_ACTIVE == tp->state) {
+        DoIPClientPollConn(tp);
+    }
+
+    bool waiting = UDS_DOIP_CLIENT_CONNECTING == tp->state ||
+                   UDS_DOIP_CLIENT_ACTIVATING == tp->state || tp->awaiting_ack;
+    if (waiting && UDSTimeAfter(UDSMillis(), tp->timer)) {
+        UDS_LOGE(__FILE__, "DoIP: timeout in state %d", tp->state);
+        if (tp->awaiting_ack && UDS_DOIP_CLIENT_ACTIVE == tp->state) {
+            tp->awaiting_ack = false;
+            tp->send_err = true;
+        } else {
+            DoIPClientFail(tp);
+        }
+    }
+
+    if (tp->pending_data || tp->awaiting_ack || tp->conn.tx_diag_data) {
+        status |= UDS_TP_SEND_IN_PROGRESS;
+    }
+    if (tp->send_err) {
+        status |= UDS_TP_ERR;
+    }
+    return status;
+}
+
+static ssize_t doip_client_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (UDS_DOIP_CLIENT_FAILED == tp->state) {
+        return -1;
+    }
+    if (tp->pending_data || tp->awaiting_ack || tp->conn.tx_diag_data) {
+        return -2;
+    }
+    bool functional = info && UDS_A_TA_TYPE_FUNCTIONAL == info->A_TA_Type;
+    tp->pending_data = buf;
+    tp->pending_len = len;
+    tp->pending_ta = functional ? tp->func_addr : tp->target_addr;
+    tp->send_err = false;
+    tp->nack_code = 0;
+    DoIPClientStartSend(tp);
+    if (tp->conn.fd >= 0 && DoIPConnFlush(&tp->conn) < 0) {
+        DoIPClientFail(tp);
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+static ssize_t doip_client_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (0 == tp->recv_len) {
+        return 0;
+    }
+    *buf = tp->recv_buf;
+    if (info) {
+        *info = tp->recv_info;
+    }
+    return (ssize_t)tp->recv_len;
+}
+
+static void doip_client_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    tp->recv_len = 0;
+}
+
+static ssize_t doip_client_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    uint8_t *data = NULL;
+    ssize_t len = doip_client_peek(hdl, &data, info);
+    if (len <= 0) {
+        return len;
+    }
+    doip_client_release(hdl);
+    if ((size_t)len > bufsize) {
+        UDS_LOGW(__FILE__, "DoIP: buffer too small: %zu < %zd", bufsize, len);
+        return -1;
+    }
+    memcpy(buf, data, (size_t)len);
+    return len;
+}
+
+static int doip_client_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (max_fds < 1 || tp->conn.fd < 0) {
+        return 0;
+    }
+    fds[0].fd = tp->conn.fd;
+    if (UDS_DOIP_CLIENT_CONNECTING == tp->state) {
+        fds[0].events = UDS_TP_FD_WRITE;
+        return 1;
+    }
+    fds[0].events = tp->recv_len ? 0 : UDS_TP_FD_READ;
+    if (DoIPConnTxPending(&tp->conn)) {
+        fds[0].events |= UDS_TP_FD_WRITE;
+    }
+    return 1;
+}
+
+static bool doip_client_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (UDS_DOIP_CLIENT_CONNECTING == tp->state || UDS_DOIP_CLIENT_ACTIVATING == tp->state ||
+        tp->awaiting_ack) {
+        *deadline_ms = tp->timer + 1;
+        return true;
+    }
+    return false;
+}
+
+UDSErr_t UDSTpDoIPClientInit(UDSTpDoIPClient_t *tp, const UDSTpDoIPClientConfig_t *cfg) {
+    if (NULL == tp || NULL == cfg || NULL == cfg->addr) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    memset(tp, 0, sizeof(*tp));
+    tp->hdl.poll = doip_client_poll;
+    tp->hdl.send = doip_client_send;
+    tp->hdl.recv = doip_client_recv;
+    tp->hdl.peek = doip_client_peek;
+    tp->hdl.release = doip_client_release;
+    tp->hdl.get_fds = doip_client_get_fds;
+    tp->hdl.next_deadline = doip_client_next_deadline;
+    tp->source_addr = cfg->source_addr;
+    tp->target_addr = cfg->target_addr;
+    tp->func_addr = cfg->func_addr ? cfg->func_addr : UDS_DOIP_FUNC_ADDR_DEFAULT;
+    tp->activation_type = cfg->activation_type;
+    DoIPConnInit(&tp->conn, -1);
+
+    struct sockaddr_storage sa;
+    socklen_t sa_len = 0;
+    uint16_t port = cfg->port ? cfg->port : UDS_DOIP_PORT;
+    if (DoIPResolve(cfg->addr, port, SOCK_STREAM, &sa, &sa_len) < 0) {
+        return UDS_FAIL;
+    }
+    int fd = socket(sa.ss_family, SOCK_STREAM, 0);
+    if (fd < 0 || DoIPSetupStream(fd) < 0) {
+        UDS_LOGE(__FILE__, "DoIP: socket: %s", strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return UDS_FAIL;
+    }
+    if (connect(fd, (struct sockaddr *)&sa, sa_len) < 0 && EINPROGRESS != errno) {
+        UDS_LOGE(__FILE__, "DoIP: cannot connect to %s:%u: %s", cfg->addr, port, strerror(errno));
+        close(fd);
+        return UDS_FAIL;
+    }
+    DoIPConnInit(&tp->conn, fd);
+    tp->state = UDS_DOIP_CLIENT_CONNECTING;
+    tp->timer = UDSMillis() + UDS_DOIP_CTRL_TIMEOUT_MS;
+    return UDS_OK;
+}
+
+void UDSTpDoIPClientDeinit(UDSTpDoIPClient_t *tp) {
+    if (NULL == tp) {
+        return;
+    }
+    DoIPConnClose(&tp->conn);
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Vehicle discovery
+ */
+
+UDSErr_t UDSTpDoIPDiscoveryInit(UDSTpDoIPDiscovery_t *d, const char *addr, uint16_t port) {
+    if (NULL == d || NULL == addr) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    struct sockaddr_storage sa;
+    socklen_t sa_len = 0;
+    d->fd = -1;
+    if (DoIPResolve(addr, port ? port : UDS_DOIP_PORT, SOCK_DGRAM, &sa, &sa_len) < 0) {
+        return UDS_FAIL;
+    }
+    d->fd = socket(sa.ss_family, SOCK_DGRAM, 0);
+    if (d->fd < 0) {
+        return UDS_FAIL;
+    }
+    int one = 1;
+    (void)setsockopt(d->fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    uint8_t req[DOIP_HEADER_LEN];
+    DoIPPutHeader(req, DOIP_VEHICLE_ID_REQ, 0);
+    if (DoIPSetNonBlocking(d->fd) < 0 ||
+        sendto(d->fd, req, sizeof(req), 0, (struct sockaddr *)&sa, sa_len) < 0) {
+        UDS_LOGE(__FILE__, "DoIP: vehicle identification request failed: %s", strerror(errno));
+        UDSTpDoIPDiscoveryDeinit(d);
+        return UDS_FAIL;
+    }
+    return UDS_OK;
+}
+
+int UDSTpDoIPDiscoveryPoll(UDSTpDoIPDiscovery_t *d, UDSTpDoIPVehicle_t *vehicle) {
+    if (NULL == d || NULL == vehicle || d->fd < 0) {
+        return -1;
+    }
+    uint8_t msg[64];
+    for (;;) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n =
+            recvfrom(d->fd, msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            return (EAGAIN == errno || EWOULDBLOCK == errno) ? 0 : -1;
+        }
+        if (n < DOIP_HEADER_LEN + DOIP_VEHICLE_ID_RES_LEN || !DoIPHeaderValid(msg, true) ||
+            DoIPGetBE16(msg + 2) != DOIP_VEHICLE_ANNOUNCEMENT) {
+            continue;
+        }
+        const uint8_t *p = msg + DOIP_HEADER_LEN;
+        memcpy(vehicle->vin, p, sizeof(vehicle->vin));
+        vehicle->logical_address = DoIPGetBE16(p + 17);
+        memcpy(vehicle->eid, p + 19, sizeof(vehicle->eid));
+        memcpy(vehicle->gid, p + 25, sizeof(vehicle->gid));
+        vehicle->further_action = p[31];
+        const void *ip = AF_INET6 == from.ss_family
+                             ? (const void *)&((struct sockaddr_in6 *)&from)->sin6_addr
+                             : (const void *)&((struct sockaddr_in *)&from)->sin_addr;
+        if (NULL == inet_ntop(from.ss_family, ip, vehicle->addr, sizeof(vehicle->addr))) {
+            vehicle->addr[0] = '\0';
+        }
+        return 1;
+    }
+}
+
+void UDSTpDoIPDiscoveryDeinit(UDSTpDoIPDiscovery_t *d) {
+    if (d && d->fd >= 0) {
+        close(d->fd);
+        d->fd = -1;
+    }
+}
+
+#endif
+
+
+#ifdef UDS_LINES
+#line 1 "src/tp/doip_gateway.c"
+#endif
+#if defined(UDS_TP_DOIP)
+
+#include <string.h>
+
+static bool DoIPGatewayIsTarget(void *arg, uint16_t ta) {
+    const UDSTpDoIPGateway_t *gw = (const UDSTpDoIPGateway_t *)arg;
+    for (int i = 0; i < gw->num_routes; i++) {
+        if (gw->routes[i].logical_address == ta) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void DoIPGatewayEndRequest(UDSTpDoIPGateway_t *gw, UDSTpDoIPGatewayRoute_t *r) {
+    UDSTpDoIPServerGiveBack(gw->doip, r->req_slot);
+    r->req_slot = -1;
+}
+
+static void DoIPGatewayForwardRequest(UDSTpDoIPGateway_t *gw, UDSTpDoIPGatewayRoute_t *r,
+                                      UDSTpStatus_t status) {
+    UDSTpDoIPServer_t *doip = gw->doip;
+    if (r->req_slot < 0) {
+        r->req_slot = UDSTpDoIPServerTake(doip, r->logical_address);
+        if (r->req_slot < 0) {
+            return;
+        }
+        r->req_available = 0;
+        r->req_started = false;
+        r->req_done = false;
+        r->tester_addr = (uint16_t)doip->rx_slots[r->req_slot].info.A_SA;
+        r->phys_awaiting = true;
+    }
+    const UDSTpDoIPRxSlot_t *slot = &doip->rx_slots[r->req_slot];
+
+    if (r->req_done) {
+        // the link sends from the slot until it is done
+        if (0 == (status & UDS_TP_SEND_IN_PROGRESS)) {
+            DoIPGatewayEndRequest(gw, r);
+        }
+        return;
+    }
+
+    if (UDS_DOIP_SLOT_ABORTED == slot->state || (r->req_started && (status & UDS_TP_ERR))) {
+        UDS_LOGI(__FILE__, "DoIP gateway: request to 0x%04X aborted", r->logical_address);
+        if (r->req_started) {
+            (void)UDSTpSendPartial(r->tp, NULL, 0, 0, NULL);
+        }
+        r->phys_awaiting = false;
+        DoIPGatewayEndRequest(gw, r);
+        return;
+    }
+
+    if (r->req_started && slot->received == r->req_available) {
+        return;
+    }
+    UDSSDU_t info = {
+        .A_Mtype = UDS_A_MTYPE_DIAG,
+        .A_SA = slot->info.A_SA,
+        .A_TA = r->logical_address,
+        .A_TA_Type = UDS_A_TA_TYPE_PHYSICAL,
+    };
+    ssize_t ret = UDSTpSendPartial(r->tp, slot->buf, slot->len, slot->received, &info);
+    if (ret < 0) {
+        UDS_LOGW(__FILE__, "DoIP gateway: cannot forward to 0x%04X: %zd", r->logical_address, ret);
+        if (r->req_started) {
+            (void)UDSTpSendPartial(r->tp, NULL, 0, 0, NULL);
+        }
+        r->phys_awaiting = false;
+        DoIPGatewayEndRequest(gw, r);
+    } else if (ret > 0) {
+        r->req_started = true;
+        r->req_available = slot->received;
+        r->req_done = slot->received == slot->len;
+    }
+}
+
+// functional requests go out on every link marked functional, the slot is given back once they
+// were all sent
+static void DoIPGatewayForwardFunctional(UDSTpDoIPGateway_t *gw, const UDSTpStatus_t *status) {
+    UDSTpDoIPServer_t *doip = gw->doip;
+    if (gw->func_slot < 0) {
+        gw->func_slot = UDSTpDoIPServerTake(doip, doip->func_address);
+        if (gw->func_slot < 0) {
+            return;
+        }
+        // every ECU on the bus may answer, also those behind routes sharing a functional link
+        for (int i = 0; i < gw->num_routes; i++) {
+            gw->routes[i].func_pending = gw->routes[i].functional;
+            gw->routes[i].func_tester_addr = (uint16_t)doip->rx_slots[gw->func_slot].info.A_SA;
+            gw->routes[i].func_awaiting = true;
+        }
+    }
+    const UDSTpDoIPRxSlot_t *slot = &doip->rx_slots[gw->func_slot];
+    bool busy = false;
+
+    if (UDS_DOIP_SLOT_ABORTED == slot->state) {
+        for (int i = 0; i < gw->num_routes; i++) {
+            gw->routes[i].func_pending = false;
+        }
+    } else if (UDS_DOIP_SLOT_READY != slot->state) {
+        return;
+    }
+
+    for (int i = 0; i < gw->num_routes; i++) {
+        UDSTpDoIPGatewayRoute_t *r = &gw->routes[i];
+        if (r->func_pending) {
+            UDSSDU_t info = {
+                .A_Mtype = UDS_A_MTYPE_DIAG,
+                .A_SA = slot->info.A_SA,
+                .A_TA = doip->func_address,
+                .A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL,
+            };
+            if (UDSTpSend(r->tp, slot->buf, (ssize_t)slot->len, &info) < 0) {
+                UDS_LOGW(__FILE__, "DoIP gateway: cannot forward functional request to 0x%04X",
+                         r->logical_address);
+            }
+            r->func_pending = false;
+            busy = true;
+        } else if (r->functional && (status[i] & UDS_TP_SEND_IN_PROGRESS)) {
+            busy = true;
+        }
+    }
+    if (!busy) {
+        UDSTpDoIPServerGiveBack(doip, gw->func_slot);
+        gw->func_slot = -1;
+    }
+}
+
+// marks the request answered by the response about to be forwarded unless it is NRC 0x78
+static void DoIPGatewayAnswered(UDSTpDoIPGatewayRoute_t *r, bool functional) {
+    if (r->resp_len >= 3 && 0x7F == r->resp_data[0] &&
+        UDS_NRC_RequestCorrectlyReceived_ResponsePending == r->resp_data[2]) {
+        return;
+    }
+    if (functional) {
+        r->func_awaiting = false;
+    } else {
+        r->phys_awaiting = false;
+    }
+}
+
+static void DoIPGatewayForwardResponse(UDSTpDoIPGateway_t *gw, UDSTpDoIPGatewayRoute_t *r) {
+    if (0 == r->resp_len) {
+        ssize_t len = UDSTpPeek(r->tp, &r->resp_data, NULL);
+        if (len <= 0) {
+            return;
+        }
+        r->resp_len = (size_t)len;
+        r->resp_sent = false;
+    }
+
+    if (!r->resp_sent) {
+        // a pending physical request is answered first, the ECU serves requests in order
+        bool functional = r->func_awaiting && !r->phys_awaiting;
+        uint16_t ta = functional ? r->func_tester_addr : r->tester_addr;
+        UDSSDU_t info = {
+            .A_Mtype = UDS_A_MTYPE_DIAG,
+            .A_SA = r->logical_address,
+            .A_TA = ta,
+            .A_TA_Type = UDS_A_TA_TYPE_PHYSICAL,
+        };
+        ssize_t ret =
+            ta ? UDSTpSend(&gw->doip->hdl, r->resp_data, (ssize_t)r->resp_len, &info) : -1;
+        if (-2 == ret) {
+            // the tester's connection is still sending another response
+            return;
+        }
+        DoIPGatewayAnswered(r, functional);
+        if (ret < 0) {
+            UDS_LOGW(__FILE__, "DoIP gateway: dropping response of 0x%04X", r->logical_address);
+            UDSTpRelease(r->tp);
+            r->resp_len = 0;
+            return;
+        }
+        r->resp_sent = true;
+    }
+
+    if (!UDSTpDoIPServerSending(gw->doip, r->resp_data)) {
+        UDSTpRelease(r->tp);
+        r->resp_len = 0;
     }
 }
 
-void ISOTPMockLogToStdout(void) {
-    if (LogFile) {
-        return;
+UDSErr_t UDSTpDoIPGatewayInit(UDSTpDoIPGateway_t *gw, UDSTpDoIPServer_t *doip) {
+    if (NULL == gw || NULL == doip) {
+        return UDS_ERR_INVALID_ARG;
     }
-    LogFile = stdout;
+    memset(gw, 0, sizeof(*gw));
+    gw->doip = doip;
+    gw->func_slot = -1;
+    doip->is_target = DoIPGatewayIsTarget;
+    doip->is_target_arg = gw;
+    return UDS_OK;
 }
 
-void ISOTPMockReset(void) {
-    memset(TPs, 0, sizeof(TPs));
-    TPCount = 0;
-    memset(msgs, 0, sizeof(msgs));
-    MsgCount = 0;
+UDSErr_t UDSTpDoIPGatewayAddRoute(UDSTpDoIPGateway_t *gw, uint16_t logical_address, UDSTp_t *tp,
+                                  bool functional) {
+    if (NULL == gw || NULL == tp || NULL == tp->peek || NULL == tp->release) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    if (gw->num_routes >= UDS_DOIP_GATEWAY_MAX_ROUTES) {
+        return UDS_ERR_BUFSIZ;
+    }
+    UDSTpDoIPGatewayRoute_t *r = &gw->routes[gw->num_routes++];
+    memset(r, 0, sizeof(*r));
+    r->logical_address = logical_address;
+    r->tp = tp;
+    r->functional = functional;
+    r->req_slot = -1;
+    return UDS_OK;
 }
 
-void ISOTPMockFree(UDSTp_t *tp) {
-    ISOTPMock_t *tpm = (ISOTPMock_t *)tp;
-    ISOTPMockDetach(tpm);
-    free(tp);
+void UDSTpDoIPGatewayPoll(UDSTpDoIPGateway_t *gw) {
+    UDS_ASSERT(gw);
+    UDSTpStatus_t status[UDS_DOIP_GATEWAY_MAX_ROUTES];
+    UDSTpPoll(&gw->doip->hdl);
+    for (int i = 0; i < gw->num_routes; i++) {
+        status[i] = UDSTpPoll(gw->routes[i].tp);
+    }
+    for (int i = 0; i < gw->num_routes; i++) {
+        DoIPGatewayForwardRequest(gw, &gw->routes[i], status[i]);
+    }
+    DoIPGatewayForwardFunctional(gw, status);
+    for (int i = 0; i < gw->num_routes; i++) {
+        DoIPGatewayForwardResponse(gw, &gw->routes[i]);
+    }
 }
 
 #endif
@@ -3749,129 +7300,164 @@ static uint32_t isotp_st_min_to_us(uint8_t st_min) {
     return 0;
 }
 
-static int isotp_send_flow_control(const IsoTpLink* link, uint8_t flow_status, uint8_t block_size, uint32_t st_min_us) {
+/* round a frame length up to the next valid CAN-FD data length */
+static uint8_t isotp_can_dl_round_up(uint8_t size) {
+    static const uint8_t can_fd_dls[] = {12, 16, 20, 24, 32, 48, 64};
+    uint8_t i;
 
-    IsoTpCanMessage message;
-    int ret;
-    uint8_t size = 0;
+    if (size <= ISOTP_CAN_DL) {
+        return size;
+    }
+    for (i = 0; i < sizeof(can_fd_dls); i++) {
+        if (size <= can_fd_dls[i]) {
+            return can_fd_dls[i];
+        }
+    }
+    return ISOTP_CAN_FD_MAX_DL;
+}
 
-    /* setup message  */
-    message.as.flow_control.type = ISOTP_PCI_TYPE_FLOW_CONTROL_FRAME;
-    message.as.flow_control.FS = flow_status;
-    message.as.flow_control.BS = block_size;
-    message.as.flow_control.STmin = isotp_us_to_st_min(st_min_us);
+/* largest SF_DL for a given frame length, 7 for classic CAN */
+static uint16_t isotp_sf_max_size(uint8_t dl) {
+    return dl <= ISOTP_CAN_DL ? (uint16_t)(dl - 1) : (uint16_t)(dl - 2);
+}
+
+/* frame bytes available to the PCI and payload: TX_DL less the address byte */
+static uint8_t isotp_send_pdu_dl(const IsoTpLink* link) {
+    return (uint8_t) (link->send_dl - link->addr_ext_len);
+}
+
+/* largest SF_DL in a frame of dl bytes, the address byte taken into account */
+static uint16_t isotp_link_sf_max_size(const IsoTpLink* link, uint8_t dl) {
+    return isotp_sf_max_size((uint8_t) (dl - link->addr_ext_len));
+}
+
+/* prepend the address byte, pad the frame to a valid length and hand it to the user shim.
+ * frame holds ISOTP_CAN_FD_MAX_DL bytes. */
+static int isotp_send_frame(const IsoTpLink* link, uint32_t id, uint8_t* frame, uint8_t size) {
+    uint8_t padded_size;
+
+    if (link->addr_ext_len) {
+        (void) memmove(frame + 1, frame, size);
+        frame[0] = link->send_addr_ext;
+        size++;
+    }
+    padded_size = size;
 
-    /* send message */
 #ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.flow_control.reserve, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.flow_control.reserve));
-    size = sizeof(message);
-#else
-    size = 3;
+    if (padded_size < ISOTP_CAN_DL) {
+        padded_size = ISOTP_CAN_DL;
+    }
 #endif
+    padded_size = isotp_can_dl_round_up(padded_size);
+    (void) memset(frame + size, ISO_TP_FRAME_PADDING_VALUE, padded_size - size);
 
-    ret = isotp_user_send_can(link->send_arbitration_id, message.as.data_array.ptr, size
+    return isotp_user_send_can(id, frame, padded_size
     #if defined (ISO_TP_USER_SEND_CAN_ARG)
     ,link->user_send_can_arg
     #endif
     );
+}
 
-    return ret;
+static int isotp_send_flow_control(const IsoTpLink* link, uint8_t flow_status, uint8_t block_size, uint32_t st_min_us) {
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+
+    /* setup message  */
+    frame[0] = (uint8_t) ((ISOTP_PCI_TYPE_FLOW_CONTROL_FRAME << 4) | (flow_status & 0x0F));
+    frame[1] = block_size;
+    frame[2] = isotp_us_to_st_min(st_min_us);
+
+    /* send message */
+    return isotp_send_frame(link, link->send_arbitration_id, frame, 3);
 }
 
 static int isotp_send_single_frame(const IsoTpLink* link, uint32_t id) {
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+    uint8_t pci_size;
 
-    IsoTpCanMessage message;
-    int ret;
-    uint8_t size = 0;
-    (void)id;
-
-    /* multi frame message length must greater than 7  */
-    assert(link->send_size <= 7);
+    /* multi frame message length must greater than the single frame capacity */
+    assert(link->send_size <= isotp_single_frame_max_size(link));
 
     /* setup message  */
-    message.as.single_frame.type = ISOTP_PCI_TYPE_SINGLE;
-    message.as.single_frame.SF_DL = (uint8_t) link->send_size;
-    (void) memcpy(message.as.single_frame.data, link->send_buffer, link->send_size);
+    if (link->send_size <= isotp_link_sf_max_size(link, ISOTP_CAN_DL)) {
+        frame[0] = (uint8_t) ((ISOTP_PCI_TYPE_SINGLE << 4) | link->send_size);
+        pci_size = 1;
+    } else {
+        /* CAN-FD escape sequence: SF_DL moves to the second byte */
+        frame[0] = (uint8_t) (ISOTP_PCI_TYPE_SINGLE << 4);
+        frame[1] = (uint8_t) link->send_size;
+        pci_size = 2;
+    }
+    (void) memcpy(frame + pci_size, link->send_data, link->send_size);
 
     /* send message */
-#ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.single_frame.data + link->send_size, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.single_frame.data) - link->send_size);
-    size = sizeof(message);
-#else
-    size = link->send_size + 1;
-#endif
-
-    ret = isotp_user_send_can(link->send_arbitration_id, message.as.data_array.ptr, size
-    #if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-    #endif
-    );
-
-    return ret;
+    return isotp_send_frame(link, id, frame, (uint8_t) (pci_size + link->send_size));
 }
 
 static int isotp_send_first_frame(IsoTpLink* link, uint32_t id) {
-    
-    IsoTpCanMessage message;
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+    uint8_t pci_size;
+    uint8_t data_length;
     int ret;
 
-    /* multi frame message length must greater than 7  */
-    assert(link->send_size > 7);
+    /* multi frame message length must greater than the single frame capacity */
+    assert(link->send_size > isotp_single_frame_max_size(link));
 
     /* setup message  */
-    message.as.first_frame.type = ISOTP_PCI_TYPE_FIRST_FRAME;
-    message.as.first_frame.FF_DL_low = (uint8_t) link->send_size;
-    message.as.first_frame.FF_DL_high = (uint8_t) (0x0F & (link->send_size >> 8));
-    (void) memcpy(message.as.first_frame.data, link->send_buffer, sizeof(message.as.first_frame.data));
+    if (link->send_size <= ISOTP_FF_DL_12BIT_MAX) {
+        frame[0] = (uint8_t) ((ISOTP_PCI_TYPE_FIRST_FRAME << 4) | (0x0F & (link->send_size >> 8)));
+        frame[1] = (uint8_t) link->send_size;
+        pci_size = 2;
+    } else {
+        /* escape sequence: FF_DL is sent as a 32-bit value after a zero 12-bit FF_DL */
+        frame[0] = (uint8_t) (ISOTP_PCI_TYPE_FIRST_FRAME << 4);
+        frame[1] = 0;
+        frame[2] = (uint8_t) ((uint32_t) link->send_size >> 24);
+        frame[3] = (uint8_t) ((uint32_t) link->send_size >> 16);
+        frame[4] = (uint8_t) (link->send_size >> 8);
+        frame[5] = (uint8_t) link->send_size;
+        pci_size = 6;
+    }
+    data_length = (uint8_t) (isotp_send_pdu_dl(link) - pci_size);
+    (void) memcpy(frame + pci_size, link->send_data, data_length);
 
     /* send message */
-    ret = isotp_user_send_can(id, message.as.data_array.ptr, sizeof(message) 
-    #if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-    #endif
-
-    );
+    ret = isotp_send_frame(link, id, frame, isotp_send_pdu_dl(link));
     if (ISOTP_RET_OK == ret) {
-        link->send_offset += sizeof(message.as.first_frame.data);
+        link->send_offset += data_length;
         link->send_sn = 1;
     }
 
     return ret;
 }
 
+/* payload offset after the next consecutive frame */
+static uint32_t isotp_consecutive_frame_end(const IsoTpLink* link) {
+    uint32_t data_length = link->send_size - link->send_offset;
+    if (data_length > (uint32_t) (isotp_send_pdu_dl(link) - 1)) {
+        data_length = (uint32_t) (isotp_send_pdu_dl(link) - 1);
+    }
+    return link->send_offset + data_length;
+}
+
 static int isotp_send_consecutive_frame(IsoTpLink* link) {
-    
-    IsoTpCanMessage message;
-    uint16_t data_length;
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+    uint8_t data_length;
     int ret;
-    uint8_t size = 0;
 
-    /* multi frame message length must greater than 7  */
-    assert(link->send_size > 7);
+    /* multi frame message length must greater than the single frame capacity */
+    assert(link->send_size > isotp_single_frame_max_size(link));
 
     /* setup message  */
-    message.as.consecutive_frame.type = TSOTP_PCI_TYPE_CONSECUTIVE_FRAME;
-    message.as.consecutive_frame.SN = link->send_sn;
-    data_length = link->send_size - link->send_offset;
-    if (data_length > sizeof(message.as.consecutive_frame.data)) {
-        data_length = sizeof(message.as.consecutive_frame.data);
+    frame[0] = (uint8_t) ((TSOTP_PCI_TYPE_CONSECUTIVE_FRAME << 4) | (link->send_sn & 0x0F));
+    if (isotp_consecutive_frame_end(link) > link->send_available) {
+        /* the data of this frame hasn't arrived yet, see isotp_send_partial */
+        return ISOTP_RET_NO_DATA;
     }
-    (void) memcpy(message.as.consecutive_frame.data, link->send_buffer + link->send_offset, data_length);
+    data_length = (uint8_t) (isotp_consecutive_frame_end(link) - link->send_offset);
+    (void) memcpy(frame + 1, link->send_data + link->send_offset, data_length);
 
     /* send message */
-#ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.consecutive_frame.data + data_length, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.consecutive_frame.data) - data_length);
-    size = sizeof(message);
-#else
-    size = data_length + 1;
-#endif
-
-    ret = isotp_user_send_can(link->send_arbitration_id,
-            message.as.data_array.ptr, size
-#if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-#endif
-    );
+    ret = isotp_send_frame(link, link->send_arbitration_id, frame, (uint8_t) (data_length + 1));
 
     if (ISOTP_RET_OK == ret) {
         link->send_offset += data_length;
@@ -3883,72 +7469,137 @@ static int isotp_send_consecutive_frame(IsoTpLink* link) {
     return ret;
 }
 
-static int isotp_receive_single_frame(IsoTpLink* link, const IsoTpCanMessage* message, uint8_t len) {
+/* give a pool block back to the pool and receive into the link's own buffer again */
+static void isotp_receive_buffer_reset(IsoTpLink *link) {
+    if (link->receive_buffer == link->receive_own_buffer) {
+        return;
+    }
+
+    isotp_pool_put(link->receive_pool, link->receive_buffer);
+    link->receive_buffer = link->receive_own_buffer;
+    link->receive_buf_size = link->receive_own_buf_size;
+}
+
+/* select the receive buffer for a message of size bytes: single frames go to the link's own
+ * buffer, multi-frame messages to a block of the pool if the link has one */
+static int isotp_receive_buffer_acquire(IsoTpLink *link, uint32_t size, uint8_t multi_frame) {
+    IsoTpBufferPool *pool = link->receive_pool;
+    uint8_t i;
+
+    isotp_receive_buffer_reset(link);
+
+    if (NULL == pool || !multi_frame) {
+        return size <= link->receive_buf_size ? ISOTP_RET_OK : ISOTP_RET_OVERFLOW;
+    }
+
+    if (size > pool->block_size) {
+        return ISOTP_RET_OVERFLOW;
+    }
+
+    for (i = 0; i < pool->num_blocks; i++) {
+        if (0 == (pool->in_use & ((uint32_t) 1 << i))) {
+            pool->in_use |= (uint32_t) 1 << i;
+            link->receive_buffer = pool->blocks + (uint32_t) i * pool->block_size;
+            link->receive_buf_size = pool->block_size;
+            return ISOTP_RET_OK;
+        }
+    }
+
+    isotp_user_debug("Receive buffer pool exhausted.");
+    return ISOTP_RET_OVERFLOW;
+}
+
+static int isotp_receive_single_frame(IsoTpLink* link, const uint8_t* data, uint8_t len) {
+    uint16_t sf_dl = data[0] & 0x0F;
+    uint8_t pci_size = 1;
+
+    /* CAN-FD escape sequence: a zero SF_DL nibble is followed by an 8-bit SF_DL */
+    if (0 == sf_dl && len + link->addr_ext_len > ISOTP_CAN_DL) {
+        sf_dl = data[1];
+        pci_size = 2;
+    }
+
     /* check data length */
-    if ((0 == message->as.single_frame.SF_DL) || (message->as.single_frame.SF_DL > (len - 1))) {
+    if ((0 == sf_dl) || (sf_dl > (len - pci_size))) {
         isotp_user_debug("Single-frame length too small.");
         return ISOTP_RET_LENGTH;
     }
 
+    if (ISOTP_RET_OK != isotp_receive_buffer_acquire(link, sf_dl, 0)) {
+        isotp_user_debug("Single-frame too large for receiving buffer.");
+        return ISOTP_RET_OVERFLOW;
+    }
+
     /* copying data */
-    (void) memcpy(link->receive_buffer, message->as.single_frame.data, message->as.single_frame.SF_DL);
-    link->receive_size = message->as.single_frame.SF_DL;
+    (void) memcpy(link->receive_buffer, data + pci_size, sf_dl);
+    link->receive_size = sf_dl;
     
     return ISOTP_RET_OK;
 }
 
-static int isotp_receive_first_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
-    uint16_t payload_length;
+static int isotp_receive_first_frame(IsoTpLink *link, const uint8_t* data, uint8_t len) {
+    uint32_t payload_length;
+    uint8_t pci_size = 2;
+    const uint8_t can_dl = (uint8_t) (len + link->addr_ext_len);
 
-    if (8 != len) {
-        isotp_user_debug("First frame should be 8 bytes in length.");
+    /* a first frame always uses the full RX_DL */
+    if (can_dl < ISOTP_CAN_DL || can_dl != isotp_can_dl_round_up(can_dl)) {
+        isotp_user_debug("First frame should be at least 8 bytes in length.");
         return ISOTP_RET_LENGTH;
     }
 
     /* check data length */
-    payload_length = message->as.first_frame.FF_DL_high;
-    payload_length = (uint16_t)(payload_length << 8) + message->as.first_frame.FF_DL_low;
+    payload_length = data[0] & 0x0F;
+    payload_length = (payload_length << 8) + data[1];
+
+    /* escape sequence: 32-bit FF_DL */
+    if (0 == payload_length) {
+        payload_length = ((uint32_t) data[2] << 24) | ((uint32_t) data[3] << 16) |
+                         ((uint32_t) data[4] << 8) | (uint32_t) data[5];
+        pci_size = 6;
+    }
 
     /* should not use multiple frame transmition */
-    if (payload_length <= 7) {
+    if (payload_length <= isotp_link_sf_max_size(link, can_dl)) {
         isotp_user_debug("Should not use multiple frame transmission.");
         return ISOTP_RET_LENGTH;
     }
     
-    if (payload_length > link->receive_buf_size) {
+    if (ISOTP_RET_OK != isotp_receive_buffer_acquire(link, payload_length, 1)) {
         isotp_user_debug("Multi-frame response too large for receiving buffer.");
         return ISOTP_RET_OVERFLOW;
     }
     
     /* copying data */
-    (void) memcpy(link->receive_buffer, message->as.first_frame.data, sizeof(message->as.first_frame.data));
+    (void) memcpy(link->receive_buffer, data + pci_size, len - pci_size);
     link->receive_size = payload_length;
-    link->receive_offset = sizeof(message->as.first_frame.data);
+    link->receive_offset = (uint32_t) (len - pci_size);
+    link->receive_dl = len;
     link->receive_sn = 1;
 
     return ISOTP_RET_OK;
 }
 
-static int isotp_receive_consecutive_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
-    uint16_t remaining_bytes;
+static int isotp_receive_consecutive_frame(IsoTpLink *link, const uint8_t* data, uint8_t len) {
+    uint32_t remaining_bytes;
     
     /* check sn */
-    if (link->receive_sn != message->as.consecutive_frame.SN) {
+    if (link->receive_sn != (data[0] & 0x0F)) {
         return ISOTP_RET_WRONG_SN;
     }
 
     /* check data length */
     remaining_bytes = link->receive_size - link->receive_offset;
-    if (remaining_bytes > sizeof(message->as.consecutive_frame.data)) {
-        remaining_bytes = sizeof(message->as.consecutive_frame.data);
+    if (remaining_bytes > (uint32_t) (link->receive_dl - 1)) {
+        remaining_bytes = (uint32_t) (link->receive_dl - 1);
     }
-    if (remaining_bytes > len - 1) {
+    if (remaining_bytes + 1 > len) {
         isotp_user_debug("Consecutive frame too short.");
         return ISOTP_RET_LENGTH;
     }
 
     /* copying data */
-    (void) memcpy(link->receive_buffer + link->receive_offset, message->as.consecutive_frame.data, remaining_bytes);
+    (void) memcpy(link->receive_buffer + link->receive_offset, data + 1, remaining_bytes);
 
     link->receive_offset += remaining_bytes;
     if (++(link->receive_sn) > 0x0F) {
@@ -3958,10 +7609,10 @@ static int isotp_receive_consecutive_frame(IsoTpLink *link, IsoTpCanMessage *mes
     return ISOTP_RET_OK;
 }
 
-static int isotp_receive_flow_control_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
+static int isotp_receive_flow_control_frame(IsoTpLink *link, const uint8_t* data, uint8_t len) {
     /* unused args */
     (void) link;
-    (void) message;
+    (void) data;
 
     /* check message length */
     if (len < 3) {
@@ -3976,11 +7627,20 @@ static int isotp_receive_flow_control_frame(IsoTpLink *link, IsoTpCanMessage *me
 ///                 PUBLIC FUNCTIONS                ///
 ///////////////////////////////////////////////////////
 
-int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size) {
+int isotp_send(IsoTpLink *link, const uint8_t payload[], uint32_t size) {
     return isotp_send_with_id(link, link->send_arbitration_id, payload, size);
 }
 
-int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint16_t size) {
+/* bytes of the payload needed to send the single or first frame */
+static uint32_t isotp_first_frame_need(const IsoTpLink *link, uint32_t size) {
+    if (size <= isotp_single_frame_max_size(link)) {
+        return size;
+    }
+    return (uint32_t) (isotp_send_pdu_dl(link) - (size <= ISOTP_FF_DL_12BIT_MAX ? 2 : 6));
+}
+
+static int isotp_send_start(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size,
+                            uint32_t available) {
     int ret;
 
     if (link == 0x0) {
@@ -3992,7 +7652,7 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
         isotp_user_debug("Message size too large. Increase ISO_TP_MAX_MESSAGE_SIZE to set a larger buffer\n");
         const int32_t messageSize = 128;
         char message[messageSize];
-        int32_t writtenChars = sprintf(&message[0], "Attempted to send %d bytes; max size is %d!\n", size, link->send_buf_size);
+        int32_t writtenChars = sprintf(&message[0], "Attempted to send %lu bytes; max size is %lu!\n", (unsigned long) size, (unsigned long) link->send_buf_size);
 
         assert(writtenChars <= messageSize);
         (void) writtenChars;
@@ -4006,12 +7666,19 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
         return ISOTP_RET_INPROGRESS;
     }
 
-    /* copy into local buffer */
     link->send_size = size;
     link->send_offset = 0;
-    (void) memcpy(link->send_buffer, payload, size);
+    link->send_available = available;
+    if (NULL == link->send_buffer) {
+        /* no local buffer, send from the caller's buffer */
+        link->send_data = payload;
+    } else {
+        /* copy into local buffer */
+        (void) memcpy(link->send_buffer, payload, size);
+        link->send_data = link->send_buffer;
+    }
  
-    if (link->send_size < 8) {
+    if (link->send_size <= isotp_single_frame_max_size(link)) {
         /* send single frame */
         ret = isotp_send_single_frame(link, id);
     } else {
@@ -4024,7 +7691,7 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
             link->send_st_min_us = 0;
             link->send_wtf_count = 0;
             link->send_timer_st = isotp_user_get_us();
-            link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+            link->send_timer_bs = isotp_user_get_us() + link->param_n_bs_us;
             link->send_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
             link->send_status = ISOTP_SEND_STATUS_INPROGRESS;
         }
@@ -4033,19 +7700,83 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
     return ret;
 }
 
+int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size) {
+    return isotp_send_start(link, id, payload, size, size);
+}
+
+int isotp_send_partial(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size,
+                       uint32_t available) {
+    if (link == 0x0 || available > size) {
+        return ISOTP_RET_ERROR;
+    }
+
+    /* the rest of the payload is read from the caller's buffer as it arrives */
+    if (NULL != link->send_buffer) {
+        isotp_user_debug("Partial sends need a link without a send buffer\n");
+        return ISOTP_RET_ERROR;
+    }
+
+    if (available < isotp_first_frame_need(link, size)) {
+        return ISOTP_RET_NO_DATA;
+    }
+
+    return isotp_send_start(link, id, payload, size, available);
+}
+
+int isotp_send_extend(IsoTpLink *link, uint32_t available) {
+    if (ISOTP_SEND_STATUS_INPROGRESS != link->send_status || available > link->send_size ||
+        available < link->send_available) {
+        return ISOTP_RET_ERROR;
+    }
+
+    link->send_available = available;
+
+    return ISOTP_RET_OK;
+}
+
+void isotp_send_abort(IsoTpLink *link) {
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        link->send_status = ISOTP_SEND_STATUS_IDLE;
+    }
+}
+
+/* a complete message waits in the link until it is read or released */
+static int isotp_receive_held(const IsoTpLink *link) {
+    return ISOTP_RECEIVE_STATUS_FULL == link->receive_status ||
+           ISOTP_RECEIVE_STATUS_LENT == link->receive_status;
+}
+
 void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
-    IsoTpCanMessage message;
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
     int ret;
     
-    if (len < 2 || len > 8) {
+    if (len > ISOTP_CAN_FD_MAX_DL) {
+        return;
+    }
+
+    /* extended and mixed addressing: the frame is for this link if the address byte matches */
+    if (link->addr_ext_len) {
+        if (len < 1 || data[0] != link->receive_addr_ext) {
+            return;
+        }
+        data++;
+        len--;
+    }
+
+    if (len < 2) {
         return;
     }
 
-    memcpy(message.as.data_array.ptr, data, len);
-    memset(message.as.data_array.ptr + len, 0, sizeof(message.as.data_array.ptr) - len);
+    memcpy(frame, data, len);
+    memset(frame + len, 0, sizeof(frame) - len);
 
-    switch (message.as.common.type) {
+    switch (frame[0] >> 4) {
         case ISOTP_PCI_TYPE_SINGLE: {
+            /* the received message wasn't read yet, it is not overwritten */
+            if (isotp_receive_held(link)) {
+                break;
+            }
+
             /* update protocol result */
             if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
@@ -4054,7 +7785,14 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_single_frame(link, &message, len);
+            ret = isotp_receive_single_frame(link, frame, len);
+
+            /* if overflow happened */
+            if (ISOTP_RET_OVERFLOW == ret) {
+                link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
+                link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                break;
+            }
             
             if (ISOTP_RET_OK == ret) {
                 /* change status */
@@ -4063,6 +7801,12 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             break;
         }
         case ISOTP_PCI_TYPE_FIRST_FRAME: {
+            /* the received message wasn't read yet, the sender is told it doesn't fit */
+            if (isotp_receive_held(link)) {
+                isotp_send_flow_control(link, PCI_FLOW_STATUS_OVERFLOW, 0, 0);
+                break;
+            }
+
             /* update protocol result */
             if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
@@ -4071,7 +7815,7 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_first_frame(link, &message, len);
+            ret = isotp_receive_first_frame(link, frame, len);
 
             /* if overflow happened */
             if (ISOTP_RET_OVERFLOW == ret) {
@@ -4089,10 +7833,10 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
                 /* change status */
                 link->receive_status = ISOTP_RECEIVE_STATUS_INPROGRESS;
                 /* send fc frame */
-                link->receive_bs_count = ISO_TP_DEFAULT_BLOCK_SIZE;
-                isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
+                link->receive_bs_count = link->param_block_size;
+                isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, link->param_st_min_us);
                 /* refresh timer cs */
-                link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                link->receive_timer_cr = isotp_user_get_us() + link->param_n_cr_us;
             }
             
             break;
@@ -4105,28 +7849,29 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_consecutive_frame(link, &message, len);
+            ret = isotp_receive_consecutive_frame(link, frame, len);
 
             /* if wrong sn */
             if (ISOTP_RET_WRONG_SN == ret) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_WRONG_SN;
                 link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                isotp_receive_buffer_reset(link);
                 break;
             }
 
             /* if success */
             if (ISOTP_RET_OK == ret) {
                 /* refresh timer cs */
-                link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                link->receive_timer_cr = isotp_user_get_us() + link->param_n_cr_us;
                 
                 /* receive finished */
                 if (link->receive_offset >= link->receive_size) {
                     link->receive_status = ISOTP_RECEIVE_STATUS_FULL;
                 } else {
-                    /* send fc when bs reaches limit */
-                    if (0 == --link->receive_bs_count) {
-                        link->receive_bs_count = ISO_TP_DEFAULT_BLOCK_SIZE;
-                        isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
+                    /* send fc when bs reaches limit, a block size of 0 means no limit */
+                    if (0 != link->receive_bs_count && 0 == --link->receive_bs_count) {
+                        link->receive_bs_count = link->param_block_size;
+                        isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, link->param_st_min_us);
                     }
                 }
             }
@@ -4140,37 +7885,37 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_flow_control_frame(link, &message, len);
+            ret = isotp_receive_flow_control_frame(link, frame, len);
             
             if (ISOTP_RET_OK == ret) {
                 /* refresh bs timer */
-                link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                link->send_timer_bs = isotp_user_get_us() + link->param_n_bs_us;
 
                 /* overflow */
-                if (PCI_FLOW_STATUS_OVERFLOW == message.as.flow_control.FS) {
+                if (PCI_FLOW_STATUS_OVERFLOW == (frame[0] & 0x0F)) {
                     link->send_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
                     link->send_status = ISOTP_SEND_STATUS_ERROR;
                 }
 
                 /* wait */
-                else if (PCI_FLOW_STATUS_WAIT == message.as.flow_control.FS) {
+                else if (PCI_FLOW_STATUS_WAIT == (frame[0] & 0x0F)) {
                     link->send_wtf_count += 1;
                     /* wait exceed allowed count */
-                    if (link->send_wtf_count > ISO_TP_MAX_WFT_NUMBER) {
+                    if (link->send_wtf_count > link->param_wft_max) {
                         link->send_protocol_result = ISOTP_PROTOCOL_RESULT_WFT_OVRN;
                         link->send_status = ISOTP_SEND_STATUS_ERROR;
                     }
                 }
 
                 /* permit send */
-                else if (PCI_FLOW_STATUS_CONTINUE == message.as.flow_control.FS) {
-                    if (0 == message.as.flow_control.BS) {
+                else if (PCI_FLOW_STATUS_CONTINUE == (frame[0] & 0x0F)) {
+                    if (0 == frame[1]) {
                         link->send_bs_remain = ISOTP_INVALID_BS;
                     } else {
-                        link->send_bs_remain = message.as.flow_control.BS;
+                        link->send_bs_remain = frame[1];
                     }
-                    uint32_t message_st_min_us = isotp_st_min_to_us(message.as.flow_control.STmin);
-                    link->send_st_min_us = message_st_min_us > ISO_TP_DEFAULT_ST_MIN_US ? message_st_min_us : ISO_TP_DEFAULT_ST_MIN_US; // prefer as much st_min as possible for stability?
+                    uint32_t message_st_min_us = isotp_st_min_to_us(frame[2]);
+                    link->send_st_min_us = message_st_min_us > link->param_st_min_us ? message_st_min_us : link->param_st_min_us; // prefer as much st_min as possible for stability?
                     link->send_wtf_count = 0;
                 }
             }
@@ -4182,8 +7927,8 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
     return;
 }
 
-int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size, uint16_t *out_size) {
-    uint16_t copylen;
+int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint32_t payload_size, uint32_t *out_size) {
+    uint32_t copylen;
     
     if (ISOTP_RECEIVE_STATUS_FULL != link->receive_status) {
         return ISOTP_RET_NO_DATA;
@@ -4197,57 +7942,228 @@ int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size
     memcpy(payload, link->receive_buffer, copylen);
     *out_size = copylen;
 
+    link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+    isotp_receive_buffer_reset(link);
+
+    return ISOTP_RET_OK;
+}
+
+int isotp_receive_peek(IsoTpLink *link, const uint8_t **payload, uint32_t *out_size) {
+    if (ISOTP_RECEIVE_STATUS_FULL != link->receive_status && ISOTP_RECEIVE_STATUS_LENT != link->receive_status) {
+        return ISOTP_RET_NO_DATA;
+    }
+
+    *payload = link->receive_buffer;
+    *out_size = link->receive_size;
+
+    link->receive_status = ISOTP_RECEIVE_STATUS_LENT;
+
+    return ISOTP_RET_OK;
+}
+
+void isotp_receive_release(IsoTpLink *link) {
+    if (ISOTP_RECEIVE_STATUS_LENT == link->receive_status) {
+        link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+        isotp_receive_buffer_reset(link);
+    }
+}
+
+int isotp_receive_take(IsoTpLink *link, uint8_t **payload, uint32_t *out_size) {
+    if (ISOTP_RECEIVE_STATUS_FULL != link->receive_status || link->receive_buffer == link->receive_own_buffer) {
+        return ISOTP_RET_NO_DATA;
+    }
+
+    *payload = link->receive_buffer;
+    *out_size = link->receive_size;
+
+    /* the block stays in use until isotp_pool_put */
+    link->receive_buffer = link->receive_own_buffer;
+    link->receive_buf_size = link->receive_own_buf_size;
     link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
 
     return ISOTP_RET_OK;
 }
 
-void isotp_init_link(IsoTpLink *link, uint32_t sendid, uint8_t *sendbuf, uint16_t sendbufsize, uint8_t *recvbuf, uint16_t recvbufsize) {
+void isotp_pool_put(IsoTpBufferPool *pool, const uint8_t *block) {
+    uint16_t index = (uint16_t) ((block - pool->blocks) / pool->block_size);
+    pool->in_use &= ~((uint32_t) 1 << index);
+}
+
+void isotp_init_link(IsoTpLink *link, uint32_t sendid, uint8_t *sendbuf, uint32_t sendbufsize, uint8_t *recvbuf, uint32_t recvbufsize) {
     memset(link, 0, sizeof(*link));
     link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
     link->send_status = ISOTP_SEND_STATUS_IDLE;
     link->send_arbitration_id = sendid;
+    link->send_dl = ISOTP_CAN_DL;
+    link->send_max_cf_per_poll = ISO_TP_DEFAULT_MAX_CF_PER_POLL;
+    link->param_block_size = ISO_TP_DEFAULT_BLOCK_SIZE;
+    link->param_st_min_us = ISO_TP_DEFAULT_ST_MIN_US;
+    link->param_n_bs_us = ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+    link->param_n_cr_us = ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+    link->param_wft_max = ISO_TP_MAX_WFT_NUMBER;
+    link->receive_dl = ISOTP_CAN_DL;
     link->send_buffer = sendbuf;
     link->send_buf_size = sendbufsize;
     link->receive_buffer = recvbuf;
     link->receive_buf_size = recvbufsize;
+    link->receive_own_buffer = recvbuf;
+    link->receive_own_buf_size = recvbufsize;
     
     return;
 }
 
+int isotp_set_tx_dl(IsoTpLink *link, uint8_t tx_dl) {
+    if (tx_dl < ISOTP_CAN_DL || tx_dl != isotp_can_dl_round_up(tx_dl)) {
+        isotp_user_debug("Invalid TX_DL %d.\n", tx_dl);
+        return ISOTP_RET_ERROR;
+    }
+
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    link->send_dl = tx_dl;
+
+    return ISOTP_RET_OK;
+}
+
+uint16_t isotp_single_frame_max_size(const IsoTpLink *link) {
+    return isotp_link_sf_max_size(link, link->send_dl);
+}
+
+int isotp_set_address_extension(IsoTpLink *link, uint8_t enable, uint8_t send_addr_ext,
+                                 uint8_t receive_addr_ext) {
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status || ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    link->addr_ext_len = enable ? 1 : 0;
+    link->send_addr_ext = send_addr_ext;
+    link->receive_addr_ext = receive_addr_ext;
+
+    return ISOTP_RET_OK;
+}
+
+int isotp_set_fc_params(IsoTpLink *link, uint8_t block_size, uint32_t st_min_us, uint32_t n_bs_us, uint32_t n_cr_us, uint8_t wft_max) {
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status || ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    link->param_block_size = block_size;
+    link->param_st_min_us = st_min_us;
+    link->param_n_bs_us = n_bs_us ? n_bs_us : ISO_TP_STANDARD_TIMEOUT_US;
+    link->param_n_cr_us = n_cr_us ? n_cr_us : ISO_TP_STANDARD_TIMEOUT_US;
+    link->param_wft_max = wft_max;
+
+    return ISOTP_RET_OK;
+}
+
+void isotp_pool_init(IsoTpBufferPool *pool, uint8_t *blocks, uint32_t block_size, uint8_t num_blocks) {
+    assert(num_blocks <= ISOTP_POOL_MAX_BLOCKS);
+    pool->blocks = blocks;
+    pool->block_size = block_size;
+    pool->num_blocks = num_blocks;
+    pool->in_use = 0;
+}
+
+int isotp_set_receive_pool(IsoTpLink *link, IsoTpBufferPool *pool) {
+    if (ISOTP_RECEIVE_STATUS_IDLE != link->receive_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    isotp_receive_buffer_reset(link);
+    link->receive_pool = pool;
+
+    return ISOTP_RET_OK;
+}
+
+int isotp_next_deadline(const IsoTpLink *link, uint32_t *deadline_us) {
+    int pending = 0;
+    uint32_t deadline = 0;
+
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        if (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) {
+            /* the next consecutive frame, unless its data has yet to arrive */
+            if (isotp_consecutive_frame_end(link) <= link->send_available) {
+                deadline = 0 == link->send_st_min_us ? isotp_user_get_us() : link->send_timer_st;
+                pending = 1;
+            }
+        } else {
+            /* waiting for a flow control frame, timeouts expire once the time is past the timer */
+            deadline = link->send_timer_bs + 1;
+            pending = 1;
+        }
+    }
+
+    if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        if (!pending || IsoTpTimeAfter(deadline, link->receive_timer_cr + 1)) {
+            deadline = link->receive_timer_cr + 1;
+        }
+        pending = 1;
+    }
+
+    if (pending) {
+        *deadline_us = deadline;
+    }
+    return pending;
+}
+
+int isotp_set_max_cf_per_poll(IsoTpLink *link, uint16_t max_cf_per_poll) {
+    if (0 == max_cf_per_poll) {
+        return ISOTP_RET_ERROR;
+    }
+
+    link->send_max_cf_per_poll = max_cf_per_poll;
+
+    return ISOTP_RET_OK;
+}
+
 void isotp_poll(IsoTpLink *link) {
+    uint16_t cf_count;
+    uint32_t now;
     int ret;
 
     /* only polling when operation in progress */
     if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
-
-        /* continue send data */
-        if (/* send data if bs_remain is invalid or bs_remain large than zero */
-        (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) &&
-        /* and if st_min is zero or go beyond interval time */
-        (0 == link->send_st_min_us || IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_st))) {
+        now = isotp_user_get_us();
+
+        /* continue send data, up to max_cf_per_poll frames in one call */
+        for (cf_count = 0; cf_count < link->send_max_cf_per_poll; cf_count++) {
+            if (!(/* send data if bs_remain is invalid or bs_remain large than zero */
+            (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) &&
+            /* and if st_min is zero or go beyond interval time */
+            (0 == link->send_st_min_us || IsoTpTimeAfter(now, link->send_timer_st)))) {
+                break;
+            }
             
             ret = isotp_send_consecutive_frame(link);
             if (ISOTP_RET_OK == ret) {
                 if (ISOTP_INVALID_BS != link->send_bs_remain) {
                     link->send_bs_remain -= 1;
                 }
-                link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
-                link->send_timer_st = isotp_user_get_us() + link->send_st_min_us;
+                link->send_timer_bs = now + link->param_n_bs_us;
+                link->send_timer_st = now + link->send_st_min_us;
 
                 /* check if send finish */
                 if (link->send_offset >= link->send_size) {
                     link->send_status = ISOTP_SEND_STATUS_IDLE;
+                    break;
                 }
             } else if (ISOTP_RET_NOSPACE == ret) {
                 /* shim reported that it isn't able to send a frame at present, retry on next call */
+                break;
+            } else if (ISOTP_RET_NO_DATA == ret) {
+                /* waiting for the caller's data, not for a flow control frame */
+                link->send_timer_bs = now + link->param_n_bs_us;
+                break;
             } else {
                 link->send_status = ISOTP_SEND_STATUS_ERROR;
+                break;
             }
         }
 
         /* check timeout */
-        if (IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_bs)) {
+        if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && IsoTpTimeAfter(now, link->send_timer_bs)) {
             link->send_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_BS;
             link->send_status = ISOTP_SEND_STATUS_ERROR;
         }
@@ -4260,6 +8176,7 @@ void isotp_poll(IsoTpLink *link) {
         if (IsoTpTimeAfter(isotp_user_get_us(), link->receive_timer_cr)) {
             link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_CR;
             link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+            isotp_receive_buffer_reset(link);
         }
     }
 
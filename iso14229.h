@@ -110,13 +110,24 @@ typedef SSIZE_T ssize_t;
 
 
 
-/** ISO-TP Maximum Transmissiable Unit (ISO-15764-2-2004 section 5.3.3) */
+/** ISO-TP Maximum Transmissiable Unit (ISO-15764-2-2004 section 5.3.3). ISO 15765-2:2016 sends
+ * larger messages with a 32-bit FF_DL, raise it to let isotp-c transports, the UDS client and the
+ * server exchange them, e.g. TransferData blocks over CAN-FD. The receive buffers of the
+ * transports grow with it, see UDS_ISOTP_RECV_BUF_SIZE. */
+#ifndef UDS_ISOTP_MTU
 #define UDS_ISOTP_MTU (4095)
+#endif
 
 #ifndef UDS_TP_MTU
 #define UDS_TP_MTU UDS_ISOTP_MTU
 #endif
 
+/** Size of the physical receive buffer embedded in each isotp-c transport. Transports with a
+ * buffer pool (rx_pool) only receive single frames into it and need no more than 64 bytes. */
+#ifndef UDS_ISOTP_RECV_BUF_SIZE
+#define UDS_ISOTP_RECV_BUF_SIZE UDS_ISOTP_MTU
+#endif
+
 #ifndef UDS_SERVER_SEND_BUF_SIZE
 #define UDS_SERVER_SEND_BUF_SIZE (UDS_TP_MTU)
 #endif
@@ -200,6 +211,10 @@ TransferData request message from the client. */
 #define UDS_CUSTOM_MILLIS 0
 #endif
 
+#ifndef UDS_CUSTOM_MICROS
+#define UDS_CUSTOM_MICROS 0
+#endif
+
 
 
 
@@ -243,10 +258,41 @@ typedef struct {
     uint32_t A_TA;             /**< application target address */
     UDS_A_TA_Type_t A_TA_Type; /**< application target address type (physical or functional) */
     uint32_t A_AE;             /**< application layer remote address */
+    uint64_t rx_time_ns; /**< received messages: monotonic time the last frame arrived in ns, 0 if
+                            the transport doesn't know it */
 } UDSSDU_t;
 
 #define UDS_TP_NOOP_ADDR (0xFFFFFFFF)
 
+/**
+ * @brief ISO 15765-2 flow control parameters of an ISO-TP link
+ * @details BS and STmin are sent to the peer in flow control frames while receiving. Timeouts of 0
+ * select the ISO 15765-2 value of 1000 ms, so a struct that only sets bs and st_min_us is valid.
+ */
+typedef struct {
+    uint8_t bs;         /**< block size, 0: the sender may send all consecutive frames at once */
+    uint32_t st_min_us; /**< minimum separation time between consecutive frames */
+    uint32_t n_bs_us;   /**< N_Bs timeout: time the sender waits for a flow control frame */
+    uint32_t n_cr_us;   /**< N_Cr timeout: time the receiver waits for a consecutive frame */
+    uint8_t wft_max;    /**< maximum number of FC.WAIT frames accepted in a row */
+} UDSISOTpFCParams_t;
+
+/**
+ * @brief Events to wait for on a file descriptor, see UDSTp_t.get_fds
+ */
+enum UDSTpFdEvents {
+    UDS_TP_FD_READ = 0x01,  /**< wait until the fd is readable (POLLIN / EPOLLIN) */
+    UDS_TP_FD_WRITE = 0x02, /**< wait until the fd is writable (POLLOUT / EPOLLOUT) */
+};
+
+/**
+ * @brief A file descriptor the transport wants to be polled for
+ */
+typedef struct {
+    int fd;
+    int events; /**< UDS_TP_FD_READ and/or UDS_TP_FD_WRITE */
+} UDSTpFd_t;
+
 /**
  * @brief UDS Transport layer
  * @note implementers should embed this struct at offset zero in their own transport layer handle
@@ -259,6 +305,8 @@ typedef struct UDSTp {
      * @param len: length of data to send
      * @param info: pointer to SDU info (may be NULL). If NULL, implementation should send with
      * physical addressing
+     * @note the transport may send directly from buf. The caller must keep buf unchanged until
+     * poll() no longer returns UDS_TP_SEND_IN_PROGRESS.
      */
     ssize_t (*send)(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_t *info);
 
@@ -280,11 +328,74 @@ typedef struct UDSTp {
      * @return UDS_TP_IDLE if idle, otherwise UDS_TP_SEND_IN_PROGRESS or UDS_TP_RECV_COMPLETE
      */
     UDSTpStatus_t (*poll)(struct UDSTp *hdl);
+
+    /**
+     * @brief Lend the received data to the caller without copying it (optional, may be NULL)
+     * @param hdl: transport handle
+     * @param buf: set to the transport's buffer holding the received data. The data stays valid
+     * and unchanged until release() is called.
+     * @param info: pointer to SDU info (may be NULL). Populated like in recv().
+     * @return length of the received data, 0 if nothing was received, negative on error
+     * @note the transport may drop messages that arrive before release() is called
+     */
+    ssize_t (*peek)(struct UDSTp *hdl, uint8_t **buf, UDSSDU_t *info);
+
+    /**
+     * @brief Give the buffer lent by peek() back to the transport (optional, may be NULL)
+     * @param hdl: transport handle
+     */
+    void (*release)(struct UDSTp *hdl);
+
+    /**
+     * @brief Report the file descriptors to watch in an event loop (optional, may be NULL)
+     * @param hdl: transport handle
+     * @param fds: filled with the file descriptors and the events to wait for
+     * @param max_fds: number of entries in fds
+     * @return number of entries filled in
+     * @note the set can change after send() and poll(), query it before every wait. Call poll()
+     * once one of the events occurred.
+     */
+    int (*get_fds)(struct UDSTp *hdl, UDSTpFd_t *fds, int max_fds);
+
+    /**
+     * @brief Report the earliest internal timer of the transport (optional, may be NULL)
+     * @param hdl: transport handle
+     * @param deadline_ms: set to the UDSMillis() time at which poll() has to be called next
+     * @return true if deadline_ms was set, false if the transport has no pending timer and only
+     * needs poll() after one of its file descriptors became ready
+     */
+    bool (*next_deadline)(struct UDSTp *hdl, uint32_t *deadline_ms);
+
+    /**
+     * @brief Send a message while its data is still arriving (optional, may be NULL)
+     * @details The first call starts the message. Call it again with the same buf, len and info
+     * whenever more data became available and with buf == NULL to abandon the message.
+     * @param hdl: transport handle
+     * @param buf: the message, filled in from the start
+     * @param len: length of the complete message
+     * @param available: number of valid bytes at the start of buf, len once the message is complete
+     * @param info: like in send()
+     * @return like send(), 0 if the transport needs more data before it can start the message
+     * @note buf must stay valid like in send()
+     */
+    ssize_t (*send_partial)(struct UDSTp *hdl, uint8_t *buf, size_t len, size_t available,
+                            UDSSDU_t *info);
 } UDSTp_t;
 
 ssize_t UDSTpSend(UDSTp_t *hdl, const uint8_t *buf, ssize_t len, UDSSDU_t *info);
 ssize_t UDSTpRecv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info);
 UDSTpStatus_t UDSTpPoll(UDSTp_t *hdl);
+ssize_t UDSTpPeek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info);
+void UDSTpRelease(UDSTp_t *hdl);
+int UDSTpGetFds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds);
+bool UDSTpNextDeadline(UDSTp_t *hdl, uint32_t *deadline_ms);
+
+/**
+ * @brief Send a message while its data is still arriving, see UDSTp_t.send_partial
+ * @note transports without send_partial send the message once it is complete
+ */
+ssize_t UDSTpSendPartial(UDSTp_t *hdl, const uint8_t *buf, size_t len, size_t available,
+                         UDSSDU_t *info);
 
 
 
@@ -592,6 +703,22 @@ static inline bool UDSTimeAfter(uint32_t a, uint32_t b) { return (int32_t)(a - b
  */
 uint32_t UDSMillis(void);
 
+/**
+ * @brief Get time in microseconds
+ * @details Monotonic, wraps around after about 71 minutes. When UDS_CUSTOM_MILLIS is set and
+ * UDS_CUSTOM_MICROS is not, this follows the user-supplied UDSMillis().
+ * @return current time in microseconds
+ */
+uint32_t UDSMicros(void);
+
+#if UDS_SYS == UDS_SYS_UNIX
+/**
+ * @brief Convert a CLOCK_REALTIME timestamp, e.g. from SO_TIMESTAMPNS, to CLOCK_MONOTONIC
+ * @return nanoseconds on the CLOCK_MONOTONIC time line
+ */
+uint64_t UDSRealtimeToMonotonicNs(const struct timespec *ts);
+#endif
+
 bool UDSSecurityAccessLevelIsReserved(uint8_t securityLevel);
 bool UDSErrIsNRC(UDSErr_t err);
 
@@ -741,8 +868,8 @@ typedef struct UDSClient {
     int (*fn)(struct UDSClient *client, UDSEvent_t evt, void *ev_data); /**< callback function */
     void *fn_data; /**< user-specified function data */
 
-    uint16_t recv_size;                         /**< size of received data */
-    uint16_t send_size;                         /**< size of data to send */
+    size_t recv_size;                           /**< size of received data */
+    size_t send_size;                           /**< size of data to send */
     uint8_t recv_buf[UDS_CLIENT_RECV_BUF_SIZE]; /**< receive buffer */
     uint8_t send_buf[UDS_CLIENT_SEND_BUF_SIZE]; /**< send buffer */
 } UDSClient_t;
@@ -785,7 +912,7 @@ typedef struct {
 
 UDSErr_t UDSClientInit(UDSClient_t *client);
 UDSErr_t UDSClientPoll(UDSClient_t *client);
-UDSErr_t UDSSendBytes(UDSClient_t *client, const uint8_t *data, uint16_t size);
+UDSErr_t UDSSendBytes(UDSClient_t *client, const uint8_t *data, size_t size);
 UDSErr_t UDSSendECUReset(UDSClient_t *client, uint8_t type);
 UDSErr_t UDSSendDiagSessCtrl(UDSClient_t *client, uint8_t mode);
 UDSErr_t UDSSendSecurityAccess(UDSClient_t *client, uint8_t level, uint8_t *data, uint16_t size);
@@ -806,9 +933,9 @@ UDSErr_t UDSSendRequestUpload(UDSClient_t *client, uint8_t dataFormatIdentifier,
                               uint8_t addressAndLengthFormatIdentifier, size_t memoryAddress,
                               size_t memorySize);
 UDSErr_t UDSSendTransferData(UDSClient_t *client, uint8_t blockSequenceCounter,
-                             const uint16_t blockLength, const uint8_t *data, uint16_t size);
+                             const size_t blockLength, const uint8_t *data, size_t size);
 UDSErr_t UDSSendTransferDataStream(UDSClient_t *client, uint8_t blockSequenceCounter,
-                                   const uint16_t blockLength, FILE *fd);
+                                   const size_t blockLength, FILE *fd);
 UDSErr_t UDSSendRequestTransferExit(UDSClient_t *client);
 
 UDSErr_t UDSSendRequestFileTransfer(UDSClient_t *client, uint8_t mode, const char *filePath,
@@ -836,12 +963,15 @@ UDSErr_t UDSConfigDownload(UDSClient_t *client, uint8_t dataFormatIdentifier,
  * @brief Server request context
  */
 typedef struct {
-    uint8_t recv_buf[UDS_SERVER_RECV_BUF_SIZE]; /**< receive buffer */
+    uint8_t *recv_buf; /**< received request, lent by the transport or stored in recv_storage */
     uint8_t send_buf[UDS_SERVER_SEND_BUF_SIZE]; /**< send buffer */
     size_t recv_len;                            /**< received data length */
     size_t send_len;                            /**< send data length */
     size_t send_buf_size;                       /**< send buffer size */
     UDSSDU_t info;                              /**< service data unit information */
+    bool recv_lent; /**< recv_buf belongs to the transport and must be released */
+    uint8_t recv_storage[UDS_SERVER_RECV_BUF_SIZE]; /**< receive buffer for transports without
+                                                       peek() */
 } UDSReq_t;
 
 /**
@@ -932,7 +1062,7 @@ typedef struct {
 typedef struct {
     const uint8_t type; /*! invoked subfunction */
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 
     union {
         struct {
@@ -978,7 +1108,7 @@ typedef struct {
 typedef struct {
     const uint16_t dataId; /*! RDBI Data Identifier */
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 } UDSRDBIArgs_t;
 
 /**
@@ -988,7 +1118,7 @@ typedef struct {
     const void *memAddr;
     const size_t memSize;
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 } UDSReadMemByAddrArgs_t;
 
 /**
@@ -1008,7 +1138,7 @@ typedef struct {
     const uint8_t *const dataRecord; /*! pointer to request data */
     const uint16_t len;              /*! size of request data */
     uint8_t (*copySeed)(UDSServer_t *srv, const void *src,
-                        uint16_t len); /*! function for copying data */
+                        size_t len); /*! function for copying data */
 } UDSSecAccessRequestSeedArgs_t;
 
 /**
@@ -1069,7 +1199,7 @@ typedef struct {
     const void *const ctrlStateAndMask; /*! controlState bytes and controlMask (optional) */
     const size_t ctrlStateAndMaskLen;   /*! number of bytes in `ctrlStateAndMask` */
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 } UDSIOCtrlArgs_t;
 
 /**
@@ -1081,7 +1211,7 @@ typedef struct {
     const uint8_t *optionRecord; /*! optional data */
     const uint16_t len;          /*! length of optional data */
     uint8_t (*copyStatusRecord)(UDSServer_t *srv, const void *src,
-                                uint16_t len); /*! function for copying response data */
+                                size_t len); /*! function for copying response data */
 } UDSRoutineCtrlArgs_t;
 
 /**
@@ -1091,7 +1221,7 @@ typedef struct {
     const void *addr;                   /*! requested address */
     const size_t size;                  /*! requested download size */
     const uint8_t dataFormatIdentifier; /*! optional specifier for format of data */
-    uint16_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
+    uint32_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
                                            send in each    `TransferData` request */
 } UDSRequestDownloadArgs_t;
 
@@ -1102,7 +1232,7 @@ typedef struct {
     const void *addr;                   /*! requested address */
     const size_t size;                  /*! requested download size */
     const uint8_t dataFormatIdentifier; /*! optional specifier for format of data */
-    uint16_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
+    uint32_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
                                            send in each    `TransferData` request */
 } UDSRequestUploadArgs_t;
 
@@ -1111,11 +1241,11 @@ typedef struct {
  */
 typedef struct {
     const uint8_t *const data; /*! transfer data */
-    const uint16_t len;        /*! transfer data length */
-    const uint16_t maxRespLen; /*! don't send more than this many bytes with copyResponse */
+    const size_t len;        /*! transfer data length */
+    const size_t maxRespLen; /*! don't send more than this many bytes with copyResponse */
     uint8_t (*copyResponse)(
         UDSServer_t *srv, const void *src,
-        uint16_t len); /*! function for copying transfer data response data (optional) */
+        size_t len); /*! function for copying transfer data response data (optional) */
 } UDSTransferDataArgs_t;
 
 /**
@@ -1123,9 +1253,9 @@ typedef struct {
  */
 typedef struct {
     const uint8_t *const data; /*! request data */
-    const uint16_t len;        /*! request data length */
+    const size_t len;          /*! request data length */
     uint8_t (*copyResponse)(UDSServer_t *srv, const void *src,
-                            uint16_t len); /*! function for copying response data (optional) */
+                            size_t len); /*! function for copying response data (optional) */
 } UDSRequestTransferExitArgs_t;
 
 /**
@@ -1138,7 +1268,7 @@ typedef struct {
     const uint8_t dataFormatIdentifier; /*! optional specifier for format of data */
     const size_t fileSizeUnCompressed;  /*! optional file size */
     const size_t fileSizeCompressed;    /*! optional file size */
-    uint16_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
+    uint32_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
                                            send in each    `TransferData` request */
 } UDSRequestFileTransferArgs_t;
 
@@ -1170,7 +1300,7 @@ typedef struct {
     const uint8_t *optionRecord; /*! optional data */
     const uint16_t len;          /*! length of optional data */
     uint8_t (*copyResponse)(UDSServer_t *srv, const void *src,
-                            uint16_t len); /*! function for copying response data (optional) */
+                            size_t len); /*! function for copying response data (optional) */
 } UDSCustomArgs_t;
 
 UDSErr_t UDSServerInit(UDSServer_t *srv);
@@ -1196,11 +1326,22 @@ void UDSServerPoll(UDSServer_t *srv);
  */
 #define ISO_TP_MAX_WFT_NUMBER       1
 
+/* The maximum number of consecutive frames isotp_poll sends in one call. Raise it to send a
+ * whole block per call when the CAN driver can queue several frames.
+ */
+#ifndef ISO_TP_DEFAULT_MAX_CF_PER_POLL
+#define ISO_TP_DEFAULT_MAX_CF_PER_POLL 1
+#endif
+
 /* Private: The default timeout to use when waiting for a response during a
  * multi-frame send or receive.
  */
 #define ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US 100000
 
+/* The N_Bs and N_Cr timeout of ISO 15765-2, used by isotp_set_fc_params for timeouts of 0.
+ */
+#define ISO_TP_STANDARD_TIMEOUT_US 1000000
+
 /* Private: Determines if by default, padding is added to ISO-TP message frames.
  */
 //#define ISO_TP_FRAME_PADDING
@@ -1282,135 +1423,9 @@ typedef enum {
     ISOTP_RECEIVE_STATUS_IDLE,
     ISOTP_RECEIVE_STATUS_INPROGRESS,
     ISOTP_RECEIVE_STATUS_FULL,
+    ISOTP_RECEIVE_STATUS_LENT,      /* the receive buffer is lent out by isotp_receive_peek */
 } IsoTpReceiveStatusTypes;
 
-/* can fram defination */
-#if defined(ISOTP_BYTE_ORDER_LITTLE_ENDIAN)
-typedef struct {
-    uint8_t reserve_1:4;
-    uint8_t type:4;
-    uint8_t reserve_2[7];
-} IsoTpPciType;
-
-typedef struct {
-    uint8_t SF_DL:4;
-    uint8_t type:4;
-    uint8_t data[7];
-} IsoTpSingleFrame;
-
-typedef struct {
-    uint8_t FF_DL_high:4;
-    uint8_t type:4;
-    uint8_t FF_DL_low;
-    uint8_t data[6];
-} IsoTpFirstFrame;
-
-typedef struct {
-    uint8_t SN:4;
-    uint8_t type:4;
-    uint8_t data[7];
-} IsoTpConsecutiveFrame;
-
-typedef struct {
-    uint8_t FS:4;
-    uint8_t type:4;
-    uint8_t BS;
-    uint8_t STmin;
-    uint8_t reserve[5];
-} IsoTpFlowControl;
-
-#else
-
-typedef struct {
-    uint8_t type:4;
-    uint8_t reserve_1:4;
-    uint8_t reserve_2[7];
-} IsoTpPciType;
-
-/*
-* single frame
-* +-------------------------+-----+
-* | byte #0                 | ... |
-* +-------------------------+-----+
-* | nibble #0   | nibble #1 | ... |
-* +-------------+-----------+ ... +
-* | PCIType = 0 | SF_DL     | ... |
-* +-------------+-----------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t SF_DL:4;
-    uint8_t data[7];
-} IsoTpSingleFrame;
-
-/*
-* first frame
-* +-------------------------+-----------------------+-----+
-* | byte #0                 | byte #1               | ... |
-* +-------------------------+-----------+-----------+-----+
-* | nibble #0   | nibble #1 | nibble #2 | nibble #3 | ... |
-* +-------------+-----------+-----------+-----------+-----+
-* | PCIType = 1 | FF_DL                             | ... |
-* +-------------+-----------+-----------------------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t FF_DL_high:4;
-    uint8_t FF_DL_low;
-    uint8_t data[6];
-} IsoTpFirstFrame;
-
-/*
-* consecutive frame
-* +-------------------------+-----+
-* | byte #0                 | ... |
-* +-------------------------+-----+
-* | nibble #0   | nibble #1 | ... |
-* +-------------+-----------+ ... +
-* | PCIType = 0 | SN        | ... |
-* +-------------+-----------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t SN:4;
-    uint8_t data[7];
-} IsoTpConsecutiveFrame;
-
-/*
-* flow control frame
-* +-------------------------+-----------------------+-----------------------+-----+
-* | byte #0                 | byte #1               | byte #2               | ... |
-* +-------------------------+-----------+-----------+-----------+-----------+-----+
-* | nibble #0   | nibble #1 | nibble #2 | nibble #3 | nibble #4 | nibble #5 | ... |
-* +-------------+-----------+-----------+-----------+-----------+-----------+-----+
-* | PCIType = 1 | FS        | BS                    | STmin                 | ... |
-* +-------------+-----------+-----------------------+-----------------------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t FS:4;
-    uint8_t BS;
-    uint8_t STmin;
-    uint8_t reserve[5];
-} IsoTpFlowControl;
-
-#endif
-
-typedef struct {
-    uint8_t ptr[8];
-} IsoTpDataArray;
-
-typedef struct {
-    union {
-        IsoTpPciType          common;
-        IsoTpSingleFrame      single_frame;
-        IsoTpFirstFrame       first_frame;
-        IsoTpConsecutiveFrame consecutive_frame;
-        IsoTpFlowControl      flow_control;
-        IsoTpDataArray        data_array;
-    } as;
-} IsoTpCanMessage;
-
 /**************************************************************
  * protocol specific defines
  *************************************************************/
@@ -1432,6 +1447,20 @@ typedef enum {
     PCI_FLOW_STATUS_OVERFLOW = 0x2
 } IsoTpFlowStatus;
 
+/* Private: CAN frame data lengths. Classic CAN frames carry up to 8 bytes, CAN-FD frames up to 64.
+ */
+#define ISOTP_CAN_DL                8
+#define ISOTP_CAN_FD_MAX_DL         64
+
+/* Private: largest FF_DL that fits the 12-bit first frame length. Larger messages use the
+ * ISO 15765-2:2016 escape sequence with a 32-bit FF_DL.
+ */
+#define ISOTP_FF_DL_12BIT_MAX       4095
+
+/* Maximum number of blocks in an IsoTpBufferPool, one bit each in IsoTpBufferPool.in_use
+ */
+#define ISOTP_POOL_MAX_BLOCKS       32
+
 /* Private: network layer resault code.
  */
 #define ISOTP_PROTOCOL_RESULT_OK            0
@@ -1496,6 +1525,20 @@ extern "C" {
 #endif
 
 
+/**
+ * @brief Fixed-size receive buffers shared by several links.
+ * A link with a pool receives single frames into its own receive buffer and multi-frame messages
+ * into a block of the pool. The block is taken on the first frame and given back once the message
+ * has been read, or when the reception fails or times out. A first frame that finds the pool empty
+ * is answered with FC.OVFLW.
+ */
+typedef struct IsoTpBufferPool {
+    uint8_t*                    blocks;     /* num_blocks * block_size bytes */
+    uint32_t                    block_size;
+    uint8_t                     num_blocks; /* at most ISOTP_POOL_MAX_BLOCKS */
+    uint32_t                    in_use;     /* bit n is set while block n is used by a link */
+} IsoTpBufferPool;
+
 /**
  * @brief Struct containing the data for linking an application to a CAN instance.
  * The data stored in this struct is used internally and may be used by software programs
@@ -1506,14 +1549,18 @@ typedef struct IsoTpLink {
     uint32_t                    send_arbitration_id; /* used to reply consecutive frame */
     /* message buffer */
     uint8_t*                    send_buffer;
-    uint16_t                    send_buf_size;
-    uint16_t                    send_size;
-    uint16_t                    send_offset;
+    uint32_t                    send_buf_size;
+    const uint8_t*              send_data;      /* payload being sent: send_buffer or the caller's buffer */
+    uint32_t                    send_size;
+    uint32_t                    send_offset;
+    uint32_t                    send_available; /* bytes of send_data that can be sent, see isotp_send_partial */
+    uint8_t                     send_dl;        /* TX_DL: 8 for classic CAN, up to 64 for CAN-FD */
     /* multi-frame flags */
     uint8_t                     send_sn;
     uint16_t                    send_bs_remain; /* Remaining block size */
     uint32_t                    send_st_min_us; /* Separation Time between consecutive frames */
     uint8_t                     send_wtf_count; /* Maximum number of FC.Wait frame transmissions  */
+    uint16_t                    send_max_cf_per_poll; /* Maximum number of consecutive frames sent per isotp_poll */
     uint32_t                    send_timer_st;  /* Last time send consecutive frame */    
     uint32_t                    send_timer_bs;  /* Time until reception of the next FlowControl N_PDU
                                                    start at sending FF, CF, receive FC
@@ -1524,9 +1571,13 @@ typedef struct IsoTpLink {
     uint32_t                    receive_arbitration_id;
     /* message buffer */
     uint8_t*                    receive_buffer;
-    uint16_t                    receive_buf_size;
-    uint16_t                    receive_size;
-    uint16_t                    receive_offset;
+    uint32_t                    receive_buf_size;
+    uint32_t                    receive_size;
+    uint32_t                    receive_offset;
+    uint8_t                     receive_dl;     /* RX_DL, taken from the length of the first frame */
+    uint8_t*                    receive_own_buffer; /* the buffer passed to isotp_init_link */
+    uint32_t                    receive_own_buf_size;
+    IsoTpBufferPool*            receive_pool;   /* optional, see isotp_set_receive_pool */
     /* multi-frame control */
     uint8_t                     receive_sn;
     uint8_t                     receive_bs_count; /* Maximum number of FC.Wait frame transmissions  */
@@ -1536,6 +1587,18 @@ typedef struct IsoTpLink {
     int                         receive_protocol_result;
     uint8_t                     receive_status;                                                     
 
+    /* flow control parameters, see isotp_set_fc_params */
+    uint8_t                     param_block_size; /* BS sent in FC frames, 0: no limit */
+    uint32_t                    param_st_min_us;  /* STmin sent in FC frames, also the minimum gap used when sending */
+    uint32_t                    param_n_bs_us;    /* Time until reception of the next FlowControl N_PDU */
+    uint32_t                    param_n_cr_us;    /* Time until reception of the next ConsecutiveFrame N_PDU */
+    uint8_t                     param_wft_max;    /* Maximum number of FC.Wait frames accepted in a row */
+
+    /* extended and mixed addressing, see isotp_set_address_extension */
+    uint8_t                     addr_ext_len;     /* 1 if frames start with an address byte, else 0 */
+    uint8_t                     send_addr_ext;    /* first byte of sent frames: N_TA or N_AE */
+    uint8_t                     receive_addr_ext; /* first byte of received frames, others are ignored */
+
 #if defined(ISO_TP_USER_SEND_CAN_ARG)
     void*                       user_send_can_arg;
 #endif
@@ -1547,13 +1610,131 @@ typedef struct IsoTpLink {
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
  * @param sendid The ID used to send data to other CAN nodes.
  * @param sendbuf A pointer to an area in memory which can be used as a buffer for data to be sent.
- * @param sendbufsize The size of the buffer area.
+ *                May be NULL: the link then sends directly from the payload passed to isotp_send,
+ *                which must stay unchanged until the send status is no longer
+ *                ISOTP_SEND_STATUS_INPROGRESS.
+ * @param sendbufsize The size of the buffer area, or the largest message size if sendbuf is NULL.
  * @param recvbuf A pointer to an area in memory which can be used as a buffer for data to be received.
  * @param recvbufsize The size of the buffer area.
  */
 void isotp_init_link(IsoTpLink *link, uint32_t sendid, 
-                     uint8_t *sendbuf, uint16_t sendbufsize,
-                     uint8_t *recvbuf, uint16_t recvbufsize);
+                     uint8_t *sendbuf, uint32_t sendbufsize,
+                     uint8_t *recvbuf, uint32_t recvbufsize);
+
+/**
+ * @brief Sets the transmit data length (TX_DL) of the link.
+ *
+ * A TX_DL of 8 selects classic CAN framing. Larger values select CAN-FD framing: single frames and
+ * first frames use the ISO 15765-2:2016 escape sequences where needed, and frames longer than 8
+ * bytes are padded up to the next valid CAN-FD data length.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param tx_dl One of 8, 12, 16, 20, 24, 32, 48 or 64.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_ERROR @endcode if tx_dl is not a valid CAN-FD data length
+ */
+int isotp_set_tx_dl(IsoTpLink *link, uint8_t tx_dl);
+
+/**
+ * @brief Selects extended or mixed addressing.
+ *
+ * Every frame then starts with an address byte: N_TA with extended addressing, N_AE with mixed
+ * addressing. The byte is written before the PCI of sent frames and received frames that start
+ * with another byte are ignored, so several links can share one CAN ID. Single and consecutive
+ * frames carry one byte of payload less.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param enable 0 selects normal addressing, the address bytes are ignored then.
+ * @param send_addr_ext The first byte of sent frames.
+ * @param receive_addr_ext The first byte of the frames received by the link.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_INPROGRESS @endcode if a message is being sent or received
+ */
+int isotp_set_address_extension(IsoTpLink *link, uint8_t enable, uint8_t send_addr_ext,
+                                 uint8_t receive_addr_ext);
+
+/**
+ * @brief Returns the largest payload that fits in a single frame with the link's TX_DL.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ */
+uint16_t isotp_single_frame_max_size(const IsoTpLink *link);
+
+/**
+ * @brief Sets the flow control parameters of the link.
+ *
+ * The link starts with ISO_TP_DEFAULT_BLOCK_SIZE, ISO_TP_DEFAULT_ST_MIN_US,
+ * ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US and ISO_TP_MAX_WFT_NUMBER. The parameters can be changed
+ * between messages.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param block_size BS sent in flow control frames, 0 for no limit.
+ * @param st_min_us STmin sent in flow control frames in microseconds.
+ * @param n_bs_us N_Bs timeout in microseconds, 0 for ISO_TP_STANDARD_TIMEOUT_US.
+ * @param n_cr_us N_Cr timeout in microseconds, 0 for ISO_TP_STANDARD_TIMEOUT_US.
+ * @param wft_max Maximum number of FC.WAIT frames accepted in a row.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_INPROGRESS @endcode if a message is being sent or received
+ */
+int isotp_set_fc_params(IsoTpLink *link, uint8_t block_size, uint32_t st_min_us, uint32_t n_bs_us, uint32_t n_cr_us, uint8_t wft_max);
+
+/**
+ * @brief Initialises a buffer pool.
+ *
+ * @param pool The pool.
+ * @param blocks Memory for the blocks, num_blocks * block_size bytes.
+ * @param block_size Size of one block, the largest message a link can receive from the pool.
+ * @param num_blocks Number of blocks, at most ISOTP_POOL_MAX_BLOCKS.
+ */
+void isotp_pool_init(IsoTpBufferPool *pool, uint8_t *blocks, uint32_t block_size, uint8_t num_blocks);
+
+/**
+ * @brief Lets the link receive multi-frame messages into blocks of a pool.
+ *
+ * The link's own receive buffer then only holds single frames, so ISOTP_CAN_FD_MAX_DL bytes are
+ * enough.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param pool The pool, or NULL to receive into the link's own buffer only.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_INPROGRESS @endcode if the link holds a received message
+ */
+int isotp_set_receive_pool(IsoTpLink *link, IsoTpBufferPool *pool);
+
+/**
+ * @brief Sets the maximum number of consecutive frames sent in one call to isotp_poll.
+ *
+ * Within this limit, isotp_poll sends every consecutive frame that the block size and STmin of the
+ * last flow control frame allow. It stops early when isotp_user_send_can returns
+ * ISOTP_RET_NOSPACE and continues on the next call.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param max_cf_per_poll Maximum number of consecutive frames per call, at least 1.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_ERROR @endcode if max_cf_per_poll is zero
+ */
+int isotp_set_max_cf_per_poll(IsoTpLink *link, uint16_t max_cf_per_poll);
+
+/**
+ * @brief Returns when isotp_poll has to be called next to send a frame or to detect a timeout.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ * @param deadline_us Set to the deadline in isotp_user_get_us time if the link has one.
+ *
+ * @return 1 if a send or receive is in progress and deadline_us was set, 0 if the link only needs
+ *         isotp_poll after isotp_on_can_message or isotp_send.
+ */
+int isotp_next_deadline(const IsoTpLink *link, uint32_t *deadline_us);
 
 /**
  * @brief Polling function; call this function periodically to handle timeouts, send consecutive frames, etc.
@@ -1565,6 +1746,8 @@ void isotp_poll(IsoTpLink *link);
 /**
  * @brief Handles incoming CAN messages.
  * Determines whether an incoming message is a valid ISO-TP frame or not and handles it accordingly.
+ * A received message that was not read yet is kept: single frames are dropped and first frames
+ * are answered with FC.OVFLW until it is read or released.
  *
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
  * @param data The data received via CAN.
@@ -1576,10 +1759,11 @@ void isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len);
  * @brief Sends ISO-TP frames via CAN, using the ID set in the initialising function.
  *
  * Single-frame messages will be sent immediately when calling this function.
- * Multi-frame messages will be sent consecutively when calling isotp_poll.
+ * Multi-frame messages will be sent consecutively when calling isotp_poll. Messages larger than
+ * 4095 bytes are announced with the ISO 15765-2:2016 escape sequence and a 32-bit FF_DL.
  *
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
- * @param payload The payload to be sent. (Up to 4095 bytes).
+ * @param payload The payload to be sent.
  * @param size The size of the payload to be sent.
  *
  * @return Possible return values:
@@ -1588,12 +1772,52 @@ void isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len);
  *  - @code ISOTP_RET_OK @endcode
  *  - The return value of the user shim function isotp_user_send_can().
  */
-int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size);
+int isotp_send(IsoTpLink *link, const uint8_t payload[], uint32_t size);
 
 /**
  * @brief See @link isotp_send @endlink, with the exception that this function is used only for functional addressing.
  */
-int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint16_t size);
+int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size);
+
+/**
+ * @brief Starts sending a message of which only the first bytes are available yet.
+ *
+ * Consecutive frames are sent as far as the available data reaches, report more data with
+ * isotp_send_extend. The caller has to keep the flow of data going, the link doesn't time out
+ * while it waits for data.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param id The CAN ID to send the first frame with.
+ * @param payload The payload to be sent, filled in from the start.
+ * @param size The size of the complete payload.
+ * @param available The number of valid bytes at the start of payload.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_NO_DATA @endcode if the single or first frame needs more data
+ *  - The return values of @link isotp_send_with_id @endlink.
+ */
+int isotp_send_partial(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size,
+                       uint32_t available);
+
+/**
+ * @brief Reports that more data of a message started with isotp_send_partial is available.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param available The number of valid bytes at the start of the payload, at most its size.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_ERROR @endcode if no message is being sent or available is out of range
+ */
+int isotp_send_extend(IsoTpLink *link, uint32_t available);
+
+/**
+ * @brief Stops sending the current message. The receiver detects the missing frames by its N_Cr
+ * timeout.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ */
+void isotp_send_abort(IsoTpLink *link);
 
 /**
  * @brief Receives and parses the received data and copies the parsed data in to the internal buffer.
@@ -1606,7 +1830,54 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
  *      - @link ISOTP_RET_OK @endlink
  *      - @link ISOTP_RET_NO_DATA @endlink
  */
-int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size, uint16_t *out_size);
+int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint32_t payload_size, uint32_t *out_size);
+
+/**
+ * @brief Lends the received message to the caller without copying it.
+ *
+ * The payload points into the link's receive buffer and stays valid until isotp_receive_release is
+ * called. Single and first frames arriving in the meantime are dropped.
+ *
+ * @param link The @link IsoTpLink @endlink instance used to transceive data.
+ * @param payload Set to the received data.
+ * @param out_size Set to the size of the received data.
+ *
+ * @return Possible return values:
+ *      - @link ISOTP_RET_OK @endlink
+ *      - @link ISOTP_RET_NO_DATA @endlink
+ */
+int isotp_receive_peek(IsoTpLink *link, const uint8_t **payload, uint32_t *out_size);
+
+/**
+ * @brief Returns the receive buffer lent by isotp_receive_peek to the link.
+ * @param link The @link IsoTpLink @endlink instance used to transceive data.
+ */
+void isotp_receive_release(IsoTpLink *link);
+
+/**
+ * @brief Takes a received multi-frame message out of the link without copying it.
+ *
+ * The link receives the next message right away, the message stays in its block of the link's
+ * pool until the block is given back with isotp_pool_put. Messages in the link's own receive
+ * buffer, e.g. single frames, are not taken.
+ *
+ * @param link The @link IsoTpLink @endlink instance used to transceive data.
+ * @param payload Set to the pool block holding the received data.
+ * @param out_size Set to the size of the received data.
+ *
+ * @return Possible return values:
+ *      - @link ISOTP_RET_OK @endlink
+ *      - @link ISOTP_RET_NO_DATA @endlink if the link holds no complete message in a pool block
+ */
+int isotp_receive_take(IsoTpLink *link, uint8_t **payload, uint32_t *out_size);
+
+/**
+ * @brief Gives a block taken with isotp_receive_take back to its pool.
+ *
+ * @param pool The pool of the link the block was taken from.
+ * @param block The payload returned by isotp_receive_take.
+ */
+void isotp_pool_put(IsoTpBufferPool *pool, const uint8_t *block);
 
 #ifdef __cplusplus
 }
@@ -1623,8 +1894,8 @@ typedef struct {
     UDSTp_t hdl;
     IsoTpLink phys_link;
     IsoTpLink func_link;
-    uint8_t send_buf[UDS_ISOTP_MTU];
-    uint8_t recv_buf[UDS_ISOTP_MTU];
+    uint8_t recv_buf[UDS_ISOTP_RECV_BUF_SIZE];
+    uint8_t func_recv_buf[ISOTP_CAN_FD_MAX_DL]; // functional messages are single frames
     uint32_t phys_sa, phys_ta;
     uint32_t func_sa, func_ta;
 } UDSISOTpC_t;
@@ -1634,10 +1905,29 @@ typedef struct {
     uint32_t target_addr;
     uint32_t source_addr_func;
     uint32_t target_addr_func;
+    uint8_t tx_dl; // 0 or 8 for classic CAN, 12..64 for CAN-FD
+    uint16_t max_cf_per_poll; // consecutive frames sent per poll, 0: ISO_TP_DEFAULT_MAX_CF_PER_POLL
+    const UDSISOTpFCParams_t *fc_params; // NULL: defaults from isotp_config.h
+    IsoTpBufferPool *rx_pool; // shared buffers for multi-frame messages, may be NULL
+
+    // Extended addressing (N_TA) or mixed addressing (N_AE): every frame starts with an address
+    // byte. The links ignore frames with other address bytes, so frames with a shared CAN ID can
+    // be passed to several transports. Received messages report it in UDSSDU_t.A_AE.
+    bool addr_ext;
+    uint8_t source_ae;      // address byte of received physical frames
+    uint8_t target_ae;      // address byte of sent physical frames
+    uint8_t source_ae_func; // address byte of received functional frames
+    uint8_t target_ae_func; // address byte of sent functional frames
 } UDSISOTpCConfig_t;
 
 UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg);
 
+/**
+ * @brief Change the flow control parameters of both links
+ * @return UDS_OK on success, UDS_ERR_BUSY if a message is being sent or received
+ */
+UDSErr_t UDSISOTpCSetFCParams(UDSISOTpC_t *tp, const UDSISOTpFCParams_t *params);
+
 void UDSISOTpCDeinit(UDSISOTpC_t *tp);
 
 #endif
@@ -1646,34 +1936,306 @@ void UDSISOTpCDeinit(UDSISOTpC_t *tp);
 
 #if defined(UDS_TP_ISOTP_C_SOCKETCAN)
 
+#include <linux/can.h>
+#include <sys/socket.h>
 
+/** Maximum number of CAN frames read with one recvmmsg call */
+#ifndef UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX
+#define UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX (32)
+#endif
+
+/** Maximum number of CAN frames queued for one sendmmsg call */
+#ifndef UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX
+#define UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX (64)
+#endif
+
+/** Maximum number of CAN_RAW_FILTER entries installed on the socket */
+#ifndef UDS_ISOTP_C_SOCKETCAN_FILTER_MAX
+#define UDS_ISOTP_C_SOCKETCAN_FILTER_MAX (128)
+#endif
+
+/** Maximum number of transports sharing one bus */
+#ifndef UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS
+#define UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS (64)
+#endif
+
+/** Received messages a transport holds until they are read. Single frames are copied into the
+ * queue, multi-frame messages wait in their block of the rx_pool. Without a pool, or once the
+ * queue is full, a message waits in its link. The link drops single frames and answers first
+ * frames with FC.OVFLW until the message was read. */
+#ifndef UDS_ISOTP_C_RX_QUEUE_LEN
+#define UDS_ISOTP_C_RX_QUEUE_LEN (4)
+#endif
+
+/** Size of the CAN ID hash table of a bus. Must be a power of two and at least
+ * 4 * UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS so that the table stays at most half full. */
+#ifndef UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE
+#define UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE (256)
+#endif
+
+static_assert((UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE &
+               (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1)) == 0,
+              "UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE must be a power of two");
+static_assert(UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE >= 4 * UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS,
+              "UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE too small");
+
+/** ISO 15765-2 normal fixed addressing: 29 bit CAN IDs carrying the target and source address */
+#define UDS_ISOTP_NORMAL_FIXED_PHYS_ID(ta, sa) (0x18DA0000u | ((ta) & 0xFFu) << 8 | ((sa) & 0xFFu))
+#define UDS_ISOTP_NORMAL_FIXED_FUNC_ID(ta, sa) (0x18DB0000u | ((ta) & 0xFFu) << 8 | ((sa) & 0xFFu))
+
+struct UDSTpISOTpC;
+
+// same layout as struct mmsghdr, which <sys/socket.h> only declares under _GNU_SOURCE
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} UDSTpISOTpCMmsg_t;
+
+/**
+ * @brief Maps a received CAN ID and address byte to the link that handles it
+ */
 typedef struct {
+    uint32_t can_id;
+    int16_t addr_ext; /**< first byte of the frames, -1 with normal addressing, -2: normal fixed
+                           addressing, can_id is the target address and the link is chosen by the
+                           source address */
+    struct UDSTpISOTpC *tp; /**< NULL if the slot is empty */
+    IsoTpLink *link;
+} UDSTpISOTpCBusEntry_t;
+
+/**
+ * @brief One raw CAN socket shared by several UDSTpISOTpC_t transports
+ *
+ * Frames are read once per poll and dispatched by CAN ID, and by address byte for links with
+ * extended or mixed addressing, through a hash table. Frames sent by any transport on the bus are
+ * flushed together.
+ */
+typedef struct {
+    int fd;
+    bool can_fd;        // CAN_RAW_FD_FRAMES enabled
+    bool kernel_filter; // fd is a CAN_RAW socket, frames are filtered by CAN ID in the kernel
+
+    UDSTpISOTpCBusEntry_t table[UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE];
+    uint16_t num_addr_ext_links;     // table entries with an address byte
+    uint16_t num_normal_fixed_links; // table entries with normal fixed addressing
+    struct UDSTpISOTpC *tps[UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS];
+    uint16_t num_tps;
+
+    // kernel receive filter, one entry per CAN ID
+    uint16_t num_filters;
+    struct can_filter filters[UDS_ISOTP_C_SOCKETCAN_FILTER_MAX];
+    uint16_t filter_refs[UDS_ISOTP_C_SOCKETCAN_FILTER_MAX];
+
+    // receive batch, filled by recvmmsg
+    uint16_t rx_batch_size;
+    struct canfd_frame rx_frames[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX];
+    struct iovec rx_iovs[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX];
+    UDSTpISOTpCMmsg_t rx_msgs[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX];
+    // SO_TIMESTAMPNS control messages, uint64_t keeps them aligned for struct cmsghdr
+    uint64_t rx_control[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX]
+                      [(CMSG_SPACE(sizeof(struct timespec)) + 7) / 8];
+
+    // transmit batch, frames queued by isotp-c and flushed with sendmmsg
+    uint16_t tx_count;
+    struct canfd_frame tx_frames[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX];
+    struct iovec tx_iovs[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX];
+    UDSTpISOTpCMmsg_t tx_msgs[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX];
+    struct UDSTpISOTpC *tx_owners[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX]; // NULL once deinitialized
+} UDSTpISOTpCBus_t;
+
+typedef struct {
+    bool can_fd;            // enable CAN-FD frames, required for transports with tx_dl > 8
+    uint16_t rx_batch_size; // frames read per syscall, 0: UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX
+} UDSTpISOTpCBusConfig_t;
+
+/**
+ * @brief Link to one peer of a transport with normal fixed addressing
+ */
+typedef struct {
+    IsoTpLink link;
+    uint8_t addr;        // N_SA of the peer
+    uint64_t rx_time_ns; // arrival of the frame completing the received message
+    uint8_t recv_buf[UDS_ISOTP_RECV_BUF_SIZE];
+} UDSTpISOTpCPeer_t;
+
+/**
+ * @brief A received message waiting to be read
+ */
+typedef struct {
+    uint8_t *data;          // a block of pool, or sf
+    uint32_t len;
+    IsoTpBufferPool *pool;  // NULL if the message was copied into sf
+    UDSSDU_t info;
+    uint8_t sf[ISOTP_CAN_FD_MAX_DL];
+} UDSTpISOTpCRxMsg_t;
+
+typedef struct UDSTpISOTpC {
     UDSTp_t hdl;
     IsoTpLink phys_link;
     IsoTpLink func_link;
-    uint8_t send_buf[UDS_ISOTP_MTU];
-    uint8_t recv_buf[UDS_ISOTP_MTU];
-    int fd;
+    uint8_t recv_buf[UDS_ISOTP_RECV_BUF_SIZE];
+    uint8_t func_recv_buf[ISOTP_CAN_FD_MAX_DL]; // functional messages are single frames
+    bool can_fd; // send CAN-FD frames
     uint32_t phys_sa, phys_ta;
     uint32_t func_sa, func_ta;
     char tag[16];
+    uint64_t phys_rx_time_ns, func_rx_time_ns; // arrival of the frame completing the message
+
+    UDSTpISOTpCBus_t *bus;    // the bus this transport sends and receives on
+    UDSTpISOTpCBus_t own_bus; // bus opened by UDSTpISOTpCInit, unused on a shared bus
+    uint16_t tx_queued;       // frames of this transport in the transmit batch of the bus
+
+    // normal fixed addressing, phys_link is unused
+    bool normal_fixed;
+    UDSTpISOTpCPeer_t *peers;
+    uint16_t num_peers;
+    uint16_t peer_index[256]; // peers[peer_index[addr] - 1] talks to addr, 0: none
+    uint16_t next_peer;       // recv() and peek() look at this peer first
+    uint16_t next_free_peer;  // a new peer is searched from here
+    uint32_t reply_ta;        // sender of the last received message
+    uint8_t func_rx_sa;       // sender of the functional message in func_link
+    IsoTpLink *send_link;     // link of the last physical message sent
+
+    // complete messages moved out of the links, read in the order they arrived
+    UDSTpISOTpCRxMsg_t rx_queue[UDS_ISOTP_C_RX_QUEUE_LEN];
+    uint8_t rx_head;  // oldest message
+    uint8_t rx_count; // messages not read yet
+    bool rx_lent;     // the oldest message is lent by peek()
 } UDSTpISOTpC_t;
 
+typedef struct {
+    uint32_t source_addr;      // CAN ID of received physical frames
+    uint32_t target_addr;      // CAN ID of sent physical frames
+    uint32_t source_addr_func; // CAN ID of received functional frames
+    uint32_t target_addr_func; // CAN ID of sent functional frames
+    uint8_t tx_dl; // 0 or 8 for classic CAN, 12..64 for CAN-FD (requires an FD-capable interface)
+    uint16_t max_cf_per_poll; // consecutive frames sent per poll, 0: ISO_TP_DEFAULT_MAX_CF_PER_POLL
+    uint16_t rx_batch_size;   // frames read per syscall, 0: UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX
+    const UDSISOTpFCParams_t *fc_params; // NULL: defaults from isotp_config.h
+    IsoTpBufferPool *rx_pool; // shared buffers for multi-frame messages, may be NULL. Needs a
+                              // block per queued message, see UDS_ISOTP_C_RX_QUEUE_LEN
+
+    // Extended addressing (N_TA) or mixed addressing (N_AE): every frame starts with an address
+    // byte, links with different address bytes can share CAN IDs. Received messages report it in
+    // UDSSDU_t.A_AE.
+    bool addr_ext;
+    uint8_t source_ae;      // address byte of received physical frames
+    uint8_t target_ae;      // address byte of sent physical frames
+    uint8_t source_ae_func; // address byte of received functional frames
+    uint8_t target_ae_func; // address byte of sent functional frames
+
+    // Normal fixed addressing: IDs are UDS_ISOTP_NORMAL_FIXED_PHYS_ID / _FUNC_ID and the addresses
+    // above are 8 bit N_SA and N_TA. Physical messages are received from every sender into one of
+    // the peers, a peer is needed for every sender whose message hasn't been read yet. Messages
+    // are sent to UDSSDU_t.A_TA if UDSSDU_t.A_SA is source_addr, else to target_addr, or, if that
+    // is UDS_TP_NOOP_ADDR, to the sender of the last received message. Received messages report
+    // the sender in UDSSDU_t.A_SA.
+    bool normal_fixed;
+    UDSTpISOTpCPeer_t *peers; // num_peers links, owned by the caller
+    uint16_t num_peers;
+} UDSTpISOTpCConfig_t;
+
+/**
+ * @brief Open a transport on a bus of its own
+ */
+UDSErr_t UDSTpISOTpCInitWithConfig(UDSTpISOTpC_t *tp, const char *ifname,
+                                   const UDSTpISOTpCConfig_t *cfg);
+
+/**
+ * @brief Open a transport on a bus of its own that sends and receives frames on fd
+ * @details See UDSTpISOTpCBusInitWithFd
+ */
+UDSErr_t UDSTpISOTpCInitWithFd(UDSTpISOTpC_t *tp, int fd, const UDSTpISOTpCConfig_t *cfg);
 UDSErr_t UDSTpISOTpCInit(UDSTpISOTpC_t *tp, const char *ifname, uint32_t source_addr,
                          uint32_t target_addr, uint32_t source_addr_func,
                          uint32_t target_addr_func);
+
+/**
+ * @brief Attach a transport to a shared bus
+ * @details UDSTpPoll() on the transport runs its timers and flushes pending frames, but frames are
+ * only received by UDSTpISOTpCBusPoll(). cfg->rx_batch_size is ignored.
+ */
+UDSErr_t UDSTpISOTpCInitOnBus(UDSTpISOTpC_t *tp, UDSTpISOTpCBus_t *bus,
+                              const UDSTpISOTpCConfig_t *cfg);
+
+/**
+ * @brief Detach the transport from its bus and close the bus if UDSTpISOTpCInit opened it
+ */
 void UDSTpISOTpCDeinit(UDSTpISOTpC_t *tp);
 
+/**
+ * @brief Change the flow control parameters of the transport
+ * @details Takes effect with the next message. Fails while a message is being sent or received.
+ * @return UDS_OK on success, UDS_ERR_BUSY if a transfer is in progress
+ */
+UDSErr_t UDSTpISOTpCSetFCParams(UDSTpISOTpC_t *tp, const UDSISOTpFCParams_t *params);
+
+/**
+ * @brief Let frames with another CAN ID through the socket's kernel receive filter
+ * @details The filter passes the source addresses of the transports on the bus. IDs above 0x7FF
+ * are treated as 29-bit identifiers.
+ * @param tp transport
+ * @param can_id CAN ID to receive
+ * @return UDS_OK on success, UDS_ERR_BUFSIZ if UDS_ISOTP_C_SOCKETCAN_FILTER_MAX is reached
+ */
+UDSErr_t UDSTpISOTpCAddRxId(UDSTpISOTpC_t *tp, uint32_t can_id);
+
+UDSErr_t UDSTpISOTpCBusInit(UDSTpISOTpCBus_t *bus, const char *ifname,
+                            const UDSTpISOTpCBusConfig_t *cfg);
+
+/**
+ * @brief Run a bus on a socket other than CAN_RAW
+ * @details fd carries one struct can_frame or struct canfd_frame per datagram, e.g. one end of
+ * socketpair(AF_UNIX, SOCK_SEQPACKET, 0). This runs the SocketCAN code path without a CAN
+ * interface, for tests and benchmarks in processes that can't create vcan. fd has no receive
+ * filter, frames with CAN IDs no transport listens to are dropped after they were read. The bus
+ * takes ownership of fd.
+ */
+UDSErr_t UDSTpISOTpCBusInitWithFd(UDSTpISOTpCBus_t *bus, int fd,
+                                  const UDSTpISOTpCBusConfig_t *cfg);
+void UDSTpISOTpCBusDeinit(UDSTpISOTpCBus_t *bus);
+
+/**
+ * @brief Receive and dispatch pending frames, run the timers of every transport on the bus and
+ * send the frames they produce
+ */
+void UDSTpISOTpCBusPoll(UDSTpISOTpCBus_t *bus);
+
+/**
+ * @brief Bus version of UDSTpISOTpCAddRxId
+ */
+UDSErr_t UDSTpISOTpCBusAddRxId(UDSTpISOTpCBus_t *bus, uint32_t can_id);
+
 #endif
 
 
 #if defined(UDS_TP_ISOTP_SOCK)
 
+#include <linux/can.h>
+#include <linux/can/isotp.h>
+
+/**
+ * @brief Link layer options of the kernel ISO-TP sockets, zero-initialized: classic CAN with the
+ * kernel defaults
+ */
+typedef struct {
+    uint8_t tx_dl;    // payload bytes per sent frame: 0 or 8: classic CAN, 12..64: CAN FD
+    uint8_t tx_flags; // flags of sent CAN FD frames, e.g. CANFD_BRS. Nonzero selects CAN FD
+    // time the kernel reserves for sending a frame when STmin is 0. 0: kernel default (50 us),
+    // CAN_ISOTP_FRAME_TXTIME_ZERO: send back to back
+    uint32_t frame_txtime_ns;
+    bool tx_padding;        // pad sent frames to tx_dl bytes
+    uint8_t tx_pad_content; // padding byte, e.g. 0xCC or 0xAA
+    bool force_tx_stmin;    // ignore the STmin in flow control frames from the peer...
+    uint32_t tx_stmin_us;   // ...and wait this long between consecutive frames
+    // flow control parameters sent while receiving, NULL: BS 16 and STmin 3 ms. The kernel uses
+    // fixed timeouts, n_bs_us and n_cr_us are ignored
+    const UDSISOTpFCParams_t *fc_params;
+} UDSTpIsoTpSockOpts_t;
 
 typedef struct {
     UDSTp_t hdl;
-    uint8_t recv_buf[UDS_ISOTP_MTU];
-    uint8_t send_buf[UDS_ISOTP_MTU];
+    uint8_t recv_buf[UDS_ISOTP_MTU]; // message lent by peek(), later ones wait in the socket
     size_t recv_len;
     UDSSDU_t recv_info;
     int phys_fd;
@@ -1681,14 +2243,47 @@ typedef struct {
     uint32_t phys_sa, phys_ta;
     uint32_t func_sa, func_ta;
     char tag[16];
+    char ifname[16];
+    UDSISOTpFCParams_t fc_params;
+    UDSTpIsoTpSockOpts_t opts;
+    int poll_timeout_ms;   // time UDSTpPoll() may wait for socket events, 0 (default): don't wait
+    bool send_in_progress; // a physical message was written and the kernel is still sending it
 } UDSTpIsoTpSock_t;
 
+/**
+ * @param opts link layer options and flow control parameters, NULL: classic CAN with the kernel
+ * defaults
+ */
 UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t source_addr_func);
+                                  uint32_t target_addr, uint32_t source_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts);
 UDSErr_t UDSTpIsoTpSockInitClient(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t target_addr_func);
+                                  uint32_t target_addr, uint32_t target_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts);
+
+/**
+ * @brief Use sockets the caller has opened and bound
+ * @details The transport closes them in UDSTpIsoTpSockDeinit(). phys_fd sends and receives
+ * physical messages, func_fd functional ones. UDSTpIsoTpSockSetFCParams() needs an interface to
+ * bind to and isn't available, set the flow control parameters before binding the sockets.
+ * @return UDS_OK on success, UDS_ERR_INVALID_ARG if a socket is missing
+ */
+UDSErr_t UDSTpIsoTpSockInitWithFds(UDSTpIsoTpSock_t *tp, int phys_fd, int func_fd,
+                                   const UDSTpIsoTpSockOpts_t *opts);
 void UDSTpIsoTpSockDeinit(UDSTpIsoTpSock_t *tp);
 
+/**
+ * @brief Change the flow control parameters the kernel sends while receiving
+ * @details The kernel only accepts CAN_ISOTP_RECV_FC before bind(), so the physical socket is
+ * closed and bound again. Call it between messages. n_bs_us and n_cr_us are ignored because the
+ * kernel uses fixed timeouts. STmin is rounded up to the next value the FC frame can carry.
+ * The parameters at init are set with UDSTpIsoTpSockOpts_t.fc_params.
+ * @return UDS_OK on success, UDS_ERR_BUSY while a message is being sent, UDS_ERR_MISUSE on sockets
+ * from UDSTpIsoTpSockInitWithFds(), UDS_FAIL if the socket could not be bound again. The physical
+ * link is closed then.
+ */
+UDSErr_t UDSTpIsoTpSockSetFCParams(UDSTpIsoTpSock_t *tp, const UDSISOTpFCParams_t *params);
+
 #endif
 
 
@@ -1702,12 +2297,74 @@ void UDSTpIsoTpSockDeinit(UDSTpIsoTpSock_t *tp);
 
 
 
+/** Maximum number of mock transports in a process */
+#ifndef UDS_ISOTP_MOCK_MAX_TPS
+#define UDS_ISOTP_MOCK_MAX_TPS (128)
+#endif
+
+/** Messages in flight on the mock network. A message to a single receiver stays queued until the
+ * receiver has room for it, its sender's buffer is borrowed until then. */
+#ifndef UDS_ISOTP_MOCK_QUEUE_LEN
+#define UDS_ISOTP_MOCK_QUEUE_LEN (UDS_ISOTP_MOCK_MAX_TPS)
+#endif
+
+/** Received messages a mock transport holds until they are read */
+#ifndef UDS_ISOTP_MOCK_RX_FIFO_LEN
+#define UDS_ISOTP_MOCK_RX_FIFO_LEN (4)
+#endif
+
+/** Size of the address hash table. Must be a power of two and at least
+ * 4 * UDS_ISOTP_MOCK_MAX_TPS so that the table stays at most half full. */
+#ifndef UDS_ISOTP_MOCK_TABLE_SIZE
+#define UDS_ISOTP_MOCK_TABLE_SIZE (512)
+#endif
+
+static_assert((UDS_ISOTP_MOCK_TABLE_SIZE & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) == 0,
+              "UDS_ISOTP_MOCK_TABLE_SIZE must be a power of two");
+static_assert(UDS_ISOTP_MOCK_TABLE_SIZE >= 4 * UDS_ISOTP_MOCK_MAX_TPS,
+              "UDS_ISOTP_MOCK_TABLE_SIZE too small");
+
+typedef struct {
+    uint32_t bitrate;      // nominal bit rate in bit/s, e.g. 500000
+    uint32_t data_bitrate; // CAN FD data phase bit rate in bit/s, 0: no bit rate switch
+    uint8_t tx_dl;         // payload bytes per frame: 0 or 8: classic CAN, 12..64: CAN FD
+    bool tx_padding;       // pad frames to tx_dl bytes
+    UDSISOTpFCParams_t fc; // flow control sent by every receiver, bs and st_min_us are used
+} ISOTPMockBusConfig_t;
+
+/**
+ * @brief A simulated CAN bus shared by mock transports
+ * @details Messages are split into ISO-TP frames that take the bus for their length in bits,
+ * including stuff bits and the interframe space. Receivers answer with flow control frames and
+ * senders honor BS and STmin. When several frames are ready the lowest CAN ID wins arbitration.
+ * Addresses above 0x7FF are sent with 29 bit IDs. Time runs on UDSMillis().
+ * Bus load over a time span is the growth of busy_ns divided by its length.
+ */
+typedef struct ISOTPMockBus {
+    ISOTPMockBusConfig_t cfg;
+    uint32_t origin_ms; // UDSMillis() at time 0 of the bus
+    uint64_t free_ns;   // end of the last frame
+    uint64_t busy_ns;   // time the bus spent sending frames
+    uint32_t num_frames;
+    uint32_t pass; // network pass in which the bus was simulated last
+} ISOTPMockBus_t;
+
+typedef struct {
+    uint8_t buf[UDS_TP_MTU];
+    size_t len;
+    UDSSDU_t info;
+} ISOTPMockRxMsg_t;
+
 typedef struct ISOTPMock {
     UDSTp_t hdl;
-    uint8_t recv_buf[UDS_TP_MTU];
-    uint8_t send_buf[UDS_TP_MTU];
-    size_t recv_len;
-    UDSSDU_t recv_info;
+    ISOTPMockRxMsg_t rx_fifo[UDS_ISOTP_MOCK_RX_FIFO_LEN];
+    unsigned rx_head;          // oldest received message
+    unsigned rx_count;         // received messages not read yet
+    unsigned tx_pending;       // sent messages still on the network
+    uint32_t blocked_pass;     // network pass in which a message waited for room in rx_fifo
+    unsigned rx_dropped;       // messages to a shared address dropped while rx_fifo was full
+    uint32_t bus_scan;         // bus simulation step that found its oldest message
+    ISOTPMockBus_t *bus;       // NULL: messages arrive after send_tx_delay_ms
     uint32_t sa_phys;          // source address - physical messages are sent from this address
     uint32_t ta_phys;          // target address - physical messages are sent to this address
     uint32_t sa_func;          // source address - functional messages are sent from this address
@@ -1722,17 +2379,31 @@ typedef struct {
     uint32_t ta_phys; // target address - physical messages are sent to this address
     uint32_t sa_func; // source address - functional messages are sent from this address
     uint32_t ta_func; // target address - functional messages are sent to this address
+    ISOTPMockBus_t *bus; // simulated bus to send on, NULL: messages arrive after send_tx_delay_ms
 } ISOTPMockArgs_t;
 
 /**
  * @brief Create a mock transport. It is connected by default to a broadcast network of all other
  * mock transports in the same process.
+ * @details Messages are routed by target address to every transport whose sa_phys or sa_func
+ * matches. Nothing is dropped while a receiver is busy: messages wait in its rx_fifo and, once
+ * that is full, on the network. Only a message to an address several transports share, e.g. a
+ * functional request, is dropped for a receiver with a full rx_fifo and counted in rx_dropped, so
+ * one transport that is never read doesn't stop the others.
  * @param name optional name of the transport (can be NULL)
  * @return UDSTp_t*
  */
 UDSTp_t *ISOTPMockNew(const char *name, ISOTPMockArgs_t *args);
 void ISOTPMockFree(UDSTp_t *tp);
 
+/**
+ * @brief Initialize a simulated bus, pass it in ISOTPMockArgs_t.bus of the transports on it
+ * @details Transports on a bus send their messages one after the other. Messages are still
+ * routed to every mock transport, bus or not, so a bus should only connect transports that talk
+ * to each other.
+ */
+void ISOTPMockBusInit(ISOTPMockBus_t *bus, const ISOTPMockBusConfig_t *cfg);
+
 /**
  * @brief write all messages to a file
  * @note uses UDSMillis() to get the current time
@@ -1749,6 +2420,358 @@ void ISOTPMockReset(void);
 #endif
 
 
+
+#if defined(UDS_TP_DOIP)
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/** TCP_DATA and UDP_DISCOVERY port, ISO 13400-2:2012 Table 39 */
+#ifndef UDS_DOIP_PORT
+#define UDS_DOIP_PORT (13400)
+#endif
+
+/** Protocol version written to sent headers, 0x02: ISO 13400-2:2012 */
+#ifndef UDS_DOIP_PROTOCOL_VERSION
+#define UDS_DOIP_PROTOCOL_VERSION (0x02)
+#endif
+
+/** Largest diagnostic message user data received by a DoIP transport. DoIP is not limited to
+ * 4095 bytes, raise UDS_TP_MTU to let the UDS client and server use larger messages. */
+#ifndef UDS_DOIP_MTU
+#define UDS_DOIP_MTU (UDS_TP_MTU)
+#endif
+
+/** Number of testers a DoIP server accepts at the same time */
+#ifndef UDS_DOIP_MAX_CONNECTIONS
+#define UDS_DOIP_MAX_CONNECTIONS (2)
+#endif
+
+/** Number of received diagnostic messages a DoIP server holds at the same time. A gateway
+ * forwards one message per ECU while the next ones arrive, give it one more than it has routes. */
+#ifndef UDS_DOIP_RX_SLOTS
+#define UDS_DOIP_RX_SLOTS (1)
+#endif
+
+/** Size of the per-connection queues for control messages (routing activation, ACK, ...) */
+#ifndef UDS_DOIP_CTRL_BUF_SIZE
+#define UDS_DOIP_CTRL_BUF_SIZE (64)
+#endif
+
+/** T_TCP_Initial_Inactivity: time a new connection has to activate routing */
+#ifndef UDS_DOIP_INITIAL_INACTIVITY_MS
+#define UDS_DOIP_INITIAL_INACTIVITY_MS (2000)
+#endif
+
+/** T_TCP_General_Inactivity: an idle connection is closed after this time */
+#ifndef UDS_DOIP_GENERAL_INACTIVITY_MS
+#define UDS_DOIP_GENERAL_INACTIVITY_MS (300000)
+#endif
+
+/** T_TCP_Alive_Check: time a tester has to answer an alive check request */
+#ifndef UDS_DOIP_ALIVE_CHECK_MS
+#define UDS_DOIP_ALIVE_CHECK_MS (500)
+#endif
+
+/** A_DoIP_Ctrl: time the client waits for the connection and the routing activation response */
+#ifndef UDS_DOIP_CTRL_TIMEOUT_MS
+#define UDS_DOIP_CTRL_TIMEOUT_MS (2000)
+#endif
+
+/** A_DoIP_Diagnostic_Message: time the client waits for the diagnostic message ACK */
+#ifndef UDS_DOIP_DIAG_ACK_TIMEOUT_MS
+#define UDS_DOIP_DIAG_ACK_TIMEOUT_MS (2000)
+#endif
+
+/** A_DoIP_Announce_Num and A_DoIP_Announce_Interval */
+#ifndef UDS_DOIP_ANNOUNCE_NUM
+#define UDS_DOIP_ANNOUNCE_NUM (3)
+#endif
+
+#ifndef UDS_DOIP_ANNOUNCE_INTERVAL_MS
+#define UDS_DOIP_ANNOUNCE_INTERVAL_MS (500)
+#endif
+
+/** Default functional logical address, ISO 13400-2:2012 Table 13 */
+#define UDS_DOIP_FUNC_ADDR_DEFAULT (0xE400)
+
+/**
+ * @brief One TCP_DATA connection: header parsing and the send queue
+ */
+typedef struct {
+    int fd; // -1 if unused
+    bool active;              // routing activation succeeded
+    uint16_t tester_addr;     // logical address of the tester
+    uint32_t inactivity_timer;
+    bool alive_check_pending; // an alive check request was sent and is not answered yet
+    bool close_after_tx;      // close once the send queue is empty, e.g. after a NACK
+
+    // receive
+    uint8_t rx_state;
+    uint8_t rx_hdr[8];
+    uint16_t rx_type;
+    uint32_t rx_len; // payload length from the header
+    uint32_t rx_pos; // payload bytes read
+    uint8_t rx_ctrl[UDS_DOIP_CTRL_BUF_SIZE]; // control message payload, diagnostic SA and TA
+    uint8_t *rx_dst;                         // user data of the diagnostic message being read
+
+    // control messages, sent in order
+    uint8_t tx_ctrl[UDS_DOIP_CTRL_BUF_SIZE];
+    size_t tx_ctrl_len, tx_ctrl_pos;
+
+    // a diagnostic message, the user data is borrowed from the caller of send()
+    uint8_t tx_diag_hdr[12];
+    const uint8_t *tx_diag_data; // NULL if none
+    size_t tx_diag_len, tx_diag_pos;
+} UDSTpDoIPConn_t;
+
+enum UDSTpDoIPRxSlotState {
+    UDS_DOIP_SLOT_FREE = 0,
+    UDS_DOIP_SLOT_FILLING, // the message is being received
+    UDS_DOIP_SLOT_READY,   // the message is complete
+    UDS_DOIP_SLOT_ABORTED, // the connection closed before the message was complete
+};
+
+/**
+ * @brief A diagnostic message received by a DoIP server
+ */
+typedef struct {
+    uint8_t state;           // enum UDSTpDoIPRxSlotState
+    bool lent;               // lent by peek()
+    bool taken;              // taken by UDSTpDoIPServerTake()
+    bool drop;               // given back before it was complete, free it once it is
+    uint32_t seq;            // arrival order
+    UDSTpDoIPConn_t *conn;   // connection receiving into buf
+    size_t len;              // user data length
+    size_t received;         // user data bytes in buf
+    UDSSDU_t info;
+    uint8_t buf[UDS_DOIP_MTU];
+} UDSTpDoIPRxSlot_t;
+
+/**
+ * @brief DoIP entity (server role)
+ * @details Accepts testers on TCP_DATA and answers vehicle identification requests on
+ * UDP_DISCOVERY. Responses go to the tester that sent the last request.
+ */
+typedef struct {
+    UDSTp_t hdl;
+    uint16_t logical_address;
+    uint16_t func_address;
+    uint8_t vin[17];
+    uint8_t eid[6];
+    uint8_t gid[6];
+    int listen_fd;
+    int udp_fd;
+    UDSTpDoIPConn_t conns[UDS_DOIP_MAX_CONNECTIONS];
+
+    // a tester that connected while all connections were in use waits for the alive check
+    int pending_fd;
+    uint32_t alive_check_timer;
+
+    uint8_t announce_count; // vehicle announcements left to send
+    uint32_t announce_timer;
+    struct sockaddr_storage announce_addr;
+    socklen_t announce_addr_len;
+
+    // additional target addresses, e.g. the ECUs behind a gateway. NULL: only logical_address
+    bool (*is_target)(void *arg, uint16_t ta);
+    void *is_target_arg;
+
+    uint16_t reply_addr; // tester that sent the last request
+    uint32_t rx_seq;
+    UDSTpDoIPRxSlot_t rx_slots[UDS_DOIP_RX_SLOTS];
+} UDSTpDoIPServer_t;
+
+typedef struct {
+    const char *bind_addr; // local address, NULL: all IPv4 interfaces
+    uint16_t port;         // TCP and UDP port, 0: UDS_DOIP_PORT
+    uint16_t logical_address;
+    uint16_t func_address; // 0: UDS_DOIP_FUNC_ADDR_DEFAULT
+    uint8_t vin[17];
+    uint8_t eid[6];
+    uint8_t gid[6];
+    const char *announce_addr; // send vehicle announcements here after init, NULL: don't announce
+} UDSTpDoIPServerConfig_t;
+
+enum UDSTpDoIPClientState {
+    UDS_DOIP_CLIENT_CONNECTING = 0,
+    UDS_DOIP_CLIENT_ACTIVATING,
+    UDS_DOIP_CLIENT_ACTIVE,
+    UDS_DOIP_CLIENT_FAILED,
+};
+
+/**
+ * @brief DoIP tester (client role)
+ * @details Connects and activates routing in the background. Messages sent before the routing
+ * activation finished are held until then. A send is complete once the entity acknowledged it.
+ */
+typedef struct {
+    UDSTp_t hdl;
+    uint16_t source_addr; // logical address of the tester
+    uint16_t target_addr; // logical address of the DoIP entity
+    uint16_t func_addr;
+    uint8_t activation_type;
+    uint8_t state; // enum UDSTpDoIPClientState
+    uint32_t timer;
+    UDSTpDoIPConn_t conn;
+
+    // message waiting for the routing activation
+    const uint8_t *pending_data;
+    size_t pending_len;
+    uint16_t pending_ta;
+
+    bool awaiting_ack;
+    bool send_err;
+    uint8_t nack_code; // code of the last diagnostic message NACK
+
+    size_t recv_len;
+    UDSSDU_t recv_info;
+    uint8_t recv_buf[UDS_DOIP_MTU];
+} UDSTpDoIPClient_t;
+
+typedef struct {
+    const char *addr;         // address of the DoIP entity
+    uint16_t port;            // 0: UDS_DOIP_PORT
+    uint16_t source_addr;     // logical address of the tester, e.g. 0x0E00
+    uint16_t target_addr;     // logical address of the DoIP entity
+    uint16_t func_addr;       // 0: UDS_DOIP_FUNC_ADDR_DEFAULT
+    uint8_t activation_type;  // 0x00: default
+} UDSTpDoIPClientConfig_t;
+
+/**
+ * @brief A vehicle identification response or vehicle announcement
+ */
+typedef struct {
+    char addr[INET6_ADDRSTRLEN]; // address the message came from
+    uint16_t logical_address;
+    uint8_t vin[17];
+    uint8_t eid[6];
+    uint8_t gid[6];
+    uint8_t further_action;
+} UDSTpDoIPVehicle_t;
+
+typedef struct {
+    int fd;
+} UDSTpDoIPDiscovery_t;
+
+UDSErr_t UDSTpDoIPServerInit(UDSTpDoIPServer_t *tp, const UDSTpDoIPServerConfig_t *cfg);
+void UDSTpDoIPServerDeinit(UDSTpDoIPServer_t *tp);
+
+/**
+ * @brief Take the oldest message for a target address, also while it is still being received
+ * @details Taken messages are not returned by peek() or recv(). rx_slots[slot].received tells how
+ * much of the message arrived, state changes to UDS_DOIP_SLOT_READY once it is complete.
+ * @return index into rx_slots, -1 if there is no message for ta
+ */
+int UDSTpDoIPServerTake(UDSTpDoIPServer_t *tp, uint16_t ta);
+
+/**
+ * @brief Give a message taken with UDSTpDoIPServerTake() back, its slot receives the next message
+ */
+void UDSTpDoIPServerGiveBack(UDSTpDoIPServer_t *tp, int slot);
+
+/**
+ * @brief Check if a message passed to send() is still being sent from buf
+ */
+bool UDSTpDoIPServerSending(const UDSTpDoIPServer_t *tp, const uint8_t *buf);
+
+UDSErr_t UDSTpDoIPClientInit(UDSTpDoIPClient_t *tp, const UDSTpDoIPClientConfig_t *cfg);
+void UDSTpDoIPClientDeinit(UDSTpDoIPClient_t *tp);
+
+/**
+ * @brief Send a vehicle identification request
+ * @param addr unicast or broadcast address, e.g. "255.255.255.255"
+ * @param port 0: UDS_DOIP_PORT
+ */
+UDSErr_t UDSTpDoIPDiscoveryInit(UDSTpDoIPDiscovery_t *d, const char *addr, uint16_t port);
+
+/**
+ * @brief Read the next vehicle identification response
+ * @return 1 if vehicle was filled in, 0 if no response is pending, negative on error
+ */
+int UDSTpDoIPDiscoveryPoll(UDSTpDoIPDiscovery_t *d, UDSTpDoIPVehicle_t *vehicle);
+void UDSTpDoIPDiscoveryDeinit(UDSTpDoIPDiscovery_t *d);
+
+#endif
+
+
+
+#if defined(UDS_TP_DOIP)
+
+
+/** Number of ECUs a DoIP gateway routes to */
+#ifndef UDS_DOIP_GATEWAY_MAX_ROUTES
+#define UDS_DOIP_GATEWAY_MAX_ROUTES (8)
+#endif
+
+/**
+ * @brief An ECU behind the gateway and the state of the messages to and from it
+ */
+typedef struct {
+    uint16_t logical_address; // DoIP address of the ECU
+    UDSTp_t *tp;              // link to the ECU, e.g. UDSTpISOTpC_t
+    bool functional;          // forward functional requests on this link
+
+    // request: lent by the DoIP server, forwarded while it arrives
+    int req_slot; // index into the server's rx_slots, -1 if none
+    size_t req_available;
+    bool req_started;
+    bool req_done;
+    uint16_t tester_addr;  // responses to physical requests go to this tester
+    bool phys_awaiting;    // the final response to the physical request is outstanding
+
+    // functional request from UDSTpDoIPGateway_t.func_slot still to be sent on this link
+    bool func_pending;
+    uint16_t func_tester_addr; // responses to the last functional request go to this tester
+    bool func_awaiting;        // the final response to the functional request is outstanding
+
+    // response: lent by tp, forwarded to the tester
+    uint8_t *resp_data;
+    size_t resp_len; // 0 if none
+    bool resp_sent;
+} UDSTpDoIPGatewayRoute_t;
+
+/**
+ * @brief Routes diagnostic messages between DoIP testers and ECUs on other transports
+ * @details Requests are forwarded by target address to the links of the ECUs and their responses
+ * back to the testers. Messages are sent from the buffers they were received into, a request
+ * goes out on the ECU link while its end still arrives over TCP. Every ECU has its own request and
+ * response in flight, a slow ECU only holds up messages to itself as long as the server has
+ * UDS_DOIP_RX_SLOTS for the others.
+ * @note a request that stalls on TCP for longer than the N_Cr timeout of the ECU is lost
+ */
+typedef struct {
+    UDSTpDoIPServer_t *doip;
+    UDSTpDoIPGatewayRoute_t routes[UDS_DOIP_GATEWAY_MAX_ROUTES];
+    int num_routes;
+    int func_slot; // functional request being forwarded, -1 if none
+} UDSTpDoIPGateway_t;
+
+/**
+ * @brief Attach a gateway to an initialized DoIP server
+ * @details The server accepts messages to the routes' addresses afterwards and reports itself as
+ * DoIP gateway.
+ */
+UDSErr_t UDSTpDoIPGatewayInit(UDSTpDoIPGateway_t *gw, UDSTpDoIPServer_t *doip);
+
+/**
+ * @brief Route a logical address to the link of an ECU
+ * @param functional forward functional requests on tp. Set it once per bus, the ECUs on a bus
+ * share the functional address.
+ * @note tp needs peek() and release(). Transports with send_partial() start forwarding a request
+ * before it is complete.
+ */
+UDSErr_t UDSTpDoIPGatewayAddRoute(UDSTpDoIPGateway_t *gw, uint16_t logical_address, UDSTp_t *tp,
+                                  bool functional);
+
+/**
+ * @brief Poll the DoIP server and the ECU links and forward what arrived
+ */
+void UDSTpDoIPGatewayPoll(UDSTpDoIPGateway_t *gw);
+
+#endif
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -202,7 +202,7 @@ static UDSErr_t PollLowLevel(UDSClient_t *client) {
         } else if (0 == ret) {
             UDS_LOGI(__FILE__, "send in progress...");
             ; // Waiting for send completion
-        } else if (client->send_size == ret) {
+        } else if ((ssize_t)client->send_size == ret) {
             changeState(client, STATE_AWAIT_SEND_COMPLETE);
         } else {
             err = UDS_ERR_BUFSIZ;
@@ -210,11 +210,8 @@ static UDSErr_t PollLowLevel(UDSClient_t *client) {
         break;
     }
     case STATE_AWAIT_SEND_COMPLETE: {
-        if (client->_options_copy & UDS_FUNCTIONAL) {
-            // "The Functional addressing is applied only to single frame transmission"
-            // Specification of Diagnostic Communication (Diagnostic on CAN - Network Layer)
-            changeState(client, STATE_IDLE);
-        }
+        // functional requests too: the transport may still be reading send_buf (DoIP borrows it
+        // for messages of any length) and the next request would overwrite it
         if (tp_status & UDS_TP_SEND_IN_PROGRESS) {
             ; // await send complete
         } else {
@@ -243,8 +240,7 @@ static UDSErr_t PollLowLevel(UDSClient_t *client) {
             }
         } else {
             UDS_LOGI(__FILE__, "received %zd bytes. Processing...", len);
-            UDS_ASSERT(len <= (ssize_t)UINT16_MAX);
-            client->recv_size = (uint16_t)len;
+            client->recv_size = (size_t)len;
 
             err = ValidateServerResponse(client);
             if (UDS_OK == err) {
@@ -296,7 +292,7 @@ static UDSErr_t PreRequestCheck(UDSClient_t *client) {
     return UDS_OK;
 }
 
-UDSErr_t UDSSendBytes(UDSClient_t *client, const uint8_t *data, uint16_t size) {
+UDSErr_t UDSSendBytes(UDSClient_t *client, const uint8_t *data, size_t size) {
     UDSErr_t err = PreRequestCheck(client);
     if (err) {
         return err;
@@ -528,7 +524,7 @@ UDSErr_t UDSSendRequestUpload(UDSClient_t *client, uint8_t dataFormatIdentifier,
  * @addtogroup transferData_0x36
  */
 UDSErr_t UDSSendTransferData(UDSClient_t *client, uint8_t blockSequenceCounter,
-                             const uint16_t blockLength, const uint8_t *data, uint16_t size) {
+                             const size_t blockLength, const uint8_t *data, size_t size) {
     UDSErr_t err = PreRequestCheck(client);
     if (err) {
         return err;
@@ -543,16 +539,19 @@ UDSErr_t UDSSendTransferData(UDSClient_t *client, uint8_t blockSequenceCounter,
     if (size > (blockLength - 2)) {
         return UDS_ERR_INVALID_ARG;
     }
+    if (UDS_0X36_REQ_BASE_LEN + size > sizeof(client->send_buf)) {
+        return UDS_ERR_BUFSIZ;
+    }
     client->send_buf[0] = kSID_TRANSFER_DATA;
     client->send_buf[1] = blockSequenceCounter;
     memmove(&client->send_buf[UDS_0X36_REQ_BASE_LEN], data, size);
-    UDS_LOGI(__FILE__, "size: %d, blocklength: %d", size, blockLength);
+    UDS_LOGI(__FILE__, "size: %zu, blocklength: %zu", size, blockLength);
     client->send_size = UDS_0X36_REQ_BASE_LEN + size;
     return SendRequest(client);
 }
 
 UDSErr_t UDSSendTransferDataStream(UDSClient_t *client, uint8_t blockSequenceCounter,
-                                   const uint16_t blockLength, FILE *fd) {
+                                   const size_t blockLength, FILE *fd) {
     UDSErr_t err = PreRequestCheck(client);
     if (err) {
         return err;
@@ -564,10 +563,11 @@ UDSErr_t UDSSendTransferDataStream(UDSClient_t *client, uint8_t blockSequenceCou
     client->send_buf[0] = kSID_TRANSFER_DATA;
     client->send_buf[1] = blockSequenceCounter;
 
-    size_t _size = fread(&client->send_buf[2], 1, blockLength - 2, fd);
-    UDS_ASSERT(_size < UINT16_MAX);
-    uint16_t size = (uint16_t)_size;
-    UDS_LOGI(__FILE__, "size: %d, blocklength: %d", size, blockLength);
+    if (blockLength > sizeof(client->send_buf)) {
+        return UDS_ERR_BUFSIZ;
+    }
+    size_t size = fread(&client->send_buf[2], 1, blockLength - 2, fd);
+    UDS_LOGI(__FILE__, "size: %zu, blocklength: %zu", size, blockLength);
     client->send_size = UDS_0X36_REQ_BASE_LEN + size;
     return SendRequest(client);
 }
@@ -643,7 +643,7 @@ UDSErr_t UDSSendRequestFileTransfer(UDSClient_t *client, uint8_t mode, const cha
         }
     }
 
-    client->send_size = (uint16_t)bufSize;
+    client->send_size = bufSize;
     return SendRequest(client);
 }
 
@@ -750,7 +750,7 @@ UDSErr_t UDSUnpackSecurityAccessResponse(const UDSClient_t *client,
         return UDS_ERR_RESP_TOO_SHORT;
     }
     resp->securityAccessType = client->recv_buf[1];
-    resp->securitySeedLength = client->recv_size - UDS_0X27_RESP_BASE_LEN;
+    resp->securitySeedLength = (uint16_t)(client->recv_size - UDS_0X27_RESP_BASE_LEN);
     resp->securitySeed = resp->securitySeedLength == 0 ? NULL : &client->recv_buf[2];
     return UDS_OK;
 }
@@ -777,7 +777,7 @@ UDSErr_t UDSUnpackRoutineControlResponse(const UDSClient_t *client,
     resp->routineControlType = client->recv_buf[1];
     resp->routineIdentifier =
         (uint16_t)((uint16_t)(client->recv_buf[2] << 8) | (uint16_t)client->recv_buf[3]);
-    resp->routineStatusRecordLength = client->recv_size - UDS_0X31_RESP_MIN_LEN;
+    resp->routineStatusRecordLength = (uint16_t)(client->recv_size - UDS_0X31_RESP_MIN_LEN);
     resp->routineStatusRecord =
         resp->routineStatusRecordLength == 0 ? NULL : &client->recv_buf[UDS_0X31_RESP_MIN_LEN];
     return UDS_OK;
@@ -812,7 +812,7 @@ UDSErr_t UDSUnpackRequestDownloadResponse(const UDSClient_t *client,
     for (uint8_t byteIdx = 0; byteIdx < maxNumberOfBlockLengthSize; byteIdx++) {
         uint8_t byte = client->recv_buf[UDS_0X34_RESP_BASE_LEN + byteIdx];
         uint8_t shiftBytes = maxNumberOfBlockLengthSize - 1 - byteIdx;
-        resp->maxNumberOfBlockLength |= byte << (8 * shiftBytes);
+        resp->maxNumberOfBlockLength |= (size_t)byte << (8 * shiftBytes);
     }
     return UDS_OK;
 }
@@ -1,12 +1,23 @@
 #pragma once
 
-/** ISO-TP Maximum Transmissiable Unit (ISO-15764-2-2004 section 5.3.3) */
+/** ISO-TP Maximum Transmissiable Unit (ISO-15764-2-2004 section 5.3.3). ISO 15765-2:2016 sends
+ * larger messages with a 32-bit FF_DL, raise it to let isotp-c transports, the UDS client and the
+ * server exchange them, e.g. TransferData blocks over CAN-FD. The receive buffers of the
+ * transports grow with it, see UDS_ISOTP_RECV_BUF_SIZE. */
+#ifndef UDS_ISOTP_MTU
 #define UDS_ISOTP_MTU (4095)
+#endif
 
 #ifndef UDS_TP_MTU
 #define UDS_TP_MTU UDS_ISOTP_MTU
 #endif
 
+/** Size of the physical receive buffer embedded in each isotp-c transport. Transports with a
+ * buffer pool (rx_pool) only receive single frames into it and need no more than 64 bytes. */
+#ifndef UDS_ISOTP_RECV_BUF_SIZE
+#define UDS_ISOTP_RECV_BUF_SIZE UDS_ISOTP_MTU
+#endif
+
 #ifndef UDS_SERVER_SEND_BUF_SIZE
 #define UDS_SERVER_SEND_BUF_SIZE (UDS_TP_MTU)
 #endif
@@ -89,3 +100,7 @@ TransferData request message from the client. */
 #ifndef UDS_CUSTOM_MILLIS
 #define UDS_CUSTOM_MILLIS 0
 #endif
+
+#ifndef UDS_CUSTOM_MICROS
+#define UDS_CUSTOM_MICROS 0
+#endif
@@ -143,7 +143,7 @@ static UDSErr_t Handle_0x14_ClearDiagnosticInformation(UDSServer_t *srv, UDSReq_
     return UDS_PositiveResponse;
 }
 
-static uint8_t safe_copy(UDSServer_t *srv, const void *src, uint16_t count) {
+static uint8_t safe_copy(UDSServer_t *srv, const void *src, size_t count) {
     if (srv == NULL) {
         return UDS_NRC_GeneralReject;
     }
@@ -485,7 +485,7 @@ static UDSErr_t decodeAddressAndLengthWithOffset(UDSReq_t *r, uint8_t *const buf
     *memoryAddress = 0;
     *memorySize = 0;
 
-    UDS_ASSERT(buf >= r->recv_buf && buf <= r->recv_buf + sizeof(r->recv_buf));
+    UDS_ASSERT(buf >= r->recv_buf && buf <= r->recv_buf + r->recv_len);
 
     if (r->recv_len < 3) {
         return NegativeResponse(r, UDS_NRC_IncorrectMessageLengthOrInvalidFormat);
@@ -911,6 +911,19 @@ static void ResetTransfer(UDSServer_t *srv) {
     srv->xferIsActive = false;
 }
 
+/**
+ * @brief write maxNumberOfBlockLength in 2 bytes, or 4 if it doesn't fit
+ * @return number of bytes written
+ */
+static uint8_t EncodeMaxNumberOfBlockLength(uint8_t *dst, uint32_t maxNumberOfBlockLength) {
+    const uint8_t len = maxNumberOfBlockLength > UINT16_MAX ? 4 : 2;
+    for (uint8_t idx = 0; idx < len; idx++) {
+        uint8_t shiftBytes = (uint8_t)(len - 1 - idx);
+        dst[idx] = (uint8_t)(maxNumberOfBlockLength >> (shiftBytes * 8));
+    }
+    return len;
+}
+
 static UDSErr_t Handle_0x34_RequestDownload(UDSServer_t *srv, UDSReq_t *r) {
     UDSErr_t err = UDS_PositiveResponse;
     void *memoryAddress = 0;
@@ -952,9 +965,6 @@ static UDSErr_t Handle_0x34_RequestDownload(UDSServer_t *srv, UDSReq_t *r) {
     srv->xferTotalBytes = memorySize;
     srv->xferBlockLength = args.maxNumberOfBlockLength;
 
-    // ISO-14229-1:2013 Table 401:
-    uint8_t lengthFormatIdentifier = (uint8_t)(sizeof(args.maxNumberOfBlockLength) << 4);
-
     /* ISO-14229-1:2013 Table 396: maxNumberOfBlockLength
     This parameter is used by the requestDownload positive response message to
     inform the client how many data bytes (maxNumberOfBlockLength) to include in
@@ -966,14 +976,12 @@ static UDSErr_t Handle_0x34_RequestDownload(UDSServer_t *srv, UDSReq_t *r) {
         args.maxNumberOfBlockLength = UDS_TP_MTU;
     }
 
+    uint8_t len = EncodeMaxNumberOfBlockLength(&r->send_buf[UDS_0X34_RESP_BASE_LEN],
+                                               args.maxNumberOfBlockLength);
     r->send_buf[0] = UDS_RESPONSE_SID_OF(kSID_REQUEST_DOWNLOAD);
-    r->send_buf[1] = lengthFormatIdentifier;
-    for (uint8_t idx = 0; idx < (uint8_t)sizeof(args.maxNumberOfBlockLength); idx++) {
-        uint8_t shiftBytes = (uint8_t)(sizeof(args.maxNumberOfBlockLength) - 1 - idx);
-        uint8_t byte = (args.maxNumberOfBlockLength >> (shiftBytes * 8)) & 0xFF;
-        r->send_buf[UDS_0X34_RESP_BASE_LEN + idx] = byte;
-    }
-    r->send_len = UDS_0X34_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength);
+    // ISO-14229-1:2013 Table 401: lengthFormatIdentifier
+    r->send_buf[1] = (uint8_t)(len << 4);
+    r->send_len = UDS_0X34_RESP_BASE_LEN + len;
     return UDS_PositiveResponse;
 }
 
@@ -1018,22 +1026,17 @@ static UDSErr_t Handle_0x35_RequestUpload(UDSServer_t *srv, UDSReq_t *r) {
     srv->xferTotalBytes = memorySize;
     srv->xferBlockLength = args.maxNumberOfBlockLength;
 
-    uint8_t lengthFormatIdentifier = (uint8_t)(sizeof(args.maxNumberOfBlockLength) << 4);
-
+    uint8_t len = EncodeMaxNumberOfBlockLength(&r->send_buf[UDS_0X35_RESP_BASE_LEN],
+                                               args.maxNumberOfBlockLength);
     r->send_buf[0] = UDS_RESPONSE_SID_OF(kSID_REQUEST_UPLOAD);
-    r->send_buf[1] = lengthFormatIdentifier;
-    for (uint8_t idx = 0; idx < (uint8_t)sizeof(args.maxNumberOfBlockLength); idx++) {
-        uint8_t shiftBytes = (sizeof(args.maxNumberOfBlockLength) - 1 - idx) & 0xFF;
-        uint8_t byte = (args.maxNumberOfBlockLength >> (shiftBytes * 8)) & 0xFF;
-        r->send_buf[UDS_0X35_RESP_BASE_LEN + idx] = byte;
-    }
-    r->send_len = UDS_0X35_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength);
+    r->send_buf[1] = (uint8_t)(len << 4);
+    r->send_len = UDS_0X35_RESP_BASE_LEN + len;
     return UDS_PositiveResponse;
 }
 
 static UDSErr_t Handle_0x36_TransferData(UDSServer_t *srv, UDSReq_t *r) {
     UDSErr_t err = UDS_PositiveResponse;
-    uint16_t request_data_len = (uint16_t)(r->recv_len - UDS_0X36_REQ_BASE_LEN);
+    size_t request_data_len = r->recv_len - UDS_0X36_REQ_BASE_LEN;
     uint8_t blockSequenceCounter = 0;
 
     if (!srv->xferIsActive) {
@@ -1064,8 +1067,8 @@ static UDSErr_t Handle_0x36_TransferData(UDSServer_t *srv, UDSReq_t *r) {
     {
         UDSTransferDataArgs_t args = {
             .data = &r->recv_buf[UDS_0X36_REQ_BASE_LEN],
-            .len = (uint16_t)(r->recv_len - UDS_0X36_REQ_BASE_LEN),
-            .maxRespLen = (uint16_t)(srv->xferBlockLength - UDS_0X36_RESP_BASE_LEN),
+            .len = r->recv_len - UDS_0X36_REQ_BASE_LEN,
+            .maxRespLen = srv->xferBlockLength - UDS_0X36_RESP_BASE_LEN,
             .copyResponse = safe_copy,
         };
 
@@ -1102,7 +1105,7 @@ static UDSErr_t Handle_0x37_RequestTransferExit(UDSServer_t *srv, UDSReq_t *r) {
 
     UDSRequestTransferExitArgs_t args = {
         .data = &r->recv_buf[UDS_0X37_REQ_BASE_LEN],
-        .len = (uint16_t)(r->recv_len - UDS_0X37_REQ_BASE_LEN),
+        .len = r->recv_len - UDS_0X37_REQ_BASE_LEN,
         .copyResponse = safe_copy,
     };
 
@@ -1213,18 +1216,14 @@ static UDSErr_t Handle_0x38_RequestFileTransfer(UDSServer_t *srv, UDSReq_t *r) {
         args.maxNumberOfBlockLength = UDS_TP_MTU;
     }
 
+    uint8_t len = EncodeMaxNumberOfBlockLength(&r->send_buf[UDS_0X38_RESP_BASE_LEN],
+                                               args.maxNumberOfBlockLength);
     r->send_buf[0] = UDS_RESPONSE_SID_OF(kSID_REQUEST_FILE_TRANSFER);
     r->send_buf[1] = args.modeOfOperation;
-    r->send_buf[2] = (uint8_t)sizeof(args.maxNumberOfBlockLength);
-    for (uint8_t idx = 0; idx < (uint8_t)sizeof(args.maxNumberOfBlockLength); idx++) {
-        uint8_t shiftBytes = (uint8_t)(sizeof(args.maxNumberOfBlockLength) - 1 - idx);
-        uint8_t byte = (uint8_t)(args.maxNumberOfBlockLength >> (shiftBytes * 8));
-        r->send_buf[UDS_0X38_RESP_BASE_LEN + idx] = byte;
-    }
-    r->send_buf[UDS_0X38_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength)] =
-        args.dataFormatIdentifier;
+    r->send_buf[2] = len;
+    r->send_buf[UDS_0X38_RESP_BASE_LEN + len] = args.dataFormatIdentifier;
 
-    r->send_len = UDS_0X38_RESP_BASE_LEN + (size_t)sizeof(args.maxNumberOfBlockLength) + 1;
+    r->send_len = UDS_0X38_RESP_BASE_LEN + len + 1;
     return UDS_PositiveResponse;
 }
 
@@ -1534,6 +1533,7 @@ UDSErr_t UDSServerInit(UDSServer_t *srv) {
         return UDS_ERR_INVALID_ARG;
     }
     memset(srv, 0, sizeof(UDSServer_t));
+    srv->r.recv_buf = srv->r.recv_storage;
     srv->p2_ms = UDS_SERVER_DEFAULT_P2_MS;
     srv->p2_star_ms = UDS_SERVER_DEFAULT_P2_STAR_MS;
     srv->s3_ms = UDS_SERVER_DEFAULT_S3_MS;
@@ -1546,6 +1546,30 @@ UDSErr_t UDSServerInit(UDSServer_t *srv) {
     return UDS_OK;
 }
 
+/**
+ * @brief Receive a request, borrowing the transport's buffer when the transport supports it
+ */
+static ssize_t ReceiveRequest(UDSServer_t *srv, UDSReq_t *r) {
+    r->recv_buf = r->recv_storage;
+    if (srv->tp->peek && srv->tp->release) {
+        ssize_t len = UDSTpPeek(srv->tp, &r->recv_buf, &r->info);
+        r->recv_lent = len > 0;
+        return len;
+    }
+    return UDSTpRecv(srv->tp, r->recv_storage, sizeof(r->recv_storage), &r->info);
+}
+
+/**
+ * @brief Give a borrowed request buffer back to the transport once the handler is done with it
+ */
+static void ReleaseRequest(UDSServer_t *srv, UDSReq_t *r) {
+    if (r->recv_lent) {
+        UDSTpRelease(srv->tp);
+        r->recv_lent = false;
+    }
+    r->recv_buf = r->recv_storage;
+}
+
 void UDSServerPoll(UDSServer_t *srv) {
     // UDS-1-2013 Figure 38: Session Timeout (S3)
     if (UDS_LEV_DS_DS != srv->sessionType &&
@@ -1559,7 +1583,10 @@ void UDSServerPoll(UDSServer_t *srv) {
         EmitEvent(srv, UDS_EVT_DoScheduledReset, &srv->ecuResetScheduled);
     }
 
-    UDSTpPoll(srv->tp);
+    // the transport may still be sending from r->send_buf, see UDSTp_t.send
+    if (UDSTpPoll(srv->tp) & UDS_TP_SEND_IN_PROGRESS) {
+        return;
+    }
 
     UDSReq_t *r = &srv->r;
 
@@ -1576,6 +1603,7 @@ void UDSServerPoll(UDSServer_t *srv) {
                 // No longer RCRRP'ing
                 srv->RCRRP = false;
                 srv->notReadyToReceive = false;
+                ReleaseRequest(srv, r);
 
                 // Not a consecutive 0x78 response, use p2 instead of p2_star * 0.3
                 srv->p2_timer = UDSMillis() + srv->p2_ms;
@@ -1610,9 +1638,9 @@ void UDSServerPoll(UDSServer_t *srv) {
         if (srv->notReadyToReceive) {
             return; // cannot respond to request right now
         }
-        ssize_t len = UDSTpRecv(srv->tp, r->recv_buf, sizeof(r->recv_buf), &r->info);
+        ssize_t len = ReceiveRequest(srv, r);
         if (len < 0) {
-            UDS_LOGE(__FILE__, "UDSTpRecv failed with %zd\n", r->recv_len);
+            UDS_LOGE(__FILE__, "UDSTpRecv failed with %zd\n", len);
             return;
         }
 
@@ -1622,7 +1650,10 @@ void UDSServerPoll(UDSServer_t *srv) {
             UDSErr_t response = evaluateServiceResponse(srv, r);
             srv->requestInProgress = true;
             if (UDS_NRC_RequestCorrectlyReceived_ResponsePending == response) {
+                // the handler is called again with the same request
                 srv->RCRRP = true;
+            } else {
+                ReleaseRequest(srv, r);
             }
         }
     }
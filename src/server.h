@@ -9,12 +9,15 @@
  * @brief Server request context
  */
 typedef struct {
-    uint8_t recv_buf[UDS_SERVER_RECV_BUF_SIZE]; /**< receive buffer */
+    uint8_t *recv_buf; /**< received request, lent by the transport or stored in recv_storage */
     uint8_t send_buf[UDS_SERVER_SEND_BUF_SIZE]; /**< send buffer */
     size_t recv_len;                            /**< received data length */
     size_t send_len;                            /**< send data length */
     size_t send_buf_size;                       /**< send buffer size */
     UDSSDU_t info;                              /**< service data unit information */
+    bool recv_lent; /**< recv_buf belongs to the transport and must be released */
+    uint8_t recv_storage[UDS_SERVER_RECV_BUF_SIZE]; /**< receive buffer for transports without
+                                                       peek() */
 } UDSReq_t;
 
 /**
@@ -105,7 +108,7 @@ typedef struct {
 typedef struct {
     const uint8_t type; /*! invoked subfunction */
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 
     union {
         struct {
@@ -151,7 +154,7 @@ typedef struct {
 typedef struct {
     const uint16_t dataId; /*! RDBI Data Identifier */
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 } UDSRDBIArgs_t;
 
 /**
@@ -161,7 +164,7 @@ typedef struct {
     const void *memAddr;
     const size_t memSize;
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 } UDSReadMemByAddrArgs_t;
 
 /**
@@ -181,7 +184,7 @@ typedef struct {
     const uint8_t *const dataRecord; /*! pointer to request data */
     const uint16_t len;              /*! size of request data */
     uint8_t (*copySeed)(UDSServer_t *srv, const void *src,
-                        uint16_t len); /*! function for copying data */
+                        size_t len); /*! function for copying data */
 } UDSSecAccessRequestSeedArgs_t;
 
 /**
@@ -242,7 +245,7 @@ typedef struct {
     const void *const ctrlStateAndMask; /*! controlState bytes and controlMask (optional) */
     const size_t ctrlStateAndMaskLen;   /*! number of bytes in `ctrlStateAndMask` */
     uint8_t (*copy)(UDSServer_t *srv, const void *src,
-                    uint16_t count); /*! function for copying data */
+                    size_t count); /*! function for copying data */
 } UDSIOCtrlArgs_t;
 
 /**
@@ -254,7 +257,7 @@ typedef struct {
     const uint8_t *optionRecord; /*! optional data */
     const uint16_t len;          /*! length of optional data */
     uint8_t (*copyStatusRecord)(UDSServer_t *srv, const void *src,
-                                uint16_t len); /*! function for copying response data */
+                                size_t len); /*! function for copying response data */
 } UDSRoutineCtrlArgs_t;
 
 /**
@@ -264,7 +267,7 @@ typedef struct {
     const void *addr;                   /*! requested address */
     const size_t size;                  /*! requested download size */
     const uint8_t dataFormatIdentifier; /*! optional specifier for format of data */
-    uint16_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
+    uint32_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
                                            send in each    `TransferData` request */
 } UDSRequestDownloadArgs_t;
 
@@ -275,7 +278,7 @@ typedef struct {
     const void *addr;                   /*! requested address */
     const size_t size;                  /*! requested download size */
     const uint8_t dataFormatIdentifier; /*! optional specifier for format of data */
-    uint16_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
+    uint32_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
                                            send in each    `TransferData` request */
 } UDSRequestUploadArgs_t;
 
@@ -284,11 +287,11 @@ typedef struct {
  */
 typedef struct {
     const uint8_t *const data; /*! transfer data */
-    const uint16_t len;        /*! transfer data length */
-    const uint16_t maxRespLen; /*! don't send more than this many bytes with copyResponse */
+    const size_t len;        /*! transfer data length */
+    const size_t maxRespLen; /*! don't send more than this many bytes with copyResponse */
     uint8_t (*copyResponse)(
         UDSServer_t *srv, const void *src,
-        uint16_t len); /*! function for copying transfer data response data (optional) */
+        size_t len); /*! function for copying transfer data response data (optional) */
 } UDSTransferDataArgs_t;
 
 /**
@@ -296,9 +299,9 @@ typedef struct {
  */
 typedef struct {
     const uint8_t *const data; /*! request data */
-    const uint16_t len;        /*! request data length */
+    const size_t len;          /*! request data length */
     uint8_t (*copyResponse)(UDSServer_t *srv, const void *src,
-                            uint16_t len); /*! function for copying response data (optional) */
+                            size_t len); /*! function for copying response data (optional) */
 } UDSRequestTransferExitArgs_t;
 
 /**
@@ -311,7 +314,7 @@ typedef struct {
     const uint8_t dataFormatIdentifier; /*! optional specifier for format of data */
     const size_t fileSizeUnCompressed;  /*! optional file size */
     const size_t fileSizeCompressed;    /*! optional file size */
-    uint16_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
+    uint32_t maxNumberOfBlockLength;    /*! optional response: inform client how many data bytes to
                                            send in each    `TransferData` request */
 } UDSRequestFileTransferArgs_t;
 
@@ -343,7 +346,7 @@ typedef struct {
     const uint8_t *optionRecord; /*! optional data */
     const uint16_t len;          /*! length of optional data */
     uint8_t (*copyResponse)(UDSServer_t *srv, const void *src,
-                            uint16_t len); /*! function for copying response data (optional) */
+                            size_t len); /*! function for copying response data (optional) */
 } UDSCustomArgs_t;
 
 UDSErr_t UDSServerInit(UDSServer_t *srv);
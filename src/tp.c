@@ -17,4 +17,45 @@ UDSTpStatus_t UDSTpPoll(struct UDSTp *hdl) {
     UDS_ASSERT(hdl);
     UDS_ASSERT(hdl->poll);
     return hdl->poll(hdl);
-}
\ No newline at end of file
+}
+
+ssize_t UDSTpPeek(struct UDSTp *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(hdl->peek);
+    return hdl->peek(hdl, buf, info);
+}
+
+void UDSTpRelease(struct UDSTp *hdl) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(hdl->release);
+    hdl->release(hdl);
+}
+
+int UDSTpGetFds(struct UDSTp *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    if (NULL == hdl->get_fds) {
+        return 0;
+    }
+    return hdl->get_fds(hdl, fds, max_fds);
+}
+
+bool UDSTpNextDeadline(struct UDSTp *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(deadline_ms);
+    if (NULL == hdl->next_deadline) {
+        return false;
+    }
+    return hdl->next_deadline(hdl, deadline_ms);
+}
+
+ssize_t UDSTpSendPartial(struct UDSTp *hdl, const uint8_t *buf, size_t len, size_t available,
+                         UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    if (hdl->send_partial) {
+        return hdl->send_partial(hdl, (uint8_t *)buf, len, available, info);
+    }
+    if (NULL == buf || available < len) {
+        return 0;
+    }
+    return UDSTpSend(hdl, buf, (ssize_t)len, info);
+}
@@ -42,10 +42,41 @@ typedef struct {
     uint32_t A_TA;             /**< application target address */
     UDS_A_TA_Type_t A_TA_Type; /**< application target address type (physical or functional) */
     uint32_t A_AE;             /**< application layer remote address */
+    uint64_t rx_time_ns; /**< received messages: monotonic time the last frame arrived in ns, 0 if
+                            the transport doesn't know it */
 } UDSSDU_t;
 
 #define UDS_TP_NOOP_ADDR (0xFFFFFFFF)
 
+/**
+ * @brief ISO 15765-2 flow control parameters of an ISO-TP link
+ * @details BS and STmin are sent to the peer in flow control frames while receiving. Timeouts of 0
+ * select the ISO 15765-2 value of 1000 ms, so a struct that only sets bs and st_min_us is valid.
+ */
+typedef struct {
+    uint8_t bs;         /**< block size, 0: the sender may send all consecutive frames at once */
+    uint32_t st_min_us; /**< minimum separation time between consecutive frames */
+    uint32_t n_bs_us;   /**< N_Bs timeout: time the sender waits for a flow control frame */
+    uint32_t n_cr_us;   /**< N_Cr timeout: time the receiver waits for a consecutive frame */
+    uint8_t wft_max;    /**< maximum number of FC.WAIT frames accepted in a row */
+} UDSISOTpFCParams_t;
+
+/**
+ * @brief Events to wait for on a file descriptor, see UDSTp_t.get_fds
+ */
+enum UDSTpFdEvents {
+    UDS_TP_FD_READ = 0x01,  /**< wait until the fd is readable (POLLIN / EPOLLIN) */
+    UDS_TP_FD_WRITE = 0x02, /**< wait until the fd is writable (POLLOUT / EPOLLOUT) */
+};
+
+/**
+ * @brief A file descriptor the transport wants to be polled for
+ */
+typedef struct {
+    int fd;
+    int events; /**< UDS_TP_FD_READ and/or UDS_TP_FD_WRITE */
+} UDSTpFd_t;
+
 /**
  * @brief UDS Transport layer
  * @note implementers should embed this struct at offset zero in their own transport layer handle
@@ -58,6 +89,8 @@ typedef struct UDSTp {
      * @param len: length of data to send
      * @param info: pointer to SDU info (may be NULL). If NULL, implementation should send with
      * physical addressing
+     * @note the transport may send directly from buf. The caller must keep buf unchanged until
+     * poll() no longer returns UDS_TP_SEND_IN_PROGRESS.
      */
     ssize_t (*send)(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_t *info);
 
@@ -79,8 +112,71 @@ typedef struct UDSTp {
      * @return UDS_TP_IDLE if idle, otherwise UDS_TP_SEND_IN_PROGRESS or UDS_TP_RECV_COMPLETE
      */
     UDSTpStatus_t (*poll)(struct UDSTp *hdl);
+
+    /**
+     * @brief Lend the received data to the caller without copying it (optional, may be NULL)
+     * @param hdl: transport handle
+     * @param buf: set to the transport's buffer holding the received data. The data stays valid
+     * and unchanged until release() is called.
+     * @param info: pointer to SDU info (may be NULL). Populated like in recv().
+     * @return length of the received data, 0 if nothing was received, negative on error
+     * @note the transport may drop messages that arrive before release() is called
+     */
+    ssize_t (*peek)(struct UDSTp *hdl, uint8_t **buf, UDSSDU_t *info);
+
+    /**
+     * @brief Give the buffer lent by peek() back to the transport (optional, may be NULL)
+     * @param hdl: transport handle
+     */
+    void (*release)(struct UDSTp *hdl);
+
+    /**
+     * @brief Report the file descriptors to watch in an event loop (optional, may be NULL)
+     * @param hdl: transport handle
+     * @param fds: filled with the file descriptors and the events to wait for
+     * @param max_fds: number of entries in fds
+     * @return number of entries filled in
+     * @note the set can change after send() and poll(), query it before every wait. Call poll()
+     * once one of the events occurred.
+     */
+    int (*get_fds)(struct UDSTp *hdl, UDSTpFd_t *fds, int max_fds);
+
+    /**
+     * @brief Report the earliest internal timer of the transport (optional, may be NULL)
+     * @param hdl: transport handle
+     * @param deadline_ms: set to the UDSMillis() time at which poll() has to be called next
+     * @return true if deadline_ms was set, false if the transport has no pending timer and only
+     * needs poll() after one of its file descriptors became ready
+     */
+    bool (*next_deadline)(struct UDSTp *hdl, uint32_t *deadline_ms);
+
+    /**
+     * @brief Send a message while its data is still arriving (optional, may be NULL)
+     * @details The first call starts the message. Call it again with the same buf, len and info
+     * whenever more data became available and with buf == NULL to abandon the message.
+     * @param hdl: transport handle
+     * @param buf: the message, filled in from the start
+     * @param len: length of the complete message
+     * @param available: number of valid bytes at the start of buf, len once the message is complete
+     * @param info: like in send()
+     * @return like send(), 0 if the transport needs more data before it can start the message
+     * @note buf must stay valid like in send()
+     */
+    ssize_t (*send_partial)(struct UDSTp *hdl, uint8_t *buf, size_t len, size_t available,
+                            UDSSDU_t *info);
 } UDSTp_t;
 
 ssize_t UDSTpSend(UDSTp_t *hdl, const uint8_t *buf, ssize_t len, UDSSDU_t *info);
 ssize_t UDSTpRecv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info);
 UDSTpStatus_t UDSTpPoll(UDSTp_t *hdl);
+ssize_t UDSTpPeek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info);
+void UDSTpRelease(UDSTp_t *hdl);
+int UDSTpGetFds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds);
+bool UDSTpNextDeadline(UDSTp_t *hdl, uint32_t *deadline_ms);
+
+/**
+ * @brief Send a message while its data is still arriving, see UDSTp_t.send_partial
+ * @note transports without send_partial send the message once it is complete
+ */
+ssize_t UDSTpSendPartial(UDSTp_t *hdl, const uint8_t *buf, size_t len, size_t available,
+                         UDSSDU_t *info);
@@ -0,0 +1,1494 @@
+#if defined(UDS_TP_DOIP)
+
+#include "tp/doip.h"
+#include "util.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// ISO 13400-2:2012 Table 17 payload types
+enum {
+    DOIP_GENERIC_NACK = 0x0000,
+    DOIP_VEHICLE_ID_REQ = 0x0001,
+    DOIP_VEHICLE_ID_REQ_EID = 0x0002,
+    DOIP_VEHICLE_ID_REQ_VIN = 0x0003,
+    DOIP_VEHICLE_ANNOUNCEMENT = 0x0004,
+    DOIP_ROUTING_ACTIVATION_REQ = 0x0005,
+    DOIP_ROUTING_ACTIVATION_RES = 0x0006,
+    DOIP_ALIVE_CHECK_REQ = 0x0007,
+    DOIP_ALIVE_CHECK_RES = 0x0008,
+    DOIP_ENTITY_STATUS_REQ = 0x4001,
+    DOIP_ENTITY_STATUS_RES = 0x4002,
+    DOIP_POWER_MODE_REQ = 0x4003,
+    DOIP_POWER_MODE_RES = 0x4004,
+    DOIP_DIAG_MSG = 0x8001,
+    DOIP_DIAG_ACK = 0x8002,
+    DOIP_DIAG_NACK = 0x8003,
+};
+
+// ISO 13400-2:2012 Table 19 generic header NACK codes
+enum {
+    DOIP_NACK_INCORRECT_PATTERN = 0x00,
+    DOIP_NACK_UNKNOWN_PAYLOAD_TYPE = 0x01,
+    DOIP_NACK_MESSAGE_TOO_LARGE = 0x02,
+    DOIP_NACK_INVALID_PAYLOAD_LENGTH = 0x04,
+};
+
+// ISO 13400-2:2012 Table 25 routing activation response codes
+enum {
+    DOIP_RA_SA_DIFFERENT = 0x02,
+    DOIP_RA_SA_IN_USE = 0x03,
+    DOIP_RA_UNSUPPORTED_TYPE = 0x06,
+    DOIP_RA_SUCCESS = 0x10,
+    DOIP_RA_CONFIRMATION_PENDING = 0x11,
+};
+
+// ISO 13400-2:2012 Table 28 diagnostic message NACK codes
+enum {
+    DOIP_DIAG_NACK_INVALID_SA = 0x02,
+    DOIP_DIAG_NACK_UNKNOWN_TA = 0x03,
+    DOIP_DIAG_NACK_TOO_LARGE = 0x04,
+};
+
+#define DOIP_HEADER_LEN (8)
+#define DOIP_DIAG_ADDR_LEN (4) // SA and TA in front of the diagnostic user data
+#define DOIP_VEHICLE_ID_RES_LEN (32)
+
+enum {
+    DOIP_RX_HEADER = 0,
+    DOIP_RX_PAYLOAD,   // control message payload into rx_ctrl
+    DOIP_RX_DIAG_ADDR, // SA and TA of a diagnostic message into rx_ctrl
+    DOIP_RX_DIAG_HOLD, // waiting for DoIPConnAcceptDiag or DoIPConnDiscard
+    DOIP_RX_DIAG_DATA, // user data into rx_dst
+    DOIP_RX_DISCARD,
+};
+
+// results of DoIPConnRead
+enum {
+    DOIP_CONN_CLOSED = -1,
+    DOIP_CONN_NONE = 0,   // no complete message
+    DOIP_CONN_MSG,        // a control message is in rx_ctrl
+    DOIP_CONN_DIAG_START, // SA and TA of a diagnostic message are in rx_ctrl
+    DOIP_CONN_DIAG,       // a diagnostic message was read into rx_dst
+};
+
+static uint16_t DoIPGetBE16(const uint8_t *p) { return (uint16_t)((p[0] << 8) | p[1]); }
+
+static uint32_t DoIPGetBE32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void DoIPPutBE16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void DoIPPutBE32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void DoIPPutHeader(uint8_t *p, uint16_t type, uint32_t len) {
+    p[0] = UDS_DOIP_PROTOCOL_VERSION;
+    p[1] = (uint8_t)~UDS_DOIP_PROTOCOL_VERSION;
+    DoIPPutBE16(p + 2, type);
+    DoIPPutBE32(p + 4, len);
+}
+
+// ISO 13400-2:2012 Figure 7: version 0xFF is only allowed in vehicle identification requests,
+// which are sent over UDP
+static bool DoIPHeaderValid(const uint8_t *hdr, bool udp) {
+    if ((uint8_t)(hdr[0] ^ hdr[1]) != 0xFF) {
+        return false;
+    }
+    return (hdr[0] >= 0x01 && hdr[0] <= 0x03) || (hdr[0] == 0xFF && udp);
+}
+
+// payload lengths from ISO 13400-2:2012 Table 17 and the message definitions
+static bool DoIPPayloadLenValid(uint16_t type, uint32_t len) {
+    switch (type) {
+    case DOIP_GENERIC_NACK:
+        return len == 1;
+    case DOIP_VEHICLE_ID_REQ:
+    case DOIP_ALIVE_CHECK_REQ:
+    case DOIP_ENTITY_STATUS_REQ:
+    case DOIP_POWER_MODE_REQ:
+        return len == 0;
+    case DOIP_VEHICLE_ID_REQ_EID:
+        return len == 6;
+    case DOIP_VEHICLE_ID_REQ_VIN:
+        return len == 17;
+    case DOIP_VEHICLE_ANNOUNCEMENT:
+        return len == 32 || len == 33;
+    case DOIP_ROUTING_ACTIVATION_REQ:
+        return len == 7 || len == 11;
+    case DOIP_ROUTING_ACTIVATION_RES:
+        return len == 9 || len == 13;
+    case DOIP_ALIVE_CHECK_RES:
+        return len == 2;
+    case DOIP_ENTITY_STATUS_RES:
+        return len == 3 || len == 7;
+    case DOIP_POWER_MODE_RES:
+        return len == 1;
+    case DOIP_DIAG_MSG:
+        return len > DOIP_DIAG_ADDR_LEN;
+    case DOIP_DIAG_ACK:
+    case DOIP_DIAG_NACK:
+        return len >= DOIP_DIAG_ADDR_LEN + 1;
+    default:
+        return true;
+    }
+}
+
+static int DoIPSetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Nagle's algorithm would hold a response until the ACK of the previous segment arrives
+static int DoIPSetupStream(int fd) {
+    int one = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        return -1;
+    }
+    return DoIPSetNonBlocking(fd);
+}
+
+static int DoIPResolve(const char *host, uint16_t port, int socktype, struct sockaddr_storage *addr,
+                       socklen_t *addr_len) {
+    struct addrinfo hints = {0};
+    struct addrinfo *res = NULL;
+    char port_str[8];
+    (void)snprintf(port_str, sizeof(port_str), "%u", port);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = socktype;
+    hints.ai_flags = AI_NUMERICSERV;
+    int err = getaddrinfo(host, port_str, &hints, &res);
+    if (err != 0 || NULL == res) {
+        UDS_LOGE(__FILE__, "DoIP: cannot resolve %s: %s", host, gai_strerror(err));
+        return -1;
+    }
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void DoIPConnInit(UDSTpDoIPConn_t *c, int fd) {
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+}
+
+static void DoIPConnClose(UDSTpDoIPConn_t *c) {
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    DoIPConnInit(c, -1);
+}
+
+static bool DoIPConnTxPending(const UDSTpDoIPConn_t *c) {
+    return c->tx_ctrl_pos < c->tx_ctrl_len || c->tx_diag_data != NULL;
+}
+
+static bool DoIPConnQueue(UDSTpDoIPConn_t *c, uint16_t type, const uint8_t *payload, size_t len) {
+    if (c->tx_ctrl_len + DOIP_HEADER_LEN + len > sizeof(c->tx_ctrl)) {
+        UDS_LOGW(__FILE__, "DoIP: control queue full, dropping payload type 0x%04X", type);
+        return false;
+    }
+    uint8_t *p = &c->tx_ctrl[c->tx_ctrl_len];
+    DoIPPutHeader(p, type, (uint32_t)len);
+    if (len) {
+        memcpy(p + DOIP_HEADER_LEN, payload, len);
+    }
+    c->tx_ctrl_len += DOIP_HEADER_LEN + len;
+    return true;
+}
+
+static void DoIPConnQueueGenericNack(UDSTpDoIPConn_t *c, uint8_t code) {
+    (void)DoIPConnQueue(c, DOIP_GENERIC_NACK, &code, 1);
+}
+
+static void DoIPConnQueueDiagAck(UDSTpDoIPConn_t *c, uint16_t type, uint16_t sa, uint16_t ta,
+                                 uint8_t code) {
+    uint8_t payload[5];
+    DoIPPutBE16(payload, sa);
+    DoIPPutBE16(payload + 2, ta);
+    payload[4] = code;
+    (void)DoIPConnQueue(c, type, payload, sizeof(payload));
+}
+
+static bool DoIPConnSendDiag(UDSTpDoIPConn_t *c, uint16_t sa, uint16_t ta, const uint8_t *data,
+                             size_t len) {
+    if (c->tx_diag_data) {
+        return false;
+    }
+    DoIPPutHeader(c->tx_diag_hdr, DOIP_DIAG_MSG, (uint32_t)(len + DOIP_DIAG_ADDR_LEN));
+    DoIPPutBE16(c->tx_diag_hdr + DOIP_HEADER_LEN, sa);
+    DoIPPutBE16(c->tx_diag_hdr + DOIP_HEADER_LEN + 2, ta);
+    c->tx_diag_data = data;
+    c->tx_diag_len = len;
+    c->tx_diag_pos = 0;
+    return true;
+}
+
+/**
+ * @brief Write as much of the send queue as the socket takes
+ * @details A started diagnostic message is finished before control messages, they cannot be
+ * interleaved on the stream.
+ * @return 0 on success, -1 if the connection failed
+ */
+static int DoIPConnFlush(UDSTpDoIPConn_t *c) {
+    for (;;) {
+        ssize_t n = 0;
+        if (c->tx_diag_data && (c->tx_diag_pos > 0 || c->tx_ctrl_pos == c->tx_ctrl_len)) {
+            struct iovec iov[2];
+            int iovcnt = 0;
+            if (c->tx_diag_pos < sizeof(c->tx_diag_hdr)) {
+                iov[iovcnt].iov_base = c->tx_diag_hdr + c->tx_diag_pos;
+                iov[iovcnt].iov_len = sizeof(c->tx_diag_hdr) - c->tx_diag_pos;
+                iovcnt++;
+                iov[iovcnt].iov_base = (void *)c->tx_diag_data;
+                iov[iovcnt].iov_len = c->tx_diag_len;
+            } else {
+                size_t off = c->tx_diag_pos - sizeof(c->tx_diag_hdr);
+                iov[iovcnt].iov_base = (void *)(c->tx_diag_data + off);
+                iov[iovcnt].iov_len = c->tx_diag_len - off;
+            }
+            iovcnt++;
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovcnt;
+            n = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                c->tx_diag_pos += (size_t)n;
+                if (c->tx_diag_pos == sizeof(c->tx_diag_hdr) + c->tx_diag_len) {
+                    c->tx_diag_data = NULL;
+                    c->tx_diag_len = 0;
+                    c->tx_diag_pos = 0;
+                }
+            }
+        } else if (c->tx_ctrl_pos < c->tx_ctrl_len) {
+            n = send(c->fd, c->tx_ctrl + c->tx_ctrl_pos, c->tx_ctrl_len - c->tx_ctrl_pos,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                c->tx_ctrl_pos += (size_t)n;
+                if (c->tx_ctrl_pos == c->tx_ctrl_len) {
+                    c->tx_ctrl_pos = 0;
+                    c->tx_ctrl_len = 0;
+                }
+            }
+        } else {
+            return 0;
+        }
+
+        if (n < 0) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return 0;
+            }
+            if (EINTR != errno) {
+                UDS_LOGI(__FILE__, "DoIP: send failed: %s", strerror(errno));
+                return -1;
+            }
+        }
+    }
+}
+
+static void DoIPConnAcceptDiag(UDSTpDoIPConn_t *c, uint8_t *buf) {
+    c->rx_dst = buf;
+    c->rx_state = DOIP_RX_DIAG_DATA;
+}
+
+static void DoIPConnDiscard(UDSTpDoIPConn_t *c) { c->rx_state = DOIP_RX_DISCARD; }
+
+/**
+ * @brief Read from the connection until a message or a part of it needs the caller's attention
+ */
+static int DoIPConnRead(UDSTpDoIPConn_t *c) {
+    uint8_t scratch[256];
+    for (;;) {
+        uint8_t *dst = NULL;
+        size_t want = 0;
+        switch (c->rx_state) {
+        case DOIP_RX_HEADER:
+            dst = c->rx_hdr + c->rx_pos;
+            want = DOIP_HEADER_LEN - c->rx_pos;
+            break;
+        case DOIP_RX_PAYLOAD:
+            dst = c->rx_ctrl + c->rx_pos;
+            want = c->rx_len - c->rx_pos;
+            break;
+        case DOIP_RX_DISCARD:
+            dst = scratch;
+            want = c->rx_len - c->rx_pos;
+            if (want > sizeof(scratch)) {
+                want = sizeof(scratch);
+            }
+            break;
+        case DOIP_RX_DIAG_ADDR:
+            dst = c->rx_ctrl + c->rx_pos;
+            want = DOIP_DIAG_ADDR_LEN - c->rx_pos;
+            break;
+        case DOIP_RX_DIAG_HOLD:
+            return DOIP_CONN_DIAG_START;
+        case DOIP_RX_DIAG_DATA:
+            dst = c->rx_dst + (c->rx_pos - DOIP_DIAG_ADDR_LEN);
+            want = c->rx_len - c->rx_pos;
+            break;
+        default:
+            UDS_ASSERT(false);
+            return DOIP_CONN_CLOSED;
+        }
+
+        if (want > 0) {
+            ssize_t n = recv(c->fd, dst, want, MSG_DONTWAIT);
+            if (n == 0) {
+                return DOIP_CONN_CLOSED;
+            }
+            if (n < 0) {
+                if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                    return DOIP_CONN_NONE;
+                }
+                if (EINTR == errno) {
+                    continue;
+                }
+                return DOIP_CONN_CLOSED;
+            }
+            c->rx_pos += (uint32_t)n;
+            if ((size_t)n < want) {
+                continue;
+            }
+        }
+
+        switch (c->rx_state) {
+        case DOIP_RX_HEADER:
+            if (c->rx_pos < DOIP_HEADER_LEN) {
+                break;
+            }
+            c->rx_pos = 0;
+            if (!DoIPHeaderValid(c->rx_hdr, false)) {
+                // ISO 13400-2:2012 Figure 7: the socket is closed after the NACK
+                DoIPConnQueueGenericNack(c, DOIP_NACK_INCORRECT_PATTERN);
+                c->close_after_tx = true;
+                return DOIP_CONN_NONE;
+            }
+            c->rx_type = DoIPGetBE16(c->rx_hdr + 2);
+            c->rx_len = DoIPGetBE32(c->rx_hdr + 4);
+            // diagnostic messages are read into the receiver's buffer, see DoIPServerDiagStart
+            if (DOIP_DIAG_MSG != c->rx_type && c->rx_len > sizeof(c->rx_ctrl)) {
+                DoIPConnQueueGenericNack(c, DOIP_NACK_MESSAGE_TOO_LARGE);
+                DoIPConnDiscard(c);
+                break;
+            }
+            if (!DoIPPayloadLenValid(c->rx_type, c->rx_len)) {
+                DoIPConnQueueGenericNack(c, DOIP_NACK_INVALID_PAYLOAD_LENGTH);
+                c->close_after_tx = true;
+                return DOIP_CONN_NONE;
+            }
+            c->rx_state = DOIP_DIAG_MSG == c->rx_type ? DOIP_RX_DIAG_ADDR : DOIP_RX_PAYLOAD;
+            break;
+        case DOIP_RX_PAYLOAD:
+            if (c->rx_pos == c->rx_len) {
+                c->rx_state = DOIP_RX_HEADER;
+                c->rx_pos = 0;
+                return DOIP_CONN_MSG;
+            }
+            break;
+        case DOIP_RX_DIAG_ADDR:
+            if (c->rx_pos == DOIP_DIAG_ADDR_LEN) {
+                c->rx_state = DOIP_RX_DIAG_HOLD;
+                return DOIP_CONN_DIAG_START;
+            }
+            break;
+        case DOIP_RX_DIAG_DATA:
+            if (c->rx_pos == c->rx_len) {
+                c->rx_state = DOIP_RX_HEADER;
+                c->rx_pos = 0;
+                return DOIP_CONN_DIAG;
+            }
+            break;
+        case DOIP_RX_DISCARD:
+            if (c->rx_pos == c->rx_len) {
+                c->rx_state = DOIP_RX_HEADER;
+                c->rx_pos = 0;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static uint32_t DoIPEarliest(bool *has, uint32_t current, uint32_t t) {
+    if (!*has || UDSTimeAfter(current, t)) {
+        *has = true;
+        return t;
+    }
+    return current;
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Server
+ */
+
+static size_t DoIPServerVehicleId(const UDSTpDoIPServer_t *tp, uint8_t *p) {
+    memcpy(p, tp->vin, sizeof(tp->vin));
+    DoIPPutBE16(p + 17, tp->logical_address);
+    memcpy(p + 19, tp->eid, sizeof(tp->eid));
+    memcpy(p + 25, tp->gid, sizeof(tp->gid));
+    p[31] = 0x00; // further action: none
+    return DOIP_VEHICLE_ID_RES_LEN;
+}
+
+static int DoIPServerOpenConnections(const UDSTpDoIPServer_t *tp) {
+    int n = 0;
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        n += tp->conns[i].fd >= 0;
+    }
+    return n;
+}
+
+/**
+ * @brief Build the response to a request that may arrive on UDP or TCP
+ * @return payload type of the response, 0 if the request is not answered
+ */
+static uint16_t DoIPServerStatusResponse(const UDSTpDoIPServer_t *tp, uint16_t type,
+                                         const uint8_t *payload, uint8_t *res, size_t *res_len) {
+    switch (type) {
+    case DOIP_VEHICLE_ID_REQ_EID:
+        if (memcmp(payload, tp->eid, sizeof(tp->eid))) {
+            return 0;
+        }
+        *res_len = DoIPServerVehicleId(tp, res);
+        return DOIP_VEHICLE_ANNOUNCEMENT;
+    case DOIP_VEHICLE_ID_REQ_VIN:
+        if (memcmp(payload, tp->vin, sizeof(tp->vin))) {
+            return 0;
+        }
+        *res_len = DoIPServerVehicleId(tp, res);
+        return DOIP_VEHICLE_ANNOUNCEMENT;
+    case DOIP_VEHICLE_ID_REQ:
+        *res_len = DoIPServerVehicleId(tp, res);
+        return DOIP_VEHICLE_ANNOUNCEMENT;
+    case DOIP_ENTITY_STATUS_REQ:
+        res[0] = tp->is_target ? 0x00 : 0x01; // DoIP gateway or DoIP node
+        res[1] = UDS_DOIP_MAX_CONNECTIONS;
+        res[2] = (uint8_t)DoIPServerOpenConnections(tp);
+        DoIPPutBE32(res + 3, (uint32_t)(UDS_DOIP_MTU + DOIP_DIAG_ADDR_LEN));
+        *res_len = 7;
+        return DOIP_ENTITY_STATUS_RES;
+    case DOIP_POWER_MODE_REQ:
+        res[0] = 0x01; // ready
+        *res_len = 1;
+        return DOIP_POWER_MODE_RES;
+    default:
+        return 0;
+    }
+}
+
+static void DoIPServerSendUDP(UDSTpDoIPServer_t *tp, uint16_t type, const uint8_t *payload,
+                              size_t len, const struct sockaddr *to, socklen_t to_len) {
+    uint8_t msg[DOIP_HEADER_LEN + DOIP_VEHICLE_ID_RES_LEN];
+    UDS_ASSERT(len <= sizeof(msg) - DOIP_HEADER_LEN);
+    DoIPPutHeader(msg, type, (uint32_t)len);
+    memcpy(msg + DOIP_HEADER_LEN, payload, len);
+    if (sendto(tp->udp_fd, msg, DOIP_HEADER_LEN + len, MSG_DONTWAIT, to, to_len) < 0) {
+        UDS_LOGI(__FILE__, "DoIP: UDP send failed: %s", strerror(errno));
+    }
+}
+
+static void DoIPServerPollUDP(UDSTpDoIPServer_t *tp) {
+    uint8_t msg[64];
+    for (;;) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n =
+            recvfrom(tp->udp_fd, msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            return;
+        }
+        uint8_t nack = 0;
+        uint16_t type = 0;
+        uint32_t len = 0;
+        if (n < DOIP_HEADER_LEN || !DoIPHeaderValid(msg, true)) {
+            nack = DOIP_NACK_INCORRECT_PATTERN;
+        } else {
+            type = DoIPGetBE16(msg + 2);
+            len = DoIPGetBE32(msg + 4);
+            if (len > sizeof(msg) - DOIP_HEADER_LEN) {
+                nack = DOIP_NACK_MESSAGE_TOO_LARGE;
+            } else if ((size_t)n != DOIP_HEADER_LEN + len || !DoIPPayloadLenValid(type, len)) {
+                nack = DOIP_NACK_INVALID_PAYLOAD_LENGTH;
+            }
+        }
+
+        uint8_t res[DOIP_VEHICLE_ID_RES_LEN];
+        size_t res_len = 0;
+        if (0 == nack) {
+            uint16_t res_type =
+                DoIPServerStatusResponse(tp, type, msg + DOIP_HEADER_LEN, res, &res_len);
+            if (res_type) {
+                DoIPServerSendUDP(tp, res_type, res, res_len, (struct sockaddr *)&from, from_len);
+                continue;
+            }
+            if (DOIP_VEHICLE_ID_REQ_EID == type || DOIP_VEHICLE_ID_REQ_VIN == type) {
+                continue; // meant for another vehicle
+            }
+            nack = DOIP_NACK_UNKNOWN_PAYLOAD_TYPE;
+        }
+        DoIPServerSendUDP(tp, DOIP_GENERIC_NACK, &nack, 1, (struct sockaddr *)&from, from_len);
+    }
+}
+
+static UDSTpDoIPConn_t *DoIPServerFreeConn(UDSTpDoIPServer_t *tp) {
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd < 0) {
+            return &tp->conns[i];
+        }
+    }
+    return NULL;
+}
+
+static void DoIPServerAdopt(UDSTpDoIPConn_t *c, int fd) {
+    DoIPConnInit(c, fd);
+    c->inactivity_timer = UDSMillis() + UDS_DOIP_INITIAL_INACTIVITY_MS;
+}
+
+static UDSTpDoIPRxSlot_t *DoIPServerFillingSlot(UDSTpDoIPServer_t *tp, const UDSTpDoIPConn_t *c) {
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        UDSTpDoIPRxSlot_t *slot = &tp->rx_slots[i];
+        if (UDS_DOIP_SLOT_FILLING == slot->state && slot->conn == c) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static void DoIPServerCloseConn(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    UDS_LOGI(__FILE__, "DoIP: closing connection of tester 0x%04X", c->tester_addr);
+    // complete messages stay, a partial one is dropped. A taken one is aborted, the taker gives
+    // it back.
+    UDSTpDoIPRxSlot_t *slot = DoIPServerFillingSlot(tp, c);
+    if (slot) {
+        slot->conn = NULL;
+        slot->state = slot->taken ? UDS_DOIP_SLOT_ABORTED : UDS_DOIP_SLOT_FREE;
+    }
+    DoIPConnClose(c);
+}
+
+// ISO 13400-2:2012 Figure 10: a tester connecting while all sockets are in use triggers an alive
+// check of the registered testers
+static void DoIPServerAccept(UDSTpDoIPServer_t *tp) {
+    for (;;) {
+        int fd = accept(tp->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        if (DoIPSetupStream(fd) < 0) {
+            close(fd);
+            continue;
+        }
+        UDSTpDoIPConn_t *c = DoIPServerFreeConn(tp);
+        if (c) {
+            DoIPServerAdopt(c, fd);
+            continue;
+        }
+        if (tp->pending_fd >= 0) {
+            close(fd);
+            continue;
+        }
+        tp->pending_fd = fd;
+        tp->alive_check_timer = UDSMillis() + UDS_DOIP_ALIVE_CHECK_MS;
+        for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+            UDSTpDoIPConn_t *other = &tp->conns[i];
+            if (other->active && DoIPConnQueue(other, DOIP_ALIVE_CHECK_REQ, NULL, 0)) {
+                other->alive_check_pending = true;
+            }
+        }
+    }
+}
+
+static void DoIPServerAliveCheck(UDSTpDoIPServer_t *tp) {
+    if (tp->pending_fd < 0) {
+        return;
+    }
+    bool waiting = false;
+    bool expired = UDSTimeAfter(UDSMillis(), tp->alive_check_timer);
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        UDSTpDoIPConn_t *c = &tp->conns[i];
+        if (c->fd >= 0 && c->alive_check_pending) {
+            if (expired) {
+                DoIPServerCloseConn(tp, c);
+            } else {
+                waiting = true;
+            }
+        }
+    }
+
+    UDSTpDoIPConn_t *c = DoIPServerFreeConn(tp);
+    if (c) {
+        DoIPServerAdopt(c, tp->pending_fd);
+        tp->pending_fd = -1;
+    } else if (!waiting || expired) {
+        // every registered tester is alive
+        close(tp->pending_fd);
+        tp->pending_fd = -1;
+    }
+}
+
+static void DoIPServerRoutingActivation(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint16_t sa = DoIPGetBE16(c->rx_ctrl);
+    uint8_t activation_type = c->rx_ctrl[2];
+    uint8_t code = DOIP_RA_SUCCESS;
+
+    if (activation_type != 0x00 && activation_type != 0x01) {
+        code = DOIP_RA_UNSUPPORTED_TYPE;
+    } else if (c->active && c->tester_addr != sa) {
+        code = DOIP_RA_SA_DIFFERENT;
+    } else {
+        for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+            UDSTpDoIPConn_t *other = &tp->conns[i];
+            if (other != c && other->active && other->tester_addr == sa) {
+                code = DOIP_RA_SA_IN_USE;
+            }
+        }
+    }
+
+    uint8_t res[9] = {0};
+    DoIPPutBE16(res, sa);
+    DoIPPutBE16(res + 2, tp->logical_address);
+    res[4] = code;
+    (void)DoIPConnQueue(c, DOIP_ROUTING_ACTIVATION_RES, res, sizeof(res));
+
+    if (DOIP_RA_SUCCESS == code) {
+        c->active = true;
+        c->tester_addr = sa;
+        c->inactivity_timer = UDSMillis() + UDS_DOIP_GENERAL_INACTIVITY_MS;
+        UDS_LOGI(__FILE__, "DoIP: routing activated for tester 0x%04X", sa);
+    } else {
+        UDS_LOGI(__FILE__, "DoIP: routing activation of 0x%04X denied: 0x%02X", sa, code);
+        c->close_after_tx = true;
+    }
+}
+
+static void DoIPServerHandleCtrl(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint8_t res[16];
+    size_t res_len = 0;
+    uint16_t res_type = 0;
+    switch (c->rx_type) {
+    case DOIP_ROUTING_ACTIVATION_REQ:
+        DoIPServerRoutingActivation(tp, c);
+        break;
+    case DOIP_ALIVE_CHECK_RES:
+        c->alive_check_pending = false;
+        break;
+    case DOIP_GENERIC_NACK:
+        UDS_LOGI(__FILE__, "DoIP: tester sent generic NACK 0x%02X", c->rx_ctrl[0]);
+        break;
+    case DOIP_ENTITY_STATUS_REQ:
+    case DOIP_POWER_MODE_REQ:
+        res_type = DoIPServerStatusResponse(tp, c->rx_type, c->rx_ctrl, res, &res_len);
+        (void)DoIPConnQueue(c, res_type, res, res_len);
+        break;
+    default:
+        DoIPConnQueueGenericNack(c, DOIP_NACK_UNKNOWN_PAYLOAD_TYPE);
+        break;
+    }
+}
+
+static bool DoIPServerIsTarget(const UDSTpDoIPServer_t *tp, uint16_t ta) {
+    return ta == tp->logical_address || ta == tp->func_address ||
+           (tp->is_target && tp->is_target(tp->is_target_arg, ta));
+}
+
+static UDSTpDoIPRxSlot_t *DoIPServerFreeSlot(UDSTpDoIPServer_t *tp) {
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        if (UDS_DOIP_SLOT_FREE == tp->rx_slots[i].state) {
+            return &tp->rx_slots[i];
+        }
+    }
+    return NULL;
+}
+
+// ISO 13400-2:2012 Figure 9: diagnostic message handling
+static void DoIPServerDiagStart(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint16_t sa = DoIPGetBE16(c->rx_ctrl);
+    uint16_t ta = DoIPGetBE16(c->rx_ctrl + 2);
+    uint32_t len = c->rx_len - DOIP_DIAG_ADDR_LEN;
+
+    if (!c->active || sa != c->tester_addr) {
+        DoIPConnQueueDiagAck(c, DOIP_DIAG_NACK, ta, sa, DOIP_DIAG_NACK_INVALID_SA);
+        DoIPConnDiscard(c);
+        c->close_after_tx = true;
+    } else if (!DoIPServerIsTarget(tp, ta)) {
+        DoIPConnQueueDiagAck(c, DOIP_DIAG_NACK, ta, sa, DOIP_DIAG_NACK_UNKNOWN_TA);
+        DoIPConnDiscard(c);
+    } else if (len > UDS_DOIP_MTU) {
+        DoIPConnQueueDiagAck(c, DOIP_DIAG_NACK, ta, sa, DOIP_DIAG_NACK_TOO_LARGE);
+        DoIPConnDiscard(c);
+    } else {
+        UDSTpDoIPRxSlot_t *slot = DoIPServerFreeSlot(tp);
+        if (slot) {
+            memset(slot, 0, offsetof(UDSTpDoIPRxSlot_t, buf));
+            slot->state = UDS_DOIP_SLOT_FILLING;
+            slot->seq = tp->rx_seq++;
+            slot->conn = c;
+            slot->len = len;
+            slot->info.A_Mtype = UDS_A_MTYPE_DIAG;
+            slot->info.A_SA = sa;
+            slot->info.A_TA = ta;
+            slot->info.A_TA_Type =
+                ta == tp->func_address ? UDS_A_TA_TYPE_FUNCTIONAL : UDS_A_TA_TYPE_PHYSICAL;
+            DoIPConnAcceptDiag(c, slot->buf);
+        }
+    }
+    // otherwise the message stays in the socket until a slot is free
+}
+
+static void DoIPServerDiagComplete(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    uint16_t sa = DoIPGetBE16(c->rx_ctrl);
+    uint16_t ta = DoIPGetBE16(c->rx_ctrl + 2);
+    UDSTpDoIPRxSlot_t *slot = DoIPServerFillingSlot(tp, c);
+    UDS_ASSERT(slot);
+    slot->conn = NULL;
+    slot->received = slot->len;
+    slot->state = slot->drop ? UDS_DOIP_SLOT_FREE : UDS_DOIP_SLOT_READY;
+    DoIPConnQueueDiagAck(c, DOIP_DIAG_ACK, ta, sa, 0x00);
+}
+
+static void DoIPServerPollConn(UDSTpDoIPServer_t *tp, UDSTpDoIPConn_t *c) {
+    while (!c->close_after_tx) {
+        int ev = DoIPConnRead(c);
+        if (DOIP_CONN_CLOSED == ev) {
+            DoIPServerCloseConn(tp, c);
+            return;
+        }
+        if (DOIP_CONN_NONE == ev) {
+            break;
+        }
+        if (c->active) {
+            c->inactivity_timer = UDSMillis() + UDS_DOIP_GENERAL_INACTIVITY_MS;
+        }
+        if (DOIP_CONN_MSG == ev) {
+            DoIPServerHandleCtrl(tp, c);
+        } else if (DOIP_CONN_DIAG_START == ev) {
+            DoIPServerDiagStart(tp, c);
+            if (DOIP_RX_DIAG_HOLD == c->rx_state) {
+                break;
+            }
+        } else if (DOIP_CONN_DIAG == ev) {
+            DoIPServerDiagComplete(tp, c);
+        }
+    }
+
+    // a taker may forward the part that arrived so far
+    UDSTpDoIPRxSlot_t *slot = DoIPServerFillingSlot(tp, c);
+    if (slot) {
+        slot->received = c->rx_pos - DOIP_DIAG_ADDR_LEN;
+    }
+
+    if (DoIPConnFlush(c) < 0) {
+        DoIPServerCloseConn(tp, c);
+        return;
+    }
+    if (c->close_after_tx && !DoIPConnTxPending(c)) {
+        DoIPServerCloseConn(tp, c);
+        return;
+    }
+    if (UDSTimeAfter(UDSMillis(), c->inactivity_timer)) {
+        UDS_LOGI(__FILE__, "DoIP: connection inactive");
+        DoIPServerCloseConn(tp, c);
+    }
+}
+
+static UDSTpStatus_t doip_server_poll(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    UDSTpStatus_t status = 0;
+
+    DoIPServerAccept(tp);
+    DoIPServerPollUDP(tp);
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd >= 0) {
+            DoIPServerPollConn(tp, &tp->conns[i]);
+        }
+    }
+    DoIPServerAliveCheck(tp);
+
+    if (tp->announce_count && UDSTimeAfter(UDSMillis(), tp->announce_timer)) {
+        uint8_t res[DOIP_VEHICLE_ID_RES_LEN];
+        size_t len = DoIPServerVehicleId(tp, res);
+        DoIPServerSendUDP(tp, DOIP_VEHICLE_ANNOUNCEMENT, res, len,
+                          (struct sockaddr *)&tp->announce_addr, tp->announce_addr_len);
+        tp->announce_count--;
+        tp->announce_timer = UDSMillis() + UDS_DOIP_ANNOUNCE_INTERVAL_MS;
+    }
+
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].tx_diag_data) {
+            status |= UDS_TP_SEND_IN_PROGRESS;
+        }
+    }
+    return status;
+}
+
+static UDSTpDoIPConn_t *DoIPServerFindTester(UDSTpDoIPServer_t *tp, uint16_t tester_addr) {
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        UDSTpDoIPConn_t *c = &tp->conns[i];
+        if (c->fd >= 0 && c->active && c->tester_addr == tester_addr) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static ssize_t doip_server_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    // with info a gateway can answer for the ECUs behind it, otherwise the entity answers the
+    // tester of the last request
+    uint16_t sa = tp->logical_address;
+    uint16_t ta = tp->reply_addr;
+    if (info && info->A_SA) {
+        sa = (uint16_t)info->A_SA;
+        ta = (uint16_t)info->A_TA;
+    }
+    UDSTpDoIPConn_t *c = DoIPServerFindTester(tp, ta);
+    if (NULL == c) {
+        UDS_LOGW(__FILE__, "DoIP: tester 0x%04X is not connected", ta);
+        return -1;
+    }
+    if (!DoIPConnSendDiag(c, sa, ta, buf, len)) {
+        return -2;
+    }
+    if (DoIPConnFlush(c) < 0) {
+        DoIPServerCloseConn(tp, c);
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+// the lent message, otherwise the oldest complete message that isn't taken
+static UDSTpDoIPRxSlot_t *DoIPServerNextSlot(UDSTpDoIPServer_t *tp) {
+    UDSTpDoIPRxSlot_t *next = NULL;
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        UDSTpDoIPRxSlot_t *slot = &tp->rx_slots[i];
+        if (UDS_DOIP_SLOT_READY != slot->state || slot->taken) {
+            continue;
+        }
+        if (slot->lent) {
+            return slot;
+        }
+        if (NULL == next || (int32_t)(slot->seq - next->seq) < 0) {
+            next = slot;
+        }
+    }
+    return next;
+}
+
+static ssize_t doip_server_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    UDSTpDoIPRxSlot_t *slot = DoIPServerNextSlot(tp);
+    if (NULL == slot) {
+        return 0;
+    }
+    slot->lent = true;
+    tp->reply_addr = (uint16_t)slot->info.A_SA;
+    *buf = slot->buf;
+    if (info) {
+        *info = slot->info;
+    }
+    return (ssize_t)slot->len;
+}
+
+static void doip_server_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    UDSTpDoIPRxSlot_t *slot = DoIPServerNextSlot(tp);
+    if (slot && slot->lent) {
+        slot->state = UDS_DOIP_SLOT_FREE;
+        slot->lent = false;
+    }
+}
+
+static ssize_t doip_server_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    uint8_t *data = NULL;
+    ssize_t len = doip_server_peek(hdl, &data, info);
+    if (len <= 0) {
+        return len;
+    }
+    if ((size_t)len > bufsize) {
+        UDS_LOGW(__FILE__, "DoIP: buffer too small: %zu < %zd", bufsize, len);
+        doip_server_release(hdl);
+        return -1;
+    }
+    memcpy(buf, data, (size_t)len);
+    doip_server_release(hdl);
+    return len;
+}
+
+static int doip_server_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    int n = 0;
+    if (n < max_fds) {
+        fds[n++] = (UDSTpFd_t){.fd = tp->listen_fd, .events = UDS_TP_FD_READ};
+    }
+    if (n < max_fds) {
+        fds[n++] = (UDSTpFd_t){.fd = tp->udp_fd, .events = UDS_TP_FD_READ};
+    }
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS && n < max_fds; i++) {
+        const UDSTpDoIPConn_t *c = &tp->conns[i];
+        if (c->fd < 0) {
+            continue;
+        }
+        int events = 0;
+        // a held diagnostic message is read once a slot is free, not when data arrives
+        if (DOIP_RX_DIAG_HOLD != c->rx_state && !c->close_after_tx) {
+            events |= UDS_TP_FD_READ;
+        }
+        if (DoIPConnTxPending(c)) {
+            events |= UDS_TP_FD_WRITE;
+        }
+        fds[n++] = (UDSTpFd_t){.fd = c->fd, .events = events};
+    }
+    return n;
+}
+
+static bool doip_server_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPServer_t *tp = (UDSTpDoIPServer_t *)hdl;
+    bool has = false;
+    uint32_t t = 0;
+    // timers expire once UDSMillis() is past them
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd >= 0) {
+            t = DoIPEarliest(&has, t, tp->conns[i].inactivity_timer + 1);
+        }
+    }
+    if (tp->pending_fd >= 0) {
+        t = DoIPEarliest(&has, t, tp->alive_check_timer + 1);
+    }
+    if (tp->announce_count) {
+        t = DoIPEarliest(&has, t, tp->announce_timer + 1);
+    }
+    if (has) {
+        *deadline_ms = t;
+    }
+    return has;
+}
+
+int UDSTpDoIPServerTake(UDSTpDoIPServer_t *tp, uint16_t ta) {
+    UDS_ASSERT(tp);
+    int oldest = -1;
+    for (int i = 0; i < UDS_DOIP_RX_SLOTS; i++) {
+        const UDSTpDoIPRxSlot_t *slot = &tp->rx_slots[i];
+        if (UDS_DOIP_SLOT_FREE == slot->state || slot->taken || slot->lent || slot->drop ||
+            slot->info.A_TA != ta) {
+            continue;
+        }
+        if (oldest < 0 || (int32_t)(slot->seq - tp->rx_slots[oldest].seq) < 0) {
+            oldest = i;
+        }
+    }
+    if (oldest >= 0) {
+        tp->rx_slots[oldest].taken = true;
+    }
+    return oldest;
+}
+
+void UDSTpDoIPServerGiveBack(UDSTpDoIPServer_t *tp, int slot) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(slot >= 0 && slot < UDS_DOIP_RX_SLOTS);
+    UDSTpDoIPRxSlot_t *s = &tp->rx_slots[slot];
+    s->taken = false;
+    if (UDS_DOIP_SLOT_FILLING == s->state) {
+        s->drop = true;
+    } else {
+        s->state = UDS_DOIP_SLOT_FREE;
+    }
+}
+
+bool UDSTpDoIPServerSending(const UDSTpDoIPServer_t *tp, const uint8_t *buf) {
+    UDS_ASSERT(tp);
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        if (tp->conns[i].fd >= 0 && tp->conns[i].tx_diag_data == buf) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int DoIPServerBind(const char *addr, uint16_t port, int socktype) {
+    struct sockaddr_storage sa;
+    socklen_t sa_len = 0;
+    if (DoIPResolve(addr, port, socktype, &sa, &sa_len) < 0) {
+        return -1;
+    }
+    int fd = socket(sa.ss_family, socktype, 0);
+    if (fd < 0) {
+        UDS_LOGE(__FILE__, "DoIP: socket: %s", strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (SOCK_DGRAM == socktype) {
+        (void)setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    }
+    if (bind(fd, (struct sockaddr *)&sa, sa_len) < 0 || DoIPSetNonBlocking(fd) < 0 ||
+        (SOCK_STREAM == socktype && listen(fd, UDS_DOIP_MAX_CONNECTIONS) < 0)) {
+        UDS_LOGE(__FILE__, "DoIP: cannot bind %s:%u: %s", addr, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+UDSErr_t UDSTpDoIPServerInit(UDSTpDoIPServer_t *tp, const UDSTpDoIPServerConfig_t *cfg) {
+    if (NULL == tp || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    memset(tp, 0, sizeof(*tp));
+    tp->hdl.poll = doip_server_poll;
+    tp->hdl.send = doip_server_send;
+    tp->hdl.recv = doip_server_recv;
+    tp->hdl.peek = doip_server_peek;
+    tp->hdl.release = doip_server_release;
+    tp->hdl.get_fds = doip_server_get_fds;
+    tp->hdl.next_deadline = doip_server_next_deadline;
+    tp->logical_address = cfg->logical_address;
+    tp->func_address = cfg->func_address ? cfg->func_address : UDS_DOIP_FUNC_ADDR_DEFAULT;
+    memcpy(tp->vin, cfg->vin, sizeof(tp->vin));
+    memcpy(tp->eid, cfg->eid, sizeof(tp->eid));
+    memcpy(tp->gid, cfg->gid, sizeof(tp->gid));
+    tp->pending_fd = -1;
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        DoIPConnInit(&tp->conns[i], -1);
+    }
+
+    const char *addr = cfg->bind_addr ? cfg->bind_addr : "0.0.0.0";
+    uint16_t port = cfg->port ? cfg->port : UDS_DOIP_PORT;
+    tp->listen_fd = DoIPServerBind(addr, port, SOCK_STREAM);
+    tp->udp_fd = DoIPServerBind(addr, port, SOCK_DGRAM);
+    if (tp->listen_fd < 0 || tp->udp_fd < 0) {
+        UDSTpDoIPServerDeinit(tp);
+        return UDS_FAIL;
+    }
+
+    if (cfg->announce_addr) {
+        if (DoIPResolve(cfg->announce_addr, port, SOCK_DGRAM, &tp->announce_addr,
+                        &tp->announce_addr_len) < 0) {
+            UDSTpDoIPServerDeinit(tp);
+            return UDS_FAIL;
+        }
+        tp->announce_count = UDS_DOIP_ANNOUNCE_NUM;
+        tp->announce_timer = UDSMillis();
+    }
+    UDS_LOGI(__FILE__, "DoIP: entity 0x%04X listening on %s:%u", tp->logical_address, addr, port);
+    return UDS_OK;
+}
+
+void UDSTpDoIPServerDeinit(UDSTpDoIPServer_t *tp) {
+    if (NULL == tp) {
+        return;
+    }
+    for (int i = 0; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        DoIPConnClose(&tp->conns[i]);
+    }
+    if (tp->pending_fd >= 0) {
+        close(tp->pending_fd);
+        tp->pending_fd = -1;
+    }
+    if (tp->listen_fd >= 0) {
+        close(tp->listen_fd);
+        tp->listen_fd = -1;
+    }
+    if (tp->udp_fd >= 0) {
+        close(tp->udp_fd);
+        tp->udp_fd = -1;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Client
+ */
+
+static void DoIPClientFail(UDSTpDoIPClient_t *tp) {
+    tp->state = UDS_DOIP_CLIENT_FAILED;
+    tp->pending_data = NULL;
+    tp->awaiting_ack = false;
+    tp->send_err = true;
+    DoIPConnClose(&tp->conn);
+}
+
+static void DoIPClientStartSend(UDSTpDoIPClient_t *tp) {
+    if (tp->pending_data && UDS_DOIP_CLIENT_ACTIVE == tp->state &&
+        DoIPConnSendDiag(&tp->conn, tp->source_addr, tp->pending_ta, tp->pending_data,
+                         tp->pending_len)) {
+        tp->pending_data = NULL;
+        tp->awaiting_ack = true;
+        tp->timer = UDSMillis() + UDS_DOIP_DIAG_ACK_TIMEOUT_MS;
+    }
+}
+
+static void DoIPClientConnected(UDSTpDoIPClient_t *tp) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct pollfd pfd = {.fd = tp->conn.fd, .events = POLLOUT};
+    if (poll(&pfd, 1, 0) <= 0) {
+        return;
+    }
+    if (getsockopt(tp->conn.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        UDS_LOGE(__FILE__, "DoIP: connect failed: %s", strerror(err));
+        DoIPClientFail(tp);
+        return;
+    }
+    uint8_t req[7] = {0};
+    DoIPPutBE16(req, tp->source_addr);
+    req[2] = tp->activation_type;
+    (void)DoIPConnQueue(&tp->conn, DOIP_ROUTING_ACTIVATION_REQ, req, sizeof(req));
+    tp->state = UDS_DOIP_CLIENT_ACTIVATING;
+    tp->timer = UDSMillis() + UDS_DOIP_CTRL_TIMEOUT_MS;
+}
+
+static void DoIPClientHandleCtrl(UDSTpDoIPClient_t *tp) {
+    UDSTpDoIPConn_t *c = &tp->conn;
+    uint8_t res[2];
+    switch (c->rx_type) {
+    case DOIP_ROUTING_ACTIVATION_RES: {
+        uint8_t code = c->rx_ctrl[4];
+        if (DOIP_RA_SUCCESS == code) {
+            tp->state = UDS_DOIP_CLIENT_ACTIVE;
+            DoIPClientStartSend(tp);
+        } else if (DOIP_RA_CONFIRMATION_PENDING == code) {
+            tp->timer = UDSMillis() + UDS_DOIP_CTRL_TIMEOUT_MS;
+        } else {
+            UDS_LOGE(__FILE__, "DoIP: routing activation denied: 0x%02X", code);
+            DoIPClientFail(tp);
+        }
+        break;
+    }
+    case DOIP_ALIVE_CHECK_REQ:
+        DoIPPutBE16(res, tp->source_addr);
+        (void)DoIPConnQueue(c, DOIP_ALIVE_CHECK_RES, res, sizeof(res));
+        break;
+    case DOIP_DIAG_ACK:
+        tp->awaiting_ack = false;
+        break;
+    case DOIP_DIAG_NACK:
+        tp->nack_code = c->rx_ctrl[4];
+        UDS_LOGW(__FILE__, "DoIP: diagnostic message NACK 0x%02X", tp->nack_code);
+        tp->awaiting_ack = false;
+        tp->send_err = true;
+        break;
+    case DOIP_GENERIC_NACK:
+        UDS_LOGW(__FILE__, "DoIP: generic NACK 0x%02X", c->rx_ctrl[0]);
+        if (tp->awaiting_ack) {
+            tp->awaiting_ack = false;
+            tp->send_err = true;
+        }
+        break;
+    default:
+        DoIPConnQueueGenericNack(c, DOIP_NACK_UNKNOWN_PAYLOAD_TYPE);
+        break;
+    }
+}
+
+static void DoIPClientPollConn(UDSTpDoIPClient_t *tp) {
+    UDSTpDoIPConn_t *c = &tp->conn;
+    while (!c->close_after_tx && tp->state != UDS_DOIP_CLIENT_FAILED) {
+        int ev = DoIPConnRead(c);
+        if (DOIP_CONN_CLOSED == ev) {
+            UDS_LOGI(__FILE__, "DoIP: connection closed by the entity");
+            DoIPClientFail(tp);
+            return;
+        }
+        if (DOIP_CONN_NONE == ev) {
+            break;
+        }
+        if (DOIP_CONN_MSG == ev) {
+            DoIPClientHandleCtrl(tp);
+        } else if (DOIP_CONN_DIAG_START == ev) {
+            uint16_t ta = DoIPGetBE16(c->rx_ctrl + 2);
+            if (ta != tp->source_addr || c->rx_len - DOIP_DIAG_ADDR_LEN > sizeof(tp->recv_buf)) {
+                UDS_LOGW(__FILE__, "DoIP: dropping diagnostic message to 0x%04X", ta);
+                DoIPConnDiscard(c);
+            } else if (0 == tp->recv_len) {
+                DoIPConnAcceptDiag(c, tp->recv_buf);
+            } else {
+                break; // the previous message has not been read yet
+            }
+        } else if (DOIP_CONN_DIAG == ev) {
+            tp->recv_len = c->rx_len - DOIP_DIAG_ADDR_LEN;
+            tp->recv_info.A_Mtype = UDS_A_MTYPE_DIAG;
+            tp->recv_info.A_SA = DoIPGetBE16(c->rx_ctrl);
+            tp->recv_info.A_TA = DoIPGetBE16(c->rx_ctrl + 2);
+            tp->recv_info.A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+            tp->recv_info.A_AE = 0;
+        }
+    }
+    if (tp->state != UDS_DOIP_CLIENT_FAILED &&
+        (DoIPConnFlush(c) < 0 || (c->close_after_tx && !DoIPConnTxPending(c)))) {
+        DoIPClientFail(tp);
+    }
+}
+
+static UDSTpStatus_t doip_client_poll(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    UDSTpStatus_t status = 0;
+
+    if (UDS_DOIP_CLIENT_CONNECTING == tp->state) {
+        DoIPClientConnected(tp);
+    }
+    if (UDS_DOIP_CLIENT_ACTIVATING == tp->state || UDS_DOIP_CLIENT_ACTIVE == tp->state) {
+        DoIPClientPollConn(tp);
+    }
+
+    bool waiting = UDS_DOIP_CLIENT_CONNECTING == tp->state ||
+                   UDS_DOIP_CLIENT_ACTIVATING == tp->state || tp->awaiting_ack;
+    if (waiting && UDSTimeAfter(UDSMillis(), tp->timer)) {
+        UDS_LOGE(__FILE__, "DoIP: timeout in state %d", tp->state);
+        if (tp->awaiting_ack && UDS_DOIP_CLIENT_ACTIVE == tp->state) {
+            tp->awaiting_ack = false;
+            tp->send_err = true;
+        } else {
+            DoIPClientFail(tp);
+        }
+    }
+
+    if (tp->pending_data || tp->awaiting_ack || tp->conn.tx_diag_data) {
+        status |= UDS_TP_SEND_IN_PROGRESS;
+    }
+    if (tp->send_err) {
+        status |= UDS_TP_ERR;
+    }
+    return status;
+}
+
+static ssize_t doip_client_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (UDS_DOIP_CLIENT_FAILED == tp->state) {
+        return -1;
+    }
+    if (tp->pending_data || tp->awaiting_ack || tp->conn.tx_diag_data) {
+        return -2;
+    }
+    bool functional = info && UDS_A_TA_TYPE_FUNCTIONAL == info->A_TA_Type;
+    tp->pending_data = buf;
+    tp->pending_len = len;
+    tp->pending_ta = functional ? tp->func_addr : tp->target_addr;
+    tp->send_err = false;
+    tp->nack_code = 0;
+    DoIPClientStartSend(tp);
+    if (tp->conn.fd >= 0 && DoIPConnFlush(&tp->conn) < 0) {
+        DoIPClientFail(tp);
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+static ssize_t doip_client_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (0 == tp->recv_len) {
+        return 0;
+    }
+    *buf = tp->recv_buf;
+    if (info) {
+        *info = tp->recv_info;
+    }
+    return (ssize_t)tp->recv_len;
+}
+
+static void doip_client_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    tp->recv_len = 0;
+}
+
+static ssize_t doip_client_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    uint8_t *data = NULL;
+    ssize_t len = doip_client_peek(hdl, &data, info);
+    if (len <= 0) {
+        return len;
+    }
+    doip_client_release(hdl);
+    if ((size_t)len > bufsize) {
+        UDS_LOGW(__FILE__, "DoIP: buffer too small: %zu < %zd", bufsize, len);
+        return -1;
+    }
+    memcpy(buf, data, (size_t)len);
+    return len;
+}
+
+static int doip_client_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (max_fds < 1 || tp->conn.fd < 0) {
+        return 0;
+    }
+    fds[0].fd = tp->conn.fd;
+    if (UDS_DOIP_CLIENT_CONNECTING == tp->state) {
+        fds[0].events = UDS_TP_FD_WRITE;
+        return 1;
+    }
+    fds[0].events = tp->recv_len ? 0 : UDS_TP_FD_READ;
+    if (DoIPConnTxPending(&tp->conn)) {
+        fds[0].events |= UDS_TP_FD_WRITE;
+    }
+    return 1;
+}
+
+static bool doip_client_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDSTpDoIPClient_t *tp = (UDSTpDoIPClient_t *)hdl;
+    if (UDS_DOIP_CLIENT_CONNECTING == tp->state || UDS_DOIP_CLIENT_ACTIVATING == tp->state ||
+        tp->awaiting_ack) {
+        *deadline_ms = tp->timer + 1;
+        return true;
+    }
+    return false;
+}
+
+UDSErr_t UDSTpDoIPClientInit(UDSTpDoIPClient_t *tp, const UDSTpDoIPClientConfig_t *cfg) {
+    if (NULL == tp || NULL == cfg || NULL == cfg->addr) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    memset(tp, 0, sizeof(*tp));
+    tp->hdl.poll = doip_client_poll;
+    tp->hdl.send = doip_client_send;
+    tp->hdl.recv = doip_client_recv;
+    tp->hdl.peek = doip_client_peek;
+    tp->hdl.release = doip_client_release;
+    tp->hdl.get_fds = doip_client_get_fds;
+    tp->hdl.next_deadline = doip_client_next_deadline;
+    tp->source_addr = cfg->source_addr;
+    tp->target_addr = cfg->target_addr;
+    tp->func_addr = cfg->func_addr ? cfg->func_addr : UDS_DOIP_FUNC_ADDR_DEFAULT;
+    tp->activation_type = cfg->activation_type;
+    DoIPConnInit(&tp->conn, -1);
+
+    struct sockaddr_storage sa;
+    socklen_t sa_len = 0;
+    uint16_t port = cfg->port ? cfg->port : UDS_DOIP_PORT;
+    if (DoIPResolve(cfg->addr, port, SOCK_STREAM, &sa, &sa_len) < 0) {
+        return UDS_FAIL;
+    }
+    int fd = socket(sa.ss_family, SOCK_STREAM, 0);
+    if (fd < 0 || DoIPSetupStream(fd) < 0) {
+        UDS_LOGE(__FILE__, "DoIP: socket: %s", strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return UDS_FAIL;
+    }
+    if (connect(fd, (struct sockaddr *)&sa, sa_len) < 0 && EINPROGRESS != errno) {
+        UDS_LOGE(__FILE__, "DoIP: cannot connect to %s:%u: %s", cfg->addr, port, strerror(errno));
+        close(fd);
+        return UDS_FAIL;
+    }
+    DoIPConnInit(&tp->conn, fd);
+    tp->state = UDS_DOIP_CLIENT_CONNECTING;
+    tp->timer = UDSMillis() + UDS_DOIP_CTRL_TIMEOUT_MS;
+    return UDS_OK;
+}
+
+void UDSTpDoIPClientDeinit(UDSTpDoIPClient_t *tp) {
+    if (NULL == tp) {
+        return;
+    }
+    DoIPConnClose(&tp->conn);
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Vehicle discovery
+ */
+
+UDSErr_t UDSTpDoIPDiscoveryInit(UDSTpDoIPDiscovery_t *d, const char *addr, uint16_t port) {
+    if (NULL == d || NULL == addr) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    struct sockaddr_storage sa;
+    socklen_t sa_len = 0;
+    d->fd = -1;
+    if (DoIPResolve(addr, port ? port : UDS_DOIP_PORT, SOCK_DGRAM, &sa, &sa_len) < 0) {
+        return UDS_FAIL;
+    }
+    d->fd = socket(sa.ss_family, SOCK_DGRAM, 0);
+    if (d->fd < 0) {
+        return UDS_FAIL;
+    }
+    int one = 1;
+    (void)setsockopt(d->fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    uint8_t req[DOIP_HEADER_LEN];
+    DoIPPutHeader(req, DOIP_VEHICLE_ID_REQ, 0);
+    if (DoIPSetNonBlocking(d->fd) < 0 ||
+        sendto(d->fd, req, sizeof(req), 0, (struct sockaddr *)&sa, sa_len) < 0) {
+        UDS_LOGE(__FILE__, "DoIP: vehicle identification request failed: %s", strerror(errno));
+        UDSTpDoIPDiscoveryDeinit(d);
+        return UDS_FAIL;
+    }
+    return UDS_OK;
+}
+
+int UDSTpDoIPDiscoveryPoll(UDSTpDoIPDiscovery_t *d, UDSTpDoIPVehicle_t *vehicle) {
+    if (NULL == d || NULL == vehicle || d->fd < 0) {
+        return -1;
+    }
+    uint8_t msg[64];
+    for (;;) {
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n =
+            recvfrom(d->fd, msg, sizeof(msg), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            return (EAGAIN == errno || EWOULDBLOCK == errno) ? 0 : -1;
+        }
+        if (n < DOIP_HEADER_LEN + DOIP_VEHICLE_ID_RES_LEN || !DoIPHeaderValid(msg, true) ||
+            DoIPGetBE16(msg + 2) != DOIP_VEHICLE_ANNOUNCEMENT) {
+            continue;
+        }
+        const uint8_t *p = msg + DOIP_HEADER_LEN;
+        memcpy(vehicle->vin, p, sizeof(vehicle->vin));
+        vehicle->logical_address = DoIPGetBE16(p + 17);
+        memcpy(vehicle->eid, p + 19, sizeof(vehicle->eid));
+        memcpy(vehicle->gid, p + 25, sizeof(vehicle->gid));
+        vehicle->further_action = p[31];
+        const void *ip = AF_INET6 == from.ss_family
+                             ? (const void *)&((struct sockaddr_in6 *)&from)->sin6_addr
+                             : (const void *)&((struct sockaddr_in *)&from)->sin_addr;
+        if (NULL == inet_ntop(from.ss_family, ip, vehicle->addr, sizeof(vehicle->addr))) {
+            vehicle->addr[0] = '\0';
+        }
+        return 1;
+    }
+}
+
+void UDSTpDoIPDiscoveryDeinit(UDSTpDoIPDiscovery_t *d) {
+    if (d && d->fd >= 0) {
+        close(d->fd);
+        d->fd = -1;
+    }
+}
+
+#endif
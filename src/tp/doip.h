@@ -0,0 +1,276 @@
+#pragma once
+
+#if defined(UDS_TP_DOIP)
+
+#include "tp.h"
+#include "uds.h"
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/** TCP_DATA and UDP_DISCOVERY port, ISO 13400-2:2012 Table 39 */
+#ifndef UDS_DOIP_PORT
+#define UDS_DOIP_PORT (13400)
+#endif
+
+/** Protocol version written to sent headers, 0x02: ISO 13400-2:2012 */
+#ifndef UDS_DOIP_PROTOCOL_VERSION
+#define UDS_DOIP_PROTOCOL_VERSION (0x02)
+#endif
+
+/** Largest diagnostic message user data received by a DoIP transport. DoIP is not limited to
+ * 4095 bytes, raise UDS_TP_MTU to let the UDS client and server use larger messages. */
+#ifndef UDS_DOIP_MTU
+#define UDS_DOIP_MTU (UDS_TP_MTU)
+#endif
+
+/** Number of testers a DoIP server accepts at the same time */
+#ifndef UDS_DOIP_MAX_CONNECTIONS
+#define UDS_DOIP_MAX_CONNECTIONS (2)
+#endif
+
+/** Number of received diagnostic messages a DoIP server holds at the same time. A gateway
+ * forwards one message per ECU while the next ones arrive, give it one more than it has routes. */
+#ifndef UDS_DOIP_RX_SLOTS
+#define UDS_DOIP_RX_SLOTS (1)
+#endif
+
+/** Size of the per-connection queues for control messages (routing activation, ACK, ...) */
+#ifndef UDS_DOIP_CTRL_BUF_SIZE
+#define UDS_DOIP_CTRL_BUF_SIZE (64)
+#endif
+
+/** T_TCP_Initial_Inactivity: time a new connection has to activate routing */
+#ifndef UDS_DOIP_INITIAL_INACTIVITY_MS
+#define UDS_DOIP_INITIAL_INACTIVITY_MS (2000)
+#endif
+
+/** T_TCP_General_Inactivity: an idle connection is closed after this time */
+#ifndef UDS_DOIP_GENERAL_INACTIVITY_MS
+#define UDS_DOIP_GENERAL_INACTIVITY_MS (300000)
+#endif
+
+/** T_TCP_Alive_Check: time a tester has to answer an alive check request */
+#ifndef UDS_DOIP_ALIVE_CHECK_MS
+#define UDS_DOIP_ALIVE_CHECK_MS (500)
+#endif
+
+/** A_DoIP_Ctrl: time the client waits for the connection and the routing activation response */
+#ifndef UDS_DOIP_CTRL_TIMEOUT_MS
+#define UDS_DOIP_CTRL_TIMEOUT_MS (2000)
+#endif
+
+/** A_DoIP_Diagnostic_Message: time the client waits for the diagnostic message ACK */
+#ifndef UDS_DOIP_DIAG_ACK_TIMEOUT_MS
+#define UDS_DOIP_DIAG_ACK_TIMEOUT_MS (2000)
+#endif
+
+/** A_DoIP_Announce_Num and A_DoIP_Announce_Interval */
+#ifndef UDS_DOIP_ANNOUNCE_NUM
+#define UDS_DOIP_ANNOUNCE_NUM (3)
+#endif
+
+#ifndef UDS_DOIP_ANNOUNCE_INTERVAL_MS
+#define UDS_DOIP_ANNOUNCE_INTERVAL_MS (500)
+#endif
+
+/** Default functional logical address, ISO 13400-2:2012 Table 13 */
+#define UDS_DOIP_FUNC_ADDR_DEFAULT (0xE400)
+
+/**
+ * @brief One TCP_DATA connection: header parsing and the send queue
+ */
+typedef struct {
+    int fd; // -1 if unused
+    bool active;              // routing activation succeeded
+    uint16_t tester_addr;     // logical address of the tester
+    uint32_t inactivity_timer;
+    bool alive_check_pending; // an alive check request was sent and is not answered yet
+    bool close_after_tx;      // close once the send queue is empty, e.g. after a NACK
+
+    // receive
+    uint8_t rx_state;
+    uint8_t rx_hdr[8];
+    uint16_t rx_type;
+    uint32_t rx_len; // payload length from the header
+    uint32_t rx_pos; // payload bytes read
+    uint8_t rx_ctrl[UDS_DOIP_CTRL_BUF_SIZE]; // control message payload, diagnostic SA and TA
+    uint8_t *rx_dst;                         // user data of the diagnostic message being read
+
+    // control messages, sent in order
+    uint8_t tx_ctrl[UDS_DOIP_CTRL_BUF_SIZE];
+    size_t tx_ctrl_len, tx_ctrl_pos;
+
+    // a diagnostic message, the user data is borrowed from the caller of send()
+    uint8_t tx_diag_hdr[12];
+    const uint8_t *tx_diag_data; // NULL if none
+    size_t tx_diag_len, tx_diag_pos;
+} UDSTpDoIPConn_t;
+
+enum UDSTpDoIPRxSlotState {
+    UDS_DOIP_SLOT_FREE = 0,
+    UDS_DOIP_SLOT_FILLING, // the message is being received
+    UDS_DOIP_SLOT_READY,   // the message is complete
+    UDS_DOIP_SLOT_ABORTED, // the connection closed before the message was complete
+};
+
+/**
+ * @brief A diagnostic message received by a DoIP server
+ */
+typedef struct {
+    uint8_t state;           // enum UDSTpDoIPRxSlotState
+    bool lent;               // lent by peek()
+    bool taken;              // taken by UDSTpDoIPServerTake()
+    bool drop;               // given back before it was complete, free it once it is
+    uint32_t seq;            // arrival order
+    UDSTpDoIPConn_t *conn;   // connection receiving into buf
+    size_t len;              // user data length
+    size_t received;         // user data bytes in buf
+    UDSSDU_t info;
+    uint8_t buf[UDS_DOIP_MTU];
+} UDSTpDoIPRxSlot_t;
+
+/**
+ * @brief DoIP entity (server role)
+ * @details Accepts testers on TCP_DATA and answers vehicle identification requests on
+ * UDP_DISCOVERY. Responses go to the tester that sent the last request.
+ */
+typedef struct {
+    UDSTp_t hdl;
+    uint16_t logical_address;
+    uint16_t func_address;
+    uint8_t vin[17];
+    uint8_t eid[6];
+    uint8_t gid[6];
+    int listen_fd;
+    int udp_fd;
+    UDSTpDoIPConn_t conns[UDS_DOIP_MAX_CONNECTIONS];
+
+    // a tester that connected while all connections were in use waits for the alive check
+    int pending_fd;
+    uint32_t alive_check_timer;
+
+    uint8_t announce_count; // vehicle announcements left to send
+    uint32_t announce_timer;
+    struct sockaddr_storage announce_addr;
+    socklen_t announce_addr_len;
+
+    // additional target addresses, e.g. the ECUs behind a gateway. NULL: only logical_address
+    bool (*is_target)(void *arg, uint16_t ta);
+    void *is_target_arg;
+
+    uint16_t reply_addr; // tester that sent the last request
+    uint32_t rx_seq;
+    UDSTpDoIPRxSlot_t rx_slots[UDS_DOIP_RX_SLOTS];
+} UDSTpDoIPServer_t;
+
+typedef struct {
+    const char *bind_addr; // local address, NULL: all IPv4 interfaces
+    uint16_t port;         // TCP and UDP port, 0: UDS_DOIP_PORT
+    uint16_t logical_address;
+    uint16_t func_address; // 0: UDS_DOIP_FUNC_ADDR_DEFAULT
+    uint8_t vin[17];
+    uint8_t eid[6];
+    uint8_t gid[6];
+    const char *announce_addr; // send vehicle announcements here after init, NULL: don't announce
+} UDSTpDoIPServerConfig_t;
+
+enum UDSTpDoIPClientState {
+    UDS_DOIP_CLIENT_CONNECTING = 0,
+    UDS_DOIP_CLIENT_ACTIVATING,
+    UDS_DOIP_CLIENT_ACTIVE,
+    UDS_DOIP_CLIENT_FAILED,
+};
+
+/**
+ * @brief DoIP tester (client role)
+ * @details Connects and activates routing in the background. Messages sent before the routing
+ * activation finished are held until then. A send is complete once the entity acknowledged it.
+ */
+typedef struct {
+    UDSTp_t hdl;
+    uint16_t source_addr; // logical address of the tester
+    uint16_t target_addr; // logical address of the DoIP entity
+    uint16_t func_addr;
+    uint8_t activation_type;
+    uint8_t state; // enum UDSTpDoIPClientState
+    uint32_t timer;
+    UDSTpDoIPConn_t conn;
+
+    // message waiting for the routing activation
+    const uint8_t *pending_data;
+    size_t pending_len;
+    uint16_t pending_ta;
+
+    bool awaiting_ack;
+    bool send_err;
+    uint8_t nack_code; // code of the last diagnostic message NACK
+
+    size_t recv_len;
+    UDSSDU_t recv_info;
+    uint8_t recv_buf[UDS_DOIP_MTU];
+} UDSTpDoIPClient_t;
+
+typedef struct {
+    const char *addr;         // address of the DoIP entity
+    uint16_t port;            // 0: UDS_DOIP_PORT
+    uint16_t source_addr;     // logical address of the tester, e.g. 0x0E00
+    uint16_t target_addr;     // logical address of the DoIP entity
+    uint16_t func_addr;       // 0: UDS_DOIP_FUNC_ADDR_DEFAULT
+    uint8_t activation_type;  // 0x00: default
+} UDSTpDoIPClientConfig_t;
+
+/**
+ * @brief A vehicle identification response or vehicle announcement
+ */
+typedef struct {
+    char addr[INET6_ADDRSTRLEN]; // address the message came from
+    uint16_t logical_address;
+    uint8_t vin[17];
+    uint8_t eid[6];
+    uint8_t gid[6];
+    uint8_t further_action;
+} UDSTpDoIPVehicle_t;
+
+typedef struct {
+    int fd;
+} UDSTpDoIPDiscovery_t;
+
+UDSErr_t UDSTpDoIPServerInit(UDSTpDoIPServer_t *tp, const UDSTpDoIPServerConfig_t *cfg);
+void UDSTpDoIPServerDeinit(UDSTpDoIPServer_t *tp);
+
+/**
+ * @brief Take the oldest message for a target address, also while it is still being received
+ * @details Taken messages are not returned by peek() or recv(). rx_slots[slot].received tells how
+ * much of the message arrived, state changes to UDS_DOIP_SLOT_READY once it is complete.
+ * @return index into rx_slots, -1 if there is no message for ta
+ */
+int UDSTpDoIPServerTake(UDSTpDoIPServer_t *tp, uint16_t ta);
+
+/**
+ * @brief Give a message taken with UDSTpDoIPServerTake() back, its slot receives the next message
+ */
+void UDSTpDoIPServerGiveBack(UDSTpDoIPServer_t *tp, int slot);
+
+/**
+ * @brief Check if a message passed to send() is still being sent from buf
+ */
+bool UDSTpDoIPServerSending(const UDSTpDoIPServer_t *tp, const uint8_t *buf);
+
+UDSErr_t UDSTpDoIPClientInit(UDSTpDoIPClient_t *tp, const UDSTpDoIPClientConfig_t *cfg);
+void UDSTpDoIPClientDeinit(UDSTpDoIPClient_t *tp);
+
+/**
+ * @brief Send a vehicle identification request
+ * @param addr unicast or broadcast address, e.g. "255.255.255.255"
+ * @param port 0: UDS_DOIP_PORT
+ */
+UDSErr_t UDSTpDoIPDiscoveryInit(UDSTpDoIPDiscovery_t *d, const char *addr, uint16_t port);
+
+/**
+ * @brief Read the next vehicle identification response
+ * @return 1 if vehicle was filled in, 0 if no response is pending, negative on error
+ */
+int UDSTpDoIPDiscoveryPoll(UDSTpDoIPDiscovery_t *d, UDSTpDoIPVehicle_t *vehicle);
+void UDSTpDoIPDiscoveryDeinit(UDSTpDoIPDiscovery_t *d);
+
+#endif
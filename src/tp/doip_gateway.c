@@ -0,0 +1,233 @@
+#if defined(UDS_TP_DOIP)
+
+#include "tp/doip_gateway.h"
+#include "util.h"
+#include "log.h"
+#include <string.h>
+
+static bool DoIPGatewayIsTarget(void *arg, uint16_t ta) {
+    const UDSTpDoIPGateway_t *gw = (const UDSTpDoIPGateway_t *)arg;
+    for (int i = 0; i < gw->num_routes; i++) {
+        if (gw->routes[i].logical_address == ta) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void DoIPGatewayEndRequest(UDSTpDoIPGateway_t *gw, UDSTpDoIPGatewayRoute_t *r) {
+    UDSTpDoIPServerGiveBack(gw->doip, r->req_slot);
+    r->req_slot = -1;
+}
+
+static void DoIPGatewayForwardRequest(UDSTpDoIPGateway_t *gw, UDSTpDoIPGatewayRoute_t *r,
+                                      UDSTpStatus_t status) {
+    UDSTpDoIPServer_t *doip = gw->doip;
+    if (r->req_slot < 0) {
+        r->req_slot = UDSTpDoIPServerTake(doip, r->logical_address);
+        if (r->req_slot < 0) {
+            return;
+        }
+        r->req_available = 0;
+        r->req_started = false;
+        r->req_done = false;
+        r->tester_addr = (uint16_t)doip->rx_slots[r->req_slot].info.A_SA;
+        r->phys_awaiting = true;
+    }
+    const UDSTpDoIPRxSlot_t *slot = &doip->rx_slots[r->req_slot];
+
+    if (r->req_done) {
+        // the link sends from the slot until it is done
+        if (0 == (status & UDS_TP_SEND_IN_PROGRESS)) {
+            DoIPGatewayEndRequest(gw, r);
+        }
+        return;
+    }
+
+    if (UDS_DOIP_SLOT_ABORTED == slot->state || (r->req_started && (status & UDS_TP_ERR))) {
+        UDS_LOGI(__FILE__, "DoIP gateway: request to 0x%04X aborted", r->logical_address);
+        if (r->req_started) {
+            (void)UDSTpSendPartial(r->tp, NULL, 0, 0, NULL);
+        }
+        r->phys_awaiting = false;
+        DoIPGatewayEndRequest(gw, r);
+        return;
+    }
+
+    if (r->req_started && slot->received == r->req_available) {
+        return;
+    }
+    UDSSDU_t info = {
+        .A_Mtype = UDS_A_MTYPE_DIAG,
+        .A_SA = slot->info.A_SA,
+        .A_TA = r->logical_address,
+        .A_TA_Type = UDS_A_TA_TYPE_PHYSICAL,
+    };
+    ssize_t ret = UDSTpSendPartial(r->tp, slot->buf, slot->len, slot->received, &info);
+    if (ret < 0) {
+        UDS_LOGW(__FILE__, "DoIP gateway: cannot forward to 0x%04X: %zd", r->logical_address, ret);
+        if (r->req_started) {
+            (void)UDSTpSendPartial(r->tp, NULL, 0, 0, NULL);
+        }
+        r->phys_awaiting = false;
+        DoIPGatewayEndRequest(gw, r);
+    } else if (ret > 0) {
+        r->req_started = true;
+        r->req_available = slot->received;
+        r->req_done = slot->received == slot->len;
+    }
+}
+
+// functional requests go out on every link marked functional, the slot is given back once they
+// were all sent
+static void DoIPGatewayForwardFunctional(UDSTpDoIPGateway_t *gw, const UDSTpStatus_t *status) {
+    UDSTpDoIPServer_t *doip = gw->doip;
+    if (gw->func_slot < 0) {
+        gw->func_slot = UDSTpDoIPServerTake(doip, doip->func_address);
+        if (gw->func_slot < 0) {
+            return;
+        }
+        // every ECU on the bus may answer, also those behind routes sharing a functional link
+        for (int i = 0; i < gw->num_routes; i++) {
+            gw->routes[i].func_pending = gw->routes[i].functional;
+            gw->routes[i].func_tester_addr = (uint16_t)doip->rx_slots[gw->func_slot].info.A_SA;
+            gw->routes[i].func_awaiting = true;
+        }
+    }
+    const UDSTpDoIPRxSlot_t *slot = &doip->rx_slots[gw->func_slot];
+    bool busy = false;
+
+    if (UDS_DOIP_SLOT_ABORTED == slot->state) {
+        for (int i = 0; i < gw->num_routes; i++) {
+            gw->routes[i].func_pending = false;
+        }
+    } else if (UDS_DOIP_SLOT_READY != slot->state) {
+        return;
+    }
+
+    for (int i = 0; i < gw->num_routes; i++) {
+        UDSTpDoIPGatewayRoute_t *r = &gw->routes[i];
+        if (r->func_pending) {
+            UDSSDU_t info = {
+                .A_Mtype = UDS_A_MTYPE_DIAG,
+                .A_SA = slot->info.A_SA,
+                .A_TA = doip->func_address,
+                .A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL,
+            };
+            if (UDSTpSend(r->tp, slot->buf, (ssize_t)slot->len, &info) < 0) {
+                UDS_LOGW(__FILE__, "DoIP gateway: cannot forward functional request to 0x%04X",
+                         r->logical_address);
+            }
+            r->func_pending = false;
+            busy = true;
+        } else if (r->functional && (status[i] & UDS_TP_SEND_IN_PROGRESS)) {
+            busy = true;
+        }
+    }
+    if (!busy) {
+        UDSTpDoIPServerGiveBack(doip, gw->func_slot);
+        gw->func_slot = -1;
+    }
+}
+
+// marks the request answered by the response about to be forwarded unless it is NRC 0x78
+static void DoIPGatewayAnswered(UDSTpDoIPGatewayRoute_t *r, bool functional) {
+    if (r->resp_len >= 3 && 0x7F == r->resp_data[0] &&
+        UDS_NRC_RequestCorrectlyReceived_ResponsePending == r->resp_data[2]) {
+        return;
+    }
+    if (functional) {
+        r->func_awaiting = false;
+    } else {
+        r->phys_awaiting = false;
+    }
+}
+
+static void DoIPGatewayForwardResponse(UDSTpDoIPGateway_t *gw, UDSTpDoIPGatewayRoute_t *r) {
+    if (0 == r->resp_len) {
+        ssize_t len = UDSTpPeek(r->tp, &r->resp_data, NULL);
+        if (len <= 0) {
+            return;
+        }
+        r->resp_len = (size_t)len;
+        r->resp_sent = false;
+    }
+
+    if (!r->resp_sent) {
+        // a pending physical request is answered first, the ECU serves requests in order
+        bool functional = r->func_awaiting && !r->phys_awaiting;
+        uint16_t ta = functional ? r->func_tester_addr : r->tester_addr;
+        UDSSDU_t info = {
+            .A_Mtype = UDS_A_MTYPE_DIAG,
+            .A_SA = r->logical_address,
+            .A_TA = ta,
+            .A_TA_Type = UDS_A_TA_TYPE_PHYSICAL,
+        };
+        ssize_t ret =
+            ta ? UDSTpSend(&gw->doip->hdl, r->resp_data, (ssize_t)r->resp_len, &info) : -1;
+        if (-2 == ret) {
+            // the tester's connection is still sending another response
+            return;
+        }
+        DoIPGatewayAnswered(r, functional);
+        if (ret < 0) {
+            UDS_LOGW(__FILE__, "DoIP gateway: dropping response of 0x%04X", r->logical_address);
+            UDSTpRelease(r->tp);
+            r->resp_len = 0;
+            return;
+        }
+        r->resp_sent = true;
+    }
+
+    if (!UDSTpDoIPServerSending(gw->doip, r->resp_data)) {
+        UDSTpRelease(r->tp);
+        r->resp_len = 0;
+    }
+}
+
+UDSErr_t UDSTpDoIPGatewayInit(UDSTpDoIPGateway_t *gw, UDSTpDoIPServer_t *doip) {
+    if (NULL == gw || NULL == doip) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    memset(gw, 0, sizeof(*gw));
+    gw->doip = doip;
+    gw->func_slot = -1;
+    doip->is_target = DoIPGatewayIsTarget;
+    doip->is_target_arg = gw;
+    return UDS_OK;
+}
+
+UDSErr_t UDSTpDoIPGatewayAddRoute(UDSTpDoIPGateway_t *gw, uint16_t logical_address, UDSTp_t *tp,
+                                  bool functional) {
+    if (NULL == gw || NULL == tp || NULL == tp->peek || NULL == tp->release) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    if (gw->num_routes >= UDS_DOIP_GATEWAY_MAX_ROUTES) {
+        return UDS_ERR_BUFSIZ;
+    }
+    UDSTpDoIPGatewayRoute_t *r = &gw->routes[gw->num_routes++];
+    memset(r, 0, sizeof(*r));
+    r->logical_address = logical_address;
+    r->tp = tp;
+    r->functional = functional;
+    r->req_slot = -1;
+    return UDS_OK;
+}
+
+void UDSTpDoIPGatewayPoll(UDSTpDoIPGateway_t *gw) {
+    UDS_ASSERT(gw);
+    UDSTpStatus_t status[UDS_DOIP_GATEWAY_MAX_ROUTES];
+    UDSTpPoll(&gw->doip->hdl);
+    for (int i = 0; i < gw->num_routes; i++) {
+        status[i] = UDSTpPoll(gw->routes[i].tp);
+    }
+    for (int i = 0; i < gw->num_routes; i++) {
+        DoIPGatewayForwardRequest(gw, &gw->routes[i], status[i]);
+    }
+    DoIPGatewayForwardFunctional(gw, status);
+    for (int i = 0; i < gw->num_routes; i++) {
+        DoIPGatewayForwardResponse(gw, &gw->routes[i]);
+    }
+}
+
+#endif
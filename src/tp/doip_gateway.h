@@ -0,0 +1,78 @@
+#pragma once
+
+#if defined(UDS_TP_DOIP)
+
+#include "tp.h"
+#include "tp/doip.h"
+
+/** Number of ECUs a DoIP gateway routes to */
+#ifndef UDS_DOIP_GATEWAY_MAX_ROUTES
+#define UDS_DOIP_GATEWAY_MAX_ROUTES (8)
+#endif
+
+/**
+ * @brief An ECU behind the gateway and the state of the messages to and from it
+ */
+typedef struct {
+    uint16_t logical_address; // DoIP address of the ECU
+    UDSTp_t *tp;              // link to the ECU, e.g. UDSTpISOTpC_t
+    bool functional;          // forward functional requests on this link
+
+    // request: lent by the DoIP server, forwarded while it arrives
+    int req_slot; // index into the server's rx_slots, -1 if none
+    size_t req_available;
+    bool req_started;
+    bool req_done;
+    uint16_t tester_addr;  // responses to physical requests go to this tester
+    bool phys_awaiting;    // the final response to the physical request is outstanding
+
+    // functional request from UDSTpDoIPGateway_t.func_slot still to be sent on this link
+    bool func_pending;
+    uint16_t func_tester_addr; // responses to the last functional request go to this tester
+    bool func_awaiting;        // the final response to the functional request is outstanding
+
+    // response: lent by tp, forwarded to the tester
+    uint8_t *resp_data;
+    size_t resp_len; // 0 if none
+    bool resp_sent;
+} UDSTpDoIPGatewayRoute_t;
+
+/**
+ * @brief Routes diagnostic messages between DoIP testers and ECUs on other transports
+ * @details Requests are forwarded by target address to the links of the ECUs and their responses
+ * back to the testers. Messages are sent from the buffers they were received into, a request
+ * goes out on the ECU link while its end still arrives over TCP. Every ECU has its own request and
+ * response in flight, a slow ECU only holds up messages to itself as long as the server has
+ * UDS_DOIP_RX_SLOTS for the others.
+ * @note a request that stalls on TCP for longer than the N_Cr timeout of the ECU is lost
+ */
+typedef struct {
+    UDSTpDoIPServer_t *doip;
+    UDSTpDoIPGatewayRoute_t routes[UDS_DOIP_GATEWAY_MAX_ROUTES];
+    int num_routes;
+    int func_slot; // functional request being forwarded, -1 if none
+} UDSTpDoIPGateway_t;
+
+/**
+ * @brief Attach a gateway to an initialized DoIP server
+ * @details The server accepts messages to the routes' addresses afterwards and reports itself as
+ * DoIP gateway.
+ */
+UDSErr_t UDSTpDoIPGatewayInit(UDSTpDoIPGateway_t *gw, UDSTpDoIPServer_t *doip);
+
+/**
+ * @brief Route a logical address to the link of an ECU
+ * @param functional forward functional requests on tp. Set it once per bus, the ECUs on a bus
+ * share the functional address.
+ * @note tp needs peek() and release(). Transports with send_partial() start forwarding a request
+ * before it is complete.
+ */
+UDSErr_t UDSTpDoIPGatewayAddRoute(UDSTpDoIPGateway_t *gw, uint16_t logical_address, UDSTp_t *tp,
+                                  bool functional);
+
+/**
+ * @brief Poll the DoIP server and the ECU links and forward what arrived
+ */
+void UDSTpDoIPGatewayPoll(UDSTpDoIPGateway_t *gw);
+
+#endif
@@ -29,129 +29,164 @@ static uint32_t isotp_st_min_to_us(uint8_t st_min) {
     return 0;
 }
 
-static int isotp_send_flow_control(const IsoTpLink* link, uint8_t flow_status, uint8_t block_size, uint32_t st_min_us) {
+/* round a frame length up to the next valid CAN-FD data length */
+static uint8_t isotp_can_dl_round_up(uint8_t size) {
+    static const uint8_t can_fd_dls[] = {12, 16, 20, 24, 32, 48, 64};
+    uint8_t i;
 
-    IsoTpCanMessage message;
-    int ret;
-    uint8_t size = 0;
+    if (size <= ISOTP_CAN_DL) {
+        return size;
+    }
+    for (i = 0; i < sizeof(can_fd_dls); i++) {
+        if (size <= can_fd_dls[i]) {
+            return can_fd_dls[i];
+        }
+    }
+    return ISOTP_CAN_FD_MAX_DL;
+}
 
-    /* setup message  */
-    message.as.flow_control.type = ISOTP_PCI_TYPE_FLOW_CONTROL_FRAME;
-    message.as.flow_control.FS = flow_status;
-    message.as.flow_control.BS = block_size;
-    message.as.flow_control.STmin = isotp_us_to_st_min(st_min_us);
+/* largest SF_DL for a given frame length, 7 for classic CAN */
+static uint16_t isotp_sf_max_size(uint8_t dl) {
+    return dl <= ISOTP_CAN_DL ? (uint16_t)(dl - 1) : (uint16_t)(dl - 2);
+}
+
+/* frame bytes available to the PCI and payload: TX_DL less the address byte */
+static uint8_t isotp_send_pdu_dl(const IsoTpLink* link) {
+    return (uint8_t) (link->send_dl - link->addr_ext_len);
+}
+
+/* largest SF_DL in a frame of dl bytes, the address byte taken into account */
+static uint16_t isotp_link_sf_max_size(const IsoTpLink* link, uint8_t dl) {
+    return isotp_sf_max_size((uint8_t) (dl - link->addr_ext_len));
+}
+
+/* prepend the address byte, pad the frame to a valid length and hand it to the user shim.
+ * frame holds ISOTP_CAN_FD_MAX_DL bytes. */
+static int isotp_send_frame(const IsoTpLink* link, uint32_t id, uint8_t* frame, uint8_t size) {
+    uint8_t padded_size;
+
+    if (link->addr_ext_len) {
+        (void) memmove(frame + 1, frame, size);
+        frame[0] = link->send_addr_ext;
+        size++;
+    }
+    padded_size = size;
 
-    /* send message */
 #ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.flow_control.reserve, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.flow_control.reserve));
-    size = sizeof(message);
-#else
-    size = 3;
+    if (padded_size < ISOTP_CAN_DL) {
+        padded_size = ISOTP_CAN_DL;
+    }
 #endif
+    padded_size = isotp_can_dl_round_up(padded_size);
+    (void) memset(frame + size, ISO_TP_FRAME_PADDING_VALUE, padded_size - size);
 
-    ret = isotp_user_send_can(link->send_arbitration_id, message.as.data_array.ptr, size
+    return isotp_user_send_can(id, frame, padded_size
     #if defined (ISO_TP_USER_SEND_CAN_ARG)
     ,link->user_send_can_arg
     #endif
     );
+}
 
-    return ret;
+static int isotp_send_flow_control(const IsoTpLink* link, uint8_t flow_status, uint8_t block_size, uint32_t st_min_us) {
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+
+    /* setup message  */
+    frame[0] = (uint8_t) ((ISOTP_PCI_TYPE_FLOW_CONTROL_FRAME << 4) | (flow_status & 0x0F));
+    frame[1] = block_size;
+    frame[2] = isotp_us_to_st_min(st_min_us);
+
+    /* send message */
+    return isotp_send_frame(link, link->send_arbitration_id, frame, 3);
 }
 
 static int isotp_send_single_frame(const IsoTpLink* link, uint32_t id) {
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+    uint8_t pci_size;
 
-    IsoTpCanMessage message;
-    int ret;
-    uint8_t size = 0;
-    (void)id;
-
-    /* multi frame message length must greater than 7  */
-    assert(link->send_size <= 7);
+    /* multi frame message length must greater than the single frame capacity */
+    assert(link->send_size <= isotp_single_frame_max_size(link));
 
     /* setup message  */
-    message.as.single_frame.type = ISOTP_PCI_TYPE_SINGLE;
-    message.as.single_frame.SF_DL = (uint8_t) link->send_size;
-    (void) memcpy(message.as.single_frame.data, link->send_buffer, link->send_size);
+    if (link->send_size <= isotp_link_sf_max_size(link, ISOTP_CAN_DL)) {
+        frame[0] = (uint8_t) ((ISOTP_PCI_TYPE_SINGLE << 4) | link->send_size);
+        pci_size = 1;
+    } else {
+        /* CAN-FD escape sequence: SF_DL moves to the second byte */
+        frame[0] = (uint8_t) (ISOTP_PCI_TYPE_SINGLE << 4);
+        frame[1] = (uint8_t) link->send_size;
+        pci_size = 2;
+    }
+    (void) memcpy(frame + pci_size, link->send_data, link->send_size);
 
     /* send message */
-#ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.single_frame.data + link->send_size, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.single_frame.data) - link->send_size);
-    size = sizeof(message);
-#else
-    size = link->send_size + 1;
-#endif
-
-    ret = isotp_user_send_can(link->send_arbitration_id, message.as.data_array.ptr, size
-    #if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-    #endif
-    );
-
-    return ret;
+    return isotp_send_frame(link, id, frame, (uint8_t) (pci_size + link->send_size));
 }
 
 static int isotp_send_first_frame(IsoTpLink* link, uint32_t id) {
-    
-    IsoTpCanMessage message;
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+    uint8_t pci_size;
+    uint8_t data_length;
     int ret;
 
-    /* multi frame message length must greater than 7  */
-    assert(link->send_size > 7);
+    /* multi frame message length must greater than the single frame capacity */
+    assert(link->send_size > isotp_single_frame_max_size(link));
 
     /* setup message  */
-    message.as.first_frame.type = ISOTP_PCI_TYPE_FIRST_FRAME;
-    message.as.first_frame.FF_DL_low = (uint8_t) link->send_size;
-    message.as.first_frame.FF_DL_high = (uint8_t) (0x0F & (link->send_size >> 8));
-    (void) memcpy(message.as.first_frame.data, link->send_buffer, sizeof(message.as.first_frame.data));
+    if (link->send_size <= ISOTP_FF_DL_12BIT_MAX) {
+        frame[0] = (uint8_t) ((ISOTP_PCI_TYPE_FIRST_FRAME << 4) | (0x0F & (link->send_size >> 8)));
+        frame[1] = (uint8_t) link->send_size;
+        pci_size = 2;
+    } else {
+        /* escape sequence: FF_DL is sent as a 32-bit value after a zero 12-bit FF_DL */
+        frame[0] = (uint8_t) (ISOTP_PCI_TYPE_FIRST_FRAME << 4);
+        frame[1] = 0;
+        frame[2] = (uint8_t) ((uint32_t) link->send_size >> 24);
+        frame[3] = (uint8_t) ((uint32_t) link->send_size >> 16);
+        frame[4] = (uint8_t) (link->send_size >> 8);
+        frame[5] = (uint8_t) link->send_size;
+        pci_size = 6;
+    }
+    data_length = (uint8_t) (isotp_send_pdu_dl(link) - pci_size);
+    (void) memcpy(frame + pci_size, link->send_data, data_length);
 
     /* send message */
-    ret = isotp_user_send_can(id, message.as.data_array.ptr, sizeof(message) 
-    #if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-    #endif
-
-    );
+    ret = isotp_send_frame(link, id, frame, isotp_send_pdu_dl(link));
     if (ISOTP_RET_OK == ret) {
-        link->send_offset += sizeof(message.as.first_frame.data);
+        link->send_offset += data_length;
         link->send_sn = 1;
     }
 
     return ret;
 }
 
+/* payload offset after the next consecutive frame */
+static uint32_t isotp_consecutive_frame_end(const IsoTpLink* link) {
+    uint32_t data_length = link->send_size - link->send_offset;
+    if (data_length > (uint32_t) (isotp_send_pdu_dl(link) - 1)) {
+        data_length = (uint32_t) (isotp_send_pdu_dl(link) - 1);
+    }
+    return link->send_offset + data_length;
+}
+
 static int isotp_send_consecutive_frame(IsoTpLink* link) {
-    
-    IsoTpCanMessage message;
-    uint16_t data_length;
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
+    uint8_t data_length;
     int ret;
-    uint8_t size = 0;
 
-    /* multi frame message length must greater than 7  */
-    assert(link->send_size > 7);
+    /* multi frame message length must greater than the single frame capacity */
+    assert(link->send_size > isotp_single_frame_max_size(link));
 
     /* setup message  */
-    message.as.consecutive_frame.type = TSOTP_PCI_TYPE_CONSECUTIVE_FRAME;
-    message.as.consecutive_frame.SN = link->send_sn;
-    data_length = link->send_size - link->send_offset;
-    if (data_length > sizeof(message.as.consecutive_frame.data)) {
-        data_length = sizeof(message.as.consecutive_frame.data);
+    frame[0] = (uint8_t) ((TSOTP_PCI_TYPE_CONSECUTIVE_FRAME << 4) | (link->send_sn & 0x0F));
+    if (isotp_consecutive_frame_end(link) > link->send_available) {
+        /* the data of this frame hasn't arrived yet, see isotp_send_partial */
+        return ISOTP_RET_NO_DATA;
     }
-    (void) memcpy(message.as.consecutive_frame.data, link->send_buffer + link->send_offset, data_length);
+    data_length = (uint8_t) (isotp_consecutive_frame_end(link) - link->send_offset);
+    (void) memcpy(frame + 1, link->send_data + link->send_offset, data_length);
 
     /* send message */
-#ifdef ISO_TP_FRAME_PADDING
-    (void) memset(message.as.consecutive_frame.data + data_length, ISO_TP_FRAME_PADDING_VALUE, sizeof(message.as.consecutive_frame.data) - data_length);
-    size = sizeof(message);
-#else
-    size = data_length + 1;
-#endif
-
-    ret = isotp_user_send_can(link->send_arbitration_id,
-            message.as.data_array.ptr, size
-#if defined (ISO_TP_USER_SEND_CAN_ARG)
-    ,link->user_send_can_arg
-#endif
-    );
+    ret = isotp_send_frame(link, link->send_arbitration_id, frame, (uint8_t) (data_length + 1));
 
     if (ISOTP_RET_OK == ret) {
         link->send_offset += data_length;
@@ -163,72 +198,137 @@ static int isotp_send_consecutive_frame(IsoTpLink* link) {
     return ret;
 }
 
-static int isotp_receive_single_frame(IsoTpLink* link, const IsoTpCanMessage* message, uint8_t len) {
+/* give a pool block back to the pool and receive into the link's own buffer again */
+static void isotp_receive_buffer_reset(IsoTpLink *link) {
+    if (link->receive_buffer == link->receive_own_buffer) {
+        return;
+    }
+
+    isotp_pool_put(link->receive_pool, link->receive_buffer);
+    link->receive_buffer = link->receive_own_buffer;
+    link->receive_buf_size = link->receive_own_buf_size;
+}
+
+/* select the receive buffer for a message of size bytes: single frames go to the link's own
+ * buffer, multi-frame messages to a block of the pool if the link has one */
+static int isotp_receive_buffer_acquire(IsoTpLink *link, uint32_t size, uint8_t multi_frame) {
+    IsoTpBufferPool *pool = link->receive_pool;
+    uint8_t i;
+
+    isotp_receive_buffer_reset(link);
+
+    if (NULL == pool || !multi_frame) {
+        return size <= link->receive_buf_size ? ISOTP_RET_OK : ISOTP_RET_OVERFLOW;
+    }
+
+    if (size > pool->block_size) {
+        return ISOTP_RET_OVERFLOW;
+    }
+
+    for (i = 0; i < pool->num_blocks; i++) {
+        if (0 == (pool->in_use & ((uint32_t) 1 << i))) {
+            pool->in_use |= (uint32_t) 1 << i;
+            link->receive_buffer = pool->blocks + (uint32_t) i * pool->block_size;
+            link->receive_buf_size = pool->block_size;
+            return ISOTP_RET_OK;
+        }
+    }
+
+    isotp_user_debug("Receive buffer pool exhausted.");
+    return ISOTP_RET_OVERFLOW;
+}
+
+static int isotp_receive_single_frame(IsoTpLink* link, const uint8_t* data, uint8_t len) {
+    uint16_t sf_dl = data[0] & 0x0F;
+    uint8_t pci_size = 1;
+
+    /* CAN-FD escape sequence: a zero SF_DL nibble is followed by an 8-bit SF_DL */
+    if (0 == sf_dl && len + link->addr_ext_len > ISOTP_CAN_DL) {
+        sf_dl = data[1];
+        pci_size = 2;
+    }
+
     /* check data length */
-    if ((0 == message->as.single_frame.SF_DL) || (message->as.single_frame.SF_DL > (len - 1))) {
+    if ((0 == sf_dl) || (sf_dl > (len - pci_size))) {
         isotp_user_debug("Single-frame length too small.");
         return ISOTP_RET_LENGTH;
     }
 
+    if (ISOTP_RET_OK != isotp_receive_buffer_acquire(link, sf_dl, 0)) {
+        isotp_user_debug("Single-frame too large for receiving buffer.");
+        return ISOTP_RET_OVERFLOW;
+    }
+
     /* copying data */
-    (void) memcpy(link->receive_buffer, message->as.single_frame.data, message->as.single_frame.SF_DL);
-    link->receive_size = message->as.single_frame.SF_DL;
+    (void) memcpy(link->receive_buffer, data + pci_size, sf_dl);
+    link->receive_size = sf_dl;
     
     return ISOTP_RET_OK;
 }
 
-static int isotp_receive_first_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
-    uint16_t payload_length;
+static int isotp_receive_first_frame(IsoTpLink *link, const uint8_t* data, uint8_t len) {
+    uint32_t payload_length;
+    uint8_t pci_size = 2;
+    const uint8_t can_dl = (uint8_t) (len + link->addr_ext_len);
 
-    if (8 != len) {
-        isotp_user_debug("First frame should be 8 bytes in length.");
+    /* a first frame always uses the full RX_DL */
+    if (can_dl < ISOTP_CAN_DL || can_dl != isotp_can_dl_round_up(can_dl)) {
+        isotp_user_debug("First frame should be at least 8 bytes in length.");
         return ISOTP_RET_LENGTH;
     }
 
     /* check data length */
-    payload_length = message->as.first_frame.FF_DL_high;
-    payload_length = (uint16_t)(payload_length << 8) + message->as.first_frame.FF_DL_low;
+    payload_length = data[0] & 0x0F;
+    payload_length = (payload_length << 8) + data[1];
+
+    /* escape sequence: 32-bit FF_DL */
+    if (0 == payload_length) {
+        payload_length = ((uint32_t) data[2] << 24) | ((uint32_t) data[3] << 16) |
+                         ((uint32_t) data[4] << 8) | (uint32_t) data[5];
+        pci_size = 6;
+    }
 
     /* should not use multiple frame transmition */
-    if (payload_length <= 7) {
+    if (payload_length <= isotp_link_sf_max_size(link, can_dl)) {
         isotp_user_debug("Should not use multiple frame transmission.");
         return ISOTP_RET_LENGTH;
     }
     
-    if (payload_length > link->receive_buf_size) {
+    if (ISOTP_RET_OK != isotp_receive_buffer_acquire(link, payload_length, 1)) {
         isotp_user_debug("Multi-frame response too large for receiving buffer.");
         return ISOTP_RET_OVERFLOW;
     }
     
     /* copying data */
-    (void) memcpy(link->receive_buffer, message->as.first_frame.data, sizeof(message->as.first_frame.data));
+    (void) memcpy(link->receive_buffer, data + pci_size, len - pci_size);
     link->receive_size = payload_length;
-    link->receive_offset = sizeof(message->as.first_frame.data);
+    link->receive_offset = (uint32_t) (len - pci_size);
+    link->receive_dl = len;
     link->receive_sn = 1;
 
     return ISOTP_RET_OK;
 }
 
-static int isotp_receive_consecutive_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
-    uint16_t remaining_bytes;
+static int isotp_receive_consecutive_frame(IsoTpLink *link, const uint8_t* data, uint8_t len) {
+    uint32_t remaining_bytes;
     
     /* check sn */
-    if (link->receive_sn != message->as.consecutive_frame.SN) {
+    if (link->receive_sn != (data[0] & 0x0F)) {
         return ISOTP_RET_WRONG_SN;
     }
 
     /* check data length */
     remaining_bytes = link->receive_size - link->receive_offset;
-    if (remaining_bytes > sizeof(message->as.consecutive_frame.data)) {
-        remaining_bytes = sizeof(message->as.consecutive_frame.data);
+    if (remaining_bytes > (uint32_t) (link->receive_dl - 1)) {
+        remaining_bytes = (uint32_t) (link->receive_dl - 1);
     }
-    if (remaining_bytes > len - 1) {
+    if (remaining_bytes + 1 > len) {
         isotp_user_debug("Consecutive frame too short.");
         return ISOTP_RET_LENGTH;
     }
 
     /* copying data */
-    (void) memcpy(link->receive_buffer + link->receive_offset, message->as.consecutive_frame.data, remaining_bytes);
+    (void) memcpy(link->receive_buffer + link->receive_offset, data + 1, remaining_bytes);
 
     link->receive_offset += remaining_bytes;
     if (++(link->receive_sn) > 0x0F) {
@@ -238,10 +338,10 @@ static int isotp_receive_consecutive_frame(IsoTpLink *link, IsoTpCanMessage *mes
     return ISOTP_RET_OK;
 }
 
-static int isotp_receive_flow_control_frame(IsoTpLink *link, IsoTpCanMessage *message, uint8_t len) {
+static int isotp_receive_flow_control_frame(IsoTpLink *link, const uint8_t* data, uint8_t len) {
     /* unused args */
     (void) link;
-    (void) message;
+    (void) data;
 
     /* check message length */
     if (len < 3) {
@@ -256,11 +356,20 @@ static int isotp_receive_flow_control_frame(IsoTpLink *link, IsoTpCanMessage *me
 ///                 PUBLIC FUNCTIONS                ///
 ///////////////////////////////////////////////////////
 
-int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size) {
+int isotp_send(IsoTpLink *link, const uint8_t payload[], uint32_t size) {
     return isotp_send_with_id(link, link->send_arbitration_id, payload, size);
 }
 
-int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint16_t size) {
+/* bytes of the payload needed to send the single or first frame */
+static uint32_t isotp_first_frame_need(const IsoTpLink *link, uint32_t size) {
+    if (size <= isotp_single_frame_max_size(link)) {
+        return size;
+    }
+    return (uint32_t) (isotp_send_pdu_dl(link) - (size <= ISOTP_FF_DL_12BIT_MAX ? 2 : 6));
+}
+
+static int isotp_send_start(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size,
+                            uint32_t available) {
     int ret;
 
     if (link == 0x0) {
@@ -272,7 +381,7 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
         isotp_user_debug("Message size too large. Increase ISO_TP_MAX_MESSAGE_SIZE to set a larger buffer\n");
         const int32_t messageSize = 128;
         char message[messageSize];
-        int32_t writtenChars = sprintf(&message[0], "Attempted to send %d bytes; max size is %d!\n", size, link->send_buf_size);
+        int32_t writtenChars = sprintf(&message[0], "Attempted to send %lu bytes; max size is %lu!\n", (unsigned long) size, (unsigned long) link->send_buf_size);
 
         assert(writtenChars <= messageSize);
         (void) writtenChars;
@@ -286,12 +395,19 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
         return ISOTP_RET_INPROGRESS;
     }
 
-    /* copy into local buffer */
     link->send_size = size;
     link->send_offset = 0;
-    (void) memcpy(link->send_buffer, payload, size);
+    link->send_available = available;
+    if (NULL == link->send_buffer) {
+        /* no local buffer, send from the caller's buffer */
+        link->send_data = payload;
+    } else {
+        /* copy into local buffer */
+        (void) memcpy(link->send_buffer, payload, size);
+        link->send_data = link->send_buffer;
+    }
  
-    if (link->send_size < 8) {
+    if (link->send_size <= isotp_single_frame_max_size(link)) {
         /* send single frame */
         ret = isotp_send_single_frame(link, id);
     } else {
@@ -304,7 +420,7 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
             link->send_st_min_us = 0;
             link->send_wtf_count = 0;
             link->send_timer_st = isotp_user_get_us();
-            link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+            link->send_timer_bs = isotp_user_get_us() + link->param_n_bs_us;
             link->send_protocol_result = ISOTP_PROTOCOL_RESULT_OK;
             link->send_status = ISOTP_SEND_STATUS_INPROGRESS;
         }
@@ -313,19 +429,83 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
     return ret;
 }
 
+int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size) {
+    return isotp_send_start(link, id, payload, size, size);
+}
+
+int isotp_send_partial(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size,
+                       uint32_t available) {
+    if (link == 0x0 || available > size) {
+        return ISOTP_RET_ERROR;
+    }
+
+    /* the rest of the payload is read from the caller's buffer as it arrives */
+    if (NULL != link->send_buffer) {
+        isotp_user_debug("Partial sends need a link without a send buffer\n");
+        return ISOTP_RET_ERROR;
+    }
+
+    if (available < isotp_first_frame_need(link, size)) {
+        return ISOTP_RET_NO_DATA;
+    }
+
+    return isotp_send_start(link, id, payload, size, available);
+}
+
+int isotp_send_extend(IsoTpLink *link, uint32_t available) {
+    if (ISOTP_SEND_STATUS_INPROGRESS != link->send_status || available > link->send_size ||
+        available < link->send_available) {
+        return ISOTP_RET_ERROR;
+    }
+
+    link->send_available = available;
+
+    return ISOTP_RET_OK;
+}
+
+void isotp_send_abort(IsoTpLink *link) {
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        link->send_status = ISOTP_SEND_STATUS_IDLE;
+    }
+}
+
+/* a complete message waits in the link until it is read or released */
+static int isotp_receive_held(const IsoTpLink *link) {
+    return ISOTP_RECEIVE_STATUS_FULL == link->receive_status ||
+           ISOTP_RECEIVE_STATUS_LENT == link->receive_status;
+}
+
 void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
-    IsoTpCanMessage message;
+    uint8_t frame[ISOTP_CAN_FD_MAX_DL];
     int ret;
     
-    if (len < 2 || len > 8) {
+    if (len > ISOTP_CAN_FD_MAX_DL) {
+        return;
+    }
+
+    /* extended and mixed addressing: the frame is for this link if the address byte matches */
+    if (link->addr_ext_len) {
+        if (len < 1 || data[0] != link->receive_addr_ext) {
+            return;
+        }
+        data++;
+        len--;
+    }
+
+    if (len < 2) {
         return;
     }
 
-    memcpy(message.as.data_array.ptr, data, len);
-    memset(message.as.data_array.ptr + len, 0, sizeof(message.as.data_array.ptr) - len);
+    memcpy(frame, data, len);
+    memset(frame + len, 0, sizeof(frame) - len);
 
-    switch (message.as.common.type) {
+    switch (frame[0] >> 4) {
         case ISOTP_PCI_TYPE_SINGLE: {
+            /* the received message wasn't read yet, it is not overwritten */
+            if (isotp_receive_held(link)) {
+                break;
+            }
+
             /* update protocol result */
             if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
@@ -334,7 +514,14 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_single_frame(link, &message, len);
+            ret = isotp_receive_single_frame(link, frame, len);
+
+            /* if overflow happened */
+            if (ISOTP_RET_OVERFLOW == ret) {
+                link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
+                link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                break;
+            }
             
             if (ISOTP_RET_OK == ret) {
                 /* change status */
@@ -343,6 +530,12 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             break;
         }
         case ISOTP_PCI_TYPE_FIRST_FRAME: {
+            /* the received message wasn't read yet, the sender is told it doesn't fit */
+            if (isotp_receive_held(link)) {
+                isotp_send_flow_control(link, PCI_FLOW_STATUS_OVERFLOW, 0, 0);
+                break;
+            }
+
             /* update protocol result */
             if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_UNEXP_PDU;
@@ -351,7 +544,7 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_first_frame(link, &message, len);
+            ret = isotp_receive_first_frame(link, frame, len);
 
             /* if overflow happened */
             if (ISOTP_RET_OVERFLOW == ret) {
@@ -369,10 +562,10 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
                 /* change status */
                 link->receive_status = ISOTP_RECEIVE_STATUS_INPROGRESS;
                 /* send fc frame */
-                link->receive_bs_count = ISO_TP_DEFAULT_BLOCK_SIZE;
-                isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
+                link->receive_bs_count = link->param_block_size;
+                isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, link->param_st_min_us);
                 /* refresh timer cs */
-                link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                link->receive_timer_cr = isotp_user_get_us() + link->param_n_cr_us;
             }
             
             break;
@@ -385,28 +578,29 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_consecutive_frame(link, &message, len);
+            ret = isotp_receive_consecutive_frame(link, frame, len);
 
             /* if wrong sn */
             if (ISOTP_RET_WRONG_SN == ret) {
                 link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_WRONG_SN;
                 link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+                isotp_receive_buffer_reset(link);
                 break;
             }
 
             /* if success */
             if (ISOTP_RET_OK == ret) {
                 /* refresh timer cs */
-                link->receive_timer_cr = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                link->receive_timer_cr = isotp_user_get_us() + link->param_n_cr_us;
                 
                 /* receive finished */
                 if (link->receive_offset >= link->receive_size) {
                     link->receive_status = ISOTP_RECEIVE_STATUS_FULL;
                 } else {
-                    /* send fc when bs reaches limit */
-                    if (0 == --link->receive_bs_count) {
-                        link->receive_bs_count = ISO_TP_DEFAULT_BLOCK_SIZE;
-                        isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, ISO_TP_DEFAULT_ST_MIN_US);
+                    /* send fc when bs reaches limit, a block size of 0 means no limit */
+                    if (0 != link->receive_bs_count && 0 == --link->receive_bs_count) {
+                        link->receive_bs_count = link->param_block_size;
+                        isotp_send_flow_control(link, PCI_FLOW_STATUS_CONTINUE, link->receive_bs_count, link->param_st_min_us);
                     }
                 }
             }
@@ -420,37 +614,37 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
             }
 
             /* handle message */
-            ret = isotp_receive_flow_control_frame(link, &message, len);
+            ret = isotp_receive_flow_control_frame(link, frame, len);
             
             if (ISOTP_RET_OK == ret) {
                 /* refresh bs timer */
-                link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+                link->send_timer_bs = isotp_user_get_us() + link->param_n_bs_us;
 
                 /* overflow */
-                if (PCI_FLOW_STATUS_OVERFLOW == message.as.flow_control.FS) {
+                if (PCI_FLOW_STATUS_OVERFLOW == (frame[0] & 0x0F)) {
                     link->send_protocol_result = ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW;
                     link->send_status = ISOTP_SEND_STATUS_ERROR;
                 }
 
                 /* wait */
-                else if (PCI_FLOW_STATUS_WAIT == message.as.flow_control.FS) {
+                else if (PCI_FLOW_STATUS_WAIT == (frame[0] & 0x0F)) {
                     link->send_wtf_count += 1;
                     /* wait exceed allowed count */
-                    if (link->send_wtf_count > ISO_TP_MAX_WFT_NUMBER) {
+                    if (link->send_wtf_count > link->param_wft_max) {
                         link->send_protocol_result = ISOTP_PROTOCOL_RESULT_WFT_OVRN;
                         link->send_status = ISOTP_SEND_STATUS_ERROR;
                     }
                 }
 
                 /* permit send */
-                else if (PCI_FLOW_STATUS_CONTINUE == message.as.flow_control.FS) {
-                    if (0 == message.as.flow_control.BS) {
+                else if (PCI_FLOW_STATUS_CONTINUE == (frame[0] & 0x0F)) {
+                    if (0 == frame[1]) {
                         link->send_bs_remain = ISOTP_INVALID_BS;
                     } else {
-                        link->send_bs_remain = message.as.flow_control.BS;
+                        link->send_bs_remain = frame[1];
                     }
-                    uint32_t message_st_min_us = isotp_st_min_to_us(message.as.flow_control.STmin);
-                    link->send_st_min_us = message_st_min_us > ISO_TP_DEFAULT_ST_MIN_US ? message_st_min_us : ISO_TP_DEFAULT_ST_MIN_US; // prefer as much st_min as possible for stability?
+                    uint32_t message_st_min_us = isotp_st_min_to_us(frame[2]);
+                    link->send_st_min_us = message_st_min_us > link->param_st_min_us ? message_st_min_us : link->param_st_min_us; // prefer as much st_min as possible for stability?
                     link->send_wtf_count = 0;
                 }
             }
@@ -462,8 +656,8 @@ void isotp_on_can_message(IsoTpLink* link, const uint8_t* data, uint8_t len) {
     return;
 }
 
-int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size, uint16_t *out_size) {
-    uint16_t copylen;
+int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint32_t payload_size, uint32_t *out_size) {
+    uint32_t copylen;
     
     if (ISOTP_RECEIVE_STATUS_FULL != link->receive_status) {
         return ISOTP_RET_NO_DATA;
@@ -477,57 +671,228 @@ int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size
     memcpy(payload, link->receive_buffer, copylen);
     *out_size = copylen;
 
+    link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+    isotp_receive_buffer_reset(link);
+
+    return ISOTP_RET_OK;
+}
+
+int isotp_receive_peek(IsoTpLink *link, const uint8_t **payload, uint32_t *out_size) {
+    if (ISOTP_RECEIVE_STATUS_FULL != link->receive_status && ISOTP_RECEIVE_STATUS_LENT != link->receive_status) {
+        return ISOTP_RET_NO_DATA;
+    }
+
+    *payload = link->receive_buffer;
+    *out_size = link->receive_size;
+
+    link->receive_status = ISOTP_RECEIVE_STATUS_LENT;
+
+    return ISOTP_RET_OK;
+}
+
+void isotp_receive_release(IsoTpLink *link) {
+    if (ISOTP_RECEIVE_STATUS_LENT == link->receive_status) {
+        link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+        isotp_receive_buffer_reset(link);
+    }
+}
+
+int isotp_receive_take(IsoTpLink *link, uint8_t **payload, uint32_t *out_size) {
+    if (ISOTP_RECEIVE_STATUS_FULL != link->receive_status || link->receive_buffer == link->receive_own_buffer) {
+        return ISOTP_RET_NO_DATA;
+    }
+
+    *payload = link->receive_buffer;
+    *out_size = link->receive_size;
+
+    /* the block stays in use until isotp_pool_put */
+    link->receive_buffer = link->receive_own_buffer;
+    link->receive_buf_size = link->receive_own_buf_size;
     link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
 
     return ISOTP_RET_OK;
 }
 
-void isotp_init_link(IsoTpLink *link, uint32_t sendid, uint8_t *sendbuf, uint16_t sendbufsize, uint8_t *recvbuf, uint16_t recvbufsize) {
+void isotp_pool_put(IsoTpBufferPool *pool, const uint8_t *block) {
+    uint16_t index = (uint16_t) ((block - pool->blocks) / pool->block_size);
+    pool->in_use &= ~((uint32_t) 1 << index);
+}
+
+void isotp_init_link(IsoTpLink *link, uint32_t sendid, uint8_t *sendbuf, uint32_t sendbufsize, uint8_t *recvbuf, uint32_t recvbufsize) {
     memset(link, 0, sizeof(*link));
     link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
     link->send_status = ISOTP_SEND_STATUS_IDLE;
     link->send_arbitration_id = sendid;
+    link->send_dl = ISOTP_CAN_DL;
+    link->send_max_cf_per_poll = ISO_TP_DEFAULT_MAX_CF_PER_POLL;
+    link->param_block_size = ISO_TP_DEFAULT_BLOCK_SIZE;
+    link->param_st_min_us = ISO_TP_DEFAULT_ST_MIN_US;
+    link->param_n_bs_us = ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+    link->param_n_cr_us = ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
+    link->param_wft_max = ISO_TP_MAX_WFT_NUMBER;
+    link->receive_dl = ISOTP_CAN_DL;
     link->send_buffer = sendbuf;
     link->send_buf_size = sendbufsize;
     link->receive_buffer = recvbuf;
     link->receive_buf_size = recvbufsize;
+    link->receive_own_buffer = recvbuf;
+    link->receive_own_buf_size = recvbufsize;
     
     return;
 }
 
+int isotp_set_tx_dl(IsoTpLink *link, uint8_t tx_dl) {
+    if (tx_dl < ISOTP_CAN_DL || tx_dl != isotp_can_dl_round_up(tx_dl)) {
+        isotp_user_debug("Invalid TX_DL %d.\n", tx_dl);
+        return ISOTP_RET_ERROR;
+    }
+
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    link->send_dl = tx_dl;
+
+    return ISOTP_RET_OK;
+}
+
+uint16_t isotp_single_frame_max_size(const IsoTpLink *link) {
+    return isotp_link_sf_max_size(link, link->send_dl);
+}
+
+int isotp_set_address_extension(IsoTpLink *link, uint8_t enable, uint8_t send_addr_ext,
+                                 uint8_t receive_addr_ext) {
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status || ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    link->addr_ext_len = enable ? 1 : 0;
+    link->send_addr_ext = send_addr_ext;
+    link->receive_addr_ext = receive_addr_ext;
+
+    return ISOTP_RET_OK;
+}
+
+int isotp_set_fc_params(IsoTpLink *link, uint8_t block_size, uint32_t st_min_us, uint32_t n_bs_us, uint32_t n_cr_us, uint8_t wft_max) {
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status || ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    link->param_block_size = block_size;
+    link->param_st_min_us = st_min_us;
+    link->param_n_bs_us = n_bs_us ? n_bs_us : ISO_TP_STANDARD_TIMEOUT_US;
+    link->param_n_cr_us = n_cr_us ? n_cr_us : ISO_TP_STANDARD_TIMEOUT_US;
+    link->param_wft_max = wft_max;
+
+    return ISOTP_RET_OK;
+}
+
+void isotp_pool_init(IsoTpBufferPool *pool, uint8_t *blocks, uint32_t block_size, uint8_t num_blocks) {
+    assert(num_blocks <= ISOTP_POOL_MAX_BLOCKS);
+    pool->blocks = blocks;
+    pool->block_size = block_size;
+    pool->num_blocks = num_blocks;
+    pool->in_use = 0;
+}
+
+int isotp_set_receive_pool(IsoTpLink *link, IsoTpBufferPool *pool) {
+    if (ISOTP_RECEIVE_STATUS_IDLE != link->receive_status) {
+        return ISOTP_RET_INPROGRESS;
+    }
+
+    isotp_receive_buffer_reset(link);
+    link->receive_pool = pool;
+
+    return ISOTP_RET_OK;
+}
+
+int isotp_next_deadline(const IsoTpLink *link, uint32_t *deadline_us) {
+    int pending = 0;
+    uint32_t deadline = 0;
+
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
+        if (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) {
+            /* the next consecutive frame, unless its data has yet to arrive */
+            if (isotp_consecutive_frame_end(link) <= link->send_available) {
+                deadline = 0 == link->send_st_min_us ? isotp_user_get_us() : link->send_timer_st;
+                pending = 1;
+            }
+        } else {
+            /* waiting for a flow control frame, timeouts expire once the time is past the timer */
+            deadline = link->send_timer_bs + 1;
+            pending = 1;
+        }
+    }
+
+    if (ISOTP_RECEIVE_STATUS_INPROGRESS == link->receive_status) {
+        if (!pending || IsoTpTimeAfter(deadline, link->receive_timer_cr + 1)) {
+            deadline = link->receive_timer_cr + 1;
+        }
+        pending = 1;
+    }
+
+    if (pending) {
+        *deadline_us = deadline;
+    }
+    return pending;
+}
+
+int isotp_set_max_cf_per_poll(IsoTpLink *link, uint16_t max_cf_per_poll) {
+    if (0 == max_cf_per_poll) {
+        return ISOTP_RET_ERROR;
+    }
+
+    link->send_max_cf_per_poll = max_cf_per_poll;
+
+    return ISOTP_RET_OK;
+}
+
 void isotp_poll(IsoTpLink *link) {
+    uint16_t cf_count;
+    uint32_t now;
     int ret;
 
     /* only polling when operation in progress */
     if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status) {
-
-        /* continue send data */
-        if (/* send data if bs_remain is invalid or bs_remain large than zero */
-        (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) &&
-        /* and if st_min is zero or go beyond interval time */
-        (0 == link->send_st_min_us || IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_st))) {
+        now = isotp_user_get_us();
+
+        /* continue send data, up to max_cf_per_poll frames in one call */
+        for (cf_count = 0; cf_count < link->send_max_cf_per_poll; cf_count++) {
+            if (!(/* send data if bs_remain is invalid or bs_remain large than zero */
+            (ISOTP_INVALID_BS == link->send_bs_remain || link->send_bs_remain > 0) &&
+            /* and if st_min is zero or go beyond interval time */
+            (0 == link->send_st_min_us || IsoTpTimeAfter(now, link->send_timer_st)))) {
+                break;
+            }
             
             ret = isotp_send_consecutive_frame(link);
             if (ISOTP_RET_OK == ret) {
                 if (ISOTP_INVALID_BS != link->send_bs_remain) {
                     link->send_bs_remain -= 1;
                 }
-                link->send_timer_bs = isotp_user_get_us() + ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US;
-                link->send_timer_st = isotp_user_get_us() + link->send_st_min_us;
+                link->send_timer_bs = now + link->param_n_bs_us;
+                link->send_timer_st = now + link->send_st_min_us;
 
                 /* check if send finish */
                 if (link->send_offset >= link->send_size) {
                     link->send_status = ISOTP_SEND_STATUS_IDLE;
+                    break;
                 }
             } else if (ISOTP_RET_NOSPACE == ret) {
                 /* shim reported that it isn't able to send a frame at present, retry on next call */
+                break;
+            } else if (ISOTP_RET_NO_DATA == ret) {
+                /* waiting for the caller's data, not for a flow control frame */
+                link->send_timer_bs = now + link->param_n_bs_us;
+                break;
             } else {
                 link->send_status = ISOTP_SEND_STATUS_ERROR;
+                break;
             }
         }
 
         /* check timeout */
-        if (IsoTpTimeAfter(isotp_user_get_us(), link->send_timer_bs)) {
+        if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && IsoTpTimeAfter(now, link->send_timer_bs)) {
             link->send_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_BS;
             link->send_status = ISOTP_SEND_STATUS_ERROR;
         }
@@ -540,6 +905,7 @@ void isotp_poll(IsoTpLink *link) {
         if (IsoTpTimeAfter(isotp_user_get_us(), link->receive_timer_cr)) {
             link->receive_protocol_result = ISOTP_PROTOCOL_RESULT_TIMEOUT_CR;
             link->receive_status = ISOTP_RECEIVE_STATUS_IDLE;
+            isotp_receive_buffer_reset(link);
         }
     }
 
@@ -14,6 +14,20 @@ extern "C" {
 #include "isotp_config.h"
 #include "isotp_user.h"
 
+/**
+ * @brief Fixed-size receive buffers shared by several links.
+ * A link with a pool receives single frames into its own receive buffer and multi-frame messages
+ * into a block of the pool. The block is taken on the first frame and given back once the message
+ * has been read, or when the reception fails or times out. A first frame that finds the pool empty
+ * is answered with FC.OVFLW.
+ */
+typedef struct IsoTpBufferPool {
+    uint8_t*                    blocks;     /* num_blocks * block_size bytes */
+    uint32_t                    block_size;
+    uint8_t                     num_blocks; /* at most ISOTP_POOL_MAX_BLOCKS */
+    uint32_t                    in_use;     /* bit n is set while block n is used by a link */
+} IsoTpBufferPool;
+
 /**
  * @brief Struct containing the data for linking an application to a CAN instance.
  * The data stored in this struct is used internally and may be used by software programs
@@ -24,14 +38,18 @@ typedef struct IsoTpLink {
     uint32_t                    send_arbitration_id; /* used to reply consecutive frame */
     /* message buffer */
     uint8_t*                    send_buffer;
-    uint16_t                    send_buf_size;
-    uint16_t                    send_size;
-    uint16_t                    send_offset;
+    uint32_t                    send_buf_size;
+    const uint8_t*              send_data;      /* payload being sent: send_buffer or the caller's buffer */
+    uint32_t                    send_size;
+    uint32_t                    send_offset;
+    uint32_t                    send_available; /* bytes of send_data that can be sent, see isotp_send_partial */
+    uint8_t                     send_dl;        /* TX_DL: 8 for classic CAN, up to 64 for CAN-FD */
     /* multi-frame flags */
     uint8_t                     send_sn;
     uint16_t                    send_bs_remain; /* Remaining block size */
     uint32_t                    send_st_min_us; /* Separation Time between consecutive frames */
     uint8_t                     send_wtf_count; /* Maximum number of FC.Wait frame transmissions  */
+    uint16_t                    send_max_cf_per_poll; /* Maximum number of consecutive frames sent per isotp_poll */
     uint32_t                    send_timer_st;  /* Last time send consecutive frame */    
     uint32_t                    send_timer_bs;  /* Time until reception of the next FlowControl N_PDU
                                                    start at sending FF, CF, receive FC
@@ -42,9 +60,13 @@ typedef struct IsoTpLink {
     uint32_t                    receive_arbitration_id;
     /* message buffer */
     uint8_t*                    receive_buffer;
-    uint16_t                    receive_buf_size;
-    uint16_t                    receive_size;
-    uint16_t                    receive_offset;
+    uint32_t                    receive_buf_size;
+    uint32_t                    receive_size;
+    uint32_t                    receive_offset;
+    uint8_t                     receive_dl;     /* RX_DL, taken from the length of the first frame */
+    uint8_t*                    receive_own_buffer; /* the buffer passed to isotp_init_link */
+    uint32_t                    receive_own_buf_size;
+    IsoTpBufferPool*            receive_pool;   /* optional, see isotp_set_receive_pool */
     /* multi-frame control */
     uint8_t                     receive_sn;
     uint8_t                     receive_bs_count; /* Maximum number of FC.Wait frame transmissions  */
@@ -54,6 +76,18 @@ typedef struct IsoTpLink {
     int                         receive_protocol_result;
     uint8_t                     receive_status;                                                     
 
+    /* flow control parameters, see isotp_set_fc_params */
+    uint8_t                     param_block_size; /* BS sent in FC frames, 0: no limit */
+    uint32_t                    param_st_min_us;  /* STmin sent in FC frames, also the minimum gap used when sending */
+    uint32_t                    param_n_bs_us;    /* Time until reception of the next FlowControl N_PDU */
+    uint32_t                    param_n_cr_us;    /* Time until reception of the next ConsecutiveFrame N_PDU */
+    uint8_t                     param_wft_max;    /* Maximum number of FC.Wait frames accepted in a row */
+
+    /* extended and mixed addressing, see isotp_set_address_extension */
+    uint8_t                     addr_ext_len;     /* 1 if frames start with an address byte, else 0 */
+    uint8_t                     send_addr_ext;    /* first byte of sent frames: N_TA or N_AE */
+    uint8_t                     receive_addr_ext; /* first byte of received frames, others are ignored */
+
 #if defined(ISO_TP_USER_SEND_CAN_ARG)
     void*                       user_send_can_arg;
 #endif
@@ -65,13 +99,131 @@ typedef struct IsoTpLink {
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
  * @param sendid The ID used to send data to other CAN nodes.
  * @param sendbuf A pointer to an area in memory which can be used as a buffer for data to be sent.
- * @param sendbufsize The size of the buffer area.
+ *                May be NULL: the link then sends directly from the payload passed to isotp_send,
+ *                which must stay unchanged until the send status is no longer
+ *                ISOTP_SEND_STATUS_INPROGRESS.
+ * @param sendbufsize The size of the buffer area, or the largest message size if sendbuf is NULL.
  * @param recvbuf A pointer to an area in memory which can be used as a buffer for data to be received.
  * @param recvbufsize The size of the buffer area.
  */
 void isotp_init_link(IsoTpLink *link, uint32_t sendid, 
-                     uint8_t *sendbuf, uint16_t sendbufsize,
-                     uint8_t *recvbuf, uint16_t recvbufsize);
+                     uint8_t *sendbuf, uint32_t sendbufsize,
+                     uint8_t *recvbuf, uint32_t recvbufsize);
+
+/**
+ * @brief Sets the transmit data length (TX_DL) of the link.
+ *
+ * A TX_DL of 8 selects classic CAN framing. Larger values select CAN-FD framing: single frames and
+ * first frames use the ISO 15765-2:2016 escape sequences where needed, and frames longer than 8
+ * bytes are padded up to the next valid CAN-FD data length.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param tx_dl One of 8, 12, 16, 20, 24, 32, 48 or 64.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_ERROR @endcode if tx_dl is not a valid CAN-FD data length
+ */
+int isotp_set_tx_dl(IsoTpLink *link, uint8_t tx_dl);
+
+/**
+ * @brief Selects extended or mixed addressing.
+ *
+ * Every frame then starts with an address byte: N_TA with extended addressing, N_AE with mixed
+ * addressing. The byte is written before the PCI of sent frames and received frames that start
+ * with another byte are ignored, so several links can share one CAN ID. Single and consecutive
+ * frames carry one byte of payload less.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param enable 0 selects normal addressing, the address bytes are ignored then.
+ * @param send_addr_ext The first byte of sent frames.
+ * @param receive_addr_ext The first byte of the frames received by the link.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_INPROGRESS @endcode if a message is being sent or received
+ */
+int isotp_set_address_extension(IsoTpLink *link, uint8_t enable, uint8_t send_addr_ext,
+                                 uint8_t receive_addr_ext);
+
+/**
+ * @brief Returns the largest payload that fits in a single frame with the link's TX_DL.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ */
+uint16_t isotp_single_frame_max_size(const IsoTpLink *link);
+
+/**
+ * @brief Sets the flow control parameters of the link.
+ *
+ * The link starts with ISO_TP_DEFAULT_BLOCK_SIZE, ISO_TP_DEFAULT_ST_MIN_US,
+ * ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US and ISO_TP_MAX_WFT_NUMBER. The parameters can be changed
+ * between messages.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param block_size BS sent in flow control frames, 0 for no limit.
+ * @param st_min_us STmin sent in flow control frames in microseconds.
+ * @param n_bs_us N_Bs timeout in microseconds, 0 for ISO_TP_STANDARD_TIMEOUT_US.
+ * @param n_cr_us N_Cr timeout in microseconds, 0 for ISO_TP_STANDARD_TIMEOUT_US.
+ * @param wft_max Maximum number of FC.WAIT frames accepted in a row.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_INPROGRESS @endcode if a message is being sent or received
+ */
+int isotp_set_fc_params(IsoTpLink *link, uint8_t block_size, uint32_t st_min_us, uint32_t n_bs_us, uint32_t n_cr_us, uint8_t wft_max);
+
+/**
+ * @brief Initialises a buffer pool.
+ *
+ * @param pool The pool.
+ * @param blocks Memory for the blocks, num_blocks * block_size bytes.
+ * @param block_size Size of one block, the largest message a link can receive from the pool.
+ * @param num_blocks Number of blocks, at most ISOTP_POOL_MAX_BLOCKS.
+ */
+void isotp_pool_init(IsoTpBufferPool *pool, uint8_t *blocks, uint32_t block_size, uint8_t num_blocks);
+
+/**
+ * @brief Lets the link receive multi-frame messages into blocks of a pool.
+ *
+ * The link's own receive buffer then only holds single frames, so ISOTP_CAN_FD_MAX_DL bytes are
+ * enough.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param pool The pool, or NULL to receive into the link's own buffer only.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_INPROGRESS @endcode if the link holds a received message
+ */
+int isotp_set_receive_pool(IsoTpLink *link, IsoTpBufferPool *pool);
+
+/**
+ * @brief Sets the maximum number of consecutive frames sent in one call to isotp_poll.
+ *
+ * Within this limit, isotp_poll sends every consecutive frame that the block size and STmin of the
+ * last flow control frame allow. It stops early when isotp_user_send_can returns
+ * ISOTP_RET_NOSPACE and continues on the next call.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param max_cf_per_poll Maximum number of consecutive frames per call, at least 1.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_ERROR @endcode if max_cf_per_poll is zero
+ */
+int isotp_set_max_cf_per_poll(IsoTpLink *link, uint16_t max_cf_per_poll);
+
+/**
+ * @brief Returns when isotp_poll has to be called next to send a frame or to detect a timeout.
+ *
+ * @param link The @code IsoTpLink @endcode instance used.
+ * @param deadline_us Set to the deadline in isotp_user_get_us time if the link has one.
+ *
+ * @return 1 if a send or receive is in progress and deadline_us was set, 0 if the link only needs
+ *         isotp_poll after isotp_on_can_message or isotp_send.
+ */
+int isotp_next_deadline(const IsoTpLink *link, uint32_t *deadline_us);
 
 /**
  * @brief Polling function; call this function periodically to handle timeouts, send consecutive frames, etc.
@@ -83,6 +235,8 @@ void isotp_poll(IsoTpLink *link);
 /**
  * @brief Handles incoming CAN messages.
  * Determines whether an incoming message is a valid ISO-TP frame or not and handles it accordingly.
+ * A received message that was not read yet is kept: single frames are dropped and first frames
+ * are answered with FC.OVFLW until it is read or released.
  *
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
  * @param data The data received via CAN.
@@ -94,10 +248,11 @@ void isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len);
  * @brief Sends ISO-TP frames via CAN, using the ID set in the initialising function.
  *
  * Single-frame messages will be sent immediately when calling this function.
- * Multi-frame messages will be sent consecutively when calling isotp_poll.
+ * Multi-frame messages will be sent consecutively when calling isotp_poll. Messages larger than
+ * 4095 bytes are announced with the ISO 15765-2:2016 escape sequence and a 32-bit FF_DL.
  *
  * @param link The @code IsoTpLink @endcode instance used for transceiving data.
- * @param payload The payload to be sent. (Up to 4095 bytes).
+ * @param payload The payload to be sent.
  * @param size The size of the payload to be sent.
  *
  * @return Possible return values:
@@ -106,12 +261,52 @@ void isotp_on_can_message(IsoTpLink *link, const uint8_t *data, uint8_t len);
  *  - @code ISOTP_RET_OK @endcode
  *  - The return value of the user shim function isotp_user_send_can().
  */
-int isotp_send(IsoTpLink *link, const uint8_t payload[], uint16_t size);
+int isotp_send(IsoTpLink *link, const uint8_t payload[], uint32_t size);
 
 /**
  * @brief See @link isotp_send @endlink, with the exception that this function is used only for functional addressing.
  */
-int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint16_t size);
+int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size);
+
+/**
+ * @brief Starts sending a message of which only the first bytes are available yet.
+ *
+ * Consecutive frames are sent as far as the available data reaches, report more data with
+ * isotp_send_extend. The caller has to keep the flow of data going, the link doesn't time out
+ * while it waits for data.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param id The CAN ID to send the first frame with.
+ * @param payload The payload to be sent, filled in from the start.
+ * @param size The size of the complete payload.
+ * @param available The number of valid bytes at the start of payload.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_NO_DATA @endcode if the single or first frame needs more data
+ *  - The return values of @link isotp_send_with_id @endlink.
+ */
+int isotp_send_partial(IsoTpLink *link, uint32_t id, const uint8_t payload[], uint32_t size,
+                       uint32_t available);
+
+/**
+ * @brief Reports that more data of a message started with isotp_send_partial is available.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ * @param available The number of valid bytes at the start of the payload, at most its size.
+ *
+ * @return Possible return values:
+ *  - @code ISOTP_RET_OK @endcode
+ *  - @code ISOTP_RET_ERROR @endcode if no message is being sent or available is out of range
+ */
+int isotp_send_extend(IsoTpLink *link, uint32_t available);
+
+/**
+ * @brief Stops sending the current message. The receiver detects the missing frames by its N_Cr
+ * timeout.
+ *
+ * @param link The @code IsoTpLink @endcode instance used for transceiving data.
+ */
+void isotp_send_abort(IsoTpLink *link);
 
 /**
  * @brief Receives and parses the received data and copies the parsed data in to the internal buffer.
@@ -124,7 +319,54 @@ int isotp_send_with_id(IsoTpLink *link, uint32_t id, const uint8_t payload[], ui
  *      - @link ISOTP_RET_OK @endlink
  *      - @link ISOTP_RET_NO_DATA @endlink
  */
-int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint16_t payload_size, uint16_t *out_size);
+int isotp_receive(IsoTpLink *link, uint8_t *payload, const uint32_t payload_size, uint32_t *out_size);
+
+/**
+ * @brief Lends the received message to the caller without copying it.
+ *
+ * The payload points into the link's receive buffer and stays valid until isotp_receive_release is
+ * called. Single and first frames arriving in the meantime are dropped.
+ *
+ * @param link The @link IsoTpLink @endlink instance used to transceive data.
+ * @param payload Set to the received data.
+ * @param out_size Set to the size of the received data.
+ *
+ * @return Possible return values:
+ *      - @link ISOTP_RET_OK @endlink
+ *      - @link ISOTP_RET_NO_DATA @endlink
+ */
+int isotp_receive_peek(IsoTpLink *link, const uint8_t **payload, uint32_t *out_size);
+
+/**
+ * @brief Returns the receive buffer lent by isotp_receive_peek to the link.
+ * @param link The @link IsoTpLink @endlink instance used to transceive data.
+ */
+void isotp_receive_release(IsoTpLink *link);
+
+/**
+ * @brief Takes a received multi-frame message out of the link without copying it.
+ *
+ * The link receives the next message right away, the message stays in its block of the link's
+ * pool until the block is given back with isotp_pool_put. Messages in the link's own receive
+ * buffer, e.g. single frames, are not taken.
+ *
+ * @param link The @link IsoTpLink @endlink instance used to transceive data.
+ * @param payload Set to the pool block holding the received data.
+ * @param out_size Set to the size of the received data.
+ *
+ * @return Possible return values:
+ *      - @link ISOTP_RET_OK @endlink
+ *      - @link ISOTP_RET_NO_DATA @endlink if the link holds no complete message in a pool block
+ */
+int isotp_receive_take(IsoTpLink *link, uint8_t **payload, uint32_t *out_size);
+
+/**
+ * @brief Gives a block taken with isotp_receive_take back to its pool.
+ *
+ * @param pool The pool of the link the block was taken from.
+ * @param block The payload returned by isotp_receive_take.
+ */
+void isotp_pool_put(IsoTpBufferPool *pool, const uint8_t *block);
 
 #ifdef __cplusplus
 }
@@ -16,11 +16,22 @@
  */
 #define ISO_TP_MAX_WFT_NUMBER       1
 
+/* The maximum number of consecutive frames isotp_poll sends in one call. Raise it to send a
+ * whole block per call when the CAN driver can queue several frames.
+ */
+#ifndef ISO_TP_DEFAULT_MAX_CF_PER_POLL
+#define ISO_TP_DEFAULT_MAX_CF_PER_POLL 1
+#endif
+
 /* Private: The default timeout to use when waiting for a response during a
  * multi-frame send or receive.
  */
 #define ISO_TP_DEFAULT_RESPONSE_TIMEOUT_US 100000
 
+/* The N_Bs and N_Cr timeout of ISO 15765-2, used by isotp_set_fc_params for timeouts of 0.
+ */
+#define ISO_TP_STANDARD_TIMEOUT_US 1000000
+
 /* Private: Determines if by default, padding is added to ISO-TP message frames.
  */
 //#define ISO_TP_FRAME_PADDING
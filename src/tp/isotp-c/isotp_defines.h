@@ -62,135 +62,9 @@ typedef enum {
     ISOTP_RECEIVE_STATUS_IDLE,
     ISOTP_RECEIVE_STATUS_INPROGRESS,
     ISOTP_RECEIVE_STATUS_FULL,
+    ISOTP_RECEIVE_STATUS_LENT,      /* the receive buffer is lent out by isotp_receive_peek */
 } IsoTpReceiveStatusTypes;
 
-/* can fram defination */
-#if defined(ISOTP_BYTE_ORDER_LITTLE_ENDIAN)
-typedef struct {
-    uint8_t reserve_1:4;
-    uint8_t type:4;
-    uint8_t reserve_2[7];
-} IsoTpPciType;
-
-typedef struct {
-    uint8_t SF_DL:4;
-    uint8_t type:4;
-    uint8_t data[7];
-} IsoTpSingleFrame;
-
-typedef struct {
-    uint8_t FF_DL_high:4;
-    uint8_t type:4;
-    uint8_t FF_DL_low;
-    uint8_t data[6];
-} IsoTpFirstFrame;
-
-typedef struct {
-    uint8_t SN:4;
-    uint8_t type:4;
-    uint8_t data[7];
-} IsoTpConsecutiveFrame;
-
-typedef struct {
-    uint8_t FS:4;
-    uint8_t type:4;
-    uint8_t BS;
-    uint8_t STmin;
-    uint8_t reserve[5];
-} IsoTpFlowControl;
-
-#else
-
-typedef struct {
-    uint8_t type:4;
-    uint8_t reserve_1:4;
-    uint8_t reserve_2[7];
-} IsoTpPciType;
-
-/*
-* single frame
-* +-------------------------+-----+
-* | byte #0                 | ... |
-* +-------------------------+-----+
-* | nibble #0   | nibble #1 | ... |
-* +-------------+-----------+ ... +
-* | PCIType = 0 | SF_DL     | ... |
-* +-------------+-----------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t SF_DL:4;
-    uint8_t data[7];
-} IsoTpSingleFrame;
-
-/*
-* first frame
-* +-------------------------+-----------------------+-----+
-* | byte #0                 | byte #1               | ... |
-* +-------------------------+-----------+-----------+-----+
-* | nibble #0   | nibble #1 | nibble #2 | nibble #3 | ... |
-* +-------------+-----------+-----------+-----------+-----+
-* | PCIType = 1 | FF_DL                             | ... |
-* +-------------+-----------+-----------------------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t FF_DL_high:4;
-    uint8_t FF_DL_low;
-    uint8_t data[6];
-} IsoTpFirstFrame;
-
-/*
-* consecutive frame
-* +-------------------------+-----+
-* | byte #0                 | ... |
-* +-------------------------+-----+
-* | nibble #0   | nibble #1 | ... |
-* +-------------+-----------+ ... +
-* | PCIType = 0 | SN        | ... |
-* +-------------+-----------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t SN:4;
-    uint8_t data[7];
-} IsoTpConsecutiveFrame;
-
-/*
-* flow control frame
-* +-------------------------+-----------------------+-----------------------+-----+
-* | byte #0                 | byte #1               | byte #2               | ... |
-* +-------------------------+-----------+-----------+-----------+-----------+-----+
-* | nibble #0   | nibble #1 | nibble #2 | nibble #3 | nibble #4 | nibble #5 | ... |
-* +-------------+-----------+-----------+-----------+-----------+-----------+-----+
-* | PCIType = 1 | FS        | BS                    | STmin                 | ... |
-* +-------------+-----------+-----------------------+-----------------------+-----+
-*/
-typedef struct {
-    uint8_t type:4;
-    uint8_t FS:4;
-    uint8_t BS;
-    uint8_t STmin;
-    uint8_t reserve[5];
-} IsoTpFlowControl;
-
-#endif
-
-typedef struct {
-    uint8_t ptr[8];
-} IsoTpDataArray;
-
-typedef struct {
-    union {
-        IsoTpPciType          common;
-        IsoTpSingleFrame      single_frame;
-        IsoTpFirstFrame       first_frame;
-        IsoTpConsecutiveFrame consecutive_frame;
-        IsoTpFlowControl      flow_control;
-        IsoTpDataArray        data_array;
-    } as;
-} IsoTpCanMessage;
-
 /**************************************************************
  * protocol specific defines
  *************************************************************/
@@ -212,6 +86,20 @@ typedef enum {
     PCI_FLOW_STATUS_OVERFLOW = 0x2
 } IsoTpFlowStatus;
 
+/* Private: CAN frame data lengths. Classic CAN frames carry up to 8 bytes, CAN-FD frames up to 64.
+ */
+#define ISOTP_CAN_DL                8
+#define ISOTP_CAN_FD_MAX_DL         64
+
+/* Private: largest FF_DL that fits the 12-bit first frame length. Larger messages use the
+ * ISO 15765-2:2016 escape sequence with a 32-bit FF_DL.
+ */
+#define ISOTP_FF_DL_12BIT_MAX       4095
+
+/* Maximum number of blocks in an IsoTpBufferPool, one bit each in IsoTpBufferPool.in_use
+ */
+#define ISOTP_POOL_MAX_BLOCKS       32
+
 /* Private: network layer resault code.
  */
 #define ISOTP_PROTOCOL_RESULT_OK            0
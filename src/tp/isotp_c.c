@@ -28,8 +28,9 @@ static ssize_t tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
         break;
     case UDS_A_TA_TYPE_FUNCTIONAL:
         link = &tp->func_link;
-        if (len > 7) {
-            UDS_LOGI(__FILE__, "Cannot send more than 7 bytes via functional addressing\n");
+        if (len > isotp_single_frame_max_size(link)) {
+            UDS_LOGI(__FILE__, "Cannot send more than %u bytes via functional addressing\n",
+                     isotp_single_frame_max_size(link));
             ret = -3;
             goto done;
         }
@@ -54,29 +55,67 @@ done:
     return ret;
 }
 
+// ISO-TP frames are sent as far as the data reaches, e.g. while a gateway still receives it
+static ssize_t tp_send_partial(UDSTp_t *hdl, uint8_t *buf, size_t len, size_t available,
+                               UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
+    IsoTpLink *link = &tp->phys_link;
+    int ret = ISOTP_RET_OK;
+    if (NULL == buf) {
+        isotp_send_abort(link);
+        return 0;
+    }
+    if (info && UDS_A_TA_TYPE_FUNCTIONAL == info->A_TA_Type) {
+        // functional messages are single frames
+        return available < len ? 0 : tp_send(hdl, buf, len, info);
+    }
+    if (len > link->send_buf_size) {
+        return -1;
+    }
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && link->send_data == buf) {
+        ret = isotp_send_extend(link, (uint32_t)available);
+    } else {
+        ret = isotp_send_partial(link, link->send_arbitration_id, buf, (uint32_t)len,
+                                 (uint32_t)available);
+        if (ISOTP_RET_NO_DATA == ret) {
+            return 0;
+        }
+    }
+    return ISOTP_RET_OK == ret ? (ssize_t)len : ret;
+}
+
+static void RecvInfo(const UDSISOTpC_t *tp, const IsoTpLink *link, UDSSDU_t *info) {
+    if (NULL == info) {
+        return;
+    }
+    if (link == &tp->phys_link) {
+        info->A_TA = tp->phys_sa;
+        info->A_SA = tp->phys_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+    } else {
+        info->A_TA = tp->func_sa;
+        info->A_SA = tp->func_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
+    }
+    info->A_AE = link->addr_ext_len ? link->receive_addr_ext : 0;
+}
+
 static ssize_t tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     UDS_ASSERT(buf);
-    uint16_t out_size = 0;
+    uint32_t out_size = 0;
     UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
 
     int ret = isotp_receive(&tp->phys_link, buf, bufsize, &out_size);
     if (ret == ISOTP_RET_OK) {
-        UDS_LOGI(__FILE__, "phys link received %d bytes", out_size);
-        if (NULL != info) {
-            info->A_TA = tp->phys_sa;
-            info->A_SA = tp->phys_ta;
-            info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
-        }
+        UDS_LOGI(__FILE__, "phys link received %u bytes", (unsigned)out_size);
+        RecvInfo(tp, &tp->phys_link, info);
     } else if (ret == ISOTP_RET_NO_DATA) {
         ret = isotp_receive(&tp->func_link, buf, bufsize, &out_size);
         if (ret == ISOTP_RET_OK) {
-            UDS_LOGI(__FILE__, "func link received %d bytes", out_size);
-            if (NULL != info) {
-                info->A_TA = tp->func_sa;
-                info->A_SA = tp->func_ta;
-                info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
-            }
+            UDS_LOGI(__FILE__, "func link received %u bytes", (unsigned)out_size);
+            RecvInfo(tp, &tp->func_link, info);
         } else if (ret == ISOTP_RET_NO_DATA) {
             return 0;
         } else {
@@ -88,6 +127,36 @@ static ssize_t tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *inf
     return out_size;
 }
 
+static int SetLinkFCParams(IsoTpLink *link, const UDSISOTpFCParams_t *params) {
+    return isotp_set_fc_params(link, params->bs, params->st_min_us, params->n_bs_us,
+                               params->n_cr_us, params->wft_max);
+}
+
+static ssize_t tp_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    const uint8_t *data = NULL;
+    uint32_t out_size = 0;
+    UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
+
+    if (ISOTP_RET_OK == isotp_receive_peek(&tp->phys_link, &data, &out_size)) {
+        RecvInfo(tp, &tp->phys_link, info);
+    } else if (ISOTP_RET_OK == isotp_receive_peek(&tp->func_link, &data, &out_size)) {
+        RecvInfo(tp, &tp->func_link, info);
+    } else {
+        return 0;
+    }
+    *buf = (uint8_t *)data;
+    return out_size;
+}
+
+static void tp_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSISOTpC_t *tp = (UDSISOTpC_t *)hdl;
+    isotp_receive_release(&tp->phys_link);
+    isotp_receive_release(&tp->func_link);
+}
+
 UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg) {
     if (cfg == NULL || tp == NULL) {
         return UDS_ERR_INVALID_ARG;
@@ -95,15 +164,46 @@ UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg) {
     tp->hdl.poll = tp_poll;
     tp->hdl.send = tp_send;
     tp->hdl.recv = tp_recv;
+    tp->hdl.peek = tp_peek;
+    tp->hdl.release = tp_release;
+    tp->hdl.send_partial = tp_send_partial;
     tp->phys_sa = cfg->source_addr;
     tp->phys_ta = cfg->target_addr;
     tp->func_sa = cfg->source_addr_func;
     tp->func_ta = cfg->target_addr_func;
 
-    isotp_init_link(&tp->phys_link, tp->phys_ta, tp->send_buf, sizeof(tp->send_buf), tp->recv_buf,
-                    sizeof(tp->recv_buf));
-    isotp_init_link(&tp->func_link, tp->func_ta, tp->recv_buf, sizeof(tp->send_buf), tp->recv_buf,
+    // the links send from the caller's buffer, see UDSTp_t.send
+    isotp_init_link(&tp->phys_link, tp->phys_ta, NULL, UDS_ISOTP_MTU, tp->recv_buf,
                     sizeof(tp->recv_buf));
+    isotp_init_link(&tp->func_link, tp->func_ta, NULL, ISOTP_CAN_FD_MAX_DL, tp->func_recv_buf,
+                    sizeof(tp->func_recv_buf));
+    if (cfg->tx_dl) {
+        if (ISOTP_RET_OK != isotp_set_tx_dl(&tp->phys_link, cfg->tx_dl) ||
+            ISOTP_RET_OK != isotp_set_tx_dl(&tp->func_link, cfg->tx_dl)) {
+            return UDS_ERR_INVALID_ARG;
+        }
+    }
+    if (cfg->max_cf_per_poll) {
+        isotp_set_max_cf_per_poll(&tp->phys_link, cfg->max_cf_per_poll);
+    }
+    isotp_set_address_extension(&tp->phys_link, cfg->addr_ext, cfg->target_ae, cfg->source_ae);
+    isotp_set_address_extension(&tp->func_link, cfg->addr_ext, cfg->target_ae_func,
+                                cfg->source_ae_func);
+    isotp_set_receive_pool(&tp->phys_link, cfg->rx_pool);
+    if (cfg->fc_params) {
+        return UDSISOTpCSetFCParams(tp, cfg->fc_params);
+    }
+    return UDS_OK;
+}
+
+UDSErr_t UDSISOTpCSetFCParams(UDSISOTpC_t *tp, const UDSISOTpFCParams_t *params) {
+    if (tp == NULL || params == NULL) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    if (ISOTP_RET_OK != SetLinkFCParams(&tp->phys_link, params) ||
+        ISOTP_RET_OK != SetLinkFCParams(&tp->func_link, params)) {
+        return UDS_ERR_BUSY;
+    }
     return UDS_OK;
 }
 
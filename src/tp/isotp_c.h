@@ -11,8 +11,8 @@ typedef struct {
     UDSTp_t hdl;
     IsoTpLink phys_link;
     IsoTpLink func_link;
-    uint8_t send_buf[UDS_ISOTP_MTU];
-    uint8_t recv_buf[UDS_ISOTP_MTU];
+    uint8_t recv_buf[UDS_ISOTP_RECV_BUF_SIZE];
+    uint8_t func_recv_buf[ISOTP_CAN_FD_MAX_DL]; // functional messages are single frames
     uint32_t phys_sa, phys_ta;
     uint32_t func_sa, func_ta;
 } UDSISOTpC_t;
@@ -22,10 +22,29 @@ typedef struct {
     uint32_t target_addr;
     uint32_t source_addr_func;
     uint32_t target_addr_func;
+    uint8_t tx_dl; // 0 or 8 for classic CAN, 12..64 for CAN-FD
+    uint16_t max_cf_per_poll; // consecutive frames sent per poll, 0: ISO_TP_DEFAULT_MAX_CF_PER_POLL
+    const UDSISOTpFCParams_t *fc_params; // NULL: defaults from isotp_config.h
+    IsoTpBufferPool *rx_pool; // shared buffers for multi-frame messages, may be NULL
+
+    // Extended addressing (N_TA) or mixed addressing (N_AE): every frame starts with an address
+    // byte. The links ignore frames with other address bytes, so frames with a shared CAN ID can
+    // be passed to several transports. Received messages report it in UDSSDU_t.A_AE.
+    bool addr_ext;
+    uint8_t source_ae;      // address byte of received physical frames
+    uint8_t target_ae;      // address byte of sent physical frames
+    uint8_t source_ae_func; // address byte of received functional frames
+    uint8_t target_ae_func; // address byte of sent functional frames
 } UDSISOTpCConfig_t;
 
 UDSErr_t UDSISOTpCInit(UDSISOTpC_t *tp, const UDSISOTpCConfig_t *cfg);
 
+/**
+ * @brief Change the flow control parameters of both links
+ * @return UDS_OK on success, UDS_ERR_BUSY if a message is being sent or received
+ */
+UDSErr_t UDSISOTpCSetFCParams(UDSISOTpC_t *tp, const UDSISOTpFCParams_t *params);
+
 void UDSISOTpCDeinit(UDSISOTpC_t *tp);
 
 #endif
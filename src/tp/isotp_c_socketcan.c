@@ -1,5 +1,9 @@
 #if defined(UDS_TP_ISOTP_C_SOCKETCAN)
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // recvmmsg, sendmmsg
+#endif
+
 #include "tp/isotp_c_socketcan.h"
 #include "iso14229.h"
 #include "tp/isotp-c/isotp_defines.h"
@@ -14,7 +18,48 @@
 #include <errno.h>
 #include <stdarg.h>
 
-static int SetupSocketCAN(const char *ifname) {
+static_assert(sizeof(UDSTpISOTpCMmsg_t) == sizeof(struct mmsghdr) &&
+                  offsetof(UDSTpISOTpCMmsg_t, msg_len) == offsetof(struct mmsghdr, msg_len),
+              "UDSTpISOTpCMmsg_t must match struct mmsghdr");
+
+// CAN IDs above 0x7FF are sent and filtered as 29-bit identifiers
+static canid_t ToSocketCANId(uint32_t id) { return id > CAN_SFF_MASK ? (id | CAN_EFF_FLAG) : id; }
+
+static uint32_t FromSocketCANId(canid_t can_id) {
+    return (can_id & CAN_EFF_FLAG) ? (can_id & CAN_EFF_MASK) : (can_id & CAN_SFF_MASK);
+}
+
+// normal fixed addressing: priority and N_SA are masked out of the bus table key and the filter
+#define NORMAL_FIXED_KEY_MASK (0x03FFFF00u)
+#define NORMAL_FIXED_ADDR_EXT (-2)
+
+// Fibonacci hashing of the CAN ID and address byte into the bus table
+static uint32_t BusSlot(uint32_t can_id, int16_t addr_ext) {
+    return ((can_id * 257u + (uint32_t)(addr_ext + 1)) * 2654435761u) &
+           (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1);
+}
+
+static UDSErr_t SocketCANApplyFilters(const UDSTpISOTpCBus_t *bus) {
+    if (!bus->kernel_filter) {
+        return UDS_OK;
+    }
+    if (setsockopt(bus->fd, SOL_CAN_RAW, CAN_RAW_FILTER, bus->filters,
+                   bus->num_filters * sizeof(struct can_filter)) < 0) {
+        perror("setsockopt CAN_RAW_FILTER");
+        return UDS_FAIL;
+    }
+    return UDS_OK;
+}
+
+// timestamp received frames, see SocketCANRxTime
+static void SocketCANEnableTimestamps(int fd) {
+    const int enable = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt SO_TIMESTAMPNS");
+    }
+}
+
+static int SetupSocketCAN(const char *ifname, bool can_fd) {
     struct sockaddr_can addr = {0};
     struct ifreq ifr = {0};
     int sockfd = -1;
@@ -24,6 +69,26 @@ static int SetupSocketCAN(const char *ifname) {
         goto done;
     }
 
+    SocketCANEnableTimestamps(sockfd);
+
+    // receive nothing until transports are attached to the bus
+    if (setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0) {
+        perror("setsockopt CAN_RAW_FILTER");
+        close(sockfd);
+        sockfd = -1;
+        goto done;
+    }
+
+    if (can_fd) {
+        const int enable = 1;
+        if (setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0) {
+            perror("setsockopt CAN_RAW_FD_FRAMES");
+            close(sockfd);
+            sockfd = -1;
+            goto done;
+        }
+    }
+
     memset(&ifr, 0, sizeof(ifr));
     if (snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname) >= (int)sizeof(ifr.ifr_name)) {
         UDS_LOGE(__FILE__, "Interface name too long");
@@ -43,7 +108,7 @@ done:
     return sockfd;
 }
 
-uint32_t isotp_user_get_us(void) { return UDSMillis() * 1000; }
+uint32_t isotp_user_get_us(void) { return UDSMicros(); }
 
 __attribute__((format(printf, 1, 2))) void isotp_user_debug(const char *message, ...) {
     va_list args;
@@ -52,86 +117,385 @@ __attribute__((format(printf, 1, 2))) void isotp_user_debug(const char *message,
     va_end(args);
 }
 
+// Sends the queued frames. Frames the interface can't take right now stay queued.
+static void SocketCANFlush(UDSTpISOTpCBus_t *bus) {
+    int sent = 0;
+
+    while (sent < bus->tx_count) {
+        int n = sendmmsg(bus->fd, (struct mmsghdr *)&bus->tx_msgs[sent], bus->tx_count - sent, MSG_DONTWAIT);
+        if (n < 0) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && ENOBUFS != errno) {
+                perror("sendmmsg");
+                sent = bus->tx_count; // drop the batch, isotp-c will time out
+            }
+            break;
+        }
+        sent += n;
+    }
+
+    for (int i = 0; i < sent; i++) {
+        if (bus->tx_owners[i]) {
+            bus->tx_owners[i]->tx_queued--;
+        }
+    }
+    if (sent > 0 && sent < bus->tx_count) {
+        for (int i = sent; i < bus->tx_count; i++) {
+            bus->tx_frames[i - sent] = bus->tx_frames[i];
+            bus->tx_iovs[i - sent].iov_len = bus->tx_iovs[i].iov_len;
+            bus->tx_owners[i - sent] = bus->tx_owners[i];
+        }
+    }
+    bus->tx_count -= sent;
+}
+
 #ifndef ISO_TP_USER_SEND_CAN_ARG
 #error "ISO_TP_USER_SEND_CAN_ARG must be defined"
 #endif
 int isotp_user_send_can(const uint32_t arbitration_id, const uint8_t *data, const uint8_t size,
                         void *user_data) {
-    (void)fflush(stdout);
     UDS_ASSERT(user_data);
-    int sockfd = *(int *)user_data;
-    struct can_frame frame = {0};
-    frame.can_id = arbitration_id;
-    frame.can_dlc = size;
-    memmove(frame.data, data, size);
-    if (write(sockfd, &frame, sizeof(struct can_frame)) != sizeof(struct can_frame)) {
-        perror("Write err");
-        return ISOTP_RET_ERROR;
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)user_data;
+    UDSTpISOTpCBus_t *bus = tp->bus;
+
+    if (bus->tx_count >= UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX) {
+        SocketCANFlush(bus);
+        if (bus->tx_count >= UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX) {
+            // the interface queue is full, isotp_poll retries the frame on the next call
+            return ISOTP_RET_NOSPACE;
+        }
+    }
+
+    struct canfd_frame *frame = &bus->tx_frames[bus->tx_count];
+    memset(frame, 0, sizeof(*frame));
+    frame->can_id = ToSocketCANId(arbitration_id);
+    frame->len = size;
+    memmove(frame->data, data, size);
+
+    // with CAN_RAW_FD_FRAMES enabled the socket takes both frame sizes, the MTU selects the type
+    bus->tx_iovs[bus->tx_count].iov_len = CAN_MTU;
+    if (tp->can_fd) {
+        frame->flags = CANFD_BRS;
+        bus->tx_iovs[bus->tx_count].iov_len = CANFD_MTU;
     }
+    bus->tx_owners[bus->tx_count] = tp;
+    bus->tx_count++;
+    tp->tx_queued++;
     return ISOTP_RET_OK;
 }
 
-static void SocketCANRecv(UDSTpISOTpC_t *tp) {
-    UDS_ASSERT(tp);
-    struct can_frame frame = {0};
-    int nbytes = 0;
+// kernel receive time of a frame read by recvmmsg, 0 if the socket doesn't timestamp
+static uint64_t SocketCANRxTime(struct msghdr *msg) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (SOL_SOCKET == c->cmsg_level && SCM_TIMESTAMPNS == c->cmsg_type) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return UDSRealtimeToMonotonicNs(&ts);
+        }
+    }
+    return 0;
+}
 
-    for (;;) {
-        nbytes = read(tp->fd, &frame, sizeof(struct can_frame));
-        if (nbytes < 0) {
-            if (EAGAIN == errno || EWOULDBLOCK == errno) {
-                break;
+// fills info for the complete message in link
+static void SocketCANRecvInfo(const UDSTpISOTpC_t *tp, const IsoTpLink *link, UDSSDU_t *info) {
+    if (link == &tp->func_link) {
+        info->A_TA = tp->func_sa;
+        info->A_SA = tp->normal_fixed ? tp->func_rx_sa : tp->func_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
+        info->rx_time_ns = tp->func_rx_time_ns;
+    } else if (tp->normal_fixed) {
+        const UDSTpISOTpCPeer_t *peer = (const UDSTpISOTpCPeer_t *)link;
+        info->A_TA = tp->phys_sa;
+        info->A_SA = peer->addr;
+        info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+        info->rx_time_ns = peer->rx_time_ns;
+    } else {
+        info->A_TA = tp->phys_sa;
+        info->A_SA = tp->phys_ta;
+        info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
+        info->rx_time_ns = tp->phys_rx_time_ns;
+    }
+    info->A_AE = link->addr_ext_len ? link->receive_addr_ext : 0;
+}
+
+// with normal fixed addressing the sender of the message read last is the target of replies
+static void SocketCANRead(UDSTpISOTpC_t *tp, const UDSSDU_t *rx_info, UDSSDU_t *info) {
+    if (tp->normal_fixed) {
+        tp->reply_ta = rx_info->A_SA;
+    }
+    if (info) {
+        *info = *rx_info;
+    }
+}
+
+// moves the complete message in link to the receive queue, the link receives the next message
+// while this one waits to be read
+static void SocketCANQueue(UDSTpISOTpC_t *tp, IsoTpLink *link) {
+    if (UDS_ISOTP_C_RX_QUEUE_LEN == tp->rx_count ||
+        ISOTP_RECEIVE_STATUS_FULL != link->receive_status) {
+        return;
+    }
+    UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[(tp->rx_head + tp->rx_count) % UDS_ISOTP_C_RX_QUEUE_LEN];
+    SocketCANRecvInfo(tp, link, &m->info);
+    if (ISOTP_RET_OK == isotp_receive_take(link, &m->data, &m->len)) {
+        m->pool = link->receive_pool;
+    } else if (link->receive_size <= sizeof(m->sf)) {
+        (void)isotp_receive(link, m->sf, sizeof(m->sf), &m->len);
+        m->data = m->sf;
+        m->pool = NULL;
+    } else {
+        return; // a multi-frame message without a pool block waits in its link
+    }
+    tp->rx_count++;
+}
+
+// messages that found the queue full wait in their links until there is room
+static void SocketCANQueueHeld(UDSTpISOTpC_t *tp) {
+    SocketCANQueue(tp, &tp->phys_link);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        SocketCANQueue(tp, &tp->peers[i].link);
+    }
+    SocketCANQueue(tp, &tp->func_link);
+}
+
+static void SocketCANRxPop(UDSTpISOTpC_t *tp) {
+    const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+    if (m->pool) {
+        isotp_pool_put(m->pool, m->data);
+    }
+    tp->rx_head = (tp->rx_head + 1) % UDS_ISOTP_C_RX_QUEUE_LEN;
+    tp->rx_count--;
+    tp->rx_lent = false;
+    SocketCANQueueHeld(tp);
+}
+
+// ISO 15765-2 2016 Table 4 note b: functional addressing is only used with single frames
+static bool SocketCANIsSingleFrame(const IsoTpLink *link, const struct canfd_frame *frame) {
+    return frame->len > link->addr_ext_len &&
+           ISOTP_PCI_TYPE_SINGLE == frame->data[link->addr_ext_len] >> 4;
+}
+
+// hands the frame to the links listening to can_id and addr_ext
+static void SocketCANDispatchTo(UDSTpISOTpCBus_t *bus, uint32_t can_id, int16_t addr_ext,
+                                const struct canfd_frame *frame, uint64_t rx_time_ns) {
+    // several links may listen to the same ID, e.g. a functional address shared by servers
+    for (uint32_t slot = BusSlot(can_id, addr_ext); bus->table[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1)) {
+        const UDSTpISOTpCBusEntry_t *entry = &bus->table[slot];
+        if (entry->can_id != can_id || entry->addr_ext != addr_ext) {
+            continue;
+        }
+        // the functional link receives independently of the physical one, e.g. TesterPresent
+        // while a long request is still arriving
+        if (entry->link == &entry->tp->func_link && !SocketCANIsSingleFrame(entry->link, frame)) {
+            continue;
+        }
+        const bool was_full = ISOTP_RECEIVE_STATUS_FULL == entry->link->receive_status;
+        isotp_on_can_message(entry->link, frame->data, frame->len);
+        if (!was_full && ISOTP_RECEIVE_STATUS_FULL == entry->link->receive_status) {
+            if (entry->link == &entry->tp->phys_link) {
+                entry->tp->phys_rx_time_ns = rx_time_ns;
             } else {
-                perror("read");
+                entry->tp->func_rx_time_ns = rx_time_ns;
             }
-        } else if (nbytes == 0) {
-            break;
-        } else {
-            if (frame.can_id == tp->phys_sa) {
-                isotp_on_can_message(&tp->phys_link, frame.data, frame.can_dlc);
-            } else if (frame.can_id == tp->func_sa) {
-                if (ISOTP_RECEIVE_STATUS_IDLE != tp->phys_link.receive_status) {
-                    UDS_LOGI(__FILE__,
-                             "func frame received but cannot process because link is not idle");
-                    return;
-                }
-                // TODO: reject if it's longer than a single frame
-                isotp_on_can_message(&tp->func_link, frame.data, frame.can_dlc);
+            SocketCANQueue(entry->tp, entry->link);
+        }
+    }
+}
+
+// the peer talking to addr, a free peer is taken over if alloc is set
+static UDSTpISOTpCPeer_t *SocketCANPeer(UDSTpISOTpC_t *tp, uint8_t addr, bool alloc) {
+    if (tp->peer_index[addr]) {
+        return &tp->peers[tp->peer_index[addr] - 1];
+    }
+    if (!alloc) {
+        return NULL;
+    }
+    for (uint16_t n = 0; n < tp->num_peers; n++) {
+        const uint16_t i = (tp->next_free_peer + n) % tp->num_peers;
+        UDSTpISOTpCPeer_t *peer = &tp->peers[i];
+        if (ISOTP_SEND_STATUS_INPROGRESS == peer->link.send_status ||
+            ISOTP_RECEIVE_STATUS_IDLE != peer->link.receive_status) {
+            continue;
+        }
+        if (tp->peer_index[peer->addr] == i + 1) {
+            tp->peer_index[peer->addr] = 0;
+        }
+        peer->addr = addr;
+        peer->link.send_arbitration_id = UDS_ISOTP_NORMAL_FIXED_PHYS_ID(addr, tp->phys_sa);
+        tp->peer_index[addr] = i + 1;
+        tp->next_free_peer = (i + 1) % tp->num_peers;
+        return peer;
+    }
+    return NULL;
+}
+
+// normal fixed addressing: the link is chosen by the N_SA in the CAN ID
+static void SocketCANDispatchFixed(UDSTpISOTpCBus_t *bus, uint32_t can_id,
+                                   const struct canfd_frame *frame, uint64_t rx_time_ns) {
+    const uint32_t key = can_id & NORMAL_FIXED_KEY_MASK;
+    const uint8_t sa = can_id & 0xFFu;
+    for (uint32_t slot = BusSlot(key, NORMAL_FIXED_ADDR_EXT); bus->table[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1)) {
+        const UDSTpISOTpCBusEntry_t *entry = &bus->table[slot];
+        if (entry->can_id != key || entry->addr_ext != NORMAL_FIXED_ADDR_EXT) {
+            continue;
+        }
+        UDSTpISOTpC_t *tp = entry->tp;
+        if (sa == tp->phys_sa) {
+            continue; // our own frames on a loopback bus
+        }
+        if (entry->link == &tp->func_link) {
+            if (!SocketCANIsSingleFrame(&tp->func_link, frame)) {
+                continue;
+            }
+            const bool was_full = ISOTP_RECEIVE_STATUS_FULL == tp->func_link.receive_status;
+            isotp_on_can_message(&tp->func_link, frame->data, frame->len);
+            if (!was_full && ISOTP_RECEIVE_STATUS_FULL == tp->func_link.receive_status) {
+                tp->func_rx_sa = sa;
+                tp->func_rx_time_ns = rx_time_ns;
+                SocketCANQueue(tp, &tp->func_link);
+            }
+            continue;
+        }
+        // single and first frames start a message and may take over a free peer, consecutive
+        // and flow control frames belong to a transfer in progress
+        const uint8_t pci_type = frame->len ? frame->data[0] >> 4 : 0xFF;
+        UDSTpISOTpCPeer_t *peer =
+            SocketCANPeer(tp, sa, ISOTP_PCI_TYPE_SINGLE == pci_type ||
+                                      ISOTP_PCI_TYPE_FIRST_FRAME == pci_type);
+        if (NULL == peer) {
+            UDS_LOGI(__FILE__, "'%s': no free peer for 0x%02X, frame dropped", tp->tag, sa);
+            continue;
+        }
+        const bool was_full = ISOTP_RECEIVE_STATUS_FULL == peer->link.receive_status;
+        isotp_on_can_message(&peer->link, frame->data, frame->len);
+        if (!was_full && ISOTP_RECEIVE_STATUS_FULL == peer->link.receive_status) {
+            peer->rx_time_ns = rx_time_ns;
+            SocketCANQueue(tp, &peer->link);
+        }
+    }
+}
+
+static void SocketCANDispatch(UDSTpISOTpCBus_t *bus, const struct canfd_frame *frame,
+                              uint64_t rx_time_ns) {
+    const uint32_t can_id = FromSocketCANId(frame->can_id);
+    SocketCANDispatchTo(bus, can_id, -1, frame, rx_time_ns);
+    if (bus->num_addr_ext_links && frame->len > 0) {
+        SocketCANDispatchTo(bus, can_id, frame->data[0], frame, rx_time_ns);
+    }
+    if (bus->num_normal_fixed_links && (frame->can_id & CAN_EFF_FLAG)) {
+        SocketCANDispatchFixed(bus, can_id, frame, rx_time_ns);
+    }
+}
+
+static void SocketCANRecv(UDSTpISOTpCBus_t *bus) {
+    UDS_ASSERT(bus);
+    int nframes = 0;
+
+    for (;;) {
+        for (int i = 0; i < bus->rx_batch_size; i++) {
+            // recvmmsg shrinks it to the control data received
+            bus->rx_msgs[i].msg_hdr.msg_controllen = sizeof(bus->rx_control[i]);
+        }
+        nframes = recvmmsg(bus->fd, (struct mmsghdr *)bus->rx_msgs, bus->rx_batch_size, MSG_DONTWAIT, NULL);
+        if (nframes < 0) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                perror("recvmmsg");
             }
+            break;
+        }
+        for (int i = 0; i < nframes; i++) {
+            SocketCANDispatch(bus, &bus->rx_frames[i],
+                              SocketCANRxTime(&bus->rx_msgs[i].msg_hdr));
+        }
+        if (nframes < bus->rx_batch_size) {
+            // the socket queue is drained
+            break;
         }
     }
 }
 
+static void SocketCANPollLinks(UDSTpISOTpC_t *tp) {
+    if (tp->normal_fixed) {
+        for (uint16_t i = 0; i < tp->num_peers; i++) {
+            isotp_poll(&tp->peers[i].link);
+        }
+    } else {
+        isotp_poll(&tp->phys_link);
+    }
+}
+
+static bool SocketCANOwnsBus(const UDSTpISOTpC_t *tp) { return tp->bus == &tp->own_bus; }
+
 static UDSTpStatus_t isotp_c_socketcan_tp_poll(UDSTp_t *hdl) {
     UDS_ASSERT(hdl);
     UDSTpStatus_t status = 0;
     UDSTpISOTpC_t *impl = (UDSTpISOTpC_t *)hdl;
-    SocketCANRecv(impl);
-    isotp_poll(&impl->phys_link);
-    if (impl->phys_link.send_status == ISOTP_SEND_STATUS_INPROGRESS) {
+    if (SocketCANOwnsBus(impl)) {
+        UDSTpISOTpCBusPoll(impl->bus);
+    } else {
+        // frames on a shared bus are received by UDSTpISOTpCBusPoll
+        SocketCANPollLinks(impl);
+        SocketCANFlush(impl->bus);
+    }
+    if (impl->send_link->send_status == ISOTP_SEND_STATUS_INPROGRESS || impl->tx_queued) {
         status |= UDS_TP_SEND_IN_PROGRESS;
     }
-    if (impl->phys_link.send_status == ISOTP_SEND_STATUS_ERROR) {
+    if (impl->send_link->send_status == ISOTP_SEND_STATUS_ERROR) {
         status |= UDS_TP_ERR;
     }
     return status;
 }
 
+// normal fixed addressing: the target is info->A_TA if info->A_SA is our address, else the
+// configured target or the sender of the last received message
+static uint32_t SocketCANFixedTarget(const UDSTpISOTpC_t *tp, const UDSSDU_t *info) {
+    if (info && info->A_SA == tp->phys_sa) {
+        return info->A_TA;
+    }
+    return UDS_TP_NOOP_ADDR == tp->phys_ta ? tp->reply_ta : tp->phys_ta;
+}
+
+// the link a physical message to ta is sent on, NULL if all peers are busy
+static IsoTpLink *SocketCANSendLink(UDSTpISOTpC_t *tp, uint32_t ta) {
+    if (!tp->normal_fixed) {
+        return &tp->phys_link;
+    }
+    UDSTpISOTpCPeer_t *peer = SocketCANPeer(tp, (uint8_t)ta, true);
+    if (NULL == peer) {
+        return NULL;
+    }
+    tp->send_link = &peer->link;
+    return &peer->link;
+}
+
 static ssize_t isotp_c_socketcan_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ssize_t ret = -1;
     UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
     IsoTpLink *link = NULL;
     const UDSTpAddr_t ta_type = info ? info->A_TA_Type : UDS_A_TA_TYPE_PHYSICAL;
-    const uint32_t ta = ta_type == UDS_A_TA_TYPE_PHYSICAL ? tp->phys_ta : tp->func_ta;
+    uint32_t ta = ta_type == UDS_A_TA_TYPE_PHYSICAL ? tp->phys_ta : tp->func_ta;
     switch (ta_type) {
     case UDS_A_TA_TYPE_PHYSICAL:
-        link = &tp->phys_link;
+        if (tp->normal_fixed) {
+            ta = SocketCANFixedTarget(tp, info);
+            if (ta > 0xFF) {
+                UDS_LOGI(__FILE__, "'%s': no target address", tp->tag);
+                goto done;
+            }
+        }
+        link = SocketCANSendLink(tp, ta);
+        if (NULL == link) {
+            ret = ISOTP_RET_INPROGRESS;
+            goto done;
+        }
         break;
     case UDS_A_TA_TYPE_FUNCTIONAL:
         link = &tp->func_link;
-        if (len > 7) {
-            UDS_LOGI(__FILE__, "Cannot send more than 7 bytes via functional addressing");
+        if (len > isotp_single_frame_max_size(link)) {
+            UDS_LOGI(__FILE__, "Cannot send more than %u bytes via functional addressing",
+                     isotp_single_frame_max_size(link));
             ret = -3;
             goto done;
         }
@@ -142,6 +506,7 @@ static ssize_t isotp_c_socketcan_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len,
     }
 
     int send_status = isotp_send(link, buf, len);
+    SocketCANFlush(tp->bus);
     switch (send_status) {
     case ISOTP_RET_OK:
         ret = len;
@@ -159,30 +524,91 @@ done:
     return ret;
 }
 
+// ISO-TP frames are sent as far as the data reaches, e.g. while a gateway still receives it
+static ssize_t isotp_c_socketcan_tp_send_partial(UDSTp_t *hdl, uint8_t *buf, size_t len,
+                                                 size_t available, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    int ret = ISOTP_RET_OK;
+    if (NULL == buf) {
+        isotp_send_abort(tp->send_link);
+        return 0;
+    }
+    if (info && UDS_A_TA_TYPE_FUNCTIONAL == info->A_TA_Type) {
+        // functional messages are single frames
+        return available < len ? 0 : isotp_c_socketcan_tp_send(hdl, buf, len, info);
+    }
+    const uint32_t ta = tp->normal_fixed ? SocketCANFixedTarget(tp, info) : tp->phys_ta;
+    if (ta > 0xFF && tp->normal_fixed) {
+        return -1;
+    }
+    IsoTpLink *link = SocketCANSendLink(tp, ta);
+    if (NULL == link) {
+        return 0;
+    }
+    if (len > link->send_buf_size) {
+        return -1;
+    }
+    if (ISOTP_SEND_STATUS_INPROGRESS == link->send_status && link->send_data == buf) {
+        ret = isotp_send_extend(link, (uint32_t)available);
+    } else {
+        ret = isotp_send_partial(link, link->send_arbitration_id, buf, (uint32_t)len,
+                                 (uint32_t)available);
+        SocketCANFlush(tp->bus);
+        if (ISOTP_RET_NO_DATA == ret) {
+            return 0;
+        }
+    }
+    return ISOTP_RET_OK == ret ? (ssize_t)len : ret;
+}
+
+// normal fixed addressing: the peer link with a complete message, the peers take turns
+static IsoTpLink *SocketCANFullPeer(UDSTpISOTpC_t *tp) {
+    for (uint16_t n = 0; n < tp->num_peers; n++) {
+        const uint16_t i = (tp->next_peer + n) % tp->num_peers;
+        if (ISOTP_RECEIVE_STATUS_LENT == tp->peers[i].link.receive_status) {
+            return &tp->peers[i].link;
+        }
+    }
+    for (uint16_t n = 0; n < tp->num_peers; n++) {
+        const uint16_t i = (tp->next_peer + n) % tp->num_peers;
+        if (ISOTP_RECEIVE_STATUS_FULL == tp->peers[i].link.receive_status) {
+            tp->next_peer = (i + 1) % tp->num_peers;
+            return &tp->peers[i].link;
+        }
+    }
+    return &tp->phys_link;
+}
+
 static ssize_t isotp_c_socketcan_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize,
                                          UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     UDS_ASSERT(buf);
-    uint16_t out_size = 0;
+    uint32_t out_size = 0;
     UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    UDSSDU_t rx_info = {0};
 
-    int ret = isotp_receive(&tp->phys_link, buf, bufsize, &out_size);
+    if (tp->rx_count) {
+        const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+        out_size = m->len < bufsize ? m->len : (uint32_t)bufsize;
+        memcpy(buf, m->data, out_size);
+        SocketCANRead(tp, &m->info, info);
+        SocketCANRxPop(tp);
+        return out_size;
+    }
+
+    IsoTpLink *phys_link = tp->normal_fixed ? SocketCANFullPeer(tp) : &tp->phys_link;
+    SocketCANRecvInfo(tp, phys_link, &rx_info);
+    int ret = isotp_receive(phys_link, buf, bufsize, &out_size);
     if (ret == ISOTP_RET_OK) {
-        UDS_LOGI(__FILE__, "phys link received %d bytes", out_size);
-        if (NULL != info) {
-            info->A_TA = tp->phys_sa;
-            info->A_SA = tp->phys_ta;
-            info->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
-        }
+        UDS_LOGI(__FILE__, "phys link received %u bytes", (unsigned)out_size);
+        SocketCANRead(tp, &rx_info, info);
     } else if (ret == ISOTP_RET_NO_DATA) {
+        SocketCANRecvInfo(tp, &tp->func_link, &rx_info);
         ret = isotp_receive(&tp->func_link, buf, bufsize, &out_size);
         if (ret == ISOTP_RET_OK) {
-            UDS_LOGI(__FILE__, "func link received %d bytes", out_size);
-            if (NULL != info) {
-                info->A_TA = tp->func_sa;
-                info->A_SA = tp->func_ta;
-                info->A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL;
-            }
+            UDS_LOGI(__FILE__, "func link received %u bytes", (unsigned)out_size);
+            SocketCANRead(tp, &rx_info, info);
         } else if (ret == ISOTP_RET_NO_DATA) {
             return 0;
         } else {
@@ -194,35 +620,492 @@ static ssize_t isotp_c_socketcan_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufs
     return out_size;
 }
 
-UDSErr_t UDSTpISOTpCInit(UDSTpISOTpC_t *tp, const char *ifname, uint32_t source_addr,
-                         uint32_t target_addr, uint32_t source_addr_func,
-                         uint32_t target_addr_func) {
-    UDS_ASSERT(tp);
-    UDS_ASSERT(ifname);
+static ssize_t isotp_c_socketcan_tp_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    const uint8_t *data = NULL;
+    uint32_t out_size = 0;
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    UDSSDU_t rx_info = {0};
+
+    if (tp->rx_count) {
+        const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+        SocketCANRead(tp, &m->info, info);
+        tp->rx_lent = true;
+        *buf = m->data;
+        return m->len;
+    }
+
+    IsoTpLink *phys_link = tp->normal_fixed ? SocketCANFullPeer(tp) : &tp->phys_link;
+    if (ISOTP_RET_OK == isotp_receive_peek(phys_link, &data, &out_size)) {
+        SocketCANRecvInfo(tp, phys_link, &rx_info);
+    } else if (ISOTP_RET_OK == isotp_receive_peek(&tp->func_link, &data, &out_size)) {
+        SocketCANRecvInfo(tp, &tp->func_link, &rx_info);
+    } else {
+        return 0;
+    }
+    SocketCANRead(tp, &rx_info, info);
+    *buf = (uint8_t *)data;
+    return out_size;
+}
+
+static void isotp_c_socketcan_tp_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    if (tp->rx_lent) {
+        SocketCANRxPop(tp);
+        return;
+    }
+    isotp_receive_release(&tp->phys_link);
+    isotp_receive_release(&tp->func_link);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        isotp_receive_release(&tp->peers[i].link);
+    }
+}
+
+static int isotp_c_socketcan_tp_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    if (max_fds < 1) {
+        return 0;
+    }
+    fds[0].fd = tp->bus->fd;
+    fds[0].events = UDS_TP_FD_READ;
+    if (tp->bus->tx_count) {
+        // sendmmsg hit EAGAIN, the rest of the batch goes out once the socket is writable
+        fds[0].events |= UDS_TP_FD_WRITE;
+    }
+    return 1;
+}
+
+// moves *deadline_us to the next deadline of link if that comes first
+static void SocketCANLinkDeadline(IsoTpLink *link, bool *found, uint32_t *deadline_us) {
+    uint32_t link_us = 0;
+    if (!isotp_next_deadline(link, &link_us)) {
+        return;
+    }
+    if (!*found || IsoTpTimeAfter(*deadline_us, link_us)) {
+        *deadline_us = link_us;
+    }
+    *found = true;
+}
+
+static bool isotp_c_socketcan_tp_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    UDS_ASSERT(hdl);
+    UDSTpISOTpC_t *tp = (UDSTpISOTpC_t *)hdl;
+    uint32_t deadline_us = 0;
+    bool found = false;
+    SocketCANLinkDeadline(&tp->phys_link, &found, &deadline_us);
+    SocketCANLinkDeadline(&tp->func_link, &found, &deadline_us);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        SocketCANLinkDeadline(&tp->peers[i].link, &found, &deadline_us);
+    }
+    if (!found) {
+        return false;
+    }
+
+    // isotp-c counts in microseconds, round up so that the deadline has passed when poll runs
+    int32_t remaining_us = (int32_t)(deadline_us - isotp_user_get_us());
+    if (remaining_us < 0) {
+        remaining_us = 0;
+    }
+    *deadline_ms = UDSMillis() + ((uint32_t)remaining_us + 999) / 1000;
+    return true;
+}
+
+static UDSErr_t BusAddRxFilter(UDSTpISOTpCBus_t *bus, canid_t id, canid_t mask) {
+    for (int i = 0; i < bus->num_filters; i++) {
+        if (bus->filters[i].can_id == id && bus->filters[i].can_mask == mask) {
+            bus->filter_refs[i]++;
+            return UDS_OK;
+        }
+    }
+    if (bus->num_filters >= UDS_ISOTP_C_SOCKETCAN_FILTER_MAX) {
+        UDS_LOGE(__FILE__, "cannot filter more than %d CAN IDs", UDS_ISOTP_C_SOCKETCAN_FILTER_MAX);
+        return UDS_ERR_BUFSIZ;
+    }
+    bus->filters[bus->num_filters].can_id = id;
+    bus->filters[bus->num_filters].can_mask = mask;
+    bus->filter_refs[bus->num_filters] = 1;
+    bus->num_filters++;
+    return SocketCANApplyFilters(bus);
+}
+
+static canid_t BusFilterMask(canid_t id) {
+    return CAN_EFF_FLAG | CAN_RTR_FLAG | ((id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+}
+
+// links with normal fixed addressing are entered with the target address part of can_id and
+// receive from every N_SA
+static UDSErr_t BusAddLink(UDSTpISOTpCBus_t *bus, UDSTpISOTpC_t *tp, IsoTpLink *link,
+                           uint32_t can_id) {
+    int16_t addr_ext = link->addr_ext_len ? link->receive_addr_ext : -1;
+    UDSErr_t err = UDS_OK;
+    if (tp->normal_fixed) {
+        addr_ext = NORMAL_FIXED_ADDR_EXT;
+        can_id &= NORMAL_FIXED_KEY_MASK;
+        err = BusAddRxFilter(bus, CAN_EFF_FLAG | can_id,
+                             CAN_EFF_FLAG | CAN_RTR_FLAG | NORMAL_FIXED_KEY_MASK);
+    } else {
+        err = UDSTpISOTpCBusAddRxId(bus, can_id);
+    }
+    if (UDS_OK != err) {
+        return err;
+    }
+    uint32_t slot = BusSlot(can_id, addr_ext);
+    while (bus->table[slot].tp) {
+        slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1);
+    }
+    bus->table[slot].can_id = can_id;
+    bus->table[slot].addr_ext = addr_ext;
+    bus->table[slot].tp = tp;
+    bus->table[slot].link = link;
+    if (addr_ext >= 0) {
+        bus->num_addr_ext_links++;
+    } else if (NORMAL_FIXED_ADDR_EXT == addr_ext) {
+        bus->num_normal_fixed_links++;
+    }
+    return UDS_OK;
+}
+
+static void BusRemoveRxFilter(UDSTpISOTpCBus_t *bus, canid_t id, canid_t mask) {
+    for (int i = 0; i < bus->num_filters; i++) {
+        if (bus->filters[i].can_id == id && bus->filters[i].can_mask == mask) {
+            if (0 == --bus->filter_refs[i]) {
+                bus->num_filters--;
+                bus->filters[i] = bus->filters[bus->num_filters];
+                bus->filter_refs[i] = bus->filter_refs[bus->num_filters];
+                SocketCANApplyFilters(bus);
+            }
+            return;
+        }
+    }
+}
+
+static void BusRemove(UDSTpISOTpCBus_t *bus, UDSTpISOTpC_t *tp) {
+    // linear probing can't simply clear slots, so the remaining entries are inserted again
+    UDSTpISOTpCBusEntry_t remaining[UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE];
+    int num_remaining = 0;
+    for (int i = 0; i < UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE; i++) {
+        if (bus->table[i].tp == tp) {
+            const uint32_t can_id = bus->table[i].can_id;
+            if (NORMAL_FIXED_ADDR_EXT == bus->table[i].addr_ext) {
+                BusRemoveRxFilter(bus, CAN_EFF_FLAG | can_id,
+                                  CAN_EFF_FLAG | CAN_RTR_FLAG | NORMAL_FIXED_KEY_MASK);
+                bus->num_normal_fixed_links--;
+            } else {
+                BusRemoveRxFilter(bus, ToSocketCANId(can_id), BusFilterMask(ToSocketCANId(can_id)));
+            }
+            if (bus->table[i].addr_ext >= 0) {
+                bus->num_addr_ext_links--;
+            }
+        } else if (bus->table[i].tp) {
+            remaining[num_remaining++] = bus->table[i];
+        }
+    }
+    memset(bus->table, 0, sizeof(bus->table));
+    for (int i = 0; i < num_remaining; i++) {
+        uint32_t slot = BusSlot(remaining[i].can_id, remaining[i].addr_ext);
+        while (bus->table[slot].tp) {
+            slot = (slot + 1) & (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1);
+        }
+        bus->table[slot] = remaining[i];
+    }
+
+    for (int i = 0; i < bus->num_tps; i++) {
+        if (bus->tps[i] == tp) {
+            bus->tps[i] = bus->tps[--bus->num_tps];
+            break;
+        }
+    }
+
+    // frames still queued are sent, but nobody waits for them
+    for (int i = 0; i < bus->tx_count; i++) {
+        if (bus->tx_owners[i] == tp) {
+            bus->tx_owners[i] = NULL;
+        }
+    }
+    tp->tx_queued = 0;
+}
+
+static void BusInit(UDSTpISOTpCBus_t *bus, const UDSTpISOTpCBusConfig_t *cfg) {
+    memset(bus, 0, sizeof(*bus));
+    bus->can_fd = cfg->can_fd;
+
+    bus->rx_batch_size = UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX;
+    if (cfg->rx_batch_size && cfg->rx_batch_size < UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX) {
+        bus->rx_batch_size = cfg->rx_batch_size;
+    }
+    for (int i = 0; i < UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX; i++) {
+        bus->rx_iovs[i].iov_base = &bus->rx_frames[i];
+        bus->rx_iovs[i].iov_len = sizeof(bus->rx_frames[i]);
+        bus->rx_msgs[i].msg_hdr.msg_iov = &bus->rx_iovs[i];
+        bus->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        bus->rx_msgs[i].msg_hdr.msg_control = bus->rx_control[i];
+    }
+    for (int i = 0; i < UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX; i++) {
+        bus->tx_iovs[i].iov_base = &bus->tx_frames[i];
+        bus->tx_msgs[i].msg_hdr.msg_iov = &bus->tx_iovs[i];
+        bus->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+UDSErr_t UDSTpISOTpCBusInit(UDSTpISOTpCBus_t *bus, const char *ifname,
+                            const UDSTpISOTpCBusConfig_t *cfg) {
+    if (NULL == bus || NULL == ifname || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    BusInit(bus, cfg);
+    bus->kernel_filter = true;
+    bus->fd = SetupSocketCAN(ifname, bus->can_fd);
+    if (bus->fd < 0) {
+        return UDS_FAIL;
+    }
+    return UDS_OK;
+}
+
+UDSErr_t UDSTpISOTpCBusInitWithFd(UDSTpISOTpCBus_t *bus, int fd,
+                                  const UDSTpISOTpCBusConfig_t *cfg) {
+    if (NULL == bus || fd < 0 || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    BusInit(bus, cfg);
+    bus->fd = fd;
+    SocketCANEnableTimestamps(fd);
+    return UDS_OK;
+}
+
+void UDSTpISOTpCBusDeinit(UDSTpISOTpCBus_t *bus) {
+    UDS_ASSERT(bus);
+    close(bus->fd);
+    bus->fd = -1;
+}
+
+void UDSTpISOTpCBusPoll(UDSTpISOTpCBus_t *bus) {
+    UDS_ASSERT(bus);
+    SocketCANRecv(bus);
+    for (int i = 0; i < bus->num_tps; i++) {
+        SocketCANPollLinks(bus->tps[i]);
+    }
+    SocketCANFlush(bus);
+}
+
+UDSErr_t UDSTpISOTpCBusAddRxId(UDSTpISOTpCBus_t *bus, uint32_t can_id) {
+    if (NULL == bus) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    const canid_t id = ToSocketCANId(can_id);
+    return BusAddRxFilter(bus, id, BusFilterMask(id));
+}
+
+UDSErr_t UDSTpISOTpCAddRxId(UDSTpISOTpC_t *tp, uint32_t can_id) {
+    if (NULL == tp) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    return UDSTpISOTpCBusAddRxId(tp->bus, can_id);
+}
+
+static int SocketCANSetLinkFCParams(IsoTpLink *link, const UDSISOTpFCParams_t *params) {
+    return isotp_set_fc_params(link, params->bs, params->st_min_us, params->n_bs_us,
+                               params->n_cr_us, params->wft_max);
+}
+
+UDSErr_t UDSTpISOTpCSetFCParams(UDSTpISOTpC_t *tp, const UDSISOTpFCParams_t *params) {
+    if (NULL == tp || NULL == params) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    bool busy = ISOTP_RET_OK != SocketCANSetLinkFCParams(&tp->phys_link, params) ||
+                ISOTP_RET_OK != SocketCANSetLinkFCParams(&tp->func_link, params);
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        busy |= ISOTP_RET_OK != SocketCANSetLinkFCParams(&tp->peers[i].link, params);
+    }
+    if (busy) {
+        UDS_LOGW(__FILE__, "'%s': cannot change flow control parameters during a transfer",
+                 tp->tag);
+        return UDS_ERR_BUSY;
+    }
+    return UDS_OK;
+}
+
+// physical links, and the peers with normal fixed addressing, are set up alike
+static int SocketCANInitPhysLink(UDSTpISOTpC_t *tp, IsoTpLink *link, uint32_t send_id,
+                                 uint8_t *recv_buf, uint32_t recv_buf_size,
+                                 const UDSTpISOTpCConfig_t *cfg) {
+    // the links send from the caller's buffer, see UDSTp_t.send
+    isotp_init_link(link, send_id, NULL, UDS_ISOTP_MTU, recv_buf, recv_buf_size);
+    if (cfg->tx_dl && ISOTP_RET_OK != isotp_set_tx_dl(link, cfg->tx_dl)) {
+        return ISOTP_RET_ERROR;
+    }
+    if (cfg->max_cf_per_poll) {
+        isotp_set_max_cf_per_poll(link, cfg->max_cf_per_poll);
+    }
+    isotp_set_address_extension(link, cfg->addr_ext, cfg->target_ae, cfg->source_ae);
+    isotp_set_receive_pool(link, cfg->rx_pool);
+    link->user_send_can_arg = tp;
+    return ISOTP_RET_OK;
+}
+
+UDSErr_t UDSTpISOTpCInitOnBus(UDSTpISOTpC_t *tp, UDSTpISOTpCBus_t *bus,
+                              const UDSTpISOTpCConfig_t *cfg) {
+    if (NULL == tp || NULL == bus || NULL == cfg) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    if (bus->num_tps >= UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS) {
+        UDS_LOGE(__FILE__, "'%s': bus is full", tp->tag);
+        return UDS_ERR_BUFSIZ;
+    }
     tp->hdl.poll = isotp_c_socketcan_tp_poll;
     tp->hdl.send = isotp_c_socketcan_tp_send;
     tp->hdl.recv = isotp_c_socketcan_tp_recv;
-    tp->phys_sa = source_addr;
-    tp->phys_ta = target_addr;
-    tp->func_sa = source_addr_func;
-    tp->func_ta = target_addr;
-    tp->fd = SetupSocketCAN(ifname);
+    tp->hdl.peek = isotp_c_socketcan_tp_peek;
+    tp->hdl.release = isotp_c_socketcan_tp_release;
+    tp->hdl.send_partial = isotp_c_socketcan_tp_send_partial;
+    tp->hdl.get_fds = isotp_c_socketcan_tp_get_fds;
+    tp->hdl.next_deadline = isotp_c_socketcan_tp_next_deadline;
+    tp->phys_sa = cfg->source_addr;
+    tp->phys_ta = cfg->target_addr;
+    tp->func_sa = cfg->source_addr_func;
+    tp->func_ta = cfg->target_addr_func;
+    tp->bus = bus;
 
-    isotp_init_link(&tp->phys_link, target_addr, tp->send_buf, sizeof(tp->send_buf), tp->recv_buf,
-                    sizeof(tp->recv_buf));
-    isotp_init_link(&tp->func_link, target_addr_func, tp->recv_buf, sizeof(tp->send_buf),
-                    tp->recv_buf, sizeof(tp->recv_buf));
+    tp->normal_fixed = cfg->normal_fixed;
+    tp->peers = NULL;
+    tp->num_peers = 0;
+    if (cfg->normal_fixed) {
+        if (NULL == cfg->peers || 0 == cfg->num_peers || cfg->addr_ext || cfg->source_addr > 0xFF) {
+            UDS_LOGE(__FILE__, "'%s': normal fixed addressing needs peers and 8 bit addresses",
+                     tp->tag);
+            return UDS_ERR_INVALID_ARG;
+        }
+        tp->peers = cfg->peers;
+        tp->num_peers = cfg->num_peers;
+    }
+    memset(tp->peer_index, 0, sizeof(tp->peer_index));
+    tp->next_peer = 0;
+    tp->next_free_peer = 0;
+    tp->reply_ta = UDS_TP_NOOP_ADDR;
+    tp->send_link = &tp->phys_link;
+    tp->rx_head = 0;
+    tp->rx_count = 0;
+    tp->rx_lent = false;
 
-    tp->phys_link.user_send_can_arg = &(tp->fd);
-    tp->func_link.user_send_can_arg = &(tp->fd);
+    // IDs of normal fixed addressing are built from the addresses
+    const uint32_t phys_rx_id =
+        tp->normal_fixed ? UDS_ISOTP_NORMAL_FIXED_PHYS_ID(tp->phys_sa, 0) : tp->phys_sa;
+    const uint32_t func_rx_id =
+        tp->normal_fixed ? UDS_ISOTP_NORMAL_FIXED_FUNC_ID(tp->func_sa, 0) : tp->func_sa;
+    const uint32_t func_tx_id =
+        tp->normal_fixed ? UDS_ISOTP_NORMAL_FIXED_FUNC_ID(tp->func_ta, tp->phys_sa) : tp->func_ta;
+
+    if (ISOTP_RET_OK != SocketCANInitPhysLink(tp, &tp->phys_link, cfg->target_addr, tp->recv_buf,
+                                              sizeof(tp->recv_buf), cfg)) {
+        UDS_LOGE(__FILE__, "invalid tx_dl %d", cfg->tx_dl);
+        return UDS_ERR_INVALID_ARG;
+    }
+    for (uint16_t i = 0; i < tp->num_peers; i++) {
+        UDSTpISOTpCPeer_t *peer = &tp->peers[i];
+        (void)SocketCANInitPhysLink(tp, &peer->link, UDS_ISOTP_NORMAL_FIXED_PHYS_ID(0, tp->phys_sa),
+                                    peer->recv_buf, sizeof(peer->recv_buf), cfg);
+        peer->addr = 0;
+        peer->rx_time_ns = 0;
+    }
+    isotp_init_link(&tp->func_link, func_tx_id, NULL, ISOTP_CAN_FD_MAX_DL, tp->func_recv_buf,
+                    sizeof(tp->func_recv_buf));
+    if (cfg->tx_dl) {
+        (void)isotp_set_tx_dl(&tp->func_link, cfg->tx_dl);
+    }
+    tp->can_fd = tp->phys_link.send_dl > ISOTP_CAN_DL;
+    if (tp->can_fd && !bus->can_fd) {
+        UDS_LOGE(__FILE__, "'%s': tx_dl %d needs a CAN-FD bus", tp->tag, cfg->tx_dl);
+        return UDS_ERR_INVALID_ARG;
+    }
+    isotp_set_address_extension(&tp->func_link, cfg->addr_ext, cfg->target_ae_func,
+                                cfg->source_ae_func);
+    if (cfg->fc_params) {
+        UDSErr_t err = UDSTpISOTpCSetFCParams(tp, cfg->fc_params);
+        if (UDS_OK != err) {
+            return err;
+        }
+    }
+    tp->func_link.user_send_can_arg = tp;
+
+    UDSErr_t err = BusAddLink(bus, tp, &tp->phys_link, phys_rx_id);
+    if (UDS_OK == err && tp->func_sa != UDS_TP_NOOP_ADDR) {
+        err = BusAddLink(bus, tp, &tp->func_link, func_rx_id);
+    }
+    if (UDS_OK != err) {
+        BusRemove(bus, tp);
+        return err;
+    }
+    bus->tps[bus->num_tps++] = tp;
 
     return UDS_OK;
 }
 
+// opens a bus on ifname, or on fd if ifname is NULL
+static UDSErr_t InitOnOwnBus(UDSTpISOTpC_t *tp, const char *ifname, int fd,
+                             const UDSTpISOTpCConfig_t *cfg) {
+    UDSTpISOTpCBus_t *bus = &tp->own_bus;
+    const UDSTpISOTpCBusConfig_t bus_cfg = {
+        .can_fd = cfg->tx_dl > ISOTP_CAN_DL,
+        .rx_batch_size = cfg->rx_batch_size,
+    };
+    UDSErr_t err = ifname ? UDSTpISOTpCBusInit(bus, ifname, &bus_cfg)
+                          : UDSTpISOTpCBusInitWithFd(bus, fd, &bus_cfg);
+    if (UDS_OK == err) {
+        err = UDSTpISOTpCInitOnBus(tp, bus, cfg);
+    }
+    if (UDS_OK != err) {
+        UDSTpISOTpCBusDeinit(bus);
+        tp->bus = NULL;
+    }
+    return err;
+}
+
+UDSErr_t UDSTpISOTpCInitWithConfig(UDSTpISOTpC_t *tp, const char *ifname,
+                                   const UDSTpISOTpCConfig_t *cfg) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(ifname);
+    UDS_ASSERT(cfg);
+    return InitOnOwnBus(tp, ifname, -1, cfg);
+}
+
+UDSErr_t UDSTpISOTpCInitWithFd(UDSTpISOTpC_t *tp, int fd, const UDSTpISOTpCConfig_t *cfg) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(cfg);
+    return InitOnOwnBus(tp, NULL, fd, cfg);
+}
+
+UDSErr_t UDSTpISOTpCInit(UDSTpISOTpC_t *tp, const char *ifname, uint32_t source_addr,
+                         uint32_t target_addr, uint32_t source_addr_func,
+                         uint32_t target_addr_func) {
+    UDSTpISOTpCConfig_t cfg = {
+        .source_addr = source_addr,
+        .target_addr = target_addr,
+        .source_addr_func = source_addr_func,
+        .target_addr_func = target_addr_func,
+    };
+    return UDSTpISOTpCInitWithConfig(tp, ifname, &cfg);
+}
+
 void UDSTpISOTpCDeinit(UDSTpISOTpC_t *tp) {
     UDS_ASSERT(tp);
-    close(tp->fd);
-    tp->fd = -1;
+    if (NULL == tp->bus) {
+        return;
+    }
+    BusRemove(tp->bus, tp);
+    // queued messages give their pool blocks back
+    for (; tp->rx_count; tp->rx_count--) {
+        const UDSTpISOTpCRxMsg_t *m = &tp->rx_queue[tp->rx_head];
+        if (m->pool) {
+            isotp_pool_put(m->pool, m->data);
+        }
+        tp->rx_head = (tp->rx_head + 1) % UDS_ISOTP_C_RX_QUEUE_LEN;
+    }
+    if (SocketCANOwnsBus(tp)) {
+        UDSTpISOTpCBusDeinit(tp->bus);
+    }
+    tp->bus = NULL;
 }
 
 #endif
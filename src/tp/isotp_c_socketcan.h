@@ -4,22 +4,274 @@
 
 #include "tp.h"
 #include "tp/isotp-c/isotp.h"
+#include <linux/can.h>
+#include <sys/socket.h>
 
+/** Maximum number of CAN frames read with one recvmmsg call */
+#ifndef UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX
+#define UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX (32)
+#endif
+
+/** Maximum number of CAN frames queued for one sendmmsg call */
+#ifndef UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX
+#define UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX (64)
+#endif
+
+/** Maximum number of CAN_RAW_FILTER entries installed on the socket */
+#ifndef UDS_ISOTP_C_SOCKETCAN_FILTER_MAX
+#define UDS_ISOTP_C_SOCKETCAN_FILTER_MAX (128)
+#endif
+
+/** Maximum number of transports sharing one bus */
+#ifndef UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS
+#define UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS (64)
+#endif
+
+/** Received messages a transport holds until they are read. Single frames are copied into the
+ * queue, multi-frame messages wait in their block of the rx_pool. Without a pool, or once the
+ * queue is full, a message waits in its link. The link drops single frames and answers first
+ * frames with FC.OVFLW until the message was read. */
+#ifndef UDS_ISOTP_C_RX_QUEUE_LEN
+#define UDS_ISOTP_C_RX_QUEUE_LEN (4)
+#endif
+
+/** Size of the CAN ID hash table of a bus. Must be a power of two and at least
+ * 4 * UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS so that the table stays at most half full. */
+#ifndef UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE
+#define UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE (256)
+#endif
+
+static_assert((UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE &
+               (UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE - 1)) == 0,
+              "UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE must be a power of two");
+static_assert(UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE >= 4 * UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS,
+              "UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE too small");
+
+/** ISO 15765-2 normal fixed addressing: 29 bit CAN IDs carrying the target and source address */
+#define UDS_ISOTP_NORMAL_FIXED_PHYS_ID(ta, sa) (0x18DA0000u | ((ta) & 0xFFu) << 8 | ((sa) & 0xFFu))
+#define UDS_ISOTP_NORMAL_FIXED_FUNC_ID(ta, sa) (0x18DB0000u | ((ta) & 0xFFu) << 8 | ((sa) & 0xFFu))
+
+struct UDSTpISOTpC;
+
+// same layout as struct mmsghdr, which <sys/socket.h> only declares under _GNU_SOURCE
+typedef struct {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} UDSTpISOTpCMmsg_t;
+
+/**
+ * @brief Maps a received CAN ID and address byte to the link that handles it
+ */
+typedef struct {
+    uint32_t can_id;
+    int16_t addr_ext; /**< first byte of the frames, -1 with normal addressing, -2: normal fixed
+                           addressing, can_id is the target address and the link is chosen by the
+                           source address */
+    struct UDSTpISOTpC *tp; /**< NULL if the slot is empty */
+    IsoTpLink *link;
+} UDSTpISOTpCBusEntry_t;
+
+/**
+ * @brief One raw CAN socket shared by several UDSTpISOTpC_t transports
+ *
+ * Frames are read once per poll and dispatched by CAN ID, and by address byte for links with
+ * extended or mixed addressing, through a hash table. Frames sent by any transport on the bus are
+ * flushed together.
+ */
+typedef struct {
+    int fd;
+    bool can_fd;        // CAN_RAW_FD_FRAMES enabled
+    bool kernel_filter; // fd is a CAN_RAW socket, frames are filtered by CAN ID in the kernel
+
+    UDSTpISOTpCBusEntry_t table[UDS_ISOTP_C_SOCKETCAN_BUS_TABLE_SIZE];
+    uint16_t num_addr_ext_links;     // table entries with an address byte
+    uint16_t num_normal_fixed_links; // table entries with normal fixed addressing
+    struct UDSTpISOTpC *tps[UDS_ISOTP_C_SOCKETCAN_BUS_MAX_LINKS];
+    uint16_t num_tps;
+
+    // kernel receive filter, one entry per CAN ID
+    uint16_t num_filters;
+    struct can_filter filters[UDS_ISOTP_C_SOCKETCAN_FILTER_MAX];
+    uint16_t filter_refs[UDS_ISOTP_C_SOCKETCAN_FILTER_MAX];
+
+    // receive batch, filled by recvmmsg
+    uint16_t rx_batch_size;
+    struct canfd_frame rx_frames[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX];
+    struct iovec rx_iovs[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX];
+    UDSTpISOTpCMmsg_t rx_msgs[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX];
+    // SO_TIMESTAMPNS control messages, uint64_t keeps them aligned for struct cmsghdr
+    uint64_t rx_control[UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX]
+                      [(CMSG_SPACE(sizeof(struct timespec)) + 7) / 8];
+
+    // transmit batch, frames queued by isotp-c and flushed with sendmmsg
+    uint16_t tx_count;
+    struct canfd_frame tx_frames[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX];
+    struct iovec tx_iovs[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX];
+    UDSTpISOTpCMmsg_t tx_msgs[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX];
+    struct UDSTpISOTpC *tx_owners[UDS_ISOTP_C_SOCKETCAN_TX_BATCH_MAX]; // NULL once deinitialized
+} UDSTpISOTpCBus_t;
+
+typedef struct {
+    bool can_fd;            // enable CAN-FD frames, required for transports with tx_dl > 8
+    uint16_t rx_batch_size; // frames read per syscall, 0: UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX
+} UDSTpISOTpCBusConfig_t;
+
+/**
+ * @brief Link to one peer of a transport with normal fixed addressing
+ */
+typedef struct {
+    IsoTpLink link;
+    uint8_t addr;        // N_SA of the peer
+    uint64_t rx_time_ns; // arrival of the frame completing the received message
+    uint8_t recv_buf[UDS_ISOTP_RECV_BUF_SIZE];
+} UDSTpISOTpCPeer_t;
+
+/**
+ * @brief A received message waiting to be read
+ */
 typedef struct {
+    uint8_t *data;          // a block of pool, or sf
+    uint32_t len;
+    IsoTpBufferPool *pool;  // NULL if the message was copied into sf
+    UDSSDU_t info;
+    uint8_t sf[ISOTP_CAN_FD_MAX_DL];
+} UDSTpISOTpCRxMsg_t;
+
+typedef struct UDSTpISOTpC {
     UDSTp_t hdl;
     IsoTpLink phys_link;
     IsoTpLink func_link;
-    uint8_t send_buf[UDS_ISOTP_MTU];
-    uint8_t recv_buf[UDS_ISOTP_MTU];
-    int fd;
+    uint8_t recv_buf[UDS_ISOTP_RECV_BUF_SIZE];
+    uint8_t func_recv_buf[ISOTP_CAN_FD_MAX_DL]; // functional messages are single frames
+    bool can_fd; // send CAN-FD frames
     uint32_t phys_sa, phys_ta;
     uint32_t func_sa, func_ta;
     char tag[16];
+    uint64_t phys_rx_time_ns, func_rx_time_ns; // arrival of the frame completing the message
+
+    UDSTpISOTpCBus_t *bus;    // the bus this transport sends and receives on
+    UDSTpISOTpCBus_t own_bus; // bus opened by UDSTpISOTpCInit, unused on a shared bus
+    uint16_t tx_queued;       // frames of this transport in the transmit batch of the bus
+
+    // normal fixed addressing, phys_link is unused
+    bool normal_fixed;
+    UDSTpISOTpCPeer_t *peers;
+    uint16_t num_peers;
+    uint16_t peer_index[256]; // peers[peer_index[addr] - 1] talks to addr, 0: none
+    uint16_t next_peer;       // recv() and peek() look at this peer first
+    uint16_t next_free_peer;  // a new peer is searched from here
+    uint32_t reply_ta;        // sender of the last received message
+    uint8_t func_rx_sa;       // sender of the functional message in func_link
+    IsoTpLink *send_link;     // link of the last physical message sent
+
+    // complete messages moved out of the links, read in the order they arrived
+    UDSTpISOTpCRxMsg_t rx_queue[UDS_ISOTP_C_RX_QUEUE_LEN];
+    uint8_t rx_head;  // oldest message
+    uint8_t rx_count; // messages not read yet
+    bool rx_lent;     // the oldest message is lent by peek()
 } UDSTpISOTpC_t;
 
+typedef struct {
+    uint32_t source_addr;      // CAN ID of received physical frames
+    uint32_t target_addr;      // CAN ID of sent physical frames
+    uint32_t source_addr_func; // CAN ID of received functional frames
+    uint32_t target_addr_func; // CAN ID of sent functional frames
+    uint8_t tx_dl; // 0 or 8 for classic CAN, 12..64 for CAN-FD (requires an FD-capable interface)
+    uint16_t max_cf_per_poll; // consecutive frames sent per poll, 0: ISO_TP_DEFAULT_MAX_CF_PER_POLL
+    uint16_t rx_batch_size;   // frames read per syscall, 0: UDS_ISOTP_C_SOCKETCAN_RX_BATCH_MAX
+    const UDSISOTpFCParams_t *fc_params; // NULL: defaults from isotp_config.h
+    IsoTpBufferPool *rx_pool; // shared buffers for multi-frame messages, may be NULL. Needs a
+                              // block per queued message, see UDS_ISOTP_C_RX_QUEUE_LEN
+
+    // Extended addressing (N_TA) or mixed addressing (N_AE): every frame starts with an address
+    // byte, links with different address bytes can share CAN IDs. Received messages report it in
+    // UDSSDU_t.A_AE.
+    bool addr_ext;
+    uint8_t source_ae;      // address byte of received physical frames
+    uint8_t target_ae;      // address byte of sent physical frames
+    uint8_t source_ae_func; // address byte of received functional frames
+    uint8_t target_ae_func; // address byte of sent functional frames
+
+    // Normal fixed addressing: IDs are UDS_ISOTP_NORMAL_FIXED_PHYS_ID / _FUNC_ID and the addresses
+    // above are 8 bit N_SA and N_TA. Physical messages are received from every sender into one of
+    // the peers, a peer is needed for every sender whose message hasn't been read yet. Messages
+    // are sent to UDSSDU_t.A_TA if UDSSDU_t.A_SA is source_addr, else to target_addr, or, if that
+    // is UDS_TP_NOOP_ADDR, to the sender of the last received message. Received messages report
+    // the sender in UDSSDU_t.A_SA.
+    bool normal_fixed;
+    UDSTpISOTpCPeer_t *peers; // num_peers links, owned by the caller
+    uint16_t num_peers;
+} UDSTpISOTpCConfig_t;
+
+/**
+ * @brief Open a transport on a bus of its own
+ */
+UDSErr_t UDSTpISOTpCInitWithConfig(UDSTpISOTpC_t *tp, const char *ifname,
+                                   const UDSTpISOTpCConfig_t *cfg);
+
+/**
+ * @brief Open a transport on a bus of its own that sends and receives frames on fd
+ * @details See UDSTpISOTpCBusInitWithFd
+ */
+UDSErr_t UDSTpISOTpCInitWithFd(UDSTpISOTpC_t *tp, int fd, const UDSTpISOTpCConfig_t *cfg);
 UDSErr_t UDSTpISOTpCInit(UDSTpISOTpC_t *tp, const char *ifname, uint32_t source_addr,
                          uint32_t target_addr, uint32_t source_addr_func,
                          uint32_t target_addr_func);
+
+/**
+ * @brief Attach a transport to a shared bus
+ * @details UDSTpPoll() on the transport runs its timers and flushes pending frames, but frames are
+ * only received by UDSTpISOTpCBusPoll(). cfg->rx_batch_size is ignored.
+ */
+UDSErr_t UDSTpISOTpCInitOnBus(UDSTpISOTpC_t *tp, UDSTpISOTpCBus_t *bus,
+                              const UDSTpISOTpCConfig_t *cfg);
+
+/**
+ * @brief Detach the transport from its bus and close the bus if UDSTpISOTpCInit opened it
+ */
 void UDSTpISOTpCDeinit(UDSTpISOTpC_t *tp);
 
+/**
+ * @brief Change the flow control parameters of the transport
+ * @details Takes effect with the next message. Fails while a message is being sent or received.
+ * @return UDS_OK on success, UDS_ERR_BUSY if a transfer is in progress
+ */
+UDSErr_t UDSTpISOTpCSetFCParams(UDSTpISOTpC_t *tp, const UDSISOTpFCParams_t *params);
+
+/**
+ * @brief Let frames with another CAN ID through the socket's kernel receive filter
+ * @details The filter passes the source addresses of the transports on the bus. IDs above 0x7FF
+ * are treated as 29-bit identifiers.
+ * @param tp transport
+ * @param can_id CAN ID to receive
+ * @return UDS_OK on success, UDS_ERR_BUFSIZ if UDS_ISOTP_C_SOCKETCAN_FILTER_MAX is reached
+ */
+UDSErr_t UDSTpISOTpCAddRxId(UDSTpISOTpC_t *tp, uint32_t can_id);
+
+UDSErr_t UDSTpISOTpCBusInit(UDSTpISOTpCBus_t *bus, const char *ifname,
+                            const UDSTpISOTpCBusConfig_t *cfg);
+
+/**
+ * @brief Run a bus on a socket other than CAN_RAW
+ * @details fd carries one struct can_frame or struct canfd_frame per datagram, e.g. one end of
+ * socketpair(AF_UNIX, SOCK_SEQPACKET, 0). This runs the SocketCAN code path without a CAN
+ * interface, for tests and benchmarks in processes that can't create vcan. fd has no receive
+ * filter, frames with CAN IDs no transport listens to are dropped after they were read. The bus
+ * takes ownership of fd.
+ */
+UDSErr_t UDSTpISOTpCBusInitWithFd(UDSTpISOTpCBus_t *bus, int fd,
+                                  const UDSTpISOTpCBusConfig_t *cfg);
+void UDSTpISOTpCBusDeinit(UDSTpISOTpCBus_t *bus);
+
+/**
+ * @brief Receive and dispatch pending frames, run the timers of every transport on the bus and
+ * send the frames they produce
+ */
+void UDSTpISOTpCBusPoll(UDSTpISOTpCBus_t *bus);
+
+/**
+ * @brief Bus version of UDSTpISOTpCAddRxId
+ */
+UDSErr_t UDSTpISOTpCBusAddRxId(UDSTpISOTpCBus_t *bus, uint32_t can_id);
+
 #endif
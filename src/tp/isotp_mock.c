@@ -8,71 +8,483 @@
 #include <string.h>
 #include <stdlib.h>
 
-#define MAX_NUM_TP 16
-#define NUM_MSGS 8
-static ISOTPMock_t *TPs[MAX_NUM_TP];
+static ISOTPMock_t *TPs[UDS_ISOTP_MOCK_MAX_TPS];
 static unsigned TPCount = 0;
 static FILE *LogFile = NULL;
+
+// receivers by address, several transports may share one, e.g. a functional address
+static struct Route {
+    uint32_t addr;
+    ISOTPMock_t *tp; // NULL if the slot is empty
+} Routes[UDS_ISOTP_MOCK_TABLE_SIZE];
+
+enum MockBusFrame {
+    MOCK_BUS_FIRST = 0, // single frame or first frame
+    MOCK_BUS_FC,        // flow control frame from the receiver
+    MOCK_BUS_CF,        // consecutive frame
+    MOCK_BUS_DONE,
+};
+
+// ring buffer of messages in send order
 static struct Msg {
-    uint8_t buf[UDS_ISOTP_MTU];
+    const uint8_t *buf; // borrowed from the sender until the message is delivered
     size_t len;
     UDSSDU_t info;
-    uint32_t scheduled_tx_time;
+    uint32_t scheduled_tx_time; // without a bus: arrival - 1, on a bus: arrival rounded up
+    uint64_t rx_time_ns;
     ISOTPMock_t *sender;
-} msgs[NUM_MSGS];
+
+    // transfer on the sender's bus
+    uint8_t frame;       // enum MockBusFrame, next frame on the bus
+    size_t sent;         // payload bytes sent
+    uint8_t sn;          // sequence number of the next consecutive frame
+    uint8_t block_left;  // consecutive frames until the next flow control, 0: no limit
+    uint32_t fc_id;      // CAN ID of the receiver's flow control frames
+    uint64_t ready_ns;   // the next frame may start from here on
+} msgs[UDS_ISOTP_MOCK_QUEUE_LEN];
+static unsigned MsgHead = 0;
 static unsigned MsgCount = 0;
+static uint32_t NetworkPass = 0;
+static uint32_t BusScan = 0;
 
-static void NetworkPoll(void) {
-    for (unsigned i = 0; i < MsgCount; i++) {
-        if (UDSTimeAfter(UDSMillis(), msgs[i].scheduled_tx_time)) {
-            bool found = false;
-            for (unsigned j = 0; j < TPCount; j++) {
-                ISOTPMock_t *tp = TPs[j];
-                if (tp->sa_phys == msgs[i].info.A_TA || tp->sa_func == msgs[i].info.A_TA) {
-                    found = true;
-                    if (tp->recv_len > 0) {
-                        UDS_LOGW(__FILE__,
-                                 "TPMock: %s recv buffer is already full. Message dropped",
-                                 tp->name);
-                        continue;
-                    }
-
-                    UDS_LOGD(__FILE__,
-                             "%s receives %ld bytes from TA=0x%03X (A_TA_Type=%s):", tp->name,
-                             msgs[i].len, msgs[i].info.A_TA,
-                             msgs[i].info.A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "PHYSICAL"
-                                                                              : "FUNCTIONAL");
-                    UDS_LOG_SDU(__FILE__, msgs[i].buf, msgs[i].len, &(msgs[i].info));
-
-                    memmove(tp->recv_buf, msgs[i].buf, msgs[i].len);
-                    tp->recv_len = msgs[i].len;
-                    tp->recv_info = msgs[i].info;
-                }
+static uint32_t MockRouteSlot(uint32_t addr) {
+    return (addr * 2654435761u) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1);
+}
+
+static void MockRouteAdd(uint32_t addr, ISOTPMock_t *tp) {
+    uint32_t slot = MockRouteSlot(addr);
+    while (Routes[slot].tp) {
+        if (Routes[slot].addr == addr && Routes[slot].tp == tp) {
+            return;
+        }
+        slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1);
+    }
+    Routes[slot].addr = addr;
+    Routes[slot].tp = tp;
+}
+
+static void MockRouteRemove(const ISOTPMock_t *tp) {
+    // linear probing can't simply clear slots, so the remaining entries are inserted again
+    struct Route remaining[UDS_ISOTP_MOCK_TABLE_SIZE];
+    unsigned num_remaining = 0;
+    for (unsigned i = 0; i < UDS_ISOTP_MOCK_TABLE_SIZE; i++) {
+        if (Routes[i].tp && Routes[i].tp != tp) {
+            remaining[num_remaining++] = Routes[i];
+        }
+    }
+    memset(Routes, 0, sizeof(Routes));
+    for (unsigned i = 0; i < num_remaining; i++) {
+        MockRouteAdd(remaining[i].addr, remaining[i].tp);
+    }
+}
+
+// frame lengths above 8 bytes CAN FD can carry, DLC 9 to 15
+static const uint8_t MockBusFDLens[] = {12, 16, 20, 24, 32, 48, 64};
+
+static uint8_t MockBusFDLen(unsigned len) {
+    if (len <= 8) {
+        return (uint8_t)len;
+    }
+    for (unsigned i = 0; i < sizeof(MockBusFDLens); i++) {
+        if (MockBusFDLens[i] >= len) {
+            return MockBusFDLens[i];
+        }
+    }
+    return 64;
+}
+
+static uint8_t MockBusDLC(unsigned len) {
+    for (uint8_t i = 0; i < sizeof(MockBusFDLens); i++) {
+        if (MockBusFDLens[i] == len) {
+            return 9 + i;
+        }
+    }
+    return (uint8_t)len;
+}
+
+static uint8_t MockBusStMinByte(uint32_t st_min_us) {
+    if (st_min_us > 0 && st_min_us <= 900) {
+        return (uint8_t)(0xF0 + (st_min_us + 99) / 100);
+    }
+    const uint32_t ms = (st_min_us + 999) / 1000;
+    return ms > 0x7F ? 0x7F : (uint8_t)ms;
+}
+
+// bits of a frame in the arbitration and data phases, with stuff bits
+struct MockBusBits {
+    uint32_t nominal;
+    uint32_t data;
+    bool data_phase;
+    uint8_t last;
+    uint8_t run;
+    bool crc_on;
+    uint16_t crc; // CRC-15 of classic frames
+};
+
+static void MockBusCount(struct MockBusBits *b, uint32_t n) {
+    if (b->data_phase) {
+        b->data += n;
+    } else {
+        b->nominal += n;
+    }
+}
+
+// a bit in the dynamically stuffed part of the frame
+static void MockBusBit(struct MockBusBits *b, uint8_t bit) {
+    if (b->crc_on) {
+        const bool crc_nxt = bit ^ ((b->crc >> 14) & 1U);
+        b->crc = (uint16_t)((b->crc << 1) & 0x7FFF);
+        if (crc_nxt) {
+            b->crc ^= 0x4599;
+        }
+    }
+    MockBusCount(b, 1);
+    if (b->run > 0 && bit == b->last) {
+        b->run++;
+    } else {
+        b->last = bit;
+        b->run = 1;
+    }
+    if (5 == b->run) {
+        // the stuff bit has the opposite level and starts the next run
+        MockBusCount(b, 1);
+        b->last = !bit;
+        b->run = 1;
+    }
+}
+
+static void MockBusBits(struct MockBusBits *b, uint32_t value, unsigned n) {
+    while (n-- > 0) {
+        MockBusBit(b, (value >> n) & 1U);
+    }
+}
+
+// time a frame takes the bus, ISO 11898-1 frame formats including the interframe space
+static uint64_t MockBusFrameNs(const ISOTPMockBus_t *bus, uint32_t id, const uint8_t *data,
+                               unsigned len) {
+    const bool fd = bus->cfg.tx_dl > 8;
+    const bool brs = fd && bus->cfg.data_bitrate > 0;
+    const bool ext = id > 0x7FF;
+    struct MockBusBits b = {0};
+    b.crc_on = !fd;
+
+    MockBusBit(&b, 0); // SOF
+    if (ext) {
+        MockBusBits(&b, id >> 18, 11);
+        MockBusBits(&b, 3, 2); // SRR, IDE
+        MockBusBits(&b, id & 0x3FFFF, 18);
+    } else {
+        MockBusBits(&b, id, 11);
+    }
+    if (fd) {
+        MockBusBit(&b, 0); // RRS
+        if (!ext) {
+            MockBusBit(&b, 0); // IDE
+        }
+        MockBusBits(&b, 2, 2); // FDF, res
+        MockBusBit(&b, brs);
+        b.data_phase = brs;
+        MockBusBit(&b, 0); // ESI
+    } else {
+        MockBusBits(&b, 0, 3); // RTR, IDE or r1, r0
+    }
+    MockBusBits(&b, MockBusDLC(len), 4);
+    for (unsigned i = 0; i < len; i++) {
+        MockBusBits(&b, data[i], 8);
+    }
+    if (fd) {
+        // stuff count and CRC, a fixed stuff bit before them and after every fourth bit
+        const uint32_t crc_len = len > 16 ? 21 : 17;
+        const uint32_t fixed_stuff_bits = 1 + (4 + crc_len) / 4;
+        MockBusCount(&b, 4 + crc_len + fixed_stuff_bits + 1); // + CRC delimiter
+    } else {
+        b.crc_on = false;
+        MockBusBits(&b, b.crc, 15);
+        MockBusCount(&b, 1); // CRC delimiter
+    }
+    b.data_phase = false;
+    MockBusCount(&b, 1 + 1 + 7 + 3); // ACK, ACK delimiter, EOF, intermission
+
+    uint64_t ns = (uint64_t)b.nominal * 1000000000ULL / bus->cfg.bitrate;
+    if (b.data) {
+        ns += (uint64_t)b.data * 1000000000ULL / bus->cfg.data_bitrate;
+    }
+    return ns;
+}
+
+static unsigned MockBusTxDl(const ISOTPMockBus_t *bus) {
+    return bus->cfg.tx_dl > 8 ? bus->cfg.tx_dl : 8;
+}
+
+static bool MockBusIsSingleFrame(const ISOTPMockBus_t *bus, size_t len) {
+    return len <= 7 || (MockBusTxDl(bus) > 8 && len <= MockBusTxDl(bus) - 2);
+}
+
+// payload bytes the next frame of m carries
+static size_t MockBusChunk(const ISOTPMockBus_t *bus, const struct Msg *m) {
+    const size_t tx_dl = MockBusTxDl(bus);
+    switch (m->frame) {
+    case MOCK_BUS_FIRST:
+        if (MockBusIsSingleFrame(bus, m->len)) {
+            return m->len;
+        }
+        return m->len > 4095 ? tx_dl - 6 : tx_dl - 2;
+    case MOCK_BUS_CF:
+        return m->len - m->sent < tx_dl - 1 ? m->len - m->sent : tx_dl - 1;
+    default:
+        return 0;
+    }
+}
+
+// the next frame of m on the bus, returns its length
+static unsigned MockBusNextFrame(const ISOTPMockBus_t *bus, const struct Msg *m, uint32_t *id,
+                                 uint8_t *data) {
+    const size_t chunk = MockBusChunk(bus, m);
+    unsigned n = 0;
+    *id = m->info.A_TA;
+    switch (m->frame) {
+    case MOCK_BUS_FIRST:
+        if (MockBusIsSingleFrame(bus, m->len) && m->len <= 7) {
+            data[n++] = (uint8_t)m->len;
+        } else if (MockBusIsSingleFrame(bus, m->len)) {
+            data[n++] = 0x00;
+            data[n++] = (uint8_t)m->len;
+        } else if (m->len <= 4095) {
+            data[n++] = (uint8_t)(0x10 | ((m->len >> 8) & 0x0F));
+            data[n++] = (uint8_t)m->len;
+        } else {
+            data[n++] = 0x10;
+            data[n++] = 0x00;
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                data[n++] = (uint8_t)(m->len >> shift);
             }
+        }
+        memmove(&data[n], m->buf, chunk);
+        n += chunk;
+        break;
+    case MOCK_BUS_FC:
+        *id = m->fc_id;
+        data[n++] = 0x30;
+        data[n++] = bus->cfg.fc.bs;
+        data[n++] = MockBusStMinByte(bus->cfg.fc.st_min_us);
+        break;
+    case MOCK_BUS_CF:
+        data[n++] = (uint8_t)(0x20 | m->sn);
+        memmove(&data[n], m->buf + m->sent, chunk);
+        n += chunk;
+        break;
+    default:
+        break;
+    }
 
-            if (!found) {
-                UDS_LOGW(__FILE__, "TPMock: no matching receiver for message");
+    unsigned len = bus->cfg.tx_padding ? MockBusTxDl(bus) : n;
+    if (bus->cfg.tx_dl > 8) {
+        len = MockBusFDLen(len);
+    }
+    memset(&data[n], 0xCC, len - n);
+    return len;
+}
+
+// send the next frame of m, it ends at end_ns
+static void MockBusSent(const ISOTPMockBus_t *bus, struct Msg *m, uint64_t end_ns) {
+    m->ready_ns = end_ns;
+    switch (m->frame) {
+    case MOCK_BUS_FIRST:
+        if (MockBusIsSingleFrame(bus, m->len) || 0 == m->fc_id) {
+            // nobody answers a first frame without a receiver, the message is lost
+            m->frame = MOCK_BUS_DONE;
+        } else {
+            m->sent = MockBusChunk(bus, m);
+            m->sn = 1;
+            m->frame = MOCK_BUS_FC;
+        }
+        break;
+    case MOCK_BUS_FC:
+        m->block_left = bus->cfg.fc.bs;
+        m->frame = MOCK_BUS_CF;
+        break;
+    case MOCK_BUS_CF:
+        m->sent += MockBusChunk(bus, m);
+        m->sn = (m->sn + 1) & 0x0F;
+        if (m->sent >= m->len) {
+            m->frame = MOCK_BUS_DONE;
+        } else if (m->block_left > 0 && 0 == --m->block_left) {
+            m->frame = MOCK_BUS_FC;
+        } else {
+            m->ready_ns = end_ns + (uint64_t)bus->cfg.fc.st_min_us * 1000U;
+        }
+        break;
+    default:
+        break;
+    }
+    if (MOCK_BUS_DONE == m->frame) {
+        const uint64_t done_ms = (end_ns + 999999U) / 1000000U;
+        m->scheduled_tx_time = bus->origin_ms + (uint32_t)done_ms;
+        m->rx_time_ns = (uint64_t)bus->origin_ms * 1000000U + end_ns;
+    }
+}
+
+// send the frames that start on the bus before now_ns
+static void MockBusRun(ISOTPMockBus_t *bus, uint64_t now_ns) {
+    for (;;) {
+        // the oldest unfinished message of every sender on the bus competes
+        struct Msg *contenders[UDS_ISOTP_MOCK_QUEUE_LEN];
+        unsigned num_contenders = 0;
+        uint64_t start_ns = UINT64_MAX;
+        BusScan++;
+        for (unsigned i = 0; i < MsgCount; i++) {
+            struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+            if (m->sender->bus != bus || MOCK_BUS_DONE == m->frame ||
+                m->sender->bus_scan == BusScan) {
+                continue;
+            }
+            m->sender->bus_scan = BusScan;
+            contenders[num_contenders++] = m;
+            const uint64_t t = m->ready_ns > bus->free_ns ? m->ready_ns : bus->free_ns;
+            if (t < start_ns) {
+                start_ns = t;
             }
+        }
+        if (0 == num_contenders || start_ns >= now_ns) {
+            // a frame sent from now on may still win arbitration
+            return;
+        }
 
-            for (unsigned j = i + 1; j < MsgCount; j++) {
-                msgs[j - 1] = msgs[j];
+        // the lowest ID among the frames ready at start_ns wins arbitration
+        struct Msg *winner = NULL;
+        uint32_t winner_id = 0;
+        unsigned winner_len = 0;
+        uint8_t winner_data[64];
+        for (unsigned i = 0; i < num_contenders; i++) {
+            if (contenders[i]->ready_ns > start_ns) {
+                continue;
             }
-            MsgCount--;
-            i--;
+            uint32_t id = 0;
+            uint8_t data[64];
+            const unsigned len = MockBusNextFrame(bus, contenders[i], &id, data);
+            if (NULL == winner || id < winner_id) {
+                winner = contenders[i];
+                winner_id = id;
+                winner_len = len;
+                memmove(winner_data, data, len);
+            }
+        }
+        const uint64_t end_ns = start_ns + MockBusFrameNs(bus, winner_id, winner_data, winner_len);
+        bus->free_ns = end_ns;
+        bus->busy_ns += end_ns - start_ns;
+        bus->num_frames++;
+        MockBusSent(bus, winner, end_ns);
+    }
+}
+
+static uint64_t MockBusNow(const ISOTPMockBus_t *bus) {
+    return (uint64_t)(uint32_t)(UDSMillis() - bus->origin_ms) * 1000000U;
+}
+
+// delivery is due: the message arrived on a bus, or the scheduled millisecond passed
+static bool MockDue(const struct Msg *m, uint32_t now) {
+    if (m->sender->bus) {
+        return MOCK_BUS_DONE == m->frame && !UDSTimeAfter(m->scheduled_tx_time, now);
+    }
+    return UDSTimeAfter(now, m->scheduled_tx_time);
+}
+
+// a receiver that holds back an older message takes no newer ones in this pass
+static bool MockRxFull(const ISOTPMock_t *tp) {
+    return tp->rx_count == UDS_ISOTP_MOCK_RX_FIFO_LEN || tp->blocked_pass == NetworkPass;
+}
+
+// copy m into the rx_fifo of every receiver. A message to a single receiver waits while its
+// rx_fifo is full, receivers sharing the address each get it unless their rx_fifo is full.
+static bool MockDeliver(struct Msg *m) {
+    const uint32_t addr = m->info.A_TA;
+    unsigned num_receivers = 0;
+    ISOTPMock_t *receiver = NULL;
+    for (uint32_t slot = MockRouteSlot(addr); Routes[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) {
+        if (Routes[slot].addr == addr) {
+            receiver = Routes[slot].tp;
+            num_receivers++;
+        }
+    }
+    if (0 == num_receivers) {
+        UDS_LOGW(__FILE__, "TPMock: no matching receiver for message");
+        return true;
+    }
+    if (1 == num_receivers && MockRxFull(receiver)) {
+        receiver->blocked_pass = NetworkPass;
+        return false;
+    }
+
+    for (uint32_t slot = MockRouteSlot(addr); Routes[slot].tp;
+         slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) {
+        ISOTPMock_t *tp = Routes[slot].tp;
+        if (Routes[slot].addr != addr) {
+            continue;
+        }
+        // one receiver that isn't read doesn't hold up the others
+        if (MockRxFull(tp)) {
+            UDS_LOGW(__FILE__, "%s: rx_fifo full, dropping message to TA=0x%03X", tp->name, addr);
+            tp->rx_dropped++;
+            continue;
         }
+
+        UDS_LOGD(__FILE__, "%s receives %ld bytes from TA=0x%03X (A_TA_Type=%s):", tp->name,
+                 m->len, m->info.A_TA,
+                 m->info.A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "PHYSICAL" : "FUNCTIONAL");
+        UDS_LOG_SDU(__FILE__, m->buf, m->len, &(m->info));
+
+        ISOTPMockRxMsg_t *rx =
+            &tp->rx_fifo[(tp->rx_head + tp->rx_count) % UDS_ISOTP_MOCK_RX_FIFO_LEN];
+        memmove(rx->buf, m->buf, m->len);
+        rx->len = m->len;
+        rx->info = m->info;
+        // the simulated arrival, not the time it was polled
+        rx->info.rx_time_ns = m->rx_time_ns;
+        tp->rx_count++;
     }
+    return true;
+}
+
+// deliver the messages that are due, linear in the number of queued messages and receivers
+static void NetworkPoll(void) {
+    if (0 == MsgCount) {
+        return;
+    }
+    const uint32_t now = UDSMillis();
+    const unsigned count = MsgCount;
+    unsigned kept = 0;
+    NetworkPass++;
+    for (unsigned i = 0; i < count; i++) {
+        ISOTPMockBus_t *bus = msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN].sender->bus;
+        if (bus && bus->pass != NetworkPass) {
+            bus->pass = NetworkPass;
+            MockBusRun(bus, MockBusNow(bus));
+        }
+    }
+    for (unsigned i = 0; i < count; i++) {
+        struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+        if (MockDue(m, now) && MockDeliver(m)) {
+            m->sender->tx_pending--;
+        } else {
+            msgs[(MsgHead + kept) % UDS_ISOTP_MOCK_QUEUE_LEN] = *m;
+            kept++;
+        }
+    }
+    MsgCount = kept;
 }
 
 static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ISOTPMock_t *tp = (ISOTPMock_t *)hdl;
-    if (MsgCount >= NUM_MSGS) {
+    if (MsgCount >= UDS_ISOTP_MOCK_QUEUE_LEN) {
         UDS_LOGW(__FILE__, "mock_tp_send: too many messages in the queue");
         return -1;
     }
-    struct Msg *m = &msgs[MsgCount++];
+    struct Msg *m = &msgs[(MsgHead + MsgCount) % UDS_ISOTP_MOCK_QUEUE_LEN];
     UDSTpAddr_t ta_type =
         info == NULL ? (UDSTpAddr_t)UDS_A_TA_TYPE_PHYSICAL : (UDSTpAddr_t)info->A_TA_Type;
+    memset(&m->info, 0, sizeof(m->info));
     m->len = len;
     m->info.A_AE = info == NULL ? 0 : info->A_AE;
     if (UDS_A_TA_TYPE_PHYSICAL == ta_type) {
@@ -80,10 +492,8 @@ static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_
         m->info.A_SA = tp->sa_phys;
     } else if (UDS_A_TA_TYPE_FUNCTIONAL == ta_type) {
 
-        // This condition is only true for standard CAN.
-        // Technically CAN-FD may also be used in ISO-TP.
-        // TODO: add profiles to isotp_mock
-        if (len > 7) {
+        // functional requests are single frames, CAN FD ones only on a bus configured for it
+        if (tp->bus ? !MockBusIsSingleFrame(tp->bus, len) : len > 7) {
             UDS_LOGW(__FILE__, "mock_tp_send: functional message too long: %ld", len);
             return -1;
         }
@@ -95,7 +505,27 @@ static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_
     }
     m->info.A_TA_Type = ta_type;
     m->scheduled_tx_time = UDSMillis() + tp->send_tx_delay_ms;
-    memmove(m->buf, buf, len);
+    // NetworkPoll delivers in the millisecond after the scheduled time, MockBusSent stamps bus ones
+    m->rx_time_ns = (uint64_t)(m->scheduled_tx_time + 1) * 1000000U;
+    m->buf = buf;
+    m->sender = tp;
+    m->frame = MOCK_BUS_FIRST;
+    m->sent = 0;
+    m->fc_id = 0;
+    if (tp->bus) {
+        m->ready_ns = MockBusNow(tp->bus);
+        // the receiver answers first frames with flow control
+        for (uint32_t slot = MockRouteSlot(m->info.A_TA); Routes[slot].tp;
+             slot = (slot + 1) & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) {
+            if (UDS_A_TA_TYPE_PHYSICAL == ta_type && Routes[slot].addr == m->info.A_TA &&
+                Routes[slot].tp->sa_phys == m->info.A_TA) {
+                m->fc_id = Routes[slot].tp->ta_phys;
+                break;
+            }
+        }
+    }
+    MsgCount++;
+    tp->tx_pending++;
 
     UDS_LOGD(__FILE__, "%s sends %ld bytes to TA=0x%03X (A_TA_Type=%s):", tp->name, len,
              m->info.A_TA, m->info.A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "PHYSICAL" : "FUNCTIONAL");
@@ -104,52 +534,131 @@ static ssize_t mock_tp_send(struct UDSTp *hdl, uint8_t *buf, size_t len, UDSSDU_
     return len;
 }
 
+static void MockRxPop(ISOTPMock_t *tp) {
+    if (tp->rx_count > 0) {
+        tp->rx_head = (tp->rx_head + 1) % UDS_ISOTP_MOCK_RX_FIFO_LEN;
+        tp->rx_count--;
+        // a message may have been waiting for the room
+        NetworkPoll();
+    }
+}
+
 static ssize_t mock_tp_recv(struct UDSTp *hdl, uint8_t *buf, size_t bufsize, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ISOTPMock_t *tp = (ISOTPMock_t *)hdl;
-    if (tp->recv_len == 0) {
+    if (tp->rx_count == 0) {
         return 0;
     }
-    if (bufsize < tp->recv_len) {
-        UDS_LOGW(__FILE__, "mock_tp_recv: buffer too small: %ld < %ld", bufsize, tp->recv_len);
+    const ISOTPMockRxMsg_t *rx = &tp->rx_fifo[tp->rx_head];
+    if (bufsize < rx->len) {
+        UDS_LOGW(__FILE__, "mock_tp_recv: buffer too small: %ld < %ld", bufsize, rx->len);
         return -1;
     }
-    ssize_t len = (ssize_t)tp->recv_len;
-    memmove(buf, tp->recv_buf, tp->recv_len);
+    ssize_t len = (ssize_t)rx->len;
+    memmove(buf, rx->buf, rx->len);
     if (info) {
-        *info = tp->recv_info;
+        *info = rx->info;
     }
-    tp->recv_len = 0;
+    MockRxPop(tp);
     return len;
 }
 
+static ssize_t mock_tp_peek(struct UDSTp *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    ISOTPMock_t *tp = (ISOTPMock_t *)hdl;
+    if (tp->rx_count == 0) {
+        return 0;
+    }
+    ISOTPMockRxMsg_t *rx = &tp->rx_fifo[tp->rx_head];
+    *buf = rx->buf;
+    if (info) {
+        *info = rx->info;
+    }
+    return (ssize_t)rx->len;
+}
+
+static void mock_tp_release(struct UDSTp *hdl) {
+    UDS_ASSERT(hdl);
+    MockRxPop((ISOTPMock_t *)hdl);
+}
+
 static UDSTpStatus_t mock_tp_poll(struct UDSTp *hdl) {
-    (void)hdl; // unused parameter
     NetworkPoll();
-    // todo: make this status reflect TX time
+    // the sender's buffer is in use until the message is delivered
+    if (((ISOTPMock_t *)hdl)->tx_pending) {
+        return UDS_TP_SEND_IN_PROGRESS;
+    }
     return UDS_TP_IDLE;
 }
 
+static bool mock_tp_next_deadline(struct UDSTp *hdl, uint32_t *deadline_ms) {
+    (void)hdl;
+    // the mock has no file descriptors, every tp on the network is woken by its next delivery
+    NetworkPoll();
+    const uint32_t now = UDSMillis();
+    bool pending = false;
+    for (unsigned i = 0; i < MsgCount; i++) {
+        const struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+        uint32_t t = 0;
+        if (m->sender->bus && MOCK_BUS_DONE != m->frame) {
+            // the bus is simulated millisecond by millisecond
+            t = now + 1;
+        } else if (MockDue(m, now)) {
+            // due, but waiting until the receiver reads its rx_fifo
+            continue;
+        } else {
+            // NetworkPoll delivers once UDSMillis() reaches the arrival on a bus, otherwise once
+            // it is after the scheduled time
+            t = m->sender->bus ? m->scheduled_tx_time : m->scheduled_tx_time + 1;
+        }
+        if (!pending || UDSTimeAfter(*deadline_ms, t)) {
+            *deadline_ms = t;
+        }
+        pending = true;
+    }
+    return pending;
+}
+
 static_assert(offsetof(ISOTPMock_t, hdl) == 0, "ISOTPMock_t must not have any members before hdl");
 
 static void ISOTPMockAttach(ISOTPMock_t *tp, ISOTPMockArgs_t *args) {
     UDS_ASSERT(tp);
     UDS_ASSERT(args);
-    UDS_ASSERT(TPCount < MAX_NUM_TP);
+    UDS_ASSERT(TPCount < UDS_ISOTP_MOCK_MAX_TPS);
     TPs[TPCount++] = tp;
     tp->hdl.send = mock_tp_send;
     tp->hdl.recv = mock_tp_recv;
     tp->hdl.poll = mock_tp_poll;
+    tp->hdl.peek = mock_tp_peek;
+    tp->hdl.release = mock_tp_release;
+    tp->hdl.next_deadline = mock_tp_next_deadline;
     tp->sa_func = args->sa_func;
     tp->sa_phys = args->sa_phys;
     tp->ta_func = args->ta_func;
     tp->ta_phys = args->ta_phys;
-    tp->recv_len = 0;
+    tp->rx_head = 0;
+    tp->rx_count = 0;
+    tp->tx_pending = 0;
+    tp->bus_scan = 0;
+    tp->bus = args->bus;
+    MockRouteAdd(tp->sa_phys, tp);
+    MockRouteAdd(tp->sa_func, tp);
     UDS_LOGV(__FILE__, "attached %s. TPCount: %d", tp->name, TPCount);
 }
 
 static void ISOTPMockDetach(ISOTPMock_t *tp) {
     UDS_ASSERT(tp);
+    // drop undelivered messages, their buffers go away with the sender
+    unsigned kept = 0;
+    for (unsigned i = 0; i < MsgCount; i++) {
+        const struct Msg *m = &msgs[(MsgHead + i) % UDS_ISOTP_MOCK_QUEUE_LEN];
+        if (m->sender != tp) {
+            msgs[(MsgHead + kept) % UDS_ISOTP_MOCK_QUEUE_LEN] = *m;
+            kept++;
+        }
+    }
+    MsgCount = kept;
+    MockRouteRemove(tp);
     for (unsigned i = 0; i < TPCount; i++) {
         if (TPs[i] == tp) {
             for (unsigned j = i + 1; j < TPCount; j++) {
@@ -164,7 +673,7 @@ static void ISOTPMockDetach(ISOTPMock_t *tp) {
 }
 
 UDSTp_t *ISOTPMockNew(const char *name, ISOTPMockArgs_t *args) {
-    if (TPCount >= MAX_NUM_TP) {
+    if (TPCount >= UDS_ISOTP_MOCK_MAX_TPS) {
         UDS_LOGI(__FILE__, "TPCount: %d, too many TPs\n", TPCount);
         return NULL;
     }
@@ -210,10 +719,21 @@ void ISOTPMockLogToStdout(void) {
 void ISOTPMockReset(void) {
     memset(TPs, 0, sizeof(TPs));
     TPCount = 0;
+    memset(Routes, 0, sizeof(Routes));
     memset(msgs, 0, sizeof(msgs));
+    MsgHead = 0;
     MsgCount = 0;
 }
 
+void ISOTPMockBusInit(ISOTPMockBus_t *bus, const ISOTPMockBusConfig_t *cfg) {
+    UDS_ASSERT(bus);
+    UDS_ASSERT(cfg);
+    UDS_ASSERT(cfg->bitrate > 0);
+    memset(bus, 0, sizeof(*bus));
+    bus->cfg = *cfg;
+    bus->origin_ms = UDSMillis();
+}
+
 void ISOTPMockFree(UDSTp_t *tp) {
     ISOTPMock_t *tpm = (ISOTPMock_t *)tp;
     ISOTPMockDetach(tpm);
@@ -10,12 +10,74 @@
 
 #include "iso14229.h"
 
+/** Maximum number of mock transports in a process */
+#ifndef UDS_ISOTP_MOCK_MAX_TPS
+#define UDS_ISOTP_MOCK_MAX_TPS (128)
+#endif
+
+/** Messages in flight on the mock network. A message to a single receiver stays queued until the
+ * receiver has room for it, its sender's buffer is borrowed until then. */
+#ifndef UDS_ISOTP_MOCK_QUEUE_LEN
+#define UDS_ISOTP_MOCK_QUEUE_LEN (UDS_ISOTP_MOCK_MAX_TPS)
+#endif
+
+/** Received messages a mock transport holds until they are read */
+#ifndef UDS_ISOTP_MOCK_RX_FIFO_LEN
+#define UDS_ISOTP_MOCK_RX_FIFO_LEN (4)
+#endif
+
+/** Size of the address hash table. Must be a power of two and at least
+ * 4 * UDS_ISOTP_MOCK_MAX_TPS so that the table stays at most half full. */
+#ifndef UDS_ISOTP_MOCK_TABLE_SIZE
+#define UDS_ISOTP_MOCK_TABLE_SIZE (512)
+#endif
+
+static_assert((UDS_ISOTP_MOCK_TABLE_SIZE & (UDS_ISOTP_MOCK_TABLE_SIZE - 1)) == 0,
+              "UDS_ISOTP_MOCK_TABLE_SIZE must be a power of two");
+static_assert(UDS_ISOTP_MOCK_TABLE_SIZE >= 4 * UDS_ISOTP_MOCK_MAX_TPS,
+              "UDS_ISOTP_MOCK_TABLE_SIZE too small");
+
+typedef struct {
+    uint32_t bitrate;      // nominal bit rate in bit/s, e.g. 500000
+    uint32_t data_bitrate; // CAN FD data phase bit rate in bit/s, 0: no bit rate switch
+    uint8_t tx_dl;         // payload bytes per frame: 0 or 8: classic CAN, 12..64: CAN FD
+    bool tx_padding;       // pad frames to tx_dl bytes
+    UDSISOTpFCParams_t fc; // flow control sent by every receiver, bs and st_min_us are used
+} ISOTPMockBusConfig_t;
+
+/**
+ * @brief A simulated CAN bus shared by mock transports
+ * @details Messages are split into ISO-TP frames that take the bus for their length in bits,
+ * including stuff bits and the interframe space. Receivers answer with flow control frames and
+ * senders honor BS and STmin. When several frames are ready the lowest CAN ID wins arbitration.
+ * Addresses above 0x7FF are sent with 29 bit IDs. Time runs on UDSMillis().
+ * Bus load over a time span is the growth of busy_ns divided by its length.
+ */
+typedef struct ISOTPMockBus {
+    ISOTPMockBusConfig_t cfg;
+    uint32_t origin_ms; // UDSMillis() at time 0 of the bus
+    uint64_t free_ns;   // end of the last frame
+    uint64_t busy_ns;   // time the bus spent sending frames
+    uint32_t num_frames;
+    uint32_t pass; // network pass in which the bus was simulated last
+} ISOTPMockBus_t;
+
+typedef struct {
+    uint8_t buf[UDS_TP_MTU];
+    size_t len;
+    UDSSDU_t info;
+} ISOTPMockRxMsg_t;
+
 typedef struct ISOTPMock {
     UDSTp_t hdl;
-    uint8_t recv_buf[UDS_TP_MTU];
-    uint8_t send_buf[UDS_TP_MTU];
-    size_t recv_len;
-    UDSSDU_t recv_info;
+    ISOTPMockRxMsg_t rx_fifo[UDS_ISOTP_MOCK_RX_FIFO_LEN];
+    unsigned rx_head;          // oldest received message
+    unsigned rx_count;         // received messages not read yet
+    unsigned tx_pending;       // sent messages still on the network
+    uint32_t blocked_pass;     // network pass in which a message waited for room in rx_fifo
+    unsigned rx_dropped;       // messages to a shared address dropped while rx_fifo was full
+    uint32_t bus_scan;         // bus simulation step that found its oldest message
+    ISOTPMockBus_t *bus;       // NULL: messages arrive after send_tx_delay_ms
     uint32_t sa_phys;          // source address - physical messages are sent from this address
     uint32_t ta_phys;          // target address - physical messages are sent to this address
     uint32_t sa_func;          // source address - functional messages are sent from this address
@@ -30,17 +92,31 @@ typedef struct {
     uint32_t ta_phys; // target address - physical messages are sent to this address
     uint32_t sa_func; // source address - functional messages are sent from this address
     uint32_t ta_func; // target address - functional messages are sent to this address
+    ISOTPMockBus_t *bus; // simulated bus to send on, NULL: messages arrive after send_tx_delay_ms
 } ISOTPMockArgs_t;
 
 /**
  * @brief Create a mock transport. It is connected by default to a broadcast network of all other
  * mock transports in the same process.
+ * @details Messages are routed by target address to every transport whose sa_phys or sa_func
+ * matches. Nothing is dropped while a receiver is busy: messages wait in its rx_fifo and, once
+ * that is full, on the network. Only a message to an address several transports share, e.g. a
+ * functional request, is dropped for a receiver with a full rx_fifo and counted in rx_dropped, so
+ * one transport that is never read doesn't stop the others.
  * @param name optional name of the transport (can be NULL)
  * @return UDSTp_t*
  */
 UDSTp_t *ISOTPMockNew(const char *name, ISOTPMockArgs_t *args);
 void ISOTPMockFree(UDSTp_t *tp);
 
+/**
+ * @brief Initialize a simulated bus, pass it in ISOTPMockArgs_t.bus of the transports on it
+ * @details Transports on a bus send their messages one after the other. Messages are still
+ * routed to every mock transport, bus or not, so a bus should only connect transports that talk
+ * to each other.
+ */
+void ISOTPMockBusInit(ISOTPMockBus_t *bus, const ISOTPMockBusConfig_t *cfg);
+
 /**
  * @brief write all messages to a file
  * @note uses UDSMillis() to get the current time
@@ -3,6 +3,7 @@
 #include "tp/isotp_sock.h"
 #include "uds.h"
 #include "log.h"
+#include "util.h"
 #include <string.h>
 #include <errno.h>
 #include <linux/can.h>
@@ -15,71 +16,99 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+// take the asynchronous error pending on fd, e.g. ECOMM when no flow control frame arrived
+static int TakeSocketError(int fd) {
+    int pending_err = 0;
+    socklen_t len = sizeof(pending_err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &pending_err, &len) || !pending_err) {
+        UDS_LOGE(__FILE__, "POLLERR was set, but no error returned via SO_ERROR?");
+        return 0;
+    }
+    switch (pending_err) {
+    case ECOMM:
+        UDS_LOGE(__FILE__, "ECOMM: Communication error on send");
+        break;
+    default:
+        UDS_LOGE(__FILE__, "Asynchronous socket error: %s (%d)", strerror(pending_err),
+                 pending_err);
+        break;
+    }
+    return pending_err;
+}
+
+// The kernel aborts a transmission with ECOMM (no flow control), EMSGSIZE (FC.OVFLW) or EBADMSG
+// (bad flow control). ETIMEDOUT and EILSEQ end a reception on the same socket.
+static bool IsSendError(int err) { return ECOMM == err || EMSGSIZE == err || EBADMSG == err; }
+
 static UDSTpStatus_t isotp_sock_tp_poll(UDSTp_t *hdl) {
     UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
     UDSTpStatus_t status = 0;
-    int ret = 0;
-    int fds[2] = {impl->phys_fd, impl->func_fd};
     struct pollfd pfds[2] = {0};
     pfds[0].fd = impl->phys_fd;
-    pfds[0].events = POLLERR | POLLOUT;
-    pfds[0].revents = 0;
-
+    pfds[0].events = POLLIN;
     pfds[1].fd = impl->func_fd;
-    pfds[1].events = POLLERR | POLLOUT;
-    pfds[1].revents = 0;
+    pfds[1].events = POLLIN;
 
-    ret = poll(pfds, 2, 1);
+    // The kernel ISO-TP driver suppresses POLLOUT while tx.state != ISOTP_IDLE, so POLLOUT
+    // coming back marks the end of the transmission.
+    // See: https://lore.kernel.org/all/20230331125511.372783-1-michal.sojka@cvut.cz/
+    if (impl->send_in_progress) {
+        pfds[0].events |= POLLOUT;
+    }
+
+    // POLLERR is always reported
+    int ret = poll(pfds, 2, impl->poll_timeout_ms);
     if (ret < 0) {
-        UDS_LOGE(__FILE__, "poll failed: %d", ret);
-        status |= UDS_TP_ERR;
-    } else if (ret == 0) {
-        ; // timeout, no events
-    } else {
-        // poll() returned with events
-        for (int i = 0; i < 2; i++) {
-            struct pollfd pfd = pfds[i];
-
-            // Check for errors
-            if (pfd.revents & POLLERR) {
-                int pending_err = 0;
-                socklen_t len = sizeof(pending_err);
-                if (!getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &pending_err, &len) && pending_err) {
-                    switch (pending_err) {
-                    case ECOMM:
-                        UDS_LOGE(__FILE__, "ECOMM: Communication error on send");
-                        status |= UDS_TP_ERR;
-                        break;
-                    default:
-                        UDS_LOGE(__FILE__, "Asynchronous socket error: %s (%d)",
-                                 strerror(pending_err), pending_err);
-                        status |= UDS_TP_ERR;
-                        break;
-                    }
-                } else {
-                    UDS_LOGE(__FILE__, "POLLERR was set, but no error returned via SO_ERROR?");
-                }
+        if (EINTR != errno) {
+            UDS_LOGE(__FILE__, "poll failed: %d", ret);
+            status |= UDS_TP_ERR;
+        }
+    } else if (ret > 0) {
+        if (pfds[0].revents & POLLERR) {
+            int err = TakeSocketError(impl->phys_fd);
+            if (err) {
+                status |= UDS_TP_ERR;
             }
-
-            // Check if send is in progress on physical socket
-            // Only check the physical socket (not functional) since that's what sends multi-frame
-            if (fds[i] == impl->phys_fd && pfd.revents != 0) {
-                // When POLLOUT is NOT set but other events are present, the socket cannot accept
-                // writes because a multi-frame transmission is in progress.
-                // See: https://lore.kernel.org/all/20230331125511.372783-1-michal.sojka@cvut.cz/
-                // The kernel ISO-TP driver suppresses POLLOUT when tx.state != ISOTP_IDLE
-                if (!(pfd.revents & POLLOUT)) {
-                    status |= UDS_TP_SEND_IN_PROGRESS;
-                }
+            // a failed reception doesn't end the message being sent
+            if (IsSendError(err)) {
+                impl->send_in_progress = false;
             }
         }
+        if ((pfds[1].revents & POLLERR) && TakeSocketError(impl->func_fd)) {
+            status |= UDS_TP_ERR;
+        }
+        if (pfds[0].revents & POLLOUT) {
+            impl->send_in_progress = false;
+        }
+    }
+
+    if (impl->send_in_progress) {
+        status |= UDS_TP_SEND_IN_PROGRESS;
     }
     return status;
 }
 
-static ssize_t tp_recv_once(int fd, uint8_t *buf, size_t size) {
-    ssize_t ret = read(fd, buf, size);
-    if (ret < 0) {
+// read one message and the time the kernel received its last frame
+static ssize_t tp_recv_once(int fd, uint8_t *buf, size_t size, uint64_t *rx_time_ns) {
+    struct iovec iov = {.iov_base = buf, .iov_len = size};
+    uint64_t control[(CMSG_SPACE(sizeof(struct timespec)) + 7) / 8]; // aligned for cmsghdr
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t ret = recvmsg(fd, &msg, 0);
+    if (ret > 0) {
+        *rx_time_ns = 0;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (SOL_SOCKET == c->cmsg_level && SCM_TIMESTAMPNS == c->cmsg_type) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                *rx_time_ns = UDSRealtimeToMonotonicNs(&ts);
+            }
+        }
+    } else if (ret < 0) {
         if (EAGAIN == errno || EWOULDBLOCK == errno) {
             ret = 0;
         } else {
@@ -99,13 +128,13 @@ static ssize_t isotp_sock_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UD
     UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
     UDSSDU_t *msg = &impl->recv_info;
 
-    ret = tp_recv_once(impl->phys_fd, buf, bufsize);
+    ret = tp_recv_once(impl->phys_fd, buf, bufsize, &msg->rx_time_ns);
     if (ret > 0) {
         msg->A_TA = impl->phys_sa;
         msg->A_SA = impl->phys_ta;
         msg->A_TA_Type = UDS_A_TA_TYPE_PHYSICAL;
     } else {
-        ret = tp_recv_once(impl->func_fd, buf, bufsize);
+        ret = tp_recv_once(impl->func_fd, buf, bufsize, &msg->rx_time_ns);
         if (ret > 0) {
             msg->A_TA = impl->func_sa;
             msg->A_SA = impl->func_ta;
@@ -120,12 +149,70 @@ static ssize_t isotp_sock_tp_recv(UDSTp_t *hdl, uint8_t *buf, size_t bufsize, UD
 
         UDS_LOGD(__FILE__, "'%s' received %ld bytes from 0x%03x (%s), ", impl->tag, ret, msg->A_TA,
                  msg->A_TA_Type == UDS_A_TA_TYPE_PHYSICAL ? "phys" : "func");
-        UDS_LOG_SDU(__FILE__, impl->recv_buf, ret, msg);
+        UDS_LOG_SDU(__FILE__, buf, ret, msg);
     }
 
     return ret;
 }
 
+static ssize_t isotp_sock_tp_peek(UDSTp_t *hdl, uint8_t **buf, UDSSDU_t *info) {
+    UDS_ASSERT(hdl);
+    UDS_ASSERT(buf);
+    UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
+
+    // the kernel reassembles the message, read it once into recv_buf and lend it from there
+    if (0 == impl->recv_len) {
+        ssize_t ret = isotp_sock_tp_recv(hdl, impl->recv_buf, sizeof(impl->recv_buf), NULL);
+        if (ret <= 0) {
+            return ret;
+        }
+        impl->recv_len = (size_t)ret;
+    }
+    if (info) {
+        *info = impl->recv_info;
+    }
+    *buf = impl->recv_buf;
+    return (ssize_t)impl->recv_len;
+}
+
+static void isotp_sock_tp_release(UDSTp_t *hdl) {
+    UDS_ASSERT(hdl);
+    UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
+    impl->recv_len = 0;
+}
+
+static int isotp_sock_tp_get_fds(UDSTp_t *hdl, UDSTpFd_t *fds, int max_fds) {
+    UDS_ASSERT(hdl);
+    UDSTpIsoTpSock_t *impl = (UDSTpIsoTpSock_t *)hdl;
+    // while peek() lends recv_buf nothing more is read, so don't wake up for readable sockets
+    int read_events = impl->recv_len ? 0 : UDS_TP_FD_READ;
+    int n = 0;
+    if (n < max_fds) {
+        fds[n].fd = impl->phys_fd;
+        fds[n].events = read_events | (impl->send_in_progress ? UDS_TP_FD_WRITE : 0);
+        n++;
+    }
+    if (n < max_fds) {
+        fds[n].fd = impl->func_fd;
+        fds[n].events = read_events;
+        n++;
+    }
+    return n;
+}
+
+static bool isotp_sock_tp_next_deadline(UDSTp_t *hdl, uint32_t *deadline_ms) {
+    // the kernel runs the ISO-TP timers, completion shows up as socket events
+    (void)hdl;
+    (void)deadline_ms;
+    return false;
+}
+
+// largest functional message, it has to fit into a single frame
+static size_t SingleFrameMax(const UDSTpIsoTpSockOpts_t *opts) {
+    // CAN FD single frames longer than 8 bytes use a two byte PCI
+    return opts->tx_dl > 8 ? opts->tx_dl - 2U : 7U;
+}
+
 static ssize_t isotp_sock_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU_t *info) {
     UDS_ASSERT(hdl);
     ssize_t ret = -1;
@@ -136,7 +223,7 @@ static ssize_t isotp_sock_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU
     if (UDS_A_TA_TYPE_PHYSICAL == ta_type) {
         fd = impl->phys_fd;
     } else if (UDS_A_TA_TYPE_FUNCTIONAL == ta_type) {
-        if (len > 7) {
+        if (len > SingleFrameMax(&impl->opts)) {
             UDS_LOGI(__FILE__, "UDSTpIsoTpSock: functional request too large");
             return -1;
         }
@@ -148,6 +235,9 @@ static ssize_t isotp_sock_tp_send(UDSTp_t *hdl, uint8_t *buf, size_t len, UDSSDU
     ret = write(fd, buf, len);
     if (ret < 0) {
         perror("write");
+    } else if (fd == impl->phys_fd) {
+        // complete once the kernel reports POLLOUT again, see isotp_sock_tp_poll
+        impl->send_in_progress = true;
     }
 done:;
     int ta = ta_type == UDS_A_TA_TYPE_PHYSICAL ? impl->phys_ta : impl->func_ta;
@@ -158,7 +248,28 @@ done:;
     return ret;
 }
 
-static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool functional) {
+static const UDSISOTpFCParams_t DefaultFCParams = {
+    .bs = 0x10,
+    .st_min_us = 3000,
+    .n_bs_us = 1000000,
+    .n_cr_us = 1000000,
+    .wft_max = 0,
+};
+
+// encode STmin for a flow control frame, rounding up
+static uint8_t StMinByte(uint32_t st_min_us) {
+    if (st_min_us == 0) {
+        return 0;
+    }
+    if (st_min_us < 1000) {
+        return (uint8_t)(0xF0 + (st_min_us + 99) / 100);
+    }
+    uint32_t ms = (st_min_us + 999) / 1000;
+    return ms > 0x7F ? 0x7F : (uint8_t)ms;
+}
+
+static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool functional,
+                         const UDSISOTpFCParams_t *fc_params, const UDSTpIsoTpSockOpts_t *ll) {
     int fd = 0;
     if ((fd = socket(AF_CAN, SOCK_DGRAM | SOCK_NONBLOCK, CAN_ISOTP)) < 0) {
         perror("Socket");
@@ -166,13 +277,19 @@ static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool
     }
 
     struct can_isotp_fc_options fcopts = {
-        .bs = 0x10,
-        .stmin = 3,
-        .wftmax = 0,
+        .bs = fc_params->bs,
+        .stmin = StMinByte(fc_params->st_min_us),
+        .wftmax = fc_params->wft_max,
     };
     if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fcopts, sizeof(fcopts)) < 0) {
         perror("setsockopt");
-        return -1;
+        goto fail;
+    }
+
+    // timestamp received messages, see tp_recv_once
+    const int enable = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        perror("setsockopt (SO_TIMESTAMPNS):");
     }
 
     struct can_isotp_options opts;
@@ -183,18 +300,44 @@ static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool
         // configure the socket as listen-only to avoid sending FC frames
         opts.flags |= CAN_ISOTP_LISTEN_MODE;
     }
+    opts.frame_txtime = ll->frame_txtime_ns;
+    if (ll->tx_padding) {
+        opts.flags |= CAN_ISOTP_TX_PADDING;
+        opts.txpad_content = ll->tx_pad_content;
+    }
+    if (ll->force_tx_stmin) {
+        opts.flags |= CAN_ISOTP_FORCE_TXSTMIN;
+        uint32_t tx_stmin_ns = ll->tx_stmin_us * 1000U;
+        if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_TX_STMIN, &tx_stmin_ns, sizeof(tx_stmin_ns)) <
+            0) {
+            perror("setsockopt (tx_stmin):");
+            goto fail;
+        }
+    }
 
     if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts)) < 0) {
         perror("setsockopt (isotp_options):");
-        return -1;
+        goto fail;
+    }
+
+    if (ll->tx_dl > 8 || ll->tx_flags) {
+        struct can_isotp_ll_options llopts = {
+            .mtu = CANFD_MTU,
+            .tx_dl = ll->tx_dl ? ll->tx_dl : 8,
+            .tx_flags = ll->tx_flags,
+        };
+        if (setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_LL_OPTS, &llopts, sizeof(llopts)) < 0) {
+            UDS_LOGE(__FILE__, "setsockopt (ll_options): %s, tx_dl %u", strerror(errno),
+                     llopts.tx_dl);
+            goto fail;
+        }
     }
 
     struct ifreq ifr;
     memset(&ifr, 0, sizeof(ifr));
     if (snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", if_name) >= (int)sizeof(ifr.ifr_name)) {
         UDS_LOGE(__FILE__, "Interface name too long");
-        close(fd);
-        return -1;
+        goto fail;
     }
     ioctl(fd, SIOCGIFINDEX, &ifr);
 
@@ -207,24 +350,49 @@ static int LinuxSockBind(const char *if_name, uint32_t rxid, uint32_t txid, bool
 
     if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
         UDS_LOGI(__FILE__, "Bind: %s %s\n", strerror(errno), if_name);
-        return -1;
+        goto fail;
     }
     return fd;
+fail:
+    close(fd);
+    return -1;
 }
 
-UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t source_addr_func) {
-    UDS_ASSERT(tp);
+// the flow control parameters are copied, opts->fc_params need not outlive init
+static void LinuxSockSetOpts(UDSTpIsoTpSock_t *tp, const UDSTpIsoTpSockOpts_t *opts) {
+    if (opts) {
+        tp->opts = *opts;
+    }
+    tp->fc_params = tp->opts.fc_params ? *tp->opts.fc_params : DefaultFCParams;
+    tp->opts.fc_params = NULL;
+}
+
+static void LinuxSockInitHdl(UDSTpIsoTpSock_t *tp, const UDSTpIsoTpSockOpts_t *opts) {
     memset(tp, 0, sizeof(*tp));
+    LinuxSockSetOpts(tp, opts);
     tp->hdl.send = isotp_sock_tp_send;
     tp->hdl.recv = isotp_sock_tp_recv;
     tp->hdl.poll = isotp_sock_tp_poll;
+    tp->hdl.peek = isotp_sock_tp_peek;
+    tp->hdl.release = isotp_sock_tp_release;
+    tp->hdl.get_fds = isotp_sock_tp_get_fds;
+    tp->hdl.next_deadline = isotp_sock_tp_next_deadline;
+}
+
+UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
+                                  uint32_t target_addr, uint32_t source_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts) {
+    UDS_ASSERT(tp);
+    LinuxSockInitHdl(tp, opts);
     tp->phys_sa = source_addr;
     tp->phys_ta = target_addr;
     tp->func_sa = source_addr_func;
 
-    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false);
-    tp->func_fd = LinuxSockBind(ifname, source_addr_func, 0, true);
+    snprintf(tp->ifname, sizeof(tp->ifname), "%s", ifname);
+
+    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false, &tp->fc_params,
+                               &tp->opts);
+    tp->func_fd = LinuxSockBind(ifname, source_addr_func, 0, true, &tp->fc_params, &tp->opts);
     if (tp->phys_fd < 0 || tp->func_fd < 0) {
         UDS_LOGI(__FILE__, "foo\n");
         (void)fflush(stdout);
@@ -239,18 +407,19 @@ UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint
 }
 
 UDSErr_t UDSTpIsoTpSockInitClient(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t target_addr_func) {
+                                  uint32_t target_addr, uint32_t target_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts) {
     UDS_ASSERT(tp);
-    memset(tp, 0, sizeof(*tp));
-    tp->hdl.send = isotp_sock_tp_send;
-    tp->hdl.recv = isotp_sock_tp_recv;
-    tp->hdl.poll = isotp_sock_tp_poll;
+    LinuxSockInitHdl(tp, opts);
     tp->func_ta = target_addr_func;
     tp->phys_ta = target_addr;
     tp->phys_sa = source_addr;
 
-    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false);
-    tp->func_fd = LinuxSockBind(ifname, 0, target_addr_func, true);
+    snprintf(tp->ifname, sizeof(tp->ifname), "%s", ifname);
+
+    tp->phys_fd = LinuxSockBind(ifname, source_addr, target_addr, false, &tp->fc_params,
+                               &tp->opts);
+    tp->func_fd = LinuxSockBind(ifname, 0, target_addr_func, true, &tp->fc_params, &tp->opts);
     if (tp->phys_fd < 0 || tp->func_fd < 0) {
         return UDS_FAIL;
     }
@@ -264,6 +433,41 @@ UDSErr_t UDSTpIsoTpSockInitClient(UDSTpIsoTpSock_t *tp, const char *ifname, uint
     return UDS_OK;
 }
 
+UDSErr_t UDSTpIsoTpSockInitWithFds(UDSTpIsoTpSock_t *tp, int phys_fd, int func_fd,
+                                   const UDSTpIsoTpSockOpts_t *opts) {
+    UDS_ASSERT(tp);
+    LinuxSockInitHdl(tp, opts);
+    if (phys_fd < 0 || func_fd < 0) {
+        return UDS_ERR_INVALID_ARG;
+    }
+    tp->phys_fd = phys_fd;
+    tp->func_fd = func_fd;
+    UDS_LOGI(__FILE__, "initialized phys link (fd %d) func link (fd %d)", phys_fd, func_fd);
+    return UDS_OK;
+}
+
+UDSErr_t UDSTpIsoTpSockSetFCParams(UDSTpIsoTpSock_t *tp, const UDSISOTpFCParams_t *params) {
+    UDS_ASSERT(tp);
+    UDS_ASSERT(params);
+    if (tp->send_in_progress) {
+        return UDS_ERR_BUSY;
+    }
+    if (!tp->ifname[0]) {
+        // sockets from UDSTpIsoTpSockInitWithFds, there is no interface to bind to
+        return UDS_ERR_MISUSE;
+    }
+    // closed first, two sockets bound to the same IDs would both send flow control frames
+    if (close(tp->phys_fd) < 0) {
+        perror("failed to close socket");
+    }
+    tp->phys_fd = LinuxSockBind(tp->ifname, tp->phys_sa, tp->phys_ta, false, params, &tp->opts);
+    if (tp->phys_fd < 0) {
+        return UDS_FAIL;
+    }
+    tp->fc_params = *params;
+    return UDS_OK;
+}
+
 void UDSTpIsoTpSockDeinit(UDSTpIsoTpSock_t *tp) {
     if (tp) {
         if (close(tp->phys_fd) < 0) {
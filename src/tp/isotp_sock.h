@@ -3,11 +3,31 @@
 #pragma once
 #include "tp.h"
 #include "uds.h"
+#include <linux/can.h>
+#include <linux/can/isotp.h>
+
+/**
+ * @brief Link layer options of the kernel ISO-TP sockets, zero-initialized: classic CAN with the
+ * kernel defaults
+ */
+typedef struct {
+    uint8_t tx_dl;    // payload bytes per sent frame: 0 or 8: classic CAN, 12..64: CAN FD
+    uint8_t tx_flags; // flags of sent CAN FD frames, e.g. CANFD_BRS. Nonzero selects CAN FD
+    // time the kernel reserves for sending a frame when STmin is 0. 0: kernel default (50 us),
+    // CAN_ISOTP_FRAME_TXTIME_ZERO: send back to back
+    uint32_t frame_txtime_ns;
+    bool tx_padding;        // pad sent frames to tx_dl bytes
+    uint8_t tx_pad_content; // padding byte, e.g. 0xCC or 0xAA
+    bool force_tx_stmin;    // ignore the STmin in flow control frames from the peer...
+    uint32_t tx_stmin_us;   // ...and wait this long between consecutive frames
+    // flow control parameters sent while receiving, NULL: BS 16 and STmin 3 ms. The kernel uses
+    // fixed timeouts, n_bs_us and n_cr_us are ignored
+    const UDSISOTpFCParams_t *fc_params;
+} UDSTpIsoTpSockOpts_t;
 
 typedef struct {
     UDSTp_t hdl;
-    uint8_t recv_buf[UDS_ISOTP_MTU];
-    uint8_t send_buf[UDS_ISOTP_MTU];
+    uint8_t recv_buf[UDS_ISOTP_MTU]; // message lent by peek(), later ones wait in the socket
     size_t recv_len;
     UDSSDU_t recv_info;
     int phys_fd;
@@ -15,12 +35,45 @@ typedef struct {
     uint32_t phys_sa, phys_ta;
     uint32_t func_sa, func_ta;
     char tag[16];
+    char ifname[16];
+    UDSISOTpFCParams_t fc_params;
+    UDSTpIsoTpSockOpts_t opts;
+    int poll_timeout_ms;   // time UDSTpPoll() may wait for socket events, 0 (default): don't wait
+    bool send_in_progress; // a physical message was written and the kernel is still sending it
 } UDSTpIsoTpSock_t;
 
+/**
+ * @param opts link layer options and flow control parameters, NULL: classic CAN with the kernel
+ * defaults
+ */
 UDSErr_t UDSTpIsoTpSockInitServer(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t source_addr_func);
+                                  uint32_t target_addr, uint32_t source_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts);
 UDSErr_t UDSTpIsoTpSockInitClient(UDSTpIsoTpSock_t *tp, const char *ifname, uint32_t source_addr,
-                                  uint32_t target_addr, uint32_t target_addr_func);
+                                  uint32_t target_addr, uint32_t target_addr_func,
+                                  const UDSTpIsoTpSockOpts_t *opts);
+
+/**
+ * @brief Use sockets the caller has opened and bound
+ * @details The transport closes them in UDSTpIsoTpSockDeinit(). phys_fd sends and receives
+ * physical messages, func_fd functional ones. UDSTpIsoTpSockSetFCParams() needs an interface to
+ * bind to and isn't available, set the flow control parameters before binding the sockets.
+ * @return UDS_OK on success, UDS_ERR_INVALID_ARG if a socket is missing
+ */
+UDSErr_t UDSTpIsoTpSockInitWithFds(UDSTpIsoTpSock_t *tp, int phys_fd, int func_fd,
+                                   const UDSTpIsoTpSockOpts_t *opts);
 void UDSTpIsoTpSockDeinit(UDSTpIsoTpSock_t *tp);
 
+/**
+ * @brief Change the flow control parameters the kernel sends while receiving
+ * @details The kernel only accepts CAN_ISOTP_RECV_FC before bind(), so the physical socket is
+ * closed and bound again. Call it between messages. n_bs_us and n_cr_us are ignored because the
+ * kernel uses fixed timeouts. STmin is rounded up to the next value the FC frame can carry.
+ * The parameters at init are set with UDSTpIsoTpSockOpts_t.fc_params.
+ * @return UDS_OK on success, UDS_ERR_BUSY while a message is being sent, UDS_ERR_MISUSE on sockets
+ * from UDSTpIsoTpSockInitWithFds(), UDS_FAIL if the socket could not be bound again. The physical
+ * link is closed then.
+ */
+UDSErr_t UDSTpIsoTpSockSetFCParams(UDSTpIsoTpSock_t *tp, const UDSISOTpFCParams_t *params);
+
 #endif
@@ -26,6 +26,43 @@ uint32_t UDSMillis(void) {
 }
 #endif
 
+#if UDS_CUSTOM_MICROS
+#elif UDS_CUSTOM_MILLIS
+uint32_t UDSMicros(void) { return UDSMillis() * 1000; }
+#else
+uint32_t UDSMicros(void) {
+#if UDS_SYS == UDS_SYS_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    long long microseconds = (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+    return (uint32_t)microseconds;
+#elif UDS_SYS == UDS_SYS_WINDOWS
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    long long microseconds = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    return (uint32_t)microseconds;
+#elif UDS_SYS == UDS_SYS_ARDUINO
+    return micros();
+#elif UDS_SYS == UDS_SYS_ESP32
+    return (uint32_t)esp_timer_get_time();
+#else
+#error "UDSMicros() undefined!"
+#endif
+}
+#endif
+
+#if UDS_SYS == UDS_SYS_UNIX
+uint64_t UDSRealtimeToMonotonicNs(const struct timespec *ts) {
+    // kernel packet timestamps use the wall clock, shift them by its current offset
+    struct timespec rt, mono;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t offset_ns =
+        ((int64_t)rt.tv_sec - mono.tv_sec) * 1000000000LL + (rt.tv_nsec - mono.tv_nsec);
+    return (uint64_t)((int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec - offset_ns);
+}
+#endif
+
 /**
  * @brief Check if a security level is reserved per ISO14229-1:2020 Table 42
  *
@@ -18,6 +18,22 @@ static inline bool UDSTimeAfter(uint32_t a, uint32_t b) { return (int32_t)(a - b
  */
 uint32_t UDSMillis(void);
 
+/**
+ * @brief Get time in microseconds
+ * @details Monotonic, wraps around after about 71 minutes. When UDS_CUSTOM_MILLIS is set and
+ * UDS_CUSTOM_MICROS is not, this follows the user-supplied UDSMillis().
+ * @return current time in microseconds
+ */
+uint32_t UDSMicros(void);
+
+#if UDS_SYS == UDS_SYS_UNIX
+/**
+ * @brief Convert a CLOCK_REALTIME timestamp, e.g. from SO_TIMESTAMPNS, to CLOCK_MONOTONIC
+ * @return nanoseconds on the CLOCK_MONOTONIC time line
+ */
+uint64_t UDSRealtimeToMonotonicNs(const struct timespec *ts);
+#endif
+
 bool UDSSecurityAccessLevelIsReserved(uint8_t securityLevel);
 bool UDSErrIsNRC(UDSErr_t err);
 
@@ -257,6 +257,29 @@ void test_0x11_suppress_pos_resp(void **state) {
     TEST_INT_EQUAL(call_count[UDS_EVT_Err], 0);
 }
 
+void test_functional_request_awaits_send_complete(void **state) {
+    Env_t *e = *state;
+    int call_count[UDS_EVT_MAX] = {0};
+    e->client->fn = fn_log_call_count;
+    e->client->fn_data = call_count;
+    ((ISOTPMock_t *)e->client->tp)->send_tx_delay_ms = 10;
+
+    // when a functional request without response is still being sent
+    e->client->options |= UDS_FUNCTIONAL | UDS_SUPPRESS_POS_RESP;
+    TEST_ERR_EQUAL(UDS_OK, UDSSendECUReset(e->client, UDS_LEV_RT_HR));
+    EnvRunMillis(e, 1);
+
+    // the client is busy, the transport may still read the request from send_buf
+    TEST_INT_EQUAL(call_count[UDS_EVT_SendComplete], 0);
+    TEST_INT_EQUAL(UDS_ERR_BUSY, UDSSendECUReset(e->client, UDS_LEV_RT_HR));
+
+    // once it has been sent the client accepts the next request
+    EnvRunMillis(e, 20);
+    TEST_INT_EQUAL(call_count[UDS_EVT_SendComplete], 1);
+    TEST_INT_EQUAL(call_count[UDS_EVT_Err], 0);
+    TEST_ERR_EQUAL(UDS_OK, UDSSendECUReset(e->client, UDS_LEV_RT_HR));
+}
+
 void test_0x22_unpack_rdbi_response(void **state) {
     Env_t *e = *state;
     int call_count[UDS_EVT_MAX] = {0};
@@ -367,6 +390,8 @@ int main(int ac, char **av) {
         cmocka_unit_test_setup_teardown(test_0x11_rcrrp_timeout, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x11_rcrrp_ok, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x11_suppress_pos_resp, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_functional_request_awaits_send_complete, Setup,
+                                        Teardown),
         cmocka_unit_test_setup_teardown(test_0x22_unpack_rdbi_response, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x34_format, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x38_format_add_file, Setup, Teardown),
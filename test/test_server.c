@@ -3748,6 +3748,49 @@ void test_0x34(void **state) {
     TEST_MEMORY_EQUAL(buf, RESP, sizeof(RESP));
 }
 
+int fn_test_0x36_zero_copy(UDSServer_t *srv, UDSEvent_t ev, void *arg) {
+    TEST_INT_EQUAL(ev, UDS_EVT_TransferData);
+    UDSTransferDataArgs_t *r = (UDSTransferDataArgs_t *)arg;
+    TEST_INT_EQUAL(r->len, 64);
+    for (int i = 0; i < 64; i++) {
+        TEST_INT_EQUAL(r->data[i], i);
+    }
+    // the data is read from the transport's buffer, not from a copy held by the server
+    TEST_INT_EQUAL(srv->r.recv_lent, true);
+    TEST_INT_EQUAL(r->data >= srv->r.recv_storage &&
+                       r->data < srv->r.recv_storage + sizeof(srv->r.recv_storage),
+                   false);
+    return UDS_PositiveResponse;
+}
+
+void test_0x36_zero_copy(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+
+    // When a download is in progress
+    e->server->fn = fn_test_0x36_zero_copy;
+    e->server->xferIsActive = true;
+    e->server->xferBlockSequenceCounter = 1;
+    e->server->xferTotalBytes = 64;
+    e->server->xferBlockLength = 66;
+
+    // sending a TransferData request to the server
+    uint8_t REQ[66] = {0x36, 0x01};
+    for (int i = 0; i < 64; i++) {
+        REQ[2 + i] = (uint8_t)i;
+    }
+    UDSTpSend(e->client_tp, REQ, sizeof(REQ), NULL);
+
+    // should receive a positive response
+    const uint8_t RESP[] = {0x76, 0x01};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->client_tp, buf, sizeof(buf), NULL) > 0,
+                     UDS_CLIENT_DEFAULT_P2_MS);
+    TEST_MEMORY_EQUAL(buf, RESP, sizeof(RESP));
+
+    // and the transport's buffer is given back
+    TEST_INT_EQUAL(e->server->r.recv_lent, false);
+}
+
 void test_0x38_no_handler(void **state) {
     Env_t *e = *state;
     uint8_t buf[8] = {0};
@@ -4284,6 +4327,7 @@ int main(int ac, char **av) {
         cmocka_unit_test_setup_teardown(test_0x31_RCRRP, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x34_no_handler, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x34, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_0x36_zero_copy, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x38_no_handler, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x38_addfile, Setup, Teardown),
         cmocka_unit_test_setup_teardown(test_0x38_delfile, Setup, Teardown),
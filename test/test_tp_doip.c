@@ -0,0 +1,650 @@
+#include "test/env.h"
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_PORT (13400 + 1000)
+#define ENTITY_ADDR (0x0010)
+#define TESTER_ADDR (0x0E00)
+
+static const uint8_t VIN[17] = "WDD1234567ABCDEFG";
+
+static UDSTpDoIPClient_t *NewClient(uint16_t source_addr, uint16_t target_addr) {
+    UDSTpDoIPClient_t *cli = malloc(sizeof(UDSTpDoIPClient_t));
+    UDSTpDoIPClientConfig_t cfg = {
+        .addr = "127.0.0.1",
+        .port = TEST_PORT,
+        .source_addr = source_addr,
+        .target_addr = target_addr,
+    };
+    assert_int_equal(UDS_OK, UDSTpDoIPClientInit(cli, &cfg));
+    return cli;
+}
+
+static void FreeClient(UDSTpDoIPClient_t *cli) {
+    UDSTpDoIPClientDeinit(cli);
+    free(cli);
+}
+
+static UDSTpDoIPServer_t *NewServer(void) {
+    UDSTpDoIPServer_t *srv = malloc(sizeof(UDSTpDoIPServer_t));
+    UDSTpDoIPServerConfig_t cfg = {
+        .bind_addr = "127.0.0.1",
+        .port = TEST_PORT,
+        .logical_address = ENTITY_ADDR,
+        .eid = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55},
+    };
+    memcpy(cfg.vin, VIN, sizeof(cfg.vin));
+    assert_int_equal(UDS_OK, UDSTpDoIPServerInit(srv, &cfg));
+    return srv;
+}
+
+int Setup(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    env->server_tp = &NewServer()->hdl;
+    env->client_tp = &NewClient(TESTER_ADDR, ENTITY_ADDR)->hdl;
+    *state = env;
+    return 0;
+}
+
+int SetupWithServer(void **state) {
+    Setup(state);
+    Env_t *env = *state;
+    env->server = malloc(sizeof(UDSServer_t));
+    UDSServerInit(env->server);
+    env->server->tp = env->server_tp;
+    return 0;
+}
+
+int Teardown(void **state) {
+    Env_t *env = *state;
+    FreeClient((UDSTpDoIPClient_t *)env->client_tp);
+    UDSTpDoIPServerDeinit((UDSTpDoIPServer_t *)env->server_tp);
+    free(env->server_tp);
+    free(env->server);
+    free(env);
+    return 0;
+}
+
+// DoIP carries messages larger than the 4095 bytes of ISO-TP
+void test_doip_send_recv_large(void **state) {
+    Env_t *e = *state;
+    static uint8_t req[8000], resp[6000], buf[8000];
+    for (unsigned i = 0; i < sizeof(req); i++) {
+        req[i] = (uint8_t)i;
+    }
+    for (unsigned i = 0; i < sizeof(resp); i++) {
+        resp[i] = (uint8_t)(i * 3);
+    }
+
+    // When the tester sends a request before the routing is activated
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, req, sizeof(req), NULL), sizeof(req));
+
+    // the entity should receive it once the routing is active
+    UDSSDU_t info = {0};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info) > 0, 100);
+    TEST_MEMORY_EQUAL(buf, req, sizeof(req));
+    TEST_INT_EQUAL(info.A_SA, TESTER_ADDR);
+    TEST_INT_EQUAL(info.A_TA, ENTITY_ADDR);
+    TEST_INT_EQUAL(info.A_TA_Type, UDS_A_TA_TYPE_PHYSICAL);
+
+    // and the send is complete once the entity acknowledged it
+    EXPECT_WITHIN_MS(e, 0 == (UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS), 100);
+    assert_false(UDSTpPoll(e->client_tp) & UDS_TP_ERR);
+
+    // The response goes back to the tester
+    TEST_INT_EQUAL(UDSTpSend(e->server_tp, resp, sizeof(resp), NULL), sizeof(resp));
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->client_tp, buf, sizeof(buf), &info) > 0, 100);
+    TEST_MEMORY_EQUAL(buf, resp, sizeof(resp));
+    TEST_INT_EQUAL(info.A_SA, ENTITY_ADDR);
+    TEST_INT_EQUAL(info.A_TA, TESTER_ADDR);
+}
+
+void test_doip_send_recv_functional(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+
+    // When a functional request is sent
+    const uint8_t MSG[] = {0x3E, 0x80};
+    UDSTpSend(e->client_tp, MSG, sizeof(MSG), &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL});
+
+    // the entity should receive it on its functional address
+    UDSSDU_t info = {0};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info) > 0, 100);
+    TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    TEST_INT_EQUAL(info.A_TA, UDS_DOIP_FUNC_ADDR_DEFAULT);
+    TEST_INT_EQUAL(info.A_TA_Type, UDS_A_TA_TYPE_FUNCTIONAL);
+}
+
+// ISO 13400-2:2012 Table 28: unknown target address
+void test_doip_unknown_target_nack(void **state) {
+    Env_t *e = *state;
+    UDSTpDoIPClient_t *cli = NewClient(TESTER_ADDR + 1, 0x0099);
+
+    // When a tester sends a message to an address the entity doesn't have
+    const uint8_t MSG[] = {0x10, 0x02};
+    UDSTpSend(&cli->hdl, MSG, sizeof(MSG), NULL);
+
+    // the send should fail with a NACK
+    EXPECT_WITHIN_MS(e, UDSTpPoll(&cli->hdl) & UDS_TP_ERR, 100);
+    TEST_INT_EQUAL(cli->nack_code, 0x03);
+    FreeClient(cli);
+}
+
+// ISO 13400-2:2012 Figure 10: a tester connecting while all sockets are in use triggers an alive
+// check. Testers that don't answer lose their socket.
+void test_doip_alive_check(void **state) {
+    Env_t *e = *state;
+    UDSTpDoIPServer_t *srv = (UDSTpDoIPServer_t *)e->server_tp;
+    UDSTpDoIPClient_t *clients[UDS_DOIP_MAX_CONNECTIONS + 1] = {0};
+    clients[0] = (UDSTpDoIPClient_t *)e->client_tp;
+    for (int i = 1; i <= UDS_DOIP_MAX_CONNECTIONS; i++) {
+        clients[i] = NewClient(TESTER_ADDR + i, ENTITY_ADDR);
+    }
+
+    // When all sockets hold testers that answer the alive check
+    for (int i = 1; i < UDS_DOIP_MAX_CONNECTIONS; i++) {
+        EXPECT_WITHIN_MS(e, (UDSTpPoll(&clients[i]->hdl), UDS_DOIP_CLIENT_ACTIVE == clients[i]->state), 100);
+    }
+    EXPECT_WITHIN_MS(e, UDS_DOIP_CLIENT_ACTIVE == clients[0]->state, 100);
+
+    // another tester should be turned away
+    UDSTpDoIPClient_t *extra = clients[UDS_DOIP_MAX_CONNECTIONS];
+    EXPECT_WITHIN_MS(e,
+                     (UDSTpPoll(&clients[1]->hdl), UDSTpPoll(&extra->hdl),
+                      UDS_DOIP_CLIENT_FAILED == extra->state),
+                     UDS_DOIP_ALIVE_CHECK_MS + 100);
+    TEST_INT_EQUAL(srv->pending_fd, -1);
+    FreeClient(extra);
+
+    // When one of the registered testers stops answering
+    extra = NewClient(TESTER_ADDR + 0x10, ENTITY_ADDR);
+    clients[UDS_DOIP_MAX_CONNECTIONS] = extra;
+
+    // it should lose its socket to the new tester after T_TCP_Alive_Check
+    EXPECT_WITHIN_MS(e, (UDSTpPoll(&extra->hdl), UDS_DOIP_CLIENT_ACTIVE == extra->state),
+                     UDS_DOIP_ALIVE_CHECK_MS + 100);
+    assert_true(UDS_DOIP_CLIENT_ACTIVE == clients[0]->state);
+    EXPECT_WITHIN_MS(e, (UDSTpPoll(&clients[1]->hdl), UDS_DOIP_CLIENT_FAILED == clients[1]->state),
+                     100);
+
+    for (int i = 1; i <= UDS_DOIP_MAX_CONNECTIONS; i++) {
+        FreeClient(clients[i]);
+    }
+}
+
+void test_doip_vehicle_identification(void **state) {
+    Env_t *e = *state;
+    UDSTpDoIPDiscovery_t d;
+    UDSTpDoIPVehicle_t v = {0};
+
+    // When a vehicle identification request is sent
+    assert_int_equal(UDS_OK, UDSTpDoIPDiscoveryInit(&d, "127.0.0.1", TEST_PORT));
+
+    // the entity should answer with its identification
+    EXPECT_WITHIN_MS(e, UDSTpDoIPDiscoveryPoll(&d, &v) == 1, 100);
+    TEST_MEMORY_EQUAL(v.vin, VIN, sizeof(VIN));
+    TEST_INT_EQUAL(v.logical_address, ENTITY_ADDR);
+    assert_string_equal(v.addr, "127.0.0.1");
+    UDSTpDoIPDiscoveryDeinit(&d);
+}
+
+int fn_test_doip_0x36_large_block(UDSServer_t *srv, UDSEvent_t ev, void *arg) {
+    TEST_INT_EQUAL(ev, UDS_EVT_TransferData);
+    UDSTransferDataArgs_t *r = (UDSTransferDataArgs_t *)arg;
+    TEST_INT_EQUAL(r->len, 8000);
+    for (int i = 0; i < 8000; i++) {
+        TEST_INT_EQUAL(r->data[i], (uint8_t)i);
+    }
+    return UDS_PositiveResponse;
+}
+
+// TransferData blocks can be sized for Ethernet instead of ISO-TP
+void test_doip_0x36_large_block(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+    e->server->fn = fn_test_doip_0x36_large_block;
+    e->server->xferIsActive = true;
+    e->server->xferBlockSequenceCounter = 1;
+    e->server->xferTotalBytes = 8000;
+    e->server->xferBlockLength = 8002;
+
+    static uint8_t REQ[8002] = {0x36, 0x01};
+    for (int i = 0; i < 8000; i++) {
+        REQ[2 + i] = (uint8_t)i;
+    }
+    UDSTpSend(e->client_tp, REQ, sizeof(REQ), NULL);
+
+    const uint8_t RESP[] = {0x76, 0x01};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->client_tp, buf, sizeof(buf), NULL) > 0,
+                     UDS_CLIENT_DEFAULT_P2_MS);
+    TEST_MEMORY_EQUAL(buf, RESP, sizeof(RESP));
+}
+
+int fn_test_doip_0x34_large_block(UDSServer_t *srv, UDSEvent_t ev, void *arg) {
+    TEST_INT_EQUAL(ev, UDS_EVT_RequestDownload);
+    UDSRequestDownloadArgs_t *r = (UDSRequestDownloadArgs_t *)arg;
+    TEST_INT_EQUAL(r->maxNumberOfBlockLength, UDS_TP_MTU);
+    return UDS_PositiveResponse;
+}
+
+// RequestDownload offers blocks as large as UDS_TP_MTU
+void test_doip_0x34_large_block(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+    e->server->fn = fn_test_doip_0x34_large_block;
+
+    const uint8_t REQ[] = {0x34, 0x00, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00};
+    UDSTpSend(e->client_tp, REQ, sizeof(REQ), NULL);
+
+    const uint8_t RESP[] = {0x74, 0x20, UDS_TP_MTU >> 8, UDS_TP_MTU & 0xFF};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->client_tp, buf, sizeof(buf), NULL) > 0,
+                     UDS_CLIENT_DEFAULT_P2_MS);
+    TEST_MEMORY_EQUAL(buf, RESP, sizeof(RESP));
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Gateway to two ECUs on an in-memory CAN bus
+ */
+#define ECU_A_ADDR (0x0101)
+#define ECU_B_ADDR (0x0102)
+#define CAN_FUNC_ID (0x7DF)
+#define CAN_UNUSED_ID (0x7FE)
+
+static struct {
+    uint32_t id;
+    uint8_t len;
+    uint8_t data[8];
+} CANFrames[64];
+static int NumCANFrames = 0;
+static UDSISOTpC_t *CANNodes[4];
+static int NumCANNodes = 0;
+
+void isotp_user_debug(const char *message, ...) { (void)message; }
+uint32_t isotp_user_get_us(void) { return UDSMillis() * 1000; }
+int isotp_user_send_can(const uint32_t arbitration_id, const uint8_t *data, const uint8_t size,
+                        void *arg) {
+    (void)arg;
+    if (NumCANFrames >= (int)(sizeof(CANFrames) / sizeof(CANFrames[0]))) {
+        return ISOTP_RET_NOSPACE;
+    }
+    CANFrames[NumCANFrames].id = arbitration_id;
+    CANFrames[NumCANFrames].len = size;
+    memcpy(CANFrames[NumCANFrames].data, data, size);
+    NumCANFrames++;
+    return ISOTP_RET_OK;
+}
+
+static void CANDeliver(void) {
+    // flow control frames sent by the receivers are delivered in the same pass
+    for (int i = 0; i < NumCANFrames; i++) {
+        for (int j = 0; j < NumCANNodes; j++) {
+            UDSISOTpC_t *node = CANNodes[j];
+            if (CANFrames[i].id == node->phys_sa) {
+                isotp_on_can_message(&node->phys_link, CANFrames[i].data, CANFrames[i].len);
+            } else if (CANFrames[i].id == node->func_sa) {
+                isotp_on_can_message(&node->func_link, CANFrames[i].data, CANFrames[i].len);
+            }
+        }
+    }
+    NumCANFrames = 0;
+}
+
+static void AddCANNode(UDSISOTpC_t *tp, uint32_t rx_id, uint32_t tx_id, uint32_t func_rx_id,
+                       uint32_t func_tx_id) {
+    UDSISOTpCConfig_t cfg = {
+        .source_addr = rx_id,
+        .target_addr = tx_id,
+        .source_addr_func = func_rx_id,
+        .target_addr_func = func_tx_id,
+    };
+    assert_int_equal(UDS_OK, UDSISOTpCInit(tp, &cfg));
+    CANNodes[NumCANNodes++] = tp;
+}
+
+// answers every request with {SID + 0x40, id} after delay_ms
+typedef struct {
+    UDSISOTpC_t tp;
+    uint8_t id;
+    uint32_t delay_ms;
+    uint8_t req[UDS_ISOTP_MTU];
+    ssize_t req_len;
+    bool respond;
+    uint32_t respond_time;
+    uint8_t resp[2];
+} ECU_t;
+
+static UDSTpDoIPGateway_t GW;
+static UDSISOTpC_t GWLinks[2];
+static ECU_t ECUs[2];
+
+static void ECUPoll(ECU_t *ecu) {
+    UDSTpPoll(&ecu->tp.hdl);
+    if (ecu->respond) {
+        if (UDSTimeAfter(UDSMillis(), ecu->respond_time)) {
+            ecu->resp[0] = ecu->req[0] + 0x40;
+            ecu->resp[1] = ecu->id;
+            UDSTpSend(&ecu->tp.hdl, ecu->resp, sizeof(ecu->resp), NULL);
+            ecu->respond = false;
+        }
+        return;
+    }
+    ssize_t len = UDSTpRecv(&ecu->tp.hdl, ecu->req, sizeof(ecu->req), NULL);
+    if (len > 0) {
+        ecu->req_len = len;
+        ecu->respond = true;
+        ecu->respond_time = UDSMillis() + ecu->delay_ms;
+    }
+}
+
+static void GatewayRun(void) {
+    UDSTpDoIPGatewayPoll(&GW);
+    for (int i = 0; i < 2; i++) {
+        ECUPoll(&ECUs[i]);
+    }
+    CANDeliver();
+}
+
+int SetupGateway(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    UDSTpDoIPServer_t *srv = NewServer();
+    env->server_tp = &srv->hdl;
+    env->client_tp = &NewClient(TESTER_ADDR, ECU_A_ADDR)->hdl;
+    NumCANNodes = 0;
+    NumCANFrames = 0;
+    memset(ECUs, 0, sizeof(ECUs));
+
+    // both ECUs are on one bus, functional requests are sent once
+    assert_int_equal(UDS_OK, UDSTpDoIPGatewayInit(&GW, srv));
+    AddCANNode(&GWLinks[0], 0x7E8, 0x7E0, CAN_UNUSED_ID, CAN_FUNC_ID);
+    AddCANNode(&GWLinks[1], 0x7E9, 0x7E1, CAN_UNUSED_ID, CAN_FUNC_ID);
+    assert_int_equal(UDS_OK, UDSTpDoIPGatewayAddRoute(&GW, ECU_A_ADDR, &GWLinks[0].hdl, true));
+    assert_int_equal(UDS_OK, UDSTpDoIPGatewayAddRoute(&GW, ECU_B_ADDR, &GWLinks[1].hdl, false));
+    AddCANNode(&ECUs[0].tp, 0x7E0, 0x7E8, CAN_FUNC_ID, CAN_UNUSED_ID);
+    AddCANNode(&ECUs[1].tp, 0x7E1, 0x7E9, CAN_FUNC_ID, CAN_UNUSED_ID);
+    ECUs[0].id = 0xA;
+    ECUs[1].id = 0xB;
+    *state = env;
+    return 0;
+}
+
+// One ECU busy with a long transfer doesn't hold up another
+void test_doip_gateway_independent_ecus(void **state) {
+    Env_t *e = *state;
+    UDSTpDoIPClient_t *tester_b = NewClient(TESTER_ADDR + 1, ECU_B_ADDR);
+    UDSSDU_t info = {0};
+    uint8_t buf[8] = {0};
+
+    // When a tester sends a large request to ECU A, it takes hundreds of CAN frames
+    static uint8_t REQ_A[4000] = {0x36, 0x01};
+    UDSTpSend(e->client_tp, REQ_A, sizeof(REQ_A), NULL);
+    EXPECT_WITHIN_MS(e, (GatewayRun(), GWLinks[0].phys_link.send_offset > 0), 100);
+
+    // and another tester sends a request to ECU B in the meantime
+    const uint8_t REQ_B[] = {0x22, 0xF1, 0x90};
+    UDSTpSend(&tester_b->hdl, REQ_B, sizeof(REQ_B), NULL);
+
+    // ECU B should answer while ECU A is still receiving
+    EXPECT_WITHIN_MS(e,
+                     (GatewayRun(), UDSTpPoll(&tester_b->hdl),
+                      UDSTpRecv(&tester_b->hdl, buf, sizeof(buf), &info) > 0),
+                     50);
+    const uint8_t RESP_B[] = {0x62, 0xB};
+    TEST_MEMORY_EQUAL(buf, RESP_B, sizeof(RESP_B));
+    TEST_INT_EQUAL(info.A_SA, ECU_B_ADDR);
+    TEST_INT_EQUAL(info.A_TA, TESTER_ADDR + 1);
+    TEST_INT_EQUAL(ECUs[0].req_len, 0);
+
+    // and ECU A's answer should follow once it got the whole request
+    EXPECT_WITHIN_MS(e, (GatewayRun(), UDSTpRecv(e->client_tp, buf, sizeof(buf), &info) > 0), 2000);
+    const uint8_t RESP_A[] = {0x76, 0xA};
+    TEST_MEMORY_EQUAL(buf, RESP_A, sizeof(RESP_A));
+    TEST_INT_EQUAL(info.A_SA, ECU_A_ADDR);
+    TEST_INT_EQUAL(ECUs[0].req_len, sizeof(REQ_A));
+    TEST_MEMORY_EQUAL(ECUs[0].req, REQ_A, sizeof(REQ_A));
+    FreeClient(tester_b);
+}
+
+void test_doip_gateway_functional(void **state) {
+    Env_t *e = *state;
+    UDSSDU_t info = {0};
+    uint8_t buf[8] = {0};
+
+    // When a tester sends a functional request
+    const uint8_t REQ[] = {0x3E, 0x00};
+    UDSTpSend(e->client_tp, REQ, sizeof(REQ), &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL});
+
+    // every ECU on the bus should answer it
+    bool answered[2] = {false, false};
+    for (int i = 0; i < 2; i++) {
+        EXPECT_WITHIN_MS(e, (GatewayRun(), UDSTpRecv(e->client_tp, buf, sizeof(buf), &info) > 0),
+                         100);
+        TEST_INT_EQUAL(buf[0], 0x7E);
+        answered[info.A_SA - ECU_A_ADDR] = true;
+    }
+    assert_true(answered[0] && answered[1]);
+}
+
+// A functional request doesn't redirect a physical response owed to another tester
+void test_doip_gateway_functional_two_testers(void **state) {
+    Env_t *e = *state;
+    UDSTpDoIPClient_t *tester_b = NewClient(TESTER_ADDR + 1, ECU_A_ADDR);
+    UDSSDU_t info = {0};
+    uint8_t buf[8] = {0};
+
+    // When a tester sends a physical request to a slow ECU A
+    ECUs[0].delay_ms = 100;
+    const uint8_t REQ_A[] = {0x22, 0xF1, 0x90};
+    UDSTpSend(e->client_tp, REQ_A, sizeof(REQ_A), NULL);
+    EXPECT_WITHIN_MS(e, (GatewayRun(), ECUs[0].respond), 100);
+
+    // and another tester sends a functional request before ECU A answered
+    const uint8_t REQ_F[] = {0x3E, 0x00};
+    UDSTpSend(&tester_b->hdl, REQ_F, sizeof(REQ_F),
+              &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL});
+    EXPECT_WITHIN_MS(e, (GatewayRun(), UDSTpPoll(&tester_b->hdl), ECUs[1].req_len > 0), 50);
+    assert_true(ECUs[0].respond);
+
+    // the physical response should still go to the first tester
+    EXPECT_WITHIN_MS(e, (GatewayRun(), UDSTpRecv(e->client_tp, buf, sizeof(buf), &info) > 0), 200);
+    const uint8_t RESP_A[] = {0x62, 0xA};
+    TEST_MEMORY_EQUAL(buf, RESP_A, sizeof(RESP_A));
+    TEST_INT_EQUAL(info.A_SA, ECU_A_ADDR);
+
+    // and both answers to the functional request to the other one
+    bool answered[2] = {false, false};
+    for (int i = 0; i < 2; i++) {
+        EXPECT_WITHIN_MS(e,
+                         (GatewayRun(), UDSTpPoll(&tester_b->hdl),
+                          UDSTpRecv(&tester_b->hdl, buf, sizeof(buf), &info) > 0),
+                         100);
+        TEST_INT_EQUAL(buf[0], 0x7E);
+        TEST_INT_EQUAL(info.A_TA, TESTER_ADDR + 1);
+        answered[info.A_SA - ECU_A_ADDR] = true;
+    }
+    assert_true(answered[0] && answered[1]);
+
+    // the first tester should get nothing else
+    EXPECT_WHILE_MS(e, (GatewayRun(), UDSTpRecv(e->client_tp, buf, sizeof(buf), &info) == 0), 20);
+    FreeClient(tester_b);
+}
+
+// Requests larger than 4095 bytes go on CAN with a 32-bit FF_DL
+void test_doip_gateway_32bit_ff_dl(void **state) {
+    Env_t *e = *state;
+    UDSSDU_t info = {0};
+    uint8_t buf[8] = {0};
+    static uint8_t REQ[10002] = {0x36, 0x01};
+    for (unsigned i = 2; i < sizeof(REQ); i++) {
+        REQ[i] = (uint8_t)(i * 5);
+    }
+
+    // When a tester sends a TransferData block larger than the 12 bit FF_DL
+    UDSTpSend(e->client_tp, REQ, sizeof(REQ), NULL);
+
+    // the ECU should receive all of it
+    EXPECT_WITHIN_MS(e, (GatewayRun(), UDSTpRecv(e->client_tp, buf, sizeof(buf), &info) > 0), 3000);
+    const uint8_t RESP[] = {0x76, 0xA};
+    TEST_MEMORY_EQUAL(buf, RESP, sizeof(RESP));
+    TEST_INT_EQUAL(ECUs[0].req_len, sizeof(REQ));
+    TEST_MEMORY_EQUAL(ECUs[0].req, REQ, sizeof(REQ));
+}
+
+static void RawSend(int fd, const void *data, size_t len) {
+    TEST_INT_EQUAL(send(fd, data, len, 0), (ssize_t)len);
+}
+
+static bool RawRecv(int fd, uint8_t *buf, size_t len, size_t *pos) {
+    ssize_t n = recv(fd, buf + *pos, len - *pos, MSG_DONTWAIT);
+    if (n > 0) {
+        *pos += (size_t)n;
+    }
+    return *pos == len;
+}
+
+// a tester that writes raw DoIP messages, each as soon as it is sent
+static int RawConnect(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(TEST_PORT)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert_int_equal(0, connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    return fd;
+}
+
+// TransferData is sent on CAN while its end still arrives over TCP
+void test_doip_gateway_cut_through(void **state) {
+    Env_t *e = *state;
+    static uint8_t REQ[4002] = {0x36, 0x01};
+    for (unsigned i = 2; i < sizeof(REQ); i++) {
+        REQ[i] = (uint8_t)(i * 7);
+    }
+
+    // a tester that writes the message in two parts
+    int fd = RawConnect();
+    const uint8_t ACTIVATE[] = {0x02, 0xFD, 0x00, 0x05, 0x00, 0x00, 0x00, 0x07,
+                                0x0E, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00};
+    RawSend(fd, ACTIVATE, sizeof(ACTIVATE));
+    uint8_t res[17];
+    size_t res_len = 0;
+    EXPECT_WITHIN_MS(e, (GatewayRun(), RawRecv(fd, res, sizeof(res), &res_len)), 100);
+    TEST_INT_EQUAL(res[12], 0x10); // routing successfully activated
+
+    uint8_t hdr[12] = {0x02, 0xFD, 0x80, 0x01, 0, 0, (4 + sizeof(REQ)) >> 8,
+                       (4 + sizeof(REQ)) & 0xFF, 0x0E, 0x10, ECU_A_ADDR >> 8, ECU_A_ADDR & 0xFF};
+    RawSend(fd, hdr, sizeof(hdr));
+    RawSend(fd, REQ, 1000);
+
+    // When the first part arrived, the ECU should receive it
+    const IsoTpLink *ecu_link = &ECUs[0].tp.phys_link, *gw_link = &GWLinks[0].phys_link;
+    EXPECT_WITHIN_MS(e, (GatewayRun(), ISOTP_RECEIVE_STATUS_INPROGRESS == ecu_link->receive_status),
+                     100);
+
+    // and the gateway should wait for the rest. The ECU gives up after N_Cr.
+    EXPECT_WHILE_MS(e,
+                    (GatewayRun(), ISOTP_SEND_STATUS_INPROGRESS == gw_link->send_status &&
+                                       gw_link->send_offset <= 1000),
+                    50);
+
+    // When the rest arrives
+    RawSend(fd, REQ + 1000, sizeof(REQ) - 1000);
+
+    // the ECU should receive the whole message
+    EXPECT_WITHIN_MS(e, (GatewayRun(), ECUs[0].req_len > 0), 1000);
+    TEST_INT_EQUAL(ECUs[0].req_len, sizeof(REQ));
+    TEST_MEMORY_EQUAL(ECUs[0].req, REQ, sizeof(REQ));
+    close(fd);
+}
+
+// the default protocol version 0xFF is only accepted in vehicle identification requests on UDP
+void test_doip_protocol_version_ff(void **state) {
+    Env_t *e = *state;
+
+    // When a vehicle identification request with version 0xFF arrives on UDP
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(TEST_PORT)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const uint8_t VID_REQ[] = {0xFF, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00};
+    TEST_INT_EQUAL(sendto(udp, VID_REQ, sizeof(VID_REQ), 0, (struct sockaddr *)&addr, sizeof(addr)),
+                   sizeof(VID_REQ));
+
+    // the entity should answer with a vehicle announcement
+    uint8_t res[64];
+    ssize_t n = -1;
+    EXPECT_WITHIN_MS(e, (n = recv(udp, res, sizeof(res), MSG_DONTWAIT)) > 0, 100);
+    TEST_INT_EQUAL(n, 8 + 32);
+    TEST_INT_EQUAL(res[2], 0x00);
+    TEST_INT_EQUAL(res[3], 0x04);
+    close(udp);
+
+    // When a routing activation request with version 0xFF arrives on TCP
+    int fd = RawConnect();
+    const uint8_t ACTIVATE[] = {0xFF, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x07,
+                                0x0E, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00};
+    RawSend(fd, ACTIVATE, sizeof(ACTIVATE));
+
+    // the entity should answer with "incorrect pattern" and close the connection
+    uint8_t nack[9];
+    size_t nack_len = 0;
+    EXPECT_WITHIN_MS(e, RawRecv(fd, nack, sizeof(nack), &nack_len), 100);
+    TEST_INT_EQUAL(nack[3], 0x00); // generic NACK
+    TEST_INT_EQUAL(nack[8], 0x00); // incorrect pattern
+    EXPECT_WITHIN_MS(e, 0 == recv(fd, nack, sizeof(nack), MSG_DONTWAIT), 100);
+    close(fd);
+}
+
+// a message that doesn't fit the receive buffer is refused before it is read
+void test_doip_message_too_large(void **state) {
+    Env_t *e = *state;
+    int fd = RawConnect();
+
+    // When a message of an unknown type announces 1000 bytes of payload
+    const uint8_t HDR[] = {0x02, 0xFD, 0x12, 0x34, 0x00, 0x00, 0x03, 0xE8};
+    RawSend(fd, HDR, sizeof(HDR));
+
+    // the entity should answer with "message too large"
+    uint8_t nack[9];
+    size_t nack_len = 0;
+    EXPECT_WITHIN_MS(e, RawRecv(fd, nack, sizeof(nack), &nack_len), 100);
+    TEST_INT_EQUAL(nack[3], 0x00); // generic NACK
+    TEST_INT_EQUAL(nack[8], 0x02); // message too large
+
+    // and discard the payload, the connection stays usable
+    static uint8_t payload[1000];
+    RawSend(fd, payload, sizeof(payload));
+    const uint8_t ACTIVATE[] = {0x02, 0xFD, 0x00, 0x05, 0x00, 0x00, 0x00, 0x07,
+                                0x0E, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00};
+    RawSend(fd, ACTIVATE, sizeof(ACTIVATE));
+    uint8_t res[17];
+    size_t res_len = 0;
+    EXPECT_WITHIN_MS(e, RawRecv(fd, res, sizeof(res), &res_len), 100);
+    TEST_INT_EQUAL(res[3], 0x06);  // routing activation response
+    TEST_INT_EQUAL(res[12], 0x10); // routing successfully activated
+    close(fd);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_doip_send_recv_large, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_send_recv_functional, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_unknown_target_nack, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_alive_check, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_vehicle_identification, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_0x36_large_block, SetupWithServer, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_0x34_large_block, SetupWithServer, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_gateway_independent_ecus, SetupGateway, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_gateway_functional, SetupGateway, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_gateway_functional_two_testers, SetupGateway,
+                                        Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_gateway_cut_through, SetupGateway, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_gateway_32bit_ff_dl, SetupGateway, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_protocol_version_ff, Setup, Teardown),
+        cmocka_unit_test_setup_teardown(test_doip_message_too_large, Setup, Teardown),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -1,5 +1,11 @@
 #include "test/env.h"
+#include <errno.h>
 #include <unistd.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 
 int SetupMockTpPair(void **state) {
     Env_t *env = malloc(sizeof(Env_t));
@@ -25,6 +31,36 @@ int TeardownMockTpPair(void **state) {
     return 0;
 }
 
+static ISOTPMockBus_t MockBus;
+
+static void NewMockTpPairOnBus(void **state, const ISOTPMockBusConfig_t *cfg) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    ISOTPMockBusInit(&MockBus, cfg);
+    env->server_tp = ISOTPMockNew("server", &(ISOTPMockArgs_t){.sa_phys = 0x7E0,
+                                                               .ta_phys = 0x7E8,
+                                                               .sa_func = 0x7DF,
+                                                               .ta_func = UDS_TP_NOOP_ADDR,
+                                                               .bus = &MockBus});
+    env->client_tp = ISOTPMockNew("client", &(ISOTPMockArgs_t){.sa_phys = 0x7E8,
+                                                               .ta_phys = 0x7E0,
+                                                               .sa_func = UDS_TP_NOOP_ADDR,
+                                                               .ta_func = 0x7DF,
+                                                               .bus = &MockBus});
+    *state = env;
+}
+
+int SetupMockTpPairOnBus(void **state) {
+    NewMockTpPairOnBus(state, &(ISOTPMockBusConfig_t){.bitrate = 500000, .tx_padding = true});
+    return 0;
+}
+
+int SetupMockTpPairOnFDBus(void **state) {
+    NewMockTpPairOnBus(state, &(ISOTPMockBusConfig_t){
+                                  .bitrate = 500000, .data_bitrate = 2000000, .tx_dl = 64});
+    return 0;
+}
+
 int SetupMockTpPairExtendedID(void **state) {
     Env_t *env = malloc(sizeof(Env_t));
     memset(env, 0, sizeof(Env_t));
@@ -87,6 +123,121 @@ int TeardownIsoTpCPair(void **state) {
     return 0;
 }
 
+int SetupIsoTpCPairFD(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    UDSTpISOTpC_t *server_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(server_isotp->tag, "server");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(server_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8,
+                                                                      .target_addr = 0x7e0,
+                                                                      .source_addr_func = 0x7df,
+                                                                      .tx_dl = 64}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpISOTpC_t *client_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(client_isotp->tag, "client");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(client_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0,
+                                                                      .target_addr = 0x7e8,
+                                                                      .target_addr_func = 0x7df,
+                                                                      .tx_dl = 64}));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
+int SetupIsoTpCPairBurst(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    UDSTpISOTpC_t *server_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(server_isotp->tag, "server");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(server_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8,
+                                                                      .target_addr = 0x7e0,
+                                                                      .source_addr_func = 0x7df,
+                                                                      .max_cf_per_poll = 32}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpISOTpC_t *client_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(client_isotp->tag, "client");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(client_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0,
+                                                                      .target_addr = 0x7e8,
+                                                                      .target_addr_func = 0x7df,
+                                                                      .max_cf_per_poll = 32}));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
+int SetupIsoTpCPairFCParams(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    UDSTpISOTpC_t *server_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(server_isotp->tag, "server");
+    // no block size limit
+    const UDSISOTpFCParams_t server_fc = {
+        .bs = 0, .st_min_us = 0, .n_bs_us = 100000, .n_cr_us = 100000, .wft_max = 0};
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(server_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8,
+                                                                      .target_addr = 0x7e0,
+                                                                      .source_addr_func = 0x7df,
+                                                                      .fc_params = &server_fc}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpISOTpC_t *client_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(client_isotp->tag, "client");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(client_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0,
+                                                                      .target_addr = 0x7e8,
+                                                                      .target_addr_func = 0x7df}));
+    // a flow control frame every two consecutive frames, changed after init
+    const UDSISOTpFCParams_t client_fc = {
+        .bs = 2, .st_min_us = 500, .n_bs_us = 200000, .n_cr_us = 200000, .wft_max = 0};
+    assert(UDS_OK == UDSTpISOTpCSetFCParams(client_isotp, &client_fc));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
+static uint8_t PoolBlocks[4][UDS_ISOTP_MTU];
+static IsoTpBufferPool Pool;
+
+int SetupIsoTpCPairPool(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    // both transports receive multi-frame messages into blocks of a shared pool
+    isotp_pool_init(&Pool, &PoolBlocks[0][0], UDS_ISOTP_MTU, 2);
+    UDSTpISOTpC_t *server_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(server_isotp->tag, "server");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(server_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8,
+                                                                      .target_addr = 0x7e0,
+                                                                      .source_addr_func = 0x7df,
+                                                                      .rx_pool = &Pool}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpISOTpC_t *client_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(client_isotp->tag, "client");
+    assert(UDS_OK == UDSTpISOTpCInitWithConfig(client_isotp, "vcan0",
+                                               &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0,
+                                                                      .target_addr = 0x7e8,
+                                                                      .target_addr_func = 0x7df,
+                                                                      .rx_pool = &Pool}));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
 int SetupIsoTpCClientOnly(void **state) {
     Env_t *env = malloc(sizeof(Env_t));
     memset(env, 0, sizeof(Env_t));
@@ -107,17 +258,207 @@ int TeardownIsoTpCClientOnly(void **state) {
     return 0;
 }
 
+// the SocketCAN code path without a CAN interface: the transports exchange frames over a socketpair
+static void NewIsoTpCSocketPair(void **state, uint8_t tx_dl, bool addr_ext,
+                                IsoTpBufferPool *rx_pool, const UDSISOTpFCParams_t *fc_params) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    int fds[2] = {-1, -1};
+    assert(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+
+    UDSTpISOTpC_t *server_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(server_isotp->tag, "server");
+    assert(UDS_OK == UDSTpISOTpCInitWithFd(server_isotp, fds[0],
+                                           &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8,
+                                                                  .target_addr = 0x7e0,
+                                                                  .source_addr_func = 0x7df,
+                                                                  .tx_dl = tx_dl,
+                                                                  .addr_ext = addr_ext,
+                                                                  .source_ae = 0x40,
+                                                                  .target_ae = 0xf1,
+                                                                  .source_ae_func = 0x33,
+                                                                  .rx_pool = rx_pool,
+                                                                  .fc_params = fc_params}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpISOTpC_t *client_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(client_isotp->tag, "client");
+    assert(UDS_OK == UDSTpISOTpCInitWithFd(client_isotp, fds[1],
+                                           &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0,
+                                                                  .target_addr = 0x7e8,
+                                                                  .target_addr_func = 0x7df,
+                                                                  .tx_dl = tx_dl,
+                                                                  .addr_ext = addr_ext,
+                                                                  .source_ae = 0xf1,
+                                                                  .target_ae = 0x40,
+                                                                  .target_ae_func = 0x33,
+                                                                  .rx_pool = rx_pool,
+                                                                  .fc_params = fc_params}));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+}
+
+int SetupIsoTpCSocketPair(void **state) {
+    NewIsoTpCSocketPair(state, 0, false, NULL, NULL);
+    return 0;
+}
+
+int SetupIsoTpCSocketPairFD(void **state) {
+    NewIsoTpCSocketPair(state, 64, false, NULL, NULL);
+    return 0;
+}
+
+// flow control parameters set at init and after init
+int SetupIsoTpCSocketPairFCParams(void **state) {
+    // no block size limit
+    const UDSISOTpFCParams_t fc = {
+        .bs = 0, .st_min_us = 0, .n_bs_us = 100000, .n_cr_us = 100000, .wft_max = 0};
+    NewIsoTpCSocketPair(state, 0, false, NULL, &fc);
+    Env_t *env = *state;
+    // a flow control frame every two consecutive frames
+    const UDSISOTpFCParams_t client_fc = {
+        .bs = 2, .st_min_us = 500, .n_bs_us = 200000, .n_cr_us = 200000, .wft_max = 0};
+    assert(UDS_OK == UDSTpISOTpCSetFCParams((UDSTpISOTpC_t *)env->client_tp, &client_fc));
+    return 0;
+}
+
+// flow control parameters without timeouts, N_Bs and N_Cr keep the ISO 15765-2 value
+int SetupIsoTpCSocketPairPartialFCParams(void **state) {
+    NewIsoTpCSocketPair(state, 0, false, NULL, NULL);
+    Env_t *env = *state;
+    const UDSISOTpFCParams_t fc = {.bs = 2, .st_min_us = 500};
+    assert(UDS_OK == UDSTpISOTpCSetFCParams((UDSTpISOTpC_t *)env->server_tp, &fc));
+    assert(UDS_OK == UDSTpISOTpCSetFCParams((UDSTpISOTpC_t *)env->client_tp, &fc));
+    return 0;
+}
+
+// multi-frame messages are received into blocks of a pool and queued there until they are read
+int SetupIsoTpCSocketPairPool(void **state) {
+    isotp_pool_init(&Pool, &PoolBlocks[0][0], UDS_ISOTP_MTU, 4);
+    NewIsoTpCSocketPair(state, 0, false, &Pool, NULL);
+    return 0;
+}
+
+// extended addressing: the server is N_TA 0x40, the client 0xf1, functional requests go to 0x33
+int SetupIsoTpCSocketPairAddrExt(void **state) {
+    NewIsoTpCSocketPair(state, 0, true, NULL, NULL);
+    return 0;
+}
+
+int SetupIsoTpCSocketPairAddrExtFD(void **state) {
+    NewIsoTpCSocketPair(state, 64, true, NULL, NULL);
+    return 0;
+}
+
+// normal fixed addressing: the server is N_SA 0x10, the client 0xf1, functional requests go to 0x33
+static void NewIsoTpCSocketPairNormalFixed(void **state, uint8_t tx_dl) {
+    static UDSTpISOTpCPeer_t server_peers[1], client_peers[4];
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    int fds[2] = {-1, -1};
+    assert(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+
+    UDSTpISOTpC_t *server_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(server_isotp->tag, "server");
+    assert(UDS_OK == UDSTpISOTpCInitWithFd(server_isotp, fds[0],
+                                           &(UDSTpISOTpCConfig_t){.source_addr = 0x10,
+                                                                  .target_addr = 0xf1,
+                                                                  .source_addr_func = 0x33,
+                                                                  .tx_dl = tx_dl,
+                                                                  .normal_fixed = true,
+                                                                  .peers = server_peers,
+                                                                  .num_peers = 1}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpISOTpC_t *client_isotp = malloc(sizeof(UDSTpISOTpC_t));
+    strcpy(client_isotp->tag, "client");
+    assert(UDS_OK == UDSTpISOTpCInitWithFd(client_isotp, fds[1],
+                                           &(UDSTpISOTpCConfig_t){.source_addr = 0xf1,
+                                                                  .target_addr = 0x10,
+                                                                  .source_addr_func =
+                                                                      UDS_TP_NOOP_ADDR,
+                                                                  .target_addr_func = 0x33,
+                                                                  .tx_dl = tx_dl,
+                                                                  .normal_fixed = true,
+                                                                  .peers = client_peers,
+                                                                  .num_peers = 4}));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+}
+
+int SetupIsoTpCSocketPairNormalFixed(void **state) {
+    NewIsoTpCSocketPairNormalFixed(state, 0);
+    return 0;
+}
+
+int SetupIsoTpCSocketPairNormalFixedFD(void **state) {
+    NewIsoTpCSocketPairNormalFixed(state, 64);
+    return 0;
+}
+
 int SetupIsoTpSockPair(void **state) {
     Env_t *env = malloc(sizeof(Env_t));
     memset(env, 0, sizeof(Env_t));
     UDSTpIsoTpSock_t *server_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
     strcpy(server_isotp->tag, "server");
-    assert(UDS_OK == UDSTpIsoTpSockInitServer(server_isotp, "vcan0", 0x7e8, 0x7e0, 0x7df));
+    assert(UDS_OK == UDSTpIsoTpSockInitServer(server_isotp, "vcan0", 0x7e8, 0x7e0, 0x7df, NULL));
     env->server_tp = (UDSTp_t *)server_isotp;
 
     UDSTpIsoTpSock_t *client_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
     strcpy(client_isotp->tag, "client");
-    assert(UDS_OK == UDSTpIsoTpSockInitClient(client_isotp, "vcan0", 0x7e0, 0x7e8, 0x7df));
+    assert(UDS_OK == UDSTpIsoTpSockInitClient(client_isotp, "vcan0", 0x7e0, 0x7e8, 0x7df, NULL));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
+int SetupIsoTpSockPairFCParams(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    const UDSISOTpFCParams_t fc = {.bs = 2, .st_min_us = 500};
+
+    // set at init
+    UDSTpIsoTpSock_t *server_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
+    assert(UDS_OK == UDSTpIsoTpSockInitServer(server_isotp, "vcan0", 0x7e8, 0x7e0, 0x7df,
+                                              &(UDSTpIsoTpSockOpts_t){.fc_params = &fc}));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    // changed after init
+    UDSTpIsoTpSock_t *client_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
+    assert(UDS_OK == UDSTpIsoTpSockInitClient(client_isotp, "vcan0", 0x7e0, 0x7e8, 0x7df, NULL));
+    assert(UDS_OK == UDSTpIsoTpSockSetFCParams(client_isotp, &fc));
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
+// CAN FD with 64 byte frames, vcan accepts CAN FD frames by default
+int SetupIsoTpSockPairCANFD(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    const UDSTpIsoTpSockOpts_t opts = {
+        .tx_dl = 64,
+        .tx_flags = CANFD_BRS,
+        .frame_txtime_ns = CAN_ISOTP_FRAME_TXTIME_ZERO,
+        .tx_padding = true,
+        .tx_pad_content = 0xCC,
+        .force_tx_stmin = true,
+        .tx_stmin_us = 0,
+    };
+    UDSTpIsoTpSock_t *server_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
+    assert(UDS_OK == UDSTpIsoTpSockInitServer(server_isotp, "vcan0", 0x7e8, 0x7e0, 0x7df, &opts));
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpIsoTpSock_t *client_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
+    assert(UDS_OK == UDSTpIsoTpSockInitClient(client_isotp, "vcan0", 0x7e0, 0x7e8, 0x7df, &opts));
     env->client_tp = (UDSTp_t *)client_isotp;
 
     env->is_real_time = true;
@@ -140,7 +481,7 @@ int SetupIsoTpSockClientOnly(void **state) {
     memset(env, 0, sizeof(Env_t));
     UDSTpIsoTpSock_t *client_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
     strcpy(client_isotp->tag, "client");
-    assert(UDS_OK == UDSTpIsoTpSockInitClient(client_isotp, "vcan0", 0x7e0, 0x7e8, 0x7df));
+    assert(UDS_OK == UDSTpIsoTpSockInitClient(client_isotp, "vcan0", 0x7e0, 0x7e8, 0x7df, NULL));
     env->client_tp = (UDSTp_t *)client_isotp;
     env->is_real_time = true;
     *state = env;
@@ -155,6 +496,30 @@ int TeardownIsoTpSockClientOnly(void **state) {
     return 0;
 }
 
+// the isotp_sock code path without a CAN interface: datagram socketpairs stand in for the kernel
+// ISO-TP sockets, which also keep message boundaries
+int SetupIsoTpSockSocketPair(void **state) {
+    Env_t *env = malloc(sizeof(Env_t));
+    memset(env, 0, sizeof(Env_t));
+    int phys[2] = {-1, -1}, func[2] = {-1, -1};
+    assert(0 == socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, phys));
+    assert(0 == socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, func));
+
+    UDSTpIsoTpSock_t *server_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
+    assert(UDS_OK == UDSTpIsoTpSockInitWithFds(server_isotp, phys[0], func[0], NULL));
+    strcpy(server_isotp->tag, "server");
+    env->server_tp = (UDSTp_t *)server_isotp;
+
+    UDSTpIsoTpSock_t *client_isotp = malloc(sizeof(UDSTpIsoTpSock_t));
+    assert(UDS_OK == UDSTpIsoTpSockInitWithFds(client_isotp, phys[1], func[1], NULL));
+    strcpy(client_isotp->tag, "client");
+    env->client_tp = (UDSTp_t *)client_isotp;
+
+    env->is_real_time = true;
+    *state = env;
+    return 0;
+}
+
 void test_send_recv(void **state) {
     Env_t *e = *state;
     uint8_t buf[2] = {0};
@@ -185,6 +550,37 @@ void test_send_recv_functional(void **state) {
     assert_int_equal(info2.A_TA_Type, UDS_A_TA_TYPE_FUNCTIONAL);
 }
 
+// the clock receive timestamps are taken from: monotonic on real transports, simulated on the mock
+static uint64_t RxClockNs(const Env_t *e) {
+    if (e->is_real_time) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    }
+    return (uint64_t)UDSMillis() * 1000000ULL;
+}
+
+void test_recv_timestamp(void **state) {
+    Env_t *e = *state;
+    uint8_t MSG[100];
+    uint8_t buf[sizeof(MSG)] = {0};
+    memset(MSG, 0x55, sizeof(MSG));
+
+    // When a multi-frame message is sent
+    const uint64_t sent = RxClockNs(e);
+    UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL);
+
+    // and received
+    UDSSDU_t info = {0};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info) > 0, 100);
+    const uint64_t read = RxClockNs(e);
+
+    // it is stamped with the time it arrived
+    assert_true(info.rx_time_ns != 0);
+    assert_true(info.rx_time_ns >= sent);
+    assert_true(info.rx_time_ns <= read);
+}
+
 void test_send_recv_largest_single_frame(void **state) {
     Env_t *e = *state;
     uint8_t buf[8] = {0};
@@ -218,6 +614,30 @@ void test_send_functional_larger_than_single_frame_fails(void **state) {
     assert_true(ret < 0);
 }
 
+// ISO 15765-2 2016 Table 10. With TX_DL=64, a single frame carries up to 62 bytes using the
+// escape sequence.
+void test_send_recv_largest_single_frame_fd(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[64] = {0};
+
+    // When a functional request is sent with the largest CAN-FD single frame payload
+    uint8_t MSG[62] = {0};
+    for (unsigned i = 0; i < sizeof(MSG); i++) {
+        MSG[i] = i;
+    }
+    ssize_t ret = UDSTpSend(e->client_tp, MSG, sizeof(MSG),
+                            &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL});
+    TEST_INT_EQUAL(ret, sizeof(MSG));
+
+    // the server should receive it quickly
+    UDSSDU_t info2 = {0};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info2) > 0, 10);
+
+    // it should be the same message
+    TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    assert_int_equal(info2.A_TA_Type, UDS_A_TA_TYPE_FUNCTIONAL);
+}
+
 void test_send_recv_max_len(void **state) {
     Env_t *e = *state;
     uint8_t buf[4095] = {0};
@@ -235,6 +655,142 @@ void test_send_recv_max_len(void **state) {
     TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
 }
 
+// Requests that arrive while the receiver doesn't read, e.g. while a handler erases flash, should
+// wait until they are read.
+void test_recv_queue(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+    const uint8_t MSGS[3][2] = {{0x3E, 0x00}, {0x22, 0x01}, {0x22, 0x02}};
+
+    // When several requests arrive before the receiver reads
+    for (int i = 0; i < 3; i++) {
+        TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSGS[i], sizeof(MSGS[i]), NULL), sizeof(MSGS[i]));
+        EnvRunMillis(e, 10);
+    }
+
+    // they should all be received in order
+    for (int i = 0; i < 3; i++) {
+        EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL) > 0, 10);
+        TEST_MEMORY_EQUAL(buf, MSGS[i], sizeof(MSGS[i]));
+    }
+}
+
+void test_recv_queue_multi_frame(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[100] = {0};
+    static uint8_t MSGS[2][100];
+    for (unsigned i = 0; i < sizeof(MSGS); i++) {
+        MSGS[i / sizeof(MSGS[0])][i % sizeof(MSGS[0])] = (uint8_t)i;
+    }
+
+    // When several multi-frame messages arrive before the receiver reads
+    for (int i = 0; i < 2; i++) {
+        TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSGS[i], sizeof(MSGS[i]), NULL), sizeof(MSGS[i]));
+        EXPECT_WITHIN_MS(e, !(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS), 100);
+    }
+
+    // they should all be received in order
+    for (int i = 0; i < 2; i++) {
+        EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL) > 0, 10);
+        TEST_MEMORY_EQUAL(buf, MSGS[i], sizeof(MSGS[i]));
+    }
+}
+
+// Once the receive queue is full, a message waits in its link and later ones are refused rather
+// than overwriting it
+void test_recv_queue_full(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+    uint8_t msgs[UDS_ISOTP_C_RX_QUEUE_LEN + 2][2];
+
+    // When more requests arrive than the queue and the link hold
+    for (int i = 0; i < UDS_ISOTP_C_RX_QUEUE_LEN + 2; i++) {
+        msgs[i][0] = 0x22;
+        msgs[i][1] = (uint8_t)i;
+        TEST_INT_EQUAL(UDSTpSend(e->client_tp, msgs[i], sizeof(msgs[i]), NULL), sizeof(msgs[i]));
+        EnvRunMillis(e, 10);
+    }
+
+    // the ones that fit should be received in order
+    for (int i = 0; i < UDS_ISOTP_C_RX_QUEUE_LEN + 1; i++) {
+        EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL) > 0, 10);
+        TEST_MEMORY_EQUAL(buf, msgs[i], sizeof(msgs[i]));
+    }
+
+    // and the last one should be dropped
+    EXPECT_WHILE_MS(e, 0 == UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL), 50);
+}
+
+// A multi-frame message waiting in the link is kept, the sender of the next one gets FC.OVFLW
+void test_recv_held_multi_frame(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[100] = {0};
+    static uint8_t MSGS[2][100];
+    memset(MSGS[0], 0xa0, sizeof(MSGS[0]));
+    memset(MSGS[1], 0xb0, sizeof(MSGS[1]));
+
+    // When a multi-frame message arrives before the previous one was read
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSGS[0], sizeof(MSGS[0]), NULL), sizeof(MSGS[0]));
+    EXPECT_WITHIN_MS(e, !(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS), 100);
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSGS[1], sizeof(MSGS[1]), NULL), sizeof(MSGS[1]));
+
+    // its sender should be told it doesn't fit
+    EXPECT_WITHIN_MS(e, UDSTpPoll(e->client_tp) & UDS_TP_ERR, 100);
+
+    // and the first message should be received intact
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL) > 0, 10);
+    TEST_MEMORY_EQUAL(buf, MSGS[0], sizeof(MSGS[0]));
+    EXPECT_WHILE_MS(e, 0 == UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL), 50);
+}
+
+// A functional request sent while a multi-frame message is still arriving on the physical link
+// should be received as well, e.g. TesterPresent during a long TransferData.
+void test_functional_during_multi_frame(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[4095] = {0};
+    static uint8_t MSG[4095] = {0};
+    for (unsigned i = 0; i < sizeof(MSG); i++) {
+        MSG[i] = (uint8_t)i;
+    }
+
+    // When a long physical request has started to arrive
+    e->do_not_poll = true;
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+    for (int i = 0; i < 3; i++) {
+        UDSTpPoll(e->server_tp);
+        UDSTpPoll(e->client_tp);
+    }
+
+    // and a functional request is sent before it is complete
+    const uint8_t FUNC[] = {0x3E, 0x80};
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, FUNC, sizeof(FUNC),
+                             &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL}),
+                   sizeof(FUNC));
+    e->do_not_poll = false;
+
+    // the server should receive both
+    bool got_func = false, got_phys = false;
+    const uint32_t deadline = UDSMillis() + 3000;
+    while (!got_func || !got_phys) {
+        EnvRunMillis(e, 1);
+        TEST_INT_LE(UDSMillis(), deadline);
+        UDSSDU_t info = {0};
+        ssize_t len = UDSTpRecv(e->server_tp, buf, sizeof(buf), &info);
+        if (len <= 0) {
+            continue;
+        }
+        if (UDS_A_TA_TYPE_FUNCTIONAL == info.A_TA_Type) {
+            TEST_INT_EQUAL(len, sizeof(FUNC));
+            TEST_MEMORY_EQUAL(buf, FUNC, sizeof(FUNC));
+            got_func = true;
+        } else {
+            TEST_INT_EQUAL(len, sizeof(MSG));
+            TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+            got_phys = true;
+        }
+    }
+}
+
 void test_flow_control_frame_timeout(void **state) {
     Env_t *e = *state;
     e->do_not_poll = true;
@@ -257,6 +813,932 @@ void test_flow_control_frame_timeout(void **state) {
     fail();
 }
 
+// An event loop that only polls the transports when one of their file descriptors is ready or a
+// deadline has passed should still deliver a multi-frame message.
+void test_send_recv_event_loop(void **state) {
+    Env_t *e = *state;
+    e->do_not_poll = true;
+    uint8_t buf[100] = {0};
+    uint8_t MSG[100] = {0};
+    for (unsigned i = 0; i < sizeof(MSG); i++) {
+        MSG[i] = i;
+    }
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+
+    UDSTp_t *tps[] = {e->client_tp, e->server_tp};
+    for (int iter = 0; iter < 1000; iter++) {
+        UDSTpFd_t fds[8] = {0};
+        struct pollfd pfds[8] = {0};
+        int nfds = 0;
+        bool has_deadline = false;
+        uint32_t deadline = 0;
+        for (unsigned i = 0; i < sizeof(tps) / sizeof(tps[0]); i++) {
+            nfds += UDSTpGetFds(tps[i], &fds[nfds], 8 - nfds);
+            uint32_t t = 0;
+            if (UDSTpNextDeadline(tps[i], &t) && (!has_deadline || UDSTimeAfter(deadline, t))) {
+                deadline = t;
+                has_deadline = true;
+            }
+        }
+
+        // the loop would sleep forever if the transports gave it nothing to wait for
+        assert_true(nfds > 0 || has_deadline);
+        int timeout_ms = has_deadline ? (int)(deadline - UDSMillis()) : 1000;
+        if (timeout_ms < 0 || (has_deadline && !UDSTimeAfter(deadline, UDSMillis()))) {
+            timeout_ms = 0;
+        }
+        if (nfds > 0) {
+            for (int i = 0; i < nfds; i++) {
+                pfds[i].fd = fds[i].fd;
+                pfds[i].events = (fds[i].events & UDS_TP_FD_READ ? POLLIN : 0) |
+                                 (fds[i].events & UDS_TP_FD_WRITE ? POLLOUT : 0);
+            }
+            TEST_INT_GE(poll(pfds, nfds, timeout_ms), 0);
+        } else {
+            EnvRunMillis(e, timeout_ms);
+        }
+
+        for (unsigned i = 0; i < sizeof(tps) / sizeof(tps[0]); i++) {
+            UDSTpPoll(tps[i]);
+        }
+        if (UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL) > 0) {
+            TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+            return;
+        }
+    }
+    fail();
+}
+
+static int RecvEach(UDSTp_t *const *tps, int n) {
+    uint8_t buf[8];
+    int num_received = 0;
+    for (int i = 0; i < n; i++) {
+        num_received += UDSTpRecv(tps[i], buf, sizeof(buf), NULL) > 0;
+    }
+    return num_received;
+}
+
+// read what arrived, responses carry their sequence number in the second byte
+static int RecvInOrder(UDSTp_t *tp, int next) {
+    uint8_t buf[8];
+    UDSTpPoll(tp);
+    while (UDSTpRecv(tp, buf, sizeof(buf), NULL) > 0) {
+        TEST_INT_EQUAL(buf[1], next);
+        next++;
+    }
+    return next;
+}
+
+// a vehicle with many ECUs answering a functional request at the same time
+void test_mock_network_loses_nothing(void **state) {
+    Env_t *e = *state;
+    enum { NUM_ECUS = 64 };
+    UDSTp_t *ecus[NUM_ECUS];
+    for (int i = 0; i < NUM_ECUS; i++) {
+        ecus[i] = ISOTPMockNew(NULL, &(ISOTPMockArgs_t){.sa_phys = 0x100 + i,
+                                                        .ta_phys = 0x6E8,
+                                                        .sa_func = 0x6DF,
+                                                        .ta_func = UDS_TP_NOOP_ADDR});
+        assert_true(ecus[i]);
+    }
+    UDSTp_t *tester = ISOTPMockNew("tester", &(ISOTPMockArgs_t){.sa_phys = 0x6E8,
+                                                                .ta_phys = 0x100,
+                                                                .sa_func = UDS_TP_NOOP_ADDR,
+                                                                .ta_func = 0x6DF});
+
+    // When a functional request is sent
+    const uint8_t REQ[] = {0x3E, 0x00};
+    UDSTpSend(tester, REQ, sizeof(REQ), &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL});
+
+    // every ECU receives it
+    int num_received = 0;
+    EXPECT_WITHIN_MS(e, (num_received += RecvEach(ecus, NUM_ECUS)) == NUM_ECUS, 10);
+
+    // and when all ECUs respond at once
+    uint8_t resps[NUM_ECUS][2];
+    for (int i = 0; i < NUM_ECUS; i++) {
+        resps[i][0] = 0x7E;
+        resps[i][1] = (uint8_t)i;
+        TEST_INT_EQUAL(UDSTpSend(ecus[i], resps[i], sizeof(resps[i]), NULL), sizeof(resps[i]));
+    }
+
+    // the tester receives every response in order although it holds only a few at a time
+    int next = 0;
+    EXPECT_WITHIN_MS(e, (next = RecvInOrder(tester, next)) == NUM_ECUS, 100);
+
+    for (int i = 0; i < NUM_ECUS; i++) {
+        TEST_INT_EQUAL(UDSTpPoll(ecus[i]), UDS_TP_IDLE);
+        ISOTPMockFree(ecus[i]);
+    }
+    ISOTPMockFree(tester);
+}
+
+// A transport on a shared functional address that is never read doesn't stop the others
+void test_mock_shared_address_unread_receiver(void **state) {
+    Env_t *e = *state;
+    UDSTp_t *ecus[2];
+    for (int i = 0; i < 2; i++) {
+        ecus[i] = ISOTPMockNew(NULL, &(ISOTPMockArgs_t){.sa_phys = 0x100 + i,
+                                                        .ta_phys = 0x6E8,
+                                                        .sa_func = 0x6DF,
+                                                        .ta_func = UDS_TP_NOOP_ADDR});
+    }
+    UDSTp_t *tester = ISOTPMockNew("tester", &(ISOTPMockArgs_t){.sa_phys = 0x6E8,
+                                                                .ta_phys = 0x100,
+                                                                .sa_func = UDS_TP_NOOP_ADDR,
+                                                                .ta_func = 0x6DF});
+
+    // When more functional requests are sent than an unread ECU can hold
+    enum { NUM_REQS = UDS_ISOTP_MOCK_RX_FIFO_LEN + 2 };
+    uint8_t buf[8];
+    for (int i = 0; i < NUM_REQS; i++) {
+        const uint8_t REQ[] = {0x3E, (uint8_t)i};
+        UDSTpSend(tester, REQ, sizeof(REQ), &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL});
+        EXPECT_WITHIN_MS(e, UDS_TP_IDLE == UDSTpPoll(tester), 10);
+
+        // the other ECU should receive each of them
+        EXPECT_WITHIN_MS(e, UDSTpRecv(ecus[1], buf, sizeof(buf), NULL) > 0, 10);
+        TEST_INT_EQUAL(buf[1], i);
+    }
+
+    // and the unread ECU should keep the oldest ones and count the rest as dropped
+    TEST_INT_EQUAL(((ISOTPMock_t *)ecus[0])->rx_dropped, NUM_REQS - UDS_ISOTP_MOCK_RX_FIFO_LEN);
+    for (int i = 0; i < UDS_ISOTP_MOCK_RX_FIFO_LEN; i++) {
+        TEST_INT_EQUAL(UDSTpRecv(ecus[0], buf, sizeof(buf), NULL), 2);
+        TEST_INT_EQUAL(buf[1], i);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        ISOTPMockFree(ecus[i]);
+    }
+    ISOTPMockFree(tester);
+}
+
+// an 8 byte classic frame with an 11 bit ID takes 111 bits and at most 24 stuff bits
+#define CLASSIC_FRAME_MIN_NS (111 * 2000ULL)
+#define CLASSIC_FRAME_MAX_NS (135 * 2000ULL)
+
+static ssize_t RecvTimed(UDSTp_t *tp, uint8_t *buf, size_t size, uint64_t *rx_time_ns) {
+    UDSSDU_t info = {0};
+    ssize_t ret = UDSTpRecv(tp, buf, size, &info);
+    if (ret > 0) {
+        *rx_time_ns = info.rx_time_ns;
+    }
+    return ret;
+}
+
+void test_mock_bus_transfer_time(void **state) {
+    Env_t *e = *state;
+    static uint8_t MSG[4095], buf[4095];
+    memset(MSG, 0x55, sizeof(MSG));
+
+    // When the largest classic ISO-TP message is sent at 500 kbit/s without STmin
+    const uint64_t sent = (uint64_t)UDSMillis() * 1000000ULL;
+    UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL);
+
+    // it takes FF, FC and 585 CFs on the bus
+    uint64_t rx_time_ns = 0;
+    EXPECT_WITHIN_MS(e, RecvTimed(e->server_tp, buf, sizeof(buf), &rx_time_ns) > 0, 200);
+    TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    TEST_INT_EQUAL(MockBus.num_frames, 587);
+    assert_true(rx_time_ns - sent >= 587 * CLASSIC_FRAME_MIN_NS);
+    assert_true(rx_time_ns - sent <= 587 * CLASSIC_FRAME_MAX_NS);
+    assert_true(MockBus.busy_ns >= 587 * CLASSIC_FRAME_MIN_NS);
+    assert_true(MockBus.busy_ns <= rx_time_ns - sent);
+}
+
+void test_mock_bus_block_size_and_st_min(void **state) {
+    Env_t *e = *state;
+    static uint8_t MSG[4095], buf[4095];
+    memset(MSG, 0x55, sizeof(MSG));
+
+    // When the receiver asks for blocks of 8 frames 1 ms apart
+    MockBus.cfg.fc.bs = 8;
+    MockBus.cfg.fc.st_min_us = 1000;
+    const uint64_t sent = (uint64_t)UDSMillis() * 1000000ULL;
+    UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL);
+
+    // 74 flow control frames are sent and 7 of 8 consecutive frames wait for STmin
+    uint64_t rx_time_ns = 0;
+    EXPECT_WITHIN_MS(e, RecvTimed(e->server_tp, buf, sizeof(buf), &rx_time_ns) > 0, 1000);
+    TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    TEST_INT_EQUAL(MockBus.num_frames, 1 + 585 + 74);
+    assert_true(rx_time_ns - sent >= 511 * 1000000ULL + 660 * CLASSIC_FRAME_MIN_NS);
+    assert_true(rx_time_ns - sent <= 511 * 1000000ULL + 660 * CLASSIC_FRAME_MAX_NS);
+}
+
+void test_mock_bus_arbitration(void **state) {
+    Env_t *e = *state;
+    static uint8_t req[4095], resp[4095], buf[4095];
+    memset(req, 0x11, sizeof(req));
+    memset(resp, 0x22, sizeof(resp));
+
+    // When both ends send at once
+    const uint64_t sent = (uint64_t)UDSMillis() * 1000000ULL;
+    UDSTpSend(e->client_tp, req, sizeof(req), NULL);
+    UDSTpSend(e->server_tp, resp, sizeof(resp), NULL);
+
+    // the frames of the client (ID 0x7E0) win arbitration, its message arrives first
+    uint64_t req_time = 0, resp_time = 0;
+    EXPECT_WITHIN_MS(e, RecvTimed(e->server_tp, buf, sizeof(buf), &req_time) > 0, 200);
+    TEST_MEMORY_EQUAL(buf, req, sizeof(req));
+    EXPECT_WITHIN_MS(e, RecvTimed(e->client_tp, buf, sizeof(buf), &resp_time) > 0, 200);
+    TEST_MEMORY_EQUAL(buf, resp, sizeof(resp));
+
+    // and the server's message shares the bus with it
+    TEST_INT_EQUAL(MockBus.num_frames, 2 * 587);
+    assert_true(resp_time > req_time);
+    assert_true(resp_time - sent >= 2 * 587 * CLASSIC_FRAME_MIN_NS);
+    assert_true(MockBus.busy_ns >= 2 * 587 * CLASSIC_FRAME_MIN_NS);
+}
+
+void test_mock_fd_bus_is_faster(void **state) {
+    Env_t *e = *state;
+    static uint8_t MSG[4095], buf[4095];
+    memset(MSG, 0x55, sizeof(MSG));
+
+    // When the message is sent in 64 byte frames with a 2 Mbit/s data phase
+    const uint64_t sent = (uint64_t)UDSMillis() * 1000000ULL;
+    UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL);
+
+    // FF, FC and 65 CFs take a fraction of the classic transfer time
+    uint64_t rx_time_ns = 0;
+    EXPECT_WITHIN_MS(e, RecvTimed(e->server_tp, buf, sizeof(buf), &rx_time_ns) > 0, 100);
+    TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    TEST_INT_EQUAL(MockBus.num_frames, 67);
+    assert_true(rx_time_ns - sent < 587 * CLASSIC_FRAME_MIN_NS / 4);
+}
+
+static uint64_t WallClockNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Sends max length messages back to back as fast as the transports are polled and logs the
+// throughput. The transports are polled in a busy loop, EnvRunMillis would sleep between polls.
+void test_send_recv_throughput(void **state) {
+    Env_t *e = *state;
+    static uint8_t MSG[4095], buf[4095];
+    const int num_msgs = 200;
+    const uint64_t start = WallClockNs();
+    for (int i = 0; i < num_msgs; i++) {
+        memset(MSG, i, sizeof(MSG));
+        TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+        ssize_t len = 0;
+        while (len <= 0) {
+            UDSTpPoll(e->client_tp);
+            UDSTpPoll(e->server_tp);
+            len = UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL);
+            assert_true(WallClockNs() - start < 10000000000ULL);
+        }
+        TEST_INT_EQUAL(len, sizeof(MSG));
+        TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    }
+    const uint64_t elapsed_us = (WallClockNs() - start) / 1000 + 1;
+    UDS_LOGI(__FILE__, "%d messages of %zu bytes in %" PRIu64 " us, %" PRIu64 " kB/s", num_msgs,
+             sizeof(MSG), elapsed_us, (uint64_t)num_msgs * sizeof(MSG) * 1000 / elapsed_us);
+}
+
+// The address byte takes one byte of every frame
+void test_addr_ext_single_frame(void **state) {
+    Env_t *e = *state;
+    uint8_t buf[8] = {0};
+
+    // When the largest classic single frame payload is sent
+    const uint8_t MSG[] = {1, 2, 3, 4, 5, 6};
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG),
+                             &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL}),
+                   sizeof(MSG));
+
+    // the server receives it with the functional address byte
+    UDSSDU_t info = {0};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info) > 0, 10);
+    TEST_MEMORY_EQUAL(buf, MSG, sizeof(MSG));
+    TEST_INT_EQUAL(info.A_TA_Type, UDS_A_TA_TYPE_FUNCTIONAL);
+    TEST_INT_EQUAL(info.A_AE, 0x33);
+
+    // a physical message arrives with the server's own address byte
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info) > 0, 10);
+    TEST_INT_EQUAL(info.A_TA_Type, UDS_A_TA_TYPE_PHYSICAL);
+    TEST_INT_EQUAL(info.A_AE, 0x40);
+
+    // and 7 bytes no longer fit a functional single frame
+    const uint8_t MSG7[] = {1, 2, 3, 4, 5, 6, 7};
+    assert_true(UDSTpSend(e->client_tp, MSG7, sizeof(MSG7),
+                          &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL}) < 0);
+}
+
+static bool RecvFrom(UDSTp_t *tp, uint8_t *buf, size_t size, ssize_t *len, UDSSDU_t *info) {
+    if (*len <= 0) {
+        *len = UDSTpRecv(tp, buf, size, info);
+    }
+    return *len > 0;
+}
+
+// With extended addressing several ECUs answer on the same CAN IDs
+void test_addr_ext_shared_can_id(void **state) {
+    (void)state;
+    static UDSTpISOTpCBus_t tester_bus, ecu_bus;
+    static UDSTpISOTpC_t testers[2], ecus[2];
+    int fds[2] = {-1, -1};
+    assert_true(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&tester_bus, fds[0], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&ecu_bus, fds[1], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    for (int i = 0; i < 2; i++) {
+        const uint8_t ecu_addr = (uint8_t)(0x40 + i), tester_addr = (uint8_t)(0xf1 + i);
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&testers[i], &tester_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8,
+                                                                   .target_addr = 0x7e0,
+                                                                   .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .addr_ext = true,
+                                                                   .source_ae = tester_addr,
+                                                                   .target_ae = ecu_addr}),
+                       UDS_OK);
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&ecus[i], &ecu_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0,
+                                                                   .target_addr = 0x7e8,
+                                                                   .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .addr_ext = true,
+                                                                   .source_ae = ecu_addr,
+                                                                   .target_ae = tester_addr}),
+                       UDS_OK);
+    }
+    // one kernel filter entry per CAN ID
+    TEST_INT_EQUAL(tester_bus.num_filters, 1);
+
+    // When both testers send multi-frame requests at the same time
+    static uint8_t req[2][300], buf[2][300];
+    ssize_t len[2] = {0};
+    UDSSDU_t info[2] = {0};
+    for (int i = 0; i < 2; i++) {
+        memset(req[i], 0xa0 + i, sizeof(req[i]));
+        TEST_INT_EQUAL(UDSTpSend(&testers[i].hdl, req[i], (ssize_t)(sizeof(req[i]) - 100 * i),
+                                 NULL),
+                       sizeof(req[i]) - 100 * i);
+    }
+    for (int iter = 0; iter < 100000; iter++) {
+        UDSTpISOTpCBusPoll(&ecu_bus);
+        UDSTpISOTpCBusPoll(&tester_bus);
+        if (RecvFrom(&ecus[0].hdl, buf[0], sizeof(buf[0]), &len[0], &info[0]) &
+            RecvFrom(&ecus[1].hdl, buf[1], sizeof(buf[1]), &len[1], &info[1])) {
+            break;
+        }
+    }
+
+    // each ECU receives the request addressed to it
+    for (int i = 0; i < 2; i++) {
+        TEST_INT_EQUAL(len[i], sizeof(req[i]) - 100 * i);
+        TEST_MEMORY_EQUAL(buf[i], req[i], len[i]);
+        TEST_INT_EQUAL(info[i].A_AE, 0x40 + i);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        UDSTpISOTpCDeinit(&testers[i]);
+        UDSTpISOTpCDeinit(&ecus[i]);
+    }
+    TEST_INT_EQUAL(tester_bus.num_filters, 0);
+    UDSTpISOTpCBusDeinit(&tester_bus);
+    UDSTpISOTpCBusDeinit(&ecu_bus);
+}
+
+// With normal fixed addressing one tester reaches every ECU on the bus by its address
+void test_normal_fixed_many_ecus(void **state) {
+    (void)state;
+    // the tester needs a peer for every response arriving at the same time
+    enum { NUM_ECUS = 20, NUM_TESTER_PEERS = NUM_ECUS };
+    static UDSTpISOTpCBus_t tester_bus, ecu_bus;
+    static UDSTpISOTpC_t tester, ecus[NUM_ECUS];
+    static UDSTpISOTpCPeer_t tester_peers[NUM_TESTER_PEERS], ecu_peers[NUM_ECUS][1];
+    int fds[2] = {-1, -1};
+    assert_true(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&tester_bus, fds[0], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&ecu_bus, fds[1], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&tester, &tester_bus,
+                                        &(UDSTpISOTpCConfig_t){.source_addr = 0xf1,
+                                                               .target_addr = UDS_TP_NOOP_ADDR,
+                                                               .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                               .target_addr_func = 0x33,
+                                                               .normal_fixed = true,
+                                                               .peers = tester_peers,
+                                                               .num_peers = NUM_TESTER_PEERS}),
+                   UDS_OK);
+    for (int i = 0; i < NUM_ECUS; i++) {
+        // the ECUs answer whoever asked
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&ecus[i], &ecu_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x10 + i,
+                                                                   .target_addr = UDS_TP_NOOP_ADDR,
+                                                                   .source_addr_func = 0x33,
+                                                                   .normal_fixed = true,
+                                                                   .peers = ecu_peers[i],
+                                                                   .num_peers = 1}),
+                       UDS_OK);
+    }
+    // one kernel filter entry per target address, whatever the source address
+    TEST_INT_EQUAL(tester_bus.num_filters, 1);
+    TEST_INT_EQUAL(ecu_bus.num_filters, NUM_ECUS + 1);
+
+    // When the tester sends a functional request
+    const uint8_t REQ[] = {0x3e, 0x00};
+    TEST_INT_EQUAL(UDSTpSend(&tester.hdl, REQ, sizeof(REQ),
+                             &(UDSSDU_t){.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL}),
+                   sizeof(REQ));
+
+    // every ECU receives it from the tester and answers it with a multi-frame response
+    static uint8_t resp[NUM_ECUS][100], buf[300];
+    bool answered[NUM_ECUS] = {0};
+    int num_responses = 0;
+    bool seen[NUM_ECUS] = {0};
+    for (int iter = 0; iter < 100000 && num_responses < NUM_ECUS; iter++) {
+        UDSTpISOTpCBusPoll(&ecu_bus);
+        UDSTpISOTpCBusPoll(&tester_bus);
+        for (int i = 0; i < NUM_ECUS; i++) {
+            UDSSDU_t info = {0};
+            if (!answered[i] && UDSTpRecv(&ecus[i].hdl, buf, sizeof(buf), &info) > 0) {
+                TEST_INT_EQUAL(info.A_TA_Type, UDS_A_TA_TYPE_FUNCTIONAL);
+                TEST_INT_EQUAL(info.A_SA, 0xf1);
+                memset(resp[i], i, sizeof(resp[i]));
+                TEST_INT_EQUAL(UDSTpSend(&ecus[i].hdl, resp[i], sizeof(resp[i]), NULL),
+                               sizeof(resp[i]));
+                answered[i] = true;
+            }
+        }
+        UDSSDU_t info = {0};
+        ssize_t len = UDSTpRecv(&tester.hdl, buf, sizeof(buf), &info);
+        if (len > 0) {
+            // the tester tells the responses apart by their source address
+            const int i = (int)info.A_SA - 0x10;
+            assert_true(i >= 0 && i < NUM_ECUS && !seen[i]);
+            TEST_INT_EQUAL(info.A_TA, 0xf1);
+            TEST_INT_EQUAL(len, sizeof(resp[i]));
+            TEST_MEMORY_EQUAL(buf, resp[i], len);
+            seen[i] = true;
+            num_responses++;
+        }
+    }
+    TEST_INT_EQUAL(num_responses, NUM_ECUS);
+
+    // When the tester sends a physical request to each ECU in turn
+    static uint8_t req[200];
+    memset(req, 0x5a, sizeof(req));
+    for (int i = 0; i < NUM_ECUS; i++) {
+        UDSSDU_t to = {.A_TA_Type = UDS_A_TA_TYPE_PHYSICAL, .A_SA = 0xf1, .A_TA = 0x10 + i};
+        req[0] = (uint8_t)i;
+        ssize_t ret = -1;
+        for (int iter = 0; iter < 100000 && ret <= 0; iter++) {
+            ret = UDSTpSend(&tester.hdl, req, sizeof(req), &to);
+            UDSTpISOTpCBusPoll(&ecu_bus);
+            UDSTpISOTpCBusPoll(&tester_bus);
+        }
+        TEST_INT_EQUAL(ret, sizeof(req));
+
+        // only the addressed ECU receives it
+        UDSSDU_t info = {0};
+        ssize_t len = 0;
+        for (int iter = 0; iter < 100000 && len <= 0; iter++) {
+            UDSTpISOTpCBusPoll(&tester_bus);
+            UDSTpISOTpCBusPoll(&ecu_bus);
+            len = UDSTpRecv(&ecus[i].hdl, buf, sizeof(buf), &info);
+        }
+        TEST_INT_EQUAL(len, sizeof(req));
+        TEST_MEMORY_EQUAL(buf, req, len);
+        TEST_INT_EQUAL(info.A_SA, 0xf1);
+        TEST_INT_EQUAL(info.A_TA, 0x10 + i);
+        for (int j = 0; j < NUM_ECUS; j++) {
+            TEST_INT_EQUAL(UDSTpRecv(&ecus[j].hdl, buf, sizeof(buf), &info), 0);
+        }
+    }
+
+    UDSTpISOTpCDeinit(&tester);
+    for (int i = 0; i < NUM_ECUS; i++) {
+        UDSTpISOTpCDeinit(&ecus[i]);
+    }
+    TEST_INT_EQUAL(tester_bus.num_filters, 0);
+    TEST_INT_EQUAL(ecu_bus.num_filters, 0);
+    UDSTpISOTpCBusDeinit(&tester_bus);
+    UDSTpISOTpCBusDeinit(&ecu_bus);
+}
+
+// Polls both buses until each of the n transports has received a message or nothing arrives
+static int BusRecvEach(UDSTpISOTpCBus_t *a, UDSTpISOTpCBus_t *b, UDSTpISOTpC_t *const *tps,
+                       int n, ssize_t *lens, uint8_t (*bufs)[64]) {
+    int received = 0;
+    for (int i = 0; i < n; i++) {
+        lens[i] = 0;
+    }
+    for (int iter = 0; iter < 1000 && received < n; iter++) {
+        UDSTpISOTpCBusPoll(a);
+        UDSTpISOTpCBusPoll(b);
+        for (int i = 0; i < n; i++) {
+            if (lens[i] <= 0 && RecvFrom(&tps[i]->hdl, bufs[i], sizeof(bufs[i]), &lens[i], NULL)) {
+                received++;
+            }
+        }
+    }
+    return received;
+}
+
+// Several ECUs on one bus: frames reach the link they are addressed to, detaching an ECU removes
+// only the kernel filter entries no other link needs
+void test_shared_bus(void **state) {
+    (void)state;
+    enum { NUM_ECUS = 3 };
+    static UDSTpISOTpCBus_t tester_bus, ecu_bus;
+    static UDSTpISOTpC_t testers[NUM_ECUS], ecus[NUM_ECUS];
+    int fds[2] = {-1, -1};
+    assert_true(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&tester_bus, fds[0], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&ecu_bus, fds[1], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    for (int i = 0; i < NUM_ECUS; i++) {
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&testers[i], &tester_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8 + i,
+                                                                   .target_addr = 0x7e0 + i,
+                                                                   .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .target_addr_func = 0x7df}),
+                       UDS_OK);
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&ecus[i], &ecu_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0 + i,
+                                                                   .target_addr = 0x7e8 + i,
+                                                                   .source_addr_func = 0x7df,
+                                                                   .target_addr_func = UDS_TP_NOOP_ADDR}),
+                       UDS_OK);
+    }
+    // the functional ID is filtered once for all ECUs
+    TEST_INT_EQUAL(ecu_bus.num_tps, NUM_ECUS);
+    TEST_INT_EQUAL(ecu_bus.num_filters, NUM_ECUS + 1);
+    TEST_INT_EQUAL(tester_bus.num_filters, NUM_ECUS);
+
+    UDSTpISOTpC_t *ecu_ptrs[NUM_ECUS] = {&ecus[0], &ecus[1], &ecus[2]};
+    static uint8_t bufs[NUM_ECUS][64];
+    ssize_t lens[NUM_ECUS];
+
+    // When the tester sends a physical multi-frame request to each ECU
+    static uint8_t req[NUM_ECUS][40];
+    for (int i = 0; i < NUM_ECUS; i++) {
+        memset(req[i], 0x10 + i, sizeof(req[i]));
+        TEST_INT_EQUAL(UDSTpSend(&testers[i].hdl, req[i], sizeof(req[i]), NULL), sizeof(req[i]));
+    }
+
+    // each ECU receives its own request
+    TEST_INT_EQUAL(BusRecvEach(&tester_bus, &ecu_bus, ecu_ptrs, NUM_ECUS, lens, bufs), NUM_ECUS);
+    for (int i = 0; i < NUM_ECUS; i++) {
+        TEST_INT_EQUAL(lens[i], sizeof(req[i]));
+        TEST_MEMORY_EQUAL(bufs[i], req[i], lens[i]);
+    }
+
+    // When the tester sends a functional request
+    const uint8_t FUNC_REQ[] = {0x3e, 0x00};
+    UDSSDU_t func = {.A_TA_Type = UDS_A_TA_TYPE_FUNCTIONAL};
+    TEST_INT_EQUAL(UDSTpSend(&testers[0].hdl, FUNC_REQ, sizeof(FUNC_REQ), &func),
+                   sizeof(FUNC_REQ));
+
+    // every ECU receives it
+    TEST_INT_EQUAL(BusRecvEach(&tester_bus, &ecu_bus, ecu_ptrs, NUM_ECUS, lens, bufs), NUM_ECUS);
+
+    // When the second ECU detaches
+    UDSTpISOTpCDeinit(&ecus[1]);
+
+    // its physical ID is no longer filtered, the functional ID still is
+    TEST_INT_EQUAL(ecu_bus.num_tps, NUM_ECUS - 1);
+    TEST_INT_EQUAL(ecu_bus.num_filters, NUM_ECUS);
+    for (int i = 0; i < ecu_bus.num_filters; i++) {
+        assert_true(ecu_bus.filters[i].can_id != 0x7e1);
+    }
+
+    // and a functional request still reaches the remaining ECUs
+    UDSTpISOTpC_t *remaining[2] = {&ecus[0], &ecus[2]};
+    TEST_INT_EQUAL(UDSTpSend(&testers[0].hdl, FUNC_REQ, sizeof(FUNC_REQ), &func),
+                   sizeof(FUNC_REQ));
+    TEST_INT_EQUAL(BusRecvEach(&tester_bus, &ecu_bus, remaining, 2, lens, bufs), 2);
+
+    // while a physical request to the detached ECU isn't dispatched to anyone
+    TEST_INT_EQUAL(UDSTpSend(&testers[1].hdl, FUNC_REQ, sizeof(FUNC_REQ), NULL), sizeof(FUNC_REQ));
+    TEST_INT_EQUAL(BusRecvEach(&tester_bus, &ecu_bus, remaining, 2, lens, bufs), 0);
+
+    // When the last ECUs detach, their filter entries go with them
+    UDSTpISOTpCDeinit(&ecus[0]);
+    TEST_INT_EQUAL(ecu_bus.num_filters, 2);
+    UDSTpISOTpCDeinit(&ecus[2]);
+    TEST_INT_EQUAL(ecu_bus.num_filters, 0);
+    TEST_INT_EQUAL(ecu_bus.num_tps, 0);
+
+    for (int i = 0; i < NUM_ECUS; i++) {
+        UDSTpISOTpCDeinit(&testers[i]);
+    }
+    TEST_INT_EQUAL(tester_bus.num_filters, 0);
+    UDSTpISOTpCBusDeinit(&tester_bus);
+    UDSTpISOTpCBusDeinit(&ecu_bus);
+}
+
+// Two multi-frame messages arrive at once but the pool has one block: the second first frame is
+// answered with FC.OVFLW and the block can be used again once the first message has been read
+void test_pool_exhausted(void **state) {
+    (void)state;
+    static UDSTpISOTpCBus_t tester_bus, ecu_bus;
+    static UDSTpISOTpC_t testers[2], ecus[2];
+    isotp_pool_init(&Pool, &PoolBlocks[0][0], UDS_ISOTP_MTU, 1);
+    int fds[2] = {-1, -1};
+    assert_true(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&tester_bus, fds[0], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&ecu_bus, fds[1], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    for (int i = 0; i < 2; i++) {
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&testers[i], &tester_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8 + i,
+                                                                   .target_addr = 0x7e0 + i,
+                                                                   .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .target_addr_func = UDS_TP_NOOP_ADDR}),
+                       UDS_OK);
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&ecus[i], &ecu_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e0 + i,
+                                                                   .target_addr = 0x7e8 + i,
+                                                                   .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .target_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .rx_pool = &Pool}),
+                       UDS_OK);
+    }
+
+    // When both testers start a multi-frame request at the same time
+    static uint8_t req[2][100], buf[100];
+    for (int i = 0; i < 2; i++) {
+        memset(req[i], 0xa0 + i, sizeof(req[i]));
+        TEST_INT_EQUAL(UDSTpSend(&testers[i].hdl, req[i], sizeof(req[i]), NULL), sizeof(req[i]));
+    }
+    int failed = -1, ok = -1;
+    uint8_t *peeked = NULL;
+    for (int iter = 0; iter < 1000 && (failed < 0 || ok < 0); iter++) {
+        UDSTpISOTpCBusPoll(&tester_bus);
+        UDSTpISOTpCBusPoll(&ecu_bus);
+        for (int i = 0; i < 2; i++) {
+            if (UDSTpPoll(&testers[i].hdl) & UDS_TP_ERR) {
+                failed = i;
+            }
+            // the received message holds the block until it is read
+            if (ok < 0 && UDSTpPeek(&ecus[i].hdl, &peeked, NULL) > 0) {
+                TEST_INT_EQUAL(Pool.in_use, 1);
+                ok = i;
+            }
+        }
+    }
+
+    // one gets the block, the other is refused with an overflow
+    assert_true(failed >= 0 && ok >= 0 && failed != ok);
+    TEST_INT_EQUAL(testers[failed].phys_link.send_protocol_result,
+                   ISOTP_PROTOCOL_RESULT_BUFFER_OVFLW);
+    TEST_INT_EQUAL(UDSTpRecv(&ecus[failed].hdl, buf, sizeof(buf), NULL), 0);
+
+    // reading the message returns the block
+    TEST_INT_EQUAL(UDSTpRecv(&ecus[ok].hdl, buf, sizeof(buf), NULL), sizeof(req[ok]));
+    TEST_MEMORY_EQUAL(buf, req[ok], sizeof(req[ok]));
+    TEST_INT_EQUAL(Pool.in_use, 0);
+
+    // and the refused request goes through when it is sent again
+    TEST_INT_EQUAL(UDSTpSend(&testers[failed].hdl, req[failed], sizeof(req[failed]), NULL),
+                   sizeof(req[failed]));
+    ssize_t len = 0;
+    for (int iter = 0; iter < 1000 && len <= 0; iter++) {
+        UDSTpISOTpCBusPoll(&tester_bus);
+        UDSTpISOTpCBusPoll(&ecu_bus);
+        len = UDSTpRecv(&ecus[failed].hdl, buf, sizeof(buf), NULL);
+    }
+    TEST_INT_EQUAL(len, sizeof(req[failed]));
+    TEST_MEMORY_EQUAL(buf, req[failed], len);
+    TEST_INT_EQUAL(Pool.in_use, 0);
+
+    for (int i = 0; i < 2; i++) {
+        UDSTpISOTpCDeinit(&testers[i]);
+        UDSTpISOTpCDeinit(&ecus[i]);
+    }
+    UDSTpISOTpCBusDeinit(&tester_bus);
+    UDSTpISOTpCBusDeinit(&ecu_bus);
+}
+
+// Frames another transport left in the transmit batch of a shared bus don't make a transport
+// report a send in progress
+void test_shared_bus_send_in_progress(void **state) {
+    (void)state;
+    static UDSTpISOTpCBus_t tester_bus;
+    static UDSTpISOTpC_t testers[2];
+    int fds[2] = {-1, -1};
+    assert_true(0 == socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds));
+    TEST_INT_EQUAL(UDSTpISOTpCBusInitWithFd(&tester_bus, fds[0], &(UDSTpISOTpCBusConfig_t){0}),
+                   UDS_OK);
+    for (int i = 0; i < 2; i++) {
+        TEST_INT_EQUAL(UDSTpISOTpCInitOnBus(&testers[i], &tester_bus,
+                                            &(UDSTpISOTpCConfig_t){.source_addr = 0x7e8 + i,
+                                                                   .target_addr = 0x7e0 + i,
+                                                                   .source_addr_func = UDS_TP_NOOP_ADDR,
+                                                                   .target_addr_func = UDS_TP_NOOP_ADDR}),
+                       UDS_OK);
+    }
+
+    // Given a bus whose socket can't take another frame
+    const struct can_frame filler = {.can_id = 0x123, .len = 1};
+    int num_filler = 0;
+    while (write(fds[0], &filler, sizeof(filler)) == sizeof(filler)) {
+        num_filler++;
+    }
+    assert_true(EAGAIN == errno || EWOULDBLOCK == errno || ENOBUFS == errno);
+
+    // When the first tester sends a request
+    const uint8_t REQ[] = {0x3e, 0x00};
+    TEST_INT_EQUAL(UDSTpSend(&testers[0].hdl, REQ, sizeof(REQ), NULL), sizeof(REQ));
+
+    // its frame waits in the transmit batch, only the first tester's send is in progress
+    TEST_INT_EQUAL(tester_bus.tx_count, 1);
+    assert_true(UDSTpPoll(&testers[0].hdl) & UDS_TP_SEND_IN_PROGRESS);
+    assert_false(UDSTpPoll(&testers[1].hdl) & UDS_TP_SEND_IN_PROGRESS);
+
+    // When the socket has room again the frame is sent
+    struct can_frame frame;
+    for (int i = 0; i < num_filler; i++) {
+        TEST_INT_EQUAL(read(fds[1], &frame, sizeof(frame)), sizeof(frame));
+    }
+    assert_false(UDSTpPoll(&testers[0].hdl) & UDS_TP_SEND_IN_PROGRESS);
+    TEST_INT_EQUAL(tester_bus.tx_count, 0);
+    TEST_INT_EQUAL(read(fds[1], &frame, sizeof(frame)), sizeof(frame));
+    TEST_INT_EQUAL(frame.can_id, 0x7e0);
+
+    // A transport deinitialized with a frame in the batch leaves it to be sent by the others
+    while (write(fds[0], &filler, sizeof(filler)) == sizeof(filler)) {
+    }
+    TEST_INT_EQUAL(UDSTpSend(&testers[1].hdl, REQ, sizeof(REQ), NULL), sizeof(REQ));
+    UDSTpISOTpCDeinit(&testers[1]);
+    TEST_INT_EQUAL(tester_bus.tx_count, 1);
+    while (read(fds[1], &frame, sizeof(frame)) > 0) {
+    }
+    assert_false(UDSTpPoll(&testers[0].hdl) & UDS_TP_SEND_IN_PROGRESS);
+    TEST_INT_EQUAL(tester_bus.tx_count, 0);
+    TEST_INT_EQUAL(read(fds[1], &frame, sizeof(frame)), sizeof(frame));
+    TEST_INT_EQUAL(frame.can_id, 0x7e1);
+
+    UDSTpISOTpCDeinit(&testers[0]);
+    UDSTpISOTpCBusDeinit(&tester_bus);
+    close(fds[1]);
+}
+
+// The kernel withholds POLLOUT until a physical message has been sent, UDSTpPoll() reports the
+// send as in progress until then
+void test_isotp_sock_send_in_progress(void **state) {
+    Env_t *e = *state;
+    static uint8_t msg[2000], buf[2000];
+    memset(msg, 0x5a, sizeof(msg));
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, msg, sizeof(msg), NULL), sizeof(msg));
+    TEST_INT_EQUAL(((UDSTpIsoTpSock_t *)e->client_tp)->send_in_progress, true);
+    assert_true(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS);
+
+    // binding the socket again would drop the message
+    const UDSISOTpFCParams_t fc = {.bs = 2};
+    TEST_INT_EQUAL(UDSTpIsoTpSockSetFCParams((UDSTpIsoTpSock_t *)e->client_tp, &fc), UDS_ERR_BUSY);
+
+    EXPECT_WITHIN_MS(e, !(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS), 1000);
+    TEST_INT_EQUAL(UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL), sizeof(msg));
+    TEST_MEMORY_EQUAL(buf, msg, sizeof(msg));
+}
+
+// With poll_timeout_ms UDSTpPoll() waits for the sockets, but not longer than needed
+void test_isotp_sock_poll_timeout(void **state) {
+    Env_t *e = *state;
+    UDSTpIsoTpSock_t *client = (UDSTpIsoTpSock_t *)e->client_tp;
+    client->poll_timeout_ms = 100;
+
+    // nothing happens: poll waits for the timeout
+    uint64_t t0 = WallClockNs();
+    TEST_INT_EQUAL(UDSTpPoll(e->client_tp), UDS_TP_IDLE);
+    TEST_INT_GE((int)((WallClockNs() - t0) / 1000000), 90);
+
+    // a message arrives: poll returns with it
+    const uint8_t MSG[] = {0x62, 0xf1, 0x90};
+    TEST_INT_EQUAL(UDSTpSend(e->server_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+    t0 = WallClockNs();
+    UDSTpPoll(e->client_tp);
+    TEST_INT_LT((int)((WallClockNs() - t0) / 1000000), 50);
+    uint8_t buf[8] = {0};
+    TEST_INT_EQUAL(UDSTpRecv(e->client_tp, buf, sizeof(buf), NULL), sizeof(MSG));
+}
+
+// An error on a message being received doesn't end the message being sent
+void test_isotp_sock_recv_error_during_send(void **state) {
+    Env_t *e = *state;
+    e->do_not_poll = true;
+    int raw = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    assert_true(raw >= 0);
+    struct sockaddr_can addr = {.can_family = AF_CAN, .can_ifindex = (int)if_nametoindex("vcan0")};
+    assert_true(0 == bind(raw, (struct sockaddr *)&addr, sizeof(addr)));
+
+    // no server answers with flow control, the client waits for it for N_Bs (1 s)
+    const uint8_t MSG[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+
+    // meanwhile a first frame to the client is followed by a consecutive frame with a wrong SN
+    const struct can_frame ff = {.can_id = 0x7e0, .len = 8, .data = {0x10, 20, 1, 2, 3, 4, 5, 6}};
+    const struct can_frame cf = {.can_id = 0x7e0, .len = 8, .data = {0x23, 7, 8, 9, 10, 11, 12}};
+    TEST_INT_EQUAL(write(raw, &ff, sizeof(ff)), sizeof(ff));
+    TEST_INT_EQUAL(write(raw, &cf, sizeof(cf)), sizeof(cf));
+
+    // the reception fails with EILSEQ, the send is still in progress
+    UDSTpStatus_t status = 0;
+    for (int i = 0; i < 200 && !(status & UDS_TP_ERR); i++) {
+        status = UDSTpPoll(e->client_tp);
+        EnvRunMillis(e, 1);
+    }
+    assert_true(status & UDS_TP_ERR);
+    assert_true(status & UDS_TP_SEND_IN_PROGRESS);
+
+    // until the flow control timeout aborts it
+    EXPECT_WITHIN_MS(e, !(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS), 2000);
+    close(raw);
+}
+
+// test_isotp_sock_send_in_progress without a CAN interface: with the smallest send buffer the
+// client's socket withholds POLLOUT until the server has read the message
+void test_isotp_sock_socketpair_send_in_progress(void **state) {
+    Env_t *e = *state;
+    UDSTpIsoTpSock_t *client = (UDSTpIsoTpSock_t *)e->client_tp;
+    const int sndbuf = 1;
+    assert_true(0 == setsockopt(client->phys_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)));
+    static uint8_t msg[2000], buf[2000];
+    memset(msg, 0x5a, sizeof(msg));
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, msg, sizeof(msg), NULL), sizeof(msg));
+    TEST_INT_EQUAL(client->send_in_progress, true);
+    assert_true(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS);
+    assert_true(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS);
+
+    const UDSISOTpFCParams_t fc = {.bs = 2};
+    TEST_INT_EQUAL(UDSTpIsoTpSockSetFCParams(client, &fc), UDS_ERR_BUSY);
+
+    TEST_INT_EQUAL(UDSTpRecv(e->server_tp, buf, sizeof(buf), NULL), sizeof(msg));
+    TEST_MEMORY_EQUAL(buf, msg, sizeof(msg));
+    assert_false(UDSTpPoll(e->client_tp) & UDS_TP_SEND_IN_PROGRESS);
+
+    // there is no interface to bind the socket to again
+    TEST_INT_EQUAL(UDSTpIsoTpSockSetFCParams(client, &fc), UDS_ERR_MISUSE);
+}
+
+// test_isotp_sock_recv_error_during_send without a CAN interface. A socket error that doesn't
+// abort a transmission is reported and the send stays in progress until POLLOUT. The server's
+// socket connects elsewhere with the request unread, which resets the client's socket
+// (ECONNRESET). A third socket then fills the server's queue so POLLOUT stays withheld.
+void test_isotp_sock_socketpair_recv_error_during_send(void **state) {
+    Env_t *e = *state;
+    UDSTpIsoTpSock_t *server = (UDSTpIsoTpSock_t *)e->server_tp;
+    const uint8_t MSG[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+
+    int other = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    assert_true(other >= 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    socklen_t addr_len = sizeof(addr);
+    // an empty address binds to a unique abstract one
+    assert_true(0 == bind(other, (struct sockaddr *)&addr, sizeof(sa_family_t)));
+    assert_true(0 == getsockname(other, (struct sockaddr *)&addr, &addr_len));
+    assert_true(0 == connect(server->phys_fd, (struct sockaddr *)&addr, addr_len));
+
+    addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+    addr_len = sizeof(addr);
+    assert_true(0 == bind(server->phys_fd, (struct sockaddr *)&addr, sizeof(sa_family_t)));
+    assert_true(0 == getsockname(server->phys_fd, (struct sockaddr *)&addr, &addr_len));
+    assert_true(0 == connect(other, (struct sockaddr *)&addr, addr_len));
+    while (write(other, MSG, sizeof(MSG)) == sizeof(MSG)) {
+    }
+
+    UDSTpStatus_t status = UDSTpPoll(e->client_tp);
+    assert_true(status & UDS_TP_ERR);
+    assert_true(status & UDS_TP_SEND_IN_PROGRESS);
+
+    // the send completes once the server's queue has room again
+    uint8_t buf[8];
+    while (read(server->phys_fd, buf, sizeof(buf)) > 0) {
+    }
+    TEST_INT_EQUAL(UDSTpPoll(e->client_tp), UDS_TP_IDLE);
+    close(other);
+}
+
+// Without a bus a message arrives send_tx_delay_ms after it was sent and is stamped with that time
+void test_mock_recv_timestamp_delay(void **state) {
+    Env_t *e = *state;
+    ((ISOTPMock_t *)e->client_tp)->send_tx_delay_ms = 10;
+
+    // When a message is sent
+    const uint8_t MSG[] = {0x3E, 0x00};
+    const uint32_t sent = UDSMillis();
+    TEST_INT_EQUAL(UDSTpSend(e->client_tp, MSG, sizeof(MSG), NULL), sizeof(MSG));
+
+    // it should be stamped with its arrival, the first millisecond after the delay
+    uint8_t buf[8];
+    UDSSDU_t info = {0};
+    EXPECT_WITHIN_MS(e, UDSTpRecv(e->server_tp, buf, sizeof(buf), &info) > 0, 100);
+    assert_true(info.rx_time_ns == (uint64_t)(sent + 11) * 1000000U);
+}
+
 // clang-format off
 const struct CMUnitTest tests_tp_mock[] = {
     cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupMockTpPair,        TeardownMockTpPair),
@@ -264,6 +1746,14 @@ const struct CMUnitTest tests_tp_mock[] = {
     cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame,                    SetupMockTpPair,        TeardownMockTpPair),
     cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupMockTpPair,        TeardownMockTpPair),
     cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_multi_frame,                            SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_event_loop,                              SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_recv_timestamp,                                    SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_recv_timestamp_delay,                         SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_network_loses_nothing,                        SetupMockTpPair,        TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_shared_address_unread_receiver,               SetupMockTpPair,        TeardownMockTpPair),
 
     // The mock server doesn't implement fc timeouts
     // cmocka_unit_test_setup_teardown(test_flow_control_frame_timeout,                        SetupMockTpClientOnly,  TeardownMockTpClientOnly),
@@ -274,6 +1764,23 @@ const struct CMUnitTest tests_tp_mock[] = {
     cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame,                    SetupMockTpPairExtendedID,  TeardownMockTpPair),
     cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupMockTpPairExtendedID,  TeardownMockTpPair),
     cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupMockTpPairExtendedID,  TeardownMockTpPair),
+
+    // simulated CAN bus
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_functional,                              SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_multi_frame,                            SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_event_loop,                              SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_recv_timestamp,                                    SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_bus_transfer_time,                            SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_bus_block_size_and_st_min,                    SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_bus_arbitration,                              SetupMockTpPairOnBus,       TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame_fd,                 SetupMockTpPairOnFDBus,     TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupMockTpPairOnFDBus,     TeardownMockTpPair),
+    cmocka_unit_test_setup_teardown(test_mock_fd_bus_is_faster,                             SetupMockTpPairOnFDBus,     TeardownMockTpPair),
 };
 
 const struct CMUnitTest tests_tp_isotp_c[] = {
@@ -282,7 +1789,80 @@ const struct CMUnitTest tests_tp_isotp_c[] = {
     cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame,                    SetupIsoTpCPair,        TeardownIsoTpCPair),
     cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupIsoTpCPair,        TeardownIsoTpCPair),
     cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCPair,        TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupIsoTpCPair,        TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupIsoTpCPair,        TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_full,                                   SetupIsoTpCPair,        TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_held_multi_frame,                             SetupIsoTpCPair,        TeardownIsoTpCPair),
     cmocka_unit_test_setup_teardown(test_flow_control_frame_timeout,                        SetupIsoTpCClientOnly,  TeardownIsoTpCClientOnly),
+    cmocka_unit_test_setup_teardown(test_send_recv_event_loop,                              SetupIsoTpCPair,        TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_timestamp,                                    SetupIsoTpCPair,        TeardownIsoTpCPair),
+
+    // CAN-FD tests
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCPairFD,      TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame_fd,                 SetupIsoTpCPairFD,      TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCPairFD,      TeardownIsoTpCPair),
+
+    // several consecutive frames per poll
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCPairBurst,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCPairBurst,   TeardownIsoTpCPair),
+
+    // flow control parameters set at init and after init
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCPairFCParams, TeardownIsoTpCPair),
+
+    // receive buffers from a pool
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCPairPool,    TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCPairPool,    TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_multi_frame,                            SetupIsoTpCPairPool,    TeardownIsoTpCPair),
+};
+
+const struct CMUnitTest tests_tp_isotp_c_socketpair[] = {
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_functional,                              SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame,                    SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_full,                                   SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_held_multi_frame,                             SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_event_loop,                              SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_timestamp,                                    SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_throughput,                              SetupIsoTpCSocketPair,  TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCSocketPairFD, TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame_fd,                 SetupIsoTpCSocketPairFD, TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairFD, TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_throughput,                              SetupIsoTpCSocketPairFD, TeardownIsoTpCPair),
+
+    // flow control parameters
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairFCParams, TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairPartialFCParams, TeardownIsoTpCPair),
+
+    // receive buffers from a pool
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairPool, TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_multi_frame,                            SetupIsoTpCSocketPairPool, TeardownIsoTpCPair),
+
+    // extended addressing
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_functional,                              SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_addr_ext_single_frame,                             SetupIsoTpCSocketPairAddrExt,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairAddrExtFD, TeardownIsoTpCPair),
+    cmocka_unit_test(test_addr_ext_shared_can_id),
+
+    // normal fixed addressing
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpCSocketPairNormalFixed,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_functional,                              SetupIsoTpCSocketPairNormalFixed,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairNormalFixed,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupIsoTpCSocketPairNormalFixed,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupIsoTpCSocketPairNormalFixed,   TeardownIsoTpCPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpCSocketPairNormalFixedFD, TeardownIsoTpCPair),
+    cmocka_unit_test(test_normal_fixed_many_ecus),
+    cmocka_unit_test(test_shared_bus),
+    cmocka_unit_test(test_shared_bus_send_in_progress),
+    cmocka_unit_test(test_pool_exhausted),
 };
 
 const struct CMUnitTest tests_tp_isotp_sock[] = {
@@ -291,7 +1871,29 @@ const struct CMUnitTest tests_tp_isotp_sock[] = {
     cmocka_unit_test_setup_teardown(test_send_recv_largest_single_frame,                    SetupIsoTpSockPair,         TeardownIsoTpSockPair),
     cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupIsoTpSockPair,         TeardownIsoTpSockPair),
     cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_functional_during_multi_frame,                     SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue_multi_frame,                            SetupIsoTpSockPair,         TeardownIsoTpSockPair),
     cmocka_unit_test_setup_teardown(test_flow_control_frame_timeout,                        SetupIsoTpSockClientOnly,   TeardownIsoTpSockClientOnly),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpSockPairFCParams, TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_event_loop,                              SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_recv_timestamp,                                    SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpSockPairCANFD,    TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_functional,                              SetupIsoTpSockPairCANFD,    TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_max_len,                                 SetupIsoTpSockPairCANFD,    TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_isotp_sock_send_in_progress,                       SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_isotp_sock_poll_timeout,                           SetupIsoTpSockPair,         TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_isotp_sock_recv_error_during_send,                 SetupIsoTpSockClientOnly,   TeardownIsoTpSockClientOnly),
+};
+
+const struct CMUnitTest tests_tp_isotp_sock_socketpair[] = {
+    cmocka_unit_test_setup_teardown(test_send_recv,                                         SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_send_recv_functional,                              SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_send_functional_larger_than_single_frame_fails,    SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_recv_queue,                                        SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_isotp_sock_socketpair_send_in_progress,            SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_isotp_sock_poll_timeout,                           SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
+    cmocka_unit_test_setup_teardown(test_isotp_sock_socketpair_recv_error_during_send,      SetupIsoTpSockSocketPair,   TeardownIsoTpSockPair),
 };
 // clang-format on
 
@@ -309,9 +1911,15 @@ int main(int ac, char **av) {
         } else if (0 == strcmp(av[1], "c")) {
             UDS_LOGI(__FILE__, "running isotp_c tests. av[1]=%s", av[1]);
             return cmocka_run_group_tests(tests_tp_isotp_c, NULL, NULL);
+        } else if (0 == strcmp(av[1], "c_socketpair")) {
+            UDS_LOGI(__FILE__, "running isotp_c socketpair tests. av[1]=%s", av[1]);
+            return cmocka_run_group_tests(tests_tp_isotp_c_socketpair, NULL, NULL);
         } else if (0 == strcmp(av[1], "sock")) {
             UDS_LOGI(__FILE__, "running isotp_sock tests. av[1]=%s", av[1]);
             return cmocka_run_group_tests(tests_tp_isotp_sock, NULL, NULL);
+        } else if (0 == strcmp(av[1], "sock_socketpair")) {
+            UDS_LOGI(__FILE__, "running isotp_sock socketpair tests. av[1]=%s", av[1]);
+            return cmocka_run_group_tests(tests_tp_isotp_sock_socketpair, NULL, NULL);
         } else {
             UDS_LOGE(__FILE__, "unknown test type: %s", av[1]);
         }
@@ -319,5 +1927,7 @@ int main(int ac, char **av) {
     UDS_LOGI(__FILE__, "running all tests");
     return cmocka_run_group_tests(tests_tp_mock, NULL, NULL) +
            cmocka_run_group_tests(tests_tp_isotp_c, NULL, NULL) +
-           cmocka_run_group_tests(tests_tp_isotp_sock, NULL, NULL);
+           cmocka_run_group_tests(tests_tp_isotp_c_socketpair, NULL, NULL) +
+           cmocka_run_group_tests(tests_tp_isotp_sock, NULL, NULL) +
+           cmocka_run_group_tests(tests_tp_isotp_sock_socketpair, NULL, NULL);
 }
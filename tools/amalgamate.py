@@ -45,6 +45,11 @@ with open(args.out_c, "w", encoding="utf-8") as f:
     f.write(" * @see https://github.com/driftregion/iso14229\n")
     f.write(" */\n")
     f.write("\n")
+    # must precede the first libc include; kept out of the public header
+    f.write("#if defined(UDS_TP_ISOTP_C_SOCKETCAN) && !defined(_GNU_SOURCE)\n")
+    f.write("#define _GNU_SOURCE // recvmmsg, sendmmsg\n")
+    f.write("#endif\n")
+    f.write("\n")
     f.write("#include \"iso14229.h\"\n")
     for src in [
         "src/client.c",
@@ -56,6 +61,8 @@ with open(args.out_c, "w", encoding="utf-8") as f:
         "src/tp/isotp_c_socketcan.c",
         "src/tp/isotp_sock.c",
         "src/tp/isotp_mock.c",
+        "src/tp/doip.c",
+        "src/tp/doip_gateway.c",
     ]:
         f.write("\n")
         f.write("#ifdef UDS_LINES\n")
@@ -115,6 +122,8 @@ with open(args.out_h, "w", encoding="utf-8") as f:
         "src/tp/isotp_c_socketcan.h",
         "src/tp/isotp_sock.h",
         "src/tp/isotp_mock.h",
+        "src/tp/doip.h",
+        "src/tp/doip_gateway.h",
     ]:
         f.write("\n")
         with open(src) as src_file: